@@ -0,0 +1,79 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BlockPool.hh"
+
+#include <vector>
+
+namespace runos {
+
+namespace {
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<BlockPoolStats::Counters*> threads;
+    // counts of threads which have exited
+    uint64_t heap_allocations = 0;
+    uint64_t reused = 0;
+    int64_t in_use = 0;
+};
+
+// Leaked, so threads exiting after main() can still unregister
+Registry& registry()
+{
+    static Registry* ret = new Registry;
+    return *ret;
+}
+
+}
+
+BlockPoolStats::Counters::Counters()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.threads.push_back(this);
+}
+
+BlockPoolStats::Counters::~Counters()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.heap_allocations += heap_allocations.load(std::memory_order_relaxed);
+    r.reused += reused.load(std::memory_order_relaxed);
+    r.in_use += in_use.load(std::memory_order_relaxed);
+    r.threads.erase(std::find(r.threads.begin(), r.threads.end(), this));
+}
+
+BlockPoolStats BlockPoolStats::get()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    BlockPoolStats ret;
+    ret.heap_allocations = r.heap_allocations;
+    ret.reused = r.reused;
+    int64_t in_use = r.in_use;
+    for (const Counters* c : r.threads) {
+        ret.heap_allocations += c->heap_allocations.load(std::memory_order_relaxed);
+        ret.reused += c->reused.load(std::memory_order_relaxed);
+        in_use += c->in_use.load(std::memory_order_relaxed);
+    }
+    // the sum may be read between a block's allocation and free
+    // counted on different threads
+    ret.in_use = std::max<int64_t>(in_use, 0);
+    return ret;
+}
+
+} // namespace runos
@@ -0,0 +1,192 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace runos {
+
+/**
+ * Counters of all block pools together.
+ */
+struct BlockPoolStats {
+    uint64_t heap_allocations = 0; ///< blocks taken from the heap
+    uint64_t reused = 0;           ///< allocations served by recycled blocks
+    uint64_t in_use = 0;           ///< blocks allocated and not freed yet
+
+    static BlockPoolStats get();
+
+    /**
+     * Counts of one thread. Only the owning thread writes them, so
+     * pools don't share a cache line; get() sums all threads.
+     */
+    struct Counters {
+        std::atomic<uint64_t> heap_allocations {0};
+        std::atomic<uint64_t> reused {0};
+        // negative when blocks allocated elsewhere are freed here
+        std::atomic<int64_t> in_use {0};
+
+        Counters();
+        ~Counters();
+
+        template<class T>
+        static void add(std::atomic<T>& counter, T n)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + n,
+                          std::memory_order_relaxed);
+        }
+    };
+
+    static Counters& local()
+    {
+        thread_local Counters ret;
+        return ret;
+    }
+};
+
+/**
+ * Recycles blocks of one size between threads.
+ *
+ * Every thread keeps a cache of free blocks, caches exchange batches
+ * through a shared list. A thread which allocates messages and one
+ * which frees them reach a steady state where the heap is not used.
+ * Blocks are never given back to the heap.
+ */
+template<size_t Size, size_t Align>
+class BlockPool {
+    struct Node { Node* next; };
+
+    static constexpr size_t block_size = std::max(Size, sizeof(Node));
+    static constexpr size_t block_align = std::max(Align, alignof(Node));
+    static constexpr size_t batch = 64;
+
+    struct List {
+        Node* head {nullptr};
+        size_t size {0};
+
+        void push(Node* n) { n->next = head; head = n; ++size; }
+        Node* pop() { Node* n = head; head = n->next; --size; return n; }
+
+        // Moves up to `count` blocks to `to`
+        void move(List& to, size_t count)
+        {
+            while (head && count--)
+                to.push(pop());
+        }
+    };
+
+    struct Shared {
+        std::mutex mutex;
+        List free;
+    };
+
+    // Leaked, so caches of exiting threads can return their blocks
+    static Shared& shared()
+    {
+        static Shared* ret = new Shared;
+        return *ret;
+    }
+
+    struct Cache : List {
+        ~Cache()
+        {
+            Shared& s = shared();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            this->move(s.free, this->size);
+        }
+    };
+
+    static Cache& cache()
+    {
+        thread_local Cache ret;
+        return ret;
+    }
+
+public:
+    static void* allocate()
+    {
+        BlockPoolStats::Counters& stats = BlockPoolStats::local();
+        stats.add<int64_t>(stats.in_use, 1);
+        Cache& c = cache();
+        if (not c.head) {
+            Shared& s = shared();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.free.move(c, batch);
+        }
+        if (c.head) {
+            stats.add<uint64_t>(stats.reused, 1);
+            return c.pop();
+        }
+        stats.add<uint64_t>(stats.heap_allocations, 1);
+        return ::operator new(block_size, std::align_val_t(block_align));
+    }
+
+    static void deallocate(void* p)
+    {
+        BlockPoolStats::Counters& stats = BlockPoolStats::local();
+        stats.add<int64_t>(stats.in_use, -1);
+        Cache& c = cache();
+        c.push(static_cast<Node*>(p));
+        if (c.size > 2 * batch) {
+            Shared& s = shared();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            c.move(s.free, batch);
+        }
+    }
+};
+
+/**
+ * Allocator serving single objects from a BlockPool, for use with
+ * std::allocate_shared: the object and its control block come
+ * from the pool together.
+ */
+template<class T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template<class U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept { }
+
+    T* allocate(size_t n)
+    {
+        if (n != 1)
+            return std::allocator<T>().allocate(n);
+        return static_cast<T*>(BlockPool<sizeof(T), alignof(T)>::allocate());
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        if (n != 1)
+            return std::allocator<T>().deallocate(p, n);
+        BlockPool<sizeof(T), alignof(T)>::deallocate(p);
+    }
+
+    template<class U>
+    bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+    template<class U>
+    bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+};
+
+} // namespace runos
@@ -17,13 +17,19 @@
 #include "Controller.hh"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
 #include <sstream>
 #include <memory>
 #include <functional>
+#include <map>
+#include <set>
 
 #include <boost/assert.hpp>
 #include <boost/variant/apply_visitor.hpp>
@@ -33,7 +39,9 @@
 
 #include "types/exception.hh"
 
+#include "OFEncoder.hh"
 #include "OFMsgUnion.hh"
+#include "PacketInAdmission.hh"
 #include "SwitchConnection.hh"
 
 
@@ -50,119 +58,182 @@ public:
     { }
 
     void replace(OFConnection* ofconn_)
-    { m_ofconn = ofconn_; }
+    { rebind(ofconn_); }
+
+    using SwitchConnection::packet_in_meter;
+    using SwitchConnection::begin_reconcile;
+    using SwitchConnection::reconcile_dump;
+    using SwitchConnection::reconcile_unclaimed;
+    using SwitchConnection::finish_reconcile;
+    using SwitchConnection::abort_reconcile;
 };
 
 typedef std::shared_ptr<SwitchConnectionImpl> SwitchConnectionImplPtr;
 typedef std::weak_ptr<SwitchConnectionImpl> SwitchConnectionImplWeakPtr;
 
+// Datapath rate limit of packets sent to the controller, zero rate disables it
+struct PacketInMeter {
+    uint32_t rate = 0;  // packets per second
+    uint32_t burst = 0; // packets
+};
+
+class ControllerImpl;
+
 struct SwitchBase {
     SwitchConnectionImplPtr connection;
+    ControllerImpl* controller{nullptr};
     uint8_t max_table;
+    // The new connection of a reconnected switch resets the admission
+    // state while the old one may still drain it
+    std::mutex admission_mutex;
+    PacketInAdmission::Switch admission;
+    PacketInMeter meter;
+    uint32_t packet_in_meter{0};
+    std::atomic<uint32_t> dump_xid{0}; // flow table dump being reconciled
 
 public:
     SwitchBase(OFConnection* ofconn,
             uint64_t dpid,
-            uint8_t max_table)
+            uint8_t max_table,
+            const PacketInAdmission::Settings& admission,
+            const PacketInMeter& meter)
         : connection{ new SwitchConnectionImpl{ofconn, dpid} },
-        max_table(max_table)
+        max_table(max_table),
+        admission(admission),
+        meter(meter)
     {
-        clearTables();
-        for (uint8_t i = 0; i < max_table; ++i){
-            installGoto(i);
+        if (meter.rate != 0) {
+            packet_in_meter = allocateMeter();
         }
-        installTableMiss(max_table);
     }
 
-    void reinit() {
-        clearTables();
+    // The whole setup goes out in one write. A single barrier orders
+    // the deletion before the new rules, which don't depend on each other.
+    // While reconciling the tables are kept, the rules are sent anyway
+    // and the reconciler drops those already installed.
+    void reinit(bool reconcile) {
+        connection->packet_in_meter(packet_in_meter);
+
+        auto enc = OFEncoder::scratch();
+        if (not reconcile) {
+            clearTables(enc);
+        }
+        installPacketInMeter(enc, reconcile);
+        if (not reconcile) {
+            enc.barrier_request();
+        }
         for (uint8_t i = 0; i < max_table; i++) {
-            installGoto(i);
+            installGoto(enc, i);
         }
-        installTableMiss(max_table);
+        installTableMiss(enc, max_table);
+
+        connection->send(enc.data(), enc.size());
+    }
+
+    // Meter ids are allocated per switch and kept across reconnects
+    uint32_t allocateMeter()
+    {
+        return next_meter++;
     }
 
 private:
+    uint32_t next_meter{1};
 
-    void barrier()
+    void clearTables(OFEncoder& enc)
     {
-        connection->send(of13::BarrierRequest());
+        OFEncoder::FlowModParams fm;
+        fm.command = of13::OFPFC_DELETE;
+        fm.table_id = of13::OFPTT_ALL;
+
+        enc.begin_flow_mod(fm, oxm::field_set{});
+        enc.end_message();
     }
 
-    void clearTables()
+    // Re-created on every connect: the switch may keep an old meter
+    // with other bands, or may have lost it after a restart.
+    // Deleting a meter deletes its rules, so it is only updated
+    // when the tables are kept; one of the two fails.
+    void installPacketInMeter(OFEncoder& enc, bool keep_rules)
     {
-        of13::FlowMod fm;
-        fm.command(of13::OFPFC_DELETE);
-        fm.table_id(of13::OFPTT_ALL);
-        fm.buffer_id(OFP_NO_BUFFER);
-        fm.cookie(0x0);
-        fm.cookie_mask(0x0);
-        fm.out_port(of13::OFPP_ANY);
-        fm.out_group(of13::OFPG_ANY);
-
-        connection->send(fm);
+        if (packet_in_meter == 0)
+            return;
+
+        enc.meter_mod(0, keep_rules ? of13::OFPMC_ADD : of13::OFPMC_DELETE,
+                      packet_in_meter, meter.rate, meter.burst);
+        enc.meter_mod(0, keep_rules ? of13::OFPMC_MODIFY : of13::OFPMC_ADD,
+                      packet_in_meter, meter.rate, meter.burst);
     }
 
-    void installGoto(uint8_t table)
+    static OFEncoder::FlowModParams defaultRule(uint8_t table)
     {
-        barrier();
-        of13::FlowMod fm;
-        fm.command(of13::OFPFC_ADD);
-        fm.buffer_id(OFP_NO_BUFFER);
-        fm.priority(0);
-        fm.cookie(0);
-        fm.idle_timeout(0);
-        fm.hard_timeout(0);
-        fm.table_id(table);
-        fm.flags(of13::OFPFF_CHECK_OVERLAP | of13::OFPFF_SEND_FLOW_REM);
-        of13::GoToTable go_to_table(table + 1);
-        fm.add_instruction(go_to_table);
-
-        connection->send(fm);
+        OFEncoder::FlowModParams fm;
+        fm.command = of13::OFPFC_ADD;
+        fm.priority = 0;
+        fm.table_id = table;
+        fm.flags = of13::OFPFF_CHECK_OVERLAP | of13::OFPFF_SEND_FLOW_REM;
+        return fm;
     }
 
-    void installTableMiss(uint8_t table)
+    void installGoto(OFEncoder& enc, uint8_t table)
     {
-        barrier();
-        of13::FlowMod fm;
-        fm.command(of13::OFPFC_ADD);
-        fm.buffer_id(OFP_NO_BUFFER);
-        fm.priority(0);
-        fm.cookie(0);
-        fm.idle_timeout(0);
-        fm.hard_timeout(0);
-        fm.table_id(table);
-        fm.flags(of13::OFPFF_CHECK_OVERLAP | of13::OFPFF_SEND_FLOW_REM);
-        of13::ApplyActions act;
-        of13::OutputAction out(of13::OFPP_CONTROLLER, 128); // TODO : unhardcore
-        act.add_action(out);
-        fm.add_instruction(act);
-
-        connection->send(fm);
+        enc.begin_flow_mod(defaultRule(table), oxm::field_set{});
+        enc.goto_table(table + 1);
+        enc.end_message();
+    }
+
+    void installTableMiss(OFEncoder& enc, uint8_t table)
+    {
+        enc.begin_flow_mod(defaultRule(table), oxm::field_set{});
+        if (packet_in_meter != 0) {
+            enc.meter(packet_in_meter);
+        }
+        enc.begin_apply_actions();
+        enc.output(of13::OFPP_CONTROLLER, 128); // TODO : unhardcore
+        enc.end_message();
     }
 
 };
 
 
 class ControllerImpl : public OFServer {
-    const uint32_t min_xid = 0xfff;
     Controller &app;
 
 public:
+    const uint32_t min_xid = 0xfff;
+    static constexpr uint32_t first_session_xid = 0x10000;
+    static constexpr std::chrono::milliseconds session_tick{100};
+
     bool started{false};
     bool cbench;
     Config config;
     Config root_config;
     uint8_t max_table;
+    // Tables of every app, first and last
+    std::map<std::string, std::pair<uint8_t, uint8_t>> reserved_tables;
 
-    std::unordered_map<uint8_t, CommonHandlers*> handlers;
+    std::array<CommonHandlers*, 256> handlers{};
     std::unordered_map<uint64_t, SwitchBase> switches;
+    mutable std::shared_mutex switches_mutex;
+    std::unique_ptr<PacketInAdmission> admission;
+    PacketInMeter packet_in_meter;
+
+    // Reconciliation
+    bool reconcile{false};
+    std::chrono::milliseconds reconcile_window{2000};
+    std::vector<Controller::FlowKeeper> flow_keepers;
+    mutable std::mutex reconcile_mutex;
+    std::unordered_map<SwitchBase*, OFSessionTable::clock::time_point> reconcile_deadlines;
+    FlowReconciler::Stats reconcile_stats;
 
     // OFResponse
     std::vector<OFTransaction*> static_ofresponse;
     // Make sure that we don't intersect with libfluid_base
     uint32_t min_session_xid{min_xid};
-    //uint32_t last_xid;
+
+    // Per-request xids, above all static ones
+    OFSessionTable sessions{first_session_xid, session_tick};
+    std::chrono::milliseconds request_timeout{5000};
+    int expire_timer{0};
 
     ControllerImpl(Controller &_app,
             const char *address,
@@ -172,7 +243,6 @@ public:
             const class OFServerSettings ofsc = OFServerSettings())
             : OFServer(address, port, nthreads, secure, ofsc),
               app(_app)
-              // last_xid(min_xid)
     { }
 
     void message_callback(OFConnection *ofconn, uint8_t type, void *data, size_t len) override
@@ -192,56 +262,68 @@ public:
 
         SwitchBase *ctx = reinterpret_cast<SwitchBase *>(ofconn->get_application_data());
 
-        auto it = handlers.find(type);
-        if( it != handlers.end()){
-            it->second->apply(data, ctx->connection);
-        }
-
-
         if (ctx == nullptr && type != of13::OFPT_FEATURES_REPLY) {
             LOG(WARNING) << "Switch send message before feature reply";
             OFMsg::free_buffer(static_cast<uint8_t *>(data));
             return;
         }
 
-        try {
-            OFMsgUnion msg(type, data, len);
-
-            switch (type) {
-            case of13::OFPT_FEATURES_REPLY:
-                ctx = createSwitchBase(ofconn, msg.featuresReply.datapath_id());
-                ofconn->set_application_data(ctx);
-                emit app.switchUp(ctx->connection, msg.featuresReply);
-                break;
-            case of13::OFPT_PORT_STATUS:
-                if (ctx == nullptr) break;
-                emit app.portStatus(ctx->connection, msg.portStatus);
-                break;
-            case of13::OFPT_FLOW_REMOVED:
-                emit app.flowRemoved(ctx->connection, msg.flowRemoved);
-                break;
-            default: {
-               uint32_t xid = msg.base()->xid();
-                if (xid < min_xid)
-                    break;
-
-                OFTransaction *transaction = nullptr;
-                if (xid < min_session_xid) {
-                    transaction = static_ofresponse[xid - min_xid];
-                } else {
-                    // TODO: session ofresponse's
-                }
+        // Everything sent while handling this message goes out in one
+        // write; libfluid has no hook at the end of a loop pass
+        SwitchConnection::Batch batch;
 
-                if (transaction) {
-                    auto msg_copy = std::make_shared<OFMsgUnion>(type, data, len);
+        if (ctx && admission->enabled()) {
+            replayBuffered(ofconn, ctx);
+        }
 
-                    if (type == of13::OFPT_ERROR) {
-                        emit transaction->error(ctx->connection, msg_copy);
-                    } else {
-                        emit transaction->response(ctx->connection, msg_copy);
-                    }
-                }
+        if (type == of13::OFPT_MULTIPART_REPLY && ctx && ctx->dump_xid != 0) {
+            auto raw = static_cast<uint8_t*>(data);
+            if (OFMsg(raw).xid() == ctx->dump_xid) {
+                flowDump(ctx, raw, len);
+                free_data(data);
+                return;
             }
+        }
+
+        // Decide before decoding, so overload costs as little as possible
+        if (type == of13::OFPT_PACKET_IN && ctx && admission->enabled()) {
+            auto raw = static_cast<uint8_t*>(data);
+            auto cls = PacketInAdmission::classify(raw, len);
+            PacketInAdmission::Verdict verdict;
+            {
+                std::lock_guard<std::mutex> lock(ctx->admission_mutex);
+                verdict = admission->admit(ctx->admission, cls, raw, len);
+            }
+            if (verdict != PacketInAdmission::Verdict::Admit) {
+                free_data(data);
+                return;
+            }
+        }
+
+        try {
+            // Decode once. Only messages handed over to a transaction
+            // outlive this call, everything else stays on the stack.
+            OFTransaction *transaction = nullptr;
+            OFSessionTable::HandlersPtr session;
+            findTransaction(type, data, transaction, session);
+
+            if (transaction || session) {
+                auto msg = OFMsgUnion::make_shared(type, data, len);
+                dispatch(ofconn, ctx, type, *msg);
+                if (type == of13::OFPT_ERROR) {
+                    if (transaction)
+                        emit transaction->error(ctx->connection, msg);
+                    else if (session->error)
+                        session->error(ctx->connection, msg);
+                } else {
+                    if (transaction)
+                        emit transaction->response(ctx->connection, msg);
+                    else if (session->response)
+                        session->response(ctx->connection, msg);
+                }
+            } else {
+                OFMsgUnion msg(type, data, len);
+                dispatch(ofconn, ctx, type, msg);
             }
         } catch (const OFMsgParseError &e) {
             LOG(WARNING) << "Malformed message received from connection " << ofconn->get_id();
@@ -293,39 +375,260 @@ public:
         }
     }
 private:
-    SwitchBase *createSwitchBase(OFConnection *ofconn, uint64_t dpid)
+    void dispatch(OFConnection *ofconn, SwitchBase *&ctx, uint8_t type, OFMsgUnion &msg)
     {
+        // The reply introduces the switch, its handlers see it
+        if (type == of13::OFPT_FEATURES_REPLY) {
+            ctx = createSwitchBase(ofconn, msg.featuresReply.datapath_id());
+            ofconn->set_application_data(ctx);
+            if (admission->enabled() &&
+                admission->settings().policy == PacketInAdmission::Policy::Buffer) {
+                ofconn->add_timed_callback(&ControllerImpl::drainBuffered,
+                                           admission->settings().drain_interval,
+                                           ofconn);
+            }
+        }
 
-        auto it = switches.find(dpid);
-        if (it != switches.end())
-            goto ret;
+        CommonHandlers *h = handlers[type];
+        if (h && ctx) {
+            h->apply(msg, ctx->connection);
+        }
+
+        switch (type) {
+        case of13::OFPT_FEATURES_REPLY:
+            emit app.switchUp(ctx->connection, msg.featuresReply);
+            break;
+        case of13::OFPT_PORT_STATUS:
+            if (ctx == nullptr) break;
+            emit app.portStatus(ctx->connection, msg.portStatus);
+            break;
+        case of13::OFPT_FLOW_REMOVED:
+            emit app.flowRemoved(ctx->connection, msg.flowRemoved);
+            break;
+        }
+    }
+
+    // Runs on the switch's worker thread, so packet-ins buffered while
+    // the switch is quiet are replayed too. Dies with the connection.
+    static void* drainBuffered(void* arg)
+    {
+        auto ofconn = static_cast<OFConnection*>(arg);
+        auto ctx = reinterpret_cast<SwitchBase*>(ofconn->get_application_data());
+        if (ctx) {
+            SwitchConnection::Batch batch;
+            ctx->controller->replayBuffered(ofconn, ctx);
+        }
+        return nullptr;
+    }
+
+    // Buffered packet-ins are replayed on the switch's own worker
+    // thread, after they are taken from the admission state
+    void replayBuffered(OFConnection *ofconn, SwitchBase *ctx)
+    {
+        std::vector<std::vector<uint8_t>> replay;
         {
-            static std::mutex mutex;
-            std::lock_guard<std::mutex> lock(mutex);
-
-            it = switches.find(dpid);
-            if (it != switches.end())
-                goto ret;
-
-            it = switches.emplace(std::piecewise_construct,
-                                  std::forward_as_tuple(dpid),
-                                  std::forward_as_tuple(ofconn,
-                                                        dpid,
-                                                        max_table))
-                          .first;
-            return &it->second;
+            std::lock_guard<std::mutex> lock(ctx->admission_mutex);
+            if (not ctx->admission.has_buffered())
+                return;
+            admission->drain(ctx->admission, [&](std::vector<uint8_t>& raw) {
+                replay.push_back(std::move(raw));
+            });
         }
+        for (auto& raw : replay) {
+            try {
+                OFMsgUnion msg(of13::OFPT_PACKET_IN, raw.data(), raw.size());
+                dispatch(ofconn, ctx, of13::OFPT_PACKET_IN, msg);
+            } catch (const std::exception &e) {
+                LOG(ERROR) << "Unhandled exception on buffered packet-in: " << e.what();
+            }
+        }
+    }
+
+    // Looks at the raw header only, so it's safe to call before decoding
+    void findTransaction(uint8_t type, void *data,
+                         OFTransaction *&transaction,
+                         OFSessionTable::HandlersPtr &session)
+    {
+        switch (type) {
+        case of13::OFPT_FEATURES_REPLY:
+        case of13::OFPT_PORT_STATUS:
+        case of13::OFPT_FLOW_REMOVED:
+        case of13::OFPT_PACKET_IN:
+            return;
+        }
+
+        uint8_t *raw = static_cast<uint8_t*>(data);
+        OFMsg header(raw);
+        uint32_t xid = header.xid();
+        if (xid < min_xid)
+            return;
 
-        ret:
-        SwitchBase *ctx = &it->second;
-        if (ctx->connection->alive()) {
-            LOG(ERROR) << "Overwriting switchscope on active connection";
+        if (xid < min_session_xid) {
+            transaction = static_ofresponse[xid - min_xid];
+        } else if (sessions.owns(xid)) {
+            if (type == of13::OFPT_ERROR) {
+                session = sessions.take_error(xid);
+            } else {
+                // Keep the continuation until the last part of a reply
+                bool more = type == of13::OFPT_MULTIPART_REPLY &&
+                            ((raw[10] << 8 | raw[11]) & of13::OFPMPF_REPLY_MORE);
+                session = sessions.take(xid, more);
+            }
         }
-        ctx->connection->replace(ofconn);
-        ctx->reinit();
+    }
+
+    // Held messages go out when the last part of the dump arrives,
+    // stale entries are deleted when the window ends.
+    void flowDump(SwitchBase *ctx, uint8_t *raw, size_t len)
+    {
+        uint32_t xid = ctx->dump_xid;
+        bool more = (raw[10] << 8 | raw[11]) & of13::OFPMPF_REPLY_MORE;
+        ctx->connection->reconcile_dump(raw, len, not more);
+        if (more || not ctx->dump_xid.compare_exchange_strong(xid, 0))
+            return;
+
+        sessions.take(xid, false);
+        std::lock_guard<std::mutex> lock(reconcile_mutex);
+        reconcile_deadlines[ctx] =
+            OFSessionTable::clock::now() + reconcile_window;
+    }
+
+    void requestFlowDump(SwitchBase *ctx)
+    {
+        {
+            std::lock_guard<std::mutex> lock(reconcile_mutex);
+            reconcile_deadlines.erase(ctx);
+        }
+
+        OFSessionHandlers handlers;
+        handlers.error = [this, ctx](SwitchConnectionPtr,
+                                     std::shared_ptr<OFMsgUnion> error) {
+            abortReconcile(ctx, error->base()->xid());
+        };
+        handlers.timeout = [this, ctx](SwitchConnectionPtr, uint32_t xid) {
+            abortReconcile(ctx, xid);
+        };
+        uint32_t xid = sessions.insert(ctx->connection, std::move(handlers),
+                                       request_timeout);
+        ctx->dump_xid = xid;
+
+        of13::MultipartRequestFlow req;
+        req.xid(xid);
+        req.table_id(of13::OFPTT_ALL);
+        req.out_port(of13::OFPP_ANY);
+        req.out_group(of13::OFPG_ANY);
+        req.cookie(0);
+        req.cookie_mask(0);
+        ctx->connection->send(req);
+        // Everything sent from now on is held until the dump is complete
+        ctx->connection->begin_reconcile();
+    }
+
+    void abortReconcile(SwitchBase *ctx, uint32_t xid)
+    {
+        // Stale if the switch has reconnected since
+        if (not ctx->dump_xid.compare_exchange_strong(xid, 0))
+            return;
+        LOG(WARNING) << "Can't dump flow tables of switch dpid="
+                     << ctx->connection->dpid() << ", wiping them instead";
+        recordReconcile(ctx->connection->abort_reconcile());
+    }
+
+    void recordReconcile(const FlowReconciler::Stats& stats)
+    {
+        std::lock_guard<std::mutex> lock(reconcile_mutex);
+        reconcile_stats += stats;
+    }
+
+public:
+    void finishReconciliations(OFSessionTable::clock::time_point now)
+    {
+        std::vector<SwitchBase*> due;
+        {
+            std::lock_guard<std::mutex> lock(reconcile_mutex);
+            for (auto it = reconcile_deadlines.begin();
+                 it != reconcile_deadlines.end(); ) {
+                if (it->second <= now) {
+                    due.push_back(it->first);
+                    it = reconcile_deadlines.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        for (SwitchBase *ctx : due) {
+            auto conn = ctx->connection;
+            uint64_t dpid = conn->dpid();
+
+            // Keepers may take their own locks, ask them before
+            // the connection is locked for finishing.
+            std::set<std::pair<uint8_t, uint64_t>> keep;
+            for (const auto& e : conn->reconcile_unclaimed()) {
+                for (const auto& keeper : flow_keepers) {
+                    if (keeper(dpid, e.table, e.cookie)) {
+                        keep.emplace(e.table, e.cookie);
+                        break;
+                    }
+                }
+            }
+
+            auto stats = conn->finish_reconcile(
+                [&](const FlowReconciler::Unclaimed& e) {
+                    return keep.count({e.table, e.cookie}) != 0;
+                });
+            if (stats.runs == 0)
+                continue;
+
+            LOG(INFO) << "Reconciled flow tables of switch dpid=" << dpid
+                      << " in " << stats.last_elapsed.count() << "ms: "
+                      << stats.dumped << " found, " << stats.kept << " kept, "
+                      << stats.added << " added, " << stats.removed << " removed";
+            recordReconcile(stats);
+        }
+    }
+
+private:
+    // Called concurrently by the worker threads of reconnecting switches.
+    // Only the lookup is serialized, table setup runs in parallel.
+    SwitchBase *createSwitchBase(OFConnection *ofconn, uint64_t dpid)
+    {
+        SwitchBase *ctx = findSwitchBase(dpid);
+        if (ctx) {
+            if (ctx->connection->alive()) {
+                LOG(ERROR) << "Overwriting switchscope on active connection";
+            }
+            ctx->connection->replace(ofconn);
+            // Buffer ids of packets kept from the old connection are invalid
+            std::lock_guard<std::mutex> lock(ctx->admission_mutex);
+            ctx->admission = PacketInAdmission::Switch(admission->settings());
+        } else {
+            std::unique_lock<std::shared_mutex> lock(switches_mutex);
+            // Nodes are stable, so the pointer outlives rehashing
+            ctx = &switches.emplace(std::piecewise_construct,
+                                    std::forward_as_tuple(dpid),
+                                    std::forward_as_tuple(ofconn,
+                                                          dpid,
+                                                          max_table,
+                                                          admission->settings(),
+                                                          packet_in_meter))
+                          .first->second;
+            ctx->controller = this;
+        }
+        if (reconcile) {
+            requestFlowDump(ctx);
+        }
+        ctx->reinit(reconcile);
         return ctx;
     }
 
+    SwitchBase *findSwitchBase(uint64_t dpid)
+    {
+        std::shared_lock<std::shared_mutex> lock(switches_mutex);
+        auto it = switches.find(dpid);
+        return it != switches.end() ? &it->second : nullptr;
+    }
+
 };
 
 /* Application interface */
@@ -347,6 +650,32 @@ void Controller::init(Loader*, const Config& rootConfig)
     impl->config = config;
     impl->root_config = rootConfig;
     impl->max_table = config_get(config, "tables.max_table", 0);
+    impl->request_timeout = std::chrono::milliseconds(
+            config_get(config, "request_timeout", 5000));
+
+    const Config& admission = config_cd(config, "admission");
+    PacketInAdmission::Settings settings;
+    settings.enabled = config_get(admission, "enabled", false);
+    settings.policy = PacketInAdmission::parse_policy(
+            config_get(admission, "policy", "drop"));
+    settings.switch_rate = config_get(admission, "switch_rate", 0.0);
+    settings.switch_burst = config_get(admission, "switch_burst", 0.0);
+    settings.global_rate = config_get(admission, "global_rate", 0.0);
+    settings.global_burst = config_get(admission, "global_burst", 0.0);
+    settings.reserve = config_get(admission, "reserve", 0.2);
+    settings.sample_every = config_get(admission, "sample_every", 100);
+    settings.buffer_size = config_get(admission, "buffer_size", 256);
+    settings.drain_interval = config_get(admission, "drain_interval", 100);
+    impl->admission.reset(new PacketInAdmission(settings));
+
+    const Config& meter = config_cd(config, "packet_in_meter");
+    impl->packet_in_meter.rate = config_get(meter, "rate", 0);
+    impl->packet_in_meter.burst = config_get(meter, "burst", 0);
+
+    const Config& reconcile = config_cd(config, "reconcile");
+    impl->reconcile = config_get(reconcile, "enabled", false);
+    impl->reconcile_window = std::chrono::milliseconds(
+            config_get(reconcile, "window", 2000));
 }
 
 void Controller::startUp(Loader*)
@@ -354,6 +683,15 @@ void Controller::startUp(Loader*)
     impl->start(/* block: */ false);
     impl->started = true;
     impl->cbench = config_get(impl->config, "cbench", false);
+    impl->expire_timer = startTimer(ControllerImpl::session_tick.count());
+}
+
+void Controller::timerEvent(QTimerEvent* event)
+{
+    if (event->timerId() == impl->expire_timer) {
+        impl->sessions.expire();
+        impl->finishReconciliations(OFSessionTable::clock::now());
+    }
 }
 
 void Controller::__register_handler__(uint8_t t, CommonHandlers* h)
@@ -361,7 +699,11 @@ void Controller::__register_handler__(uint8_t t, CommonHandlers* h)
     if (impl->started) {
         LOG(ERROR) << "Register handler after startup";
     }
-    impl->handlers.emplace(t, h);
+    if (impl->handlers[t] && impl->handlers[t] != h) {
+        LOG(ERROR) << "Handler for message type " << int(t) << " already registered";
+        return;
+    }
+    impl->handlers[t] = h;
 }
 
 OFTransaction* Controller::registerStaticTransaction(Application *caller)
@@ -371,6 +713,10 @@ OFTransaction* Controller::registerStaticTransaction(Application *caller)
         return 0;
     }
 
+    if (impl->min_session_xid == ControllerImpl::first_session_xid) {
+        LOG(ERROR) << "Static xids exhausted";
+        return 0;
+    }
     uint32_t xid = impl->min_session_xid++;
 
     OFTransaction* ret = new OFTransaction(xid, caller);
@@ -379,18 +725,85 @@ OFTransaction* Controller::registerStaticTransaction(Application *caller)
     QObject::connect(ret, &QObject::destroyed, [xid, this]() {
         static std::mutex mutex;
         std::lock_guard<std::mutex> lock(mutex);
-        impl->static_ofresponse[xid] = 0;
+        impl->static_ofresponse[xid - impl->min_xid] = 0;
     });
 
     return ret;
 }
 
+OFTransaction* Controller::registerTransaction(Application *caller)
+{
+    return new OFTransaction(impl->sessions, impl->request_timeout, caller);
+}
+
+uint32_t Controller::request(SwitchConnectionPtr conn,
+                             OFMsg& msg,
+                             OFSessionHandlers handlers,
+                             std::chrono::milliseconds timeout)
+{
+    uint32_t xid = impl->sessions.insert(conn, std::move(handlers), timeout);
+    msg.xid(xid);
+    conn->send(msg);
+    return xid;
+}
+
+OFSessionTable::Stats Controller::sessionStats() const
+{
+    return impl->sessions.stats();
+}
+
+const PacketInAdmission& Controller::admission() const
+{
+    return *impl->admission;
+}
+
+void Controller::registerFlowKeeper(FlowKeeper keeper)
+{
+    if (impl->started) {
+        LOG(ERROR) << "Register flow keeper after startup";
+    }
+    impl->flow_keepers.push_back(std::move(keeper));
+}
+
+FlowReconciler::Stats Controller::reconcileStats() const
+{
+    std::lock_guard<std::mutex> lock(impl->reconcile_mutex);
+    return impl->reconcile_stats;
+}
+
 uint8_t Controller::getTable(const char* name) const
+{
+    return reserveTables(name, 1);
+}
+
+uint8_t Controller::reserveTables(const char* name, uint8_t count) const
 {
     auto config = config_cd(impl->root_config, "tables");
-    uint8_t table = config_get(config, name, 0);
-    impl->max_table = std::max(table, impl->max_table);
-    return table;
+    unsigned first = config_get(config, name, 0);
+    unsigned last = first + std::max<unsigned>(count, 1) - 1;
+    if (last > of13::OFPTT_MAX) {
+        RUNOS_THROW(invalid_argument() << errinfo_str(
+            std::string("Tables of ") + name + " exceed the last table"));
+    }
+
+    for (const auto& other : impl->reserved_tables) {
+        if (other.first == name)
+            continue;
+        unsigned other_first = other.second.first;
+        unsigned other_last = other.second.second;
+        if (last < other_first || other_last < first)
+            continue;
+        // Only the first tables are in common
+        if (first == other_first && std::min(last, other_last) == first)
+            continue;
+        RUNOS_THROW(invalid_argument() << errinfo_str(
+            std::string("Tables of ") + name + " overlap tables of " +
+            other.first + ", configure them apart in \"tables\""));
+    }
+
+    impl->reserved_tables[name] = {uint8_t(first), uint8_t(last)};
+    impl->max_table = std::max(uint8_t(last), impl->max_table);
+    return first;
 }
 
 uint8_t Controller::maxTable() const
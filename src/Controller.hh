@@ -20,11 +20,16 @@
 #include "Application.hh"
 #include "Loader.hh"
 #include "OFTransaction.hh"
+#include "OFSessionTable.hh"
+#include "PacketInAdmission.hh"
+#include "FlowReconciler.hh"
+#include "OFMsgUnion.hh"
 #include "SwitchConnection.hh"
 
 #include "api/PacketMissHandler.hh"
 #include "SwitchConnectionFwd.hh"
 
+#include <chrono>
 #include <vector>
 
 using runos::SwitchConnectionPtr;
@@ -33,22 +38,22 @@ using runos::FloodImplementation;
 using runos::OfMessageHandler;
 
 struct CommonHandlers{
-    virtual void apply(void *data, SwitchConnectionPtr connection) = 0;
+    virtual void apply(OFMsgUnion& msg, SwitchConnectionPtr connection) = 0;
     virtual ~CommonHandlers(){}
 };
 
+/**
+ * Handlers receive a typed view of the message decoded once
+ * by the controller, so any number of them may share one unpack.
+ */
 template <class ofMessage>
 class Handlers : public CommonHandlers{
-    class OFMsgParseError : std::exception { };
     std::vector<OfMessageHandler<ofMessage>> handlers;
 public:
-    void apply(void *data, SwitchConnectionPtr connection) override{
-        ofMessage msg;
-        if( msg.unpack(static_cast<uint8_t *>(data)) != 0 ){
-            throw OFMsgParseError();
-        }
-        for (auto h : handlers){
-            h(msg, connection);
+    void apply(OFMsgUnion& msg, SwitchConnectionPtr connection) override{
+        ofMessage& typed = msg.as<ofMessage>();
+        for (auto& h : handlers){
+            h(typed, connection);
         }
     }
     friend class Controller;
@@ -68,7 +73,8 @@ public:
     void startUp(Loader* loader) override;
 
     /**
-    * Register handler of openflow message
+    * Register handler of openflow message.
+    * ofMessage must be one of the types OFMsgUnion can hold.
     */
     template<class ofMessage>
     void registerHandler(OfMessageHandler<ofMessage> handler){
@@ -83,6 +89,14 @@ public:
       */
     uint8_t getTable(const char* name) const;
 
+    /**
+      * Reserves `count` tables starting from the one configured for
+      * `name` and returns the first. Apps may share a first table,
+      * the others are theirs only: throws if they overlap tables
+      * of another app.
+      */
+    uint8_t reserveTables(const char* name, uint8_t count) const;
+
     /**
      * Allocate unique OFMsg::xid and return's a wrapper class
      * to handle this transaction responses.
@@ -92,6 +106,58 @@ public:
      */
     OFTransaction* registerStaticTransaction(Application* caller);
 
+    /**
+     * Returns a transaction which sends every request with its own xid,
+     * so requests never overlap. May be called at any time.
+     *
+     * @param caller Parent object.
+     */
+    OFTransaction* registerTransaction(Application* caller);
+
+    /**
+     * Sends a request with a fresh xid and calls one of the handlers
+     * when it is answered, fails or times out.
+     * Response and error handlers are called on the connection's
+     * worker thread, timeout handlers on the controller's thread.
+     *
+     * @return xid the message was sent with.
+     */
+    uint32_t request(SwitchConnectionPtr conn,
+                     OFMsg& msg,
+                     runos::OFSessionHandlers handlers,
+                     std::chrono::milliseconds timeout);
+
+    /**
+     * Counters of requests sent with per-request xids.
+     */
+    runos::OFSessionTable::Stats sessionStats() const;
+
+    /**
+     * Packet-in admission control settings and counters.
+     */
+    const runos::PacketInAdmission& admission() const;
+
+    /**
+     * Tells whether an entry found on a switch is still wanted.
+     * Called by the controller's thread.
+     */
+    typedef std::function<bool(uint64_t dpid, uint8_t table, uint64_t cookie)>
+        FlowKeeper;
+
+    /**
+     * With reconciliation on, a (re)connected switch keeps its flow
+     * tables. Entries nobody re-sends within the reconciliation window
+     * are deleted unless some keeper wants them. Applications whose
+     * rules live on after a reconnect without being re-sent register
+     * a keeper. Must be called before startup.
+     */
+    void registerFlowKeeper(FlowKeeper keeper);
+
+    /**
+     * Counters of flow table reconciliations.
+     */
+    runos::FlowReconciler::Stats reconcileStats() const;
+
     /**
       * get the max number of using table
       */
@@ -120,6 +186,9 @@ signals:
       */
     void flowRemoved(SwitchConnectionPtr ofconnl, of13::FlowRemoved fr);
 
+protected:
+    void timerEvent(QTimerEvent*) override;
+
 private:
     std::unique_ptr<class ControllerImpl> impl;
     void __register_handler__(uint8_t t, CommonHandlers *h);
@@ -0,0 +1,49 @@
+#include "Controller.hh"
+
+#include "Common.hh"
+#include "CommandLine.hh"
+#include "LatencyStats.hh"
+
+using namespace cli;
+using namespace runos;
+
+class ControllerCli: public Application {
+SIMPLE_APPLICATION(ControllerCli, "controller-cli")
+public:
+    void init(Loader* loader, const Config& config) override
+    {
+        auto app = Controller::get(loader);
+        auto cli = CommandLine::get(loader);
+        options::options_description desc;
+
+        auto cmd = [app](const options::variables_map& vm, Outside& out) {
+            auto stats = app->sessionStats();
+            out.print("Transactions. In flight : {}\n"
+                      "              Issued    : {}\n"
+                      "              Completed : {}\n"
+                      "              Errors    : {}\n"
+                      "              Timeouts  : {}\n",
+                      stats.in_flight, stats.issued, stats.completed,
+                      stats.errors, stats.timeouts);
+        };
+        cli->registerCommand("transactions", std::move(desc), std::move(cmd),
+                             "Show requests awaiting switch replies");
+
+        auto latency = [](const options::variables_map&, Outside& out) {
+            out.print("{:<32} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+                      "Stage", "Count", "Mean, us", "p50", "p99", "p99.9", "Max");
+            for (auto& stage : LatencyStats::get()) {
+                auto& hist = stage.second;
+                out.print("{:<32} {:>10} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f} {:>10.1f}\n",
+                          stage.first, hist.count(), hist.mean() / 1000,
+                          hist.percentile(50) / 1000.0, hist.percentile(99) / 1000.0,
+                          hist.percentile(99.9) / 1000.0, hist.max() / 1000.0);
+            }
+        };
+        cli->registerCommand("latency", options::options_description(),
+                             std::move(latency),
+                             "Show latency histograms of packet-in processing");
+    }
+};
+
+REGISTER_APPLICATION(ControllerCli, {"controller", "command-line-interface", ""})
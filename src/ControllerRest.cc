@@ -0,0 +1,156 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ControllerRest.hh"
+
+#include "BlockPool.hh"
+#include "Controller.hh"
+#include "LatencyStats.hh"
+#include "RestListener.hh"
+
+REGISTER_APPLICATION(ControllerRest, {"controller", "rest-listener", ""})
+
+using namespace runos;
+
+namespace {
+
+const char* policy_name(PacketInAdmission::Policy policy)
+{
+    switch (policy) {
+    case PacketInAdmission::Policy::Drop: return "drop";
+    case PacketInAdmission::Policy::Sample: return "sample";
+    case PacketInAdmission::Policy::Buffer: return "buffer";
+    }
+    return "unknown";
+}
+
+json11::Json admission_json(const PacketInAdmission& admission)
+{
+    const auto& settings = admission.settings();
+    auto stats = admission.stats();
+
+    json11::Json::object classes;
+    for (size_t c = 0; c < PacketInAdmission::nclasses; ++c) {
+        classes[PacketInAdmission::name(PacketInAdmission::Class(c))] =
+            json11::Json::object {
+                {"admitted", json_counter(stats[c].admitted)},
+                {"dropped", json_counter(stats[c].dropped)},
+                {"sampled", json_counter(stats[c].sampled)},
+                {"buffered", json_counter(stats[c].buffered)},
+                {"replayed", json_counter(stats[c].replayed)}
+            };
+    }
+
+    return json11::Json::object {
+        {"enabled", settings.enabled},
+        {"policy", policy_name(settings.policy)},
+        {"switch_rate", settings.switch_rate},
+        {"switch_burst", settings.switch_burst},
+        {"global_rate", settings.global_rate},
+        {"global_burst", settings.global_burst},
+        {"classes", classes}
+    };
+}
+
+json11::Json transactions_json(const OFSessionTable::Stats& stats)
+{
+    return json11::Json::object {
+        {"in_flight", json_counter(stats.in_flight)},
+        {"issued", json_counter(stats.issued)},
+        {"completed", json_counter(stats.completed)},
+        {"errors", json_counter(stats.errors)},
+        {"timeouts", json_counter(stats.timeouts)}
+    };
+}
+
+json11::Json reconciliation_json(const FlowReconciler::Stats& stats)
+{
+    return json11::Json::object {
+        {"runs", json_counter(stats.runs)},
+        {"aborted", json_counter(stats.aborted)},
+        {"found", json_counter(stats.dumped)},
+        {"kept", json_counter(stats.kept)},
+        {"added", json_counter(stats.added)},
+        {"removed", json_counter(stats.removed)},
+        {"elapsed_ms", json_counter(stats.elapsed.count())},
+        {"last_elapsed_ms", json_counter(stats.last_elapsed.count())}
+    };
+}
+
+json11::Json messages_json(const BlockPoolStats& stats)
+{
+    return json11::Json::object {
+        {"heap_allocations", json_counter(stats.heap_allocations)},
+        {"reused", json_counter(stats.reused)},
+        {"in_use", json_counter(stats.in_use)}
+    };
+}
+
+// Nanoseconds
+json11::Json latency_json(const std::map<std::string, LatencyHistogram>& stats)
+{
+    json11::Json::object ret;
+    for (auto& stage : stats) {
+        auto& hist = stage.second;
+        ret[stage.first] = json11::Json::object {
+            {"count", json_counter(hist.count())},
+            {"min", json_counter(hist.min())},
+            {"mean", hist.mean()},
+            {"p50", json_counter(hist.percentile(50))},
+            {"p90", json_counter(hist.percentile(90))},
+            {"p99", json_counter(hist.percentile(99))},
+            {"p999", json_counter(hist.percentile(99.9))},
+            {"max", json_counter(hist.max())}
+        };
+    }
+    return ret;
+}
+
+}
+
+void ControllerRest::init(Loader* loader, const Config&)
+{
+    ctrl = Controller::get(loader);
+
+    RestListener::get(loader)->registerRestHandler(this);
+    acceptPath(Method::GET, "admission");
+    acceptPath(Method::GET, "transactions");
+    acceptPath(Method::GET, "reconciliation");
+    acceptPath(Method::GET, "messages");
+    acceptPath(Method::GET, "latency");
+}
+
+json11::Json ControllerRest::handleGET(std::vector<std::string> params, std::string)
+{
+    if (params[0] == "admission") {
+        return admission_json(ctrl->admission());
+    }
+    if (params[0] == "transactions") {
+        return transactions_json(ctrl->sessionStats());
+    }
+    if (params[0] == "reconciliation") {
+        return reconciliation_json(ctrl->reconcileStats());
+    }
+    if (params[0] == "messages") {
+        return messages_json(BlockPoolStats::get());
+    }
+    if (params[0] == "latency") {
+        return latency_json(LatencyStats::get());
+    }
+    return json11::Json::object{
+        {"controller-rest", "incorrect request"}
+    };
+}
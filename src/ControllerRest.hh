@@ -0,0 +1,46 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include "Common.hh"
+#include "Application.hh"
+#include "Loader.hh"
+#include "Rest.hh"
+#include "json11.hpp"
+
+/**
+ * REST access to controller's counters:
+ *  - GET admission: packet-in admission settings and counters per class
+ *  - GET transactions: requests awaiting switch replies
+ *  - GET reconciliation: flow table reconciliation counters
+ *  - GET messages: pooled allocations of decoded messages
+ *  - GET latency: latency histograms of packet-in processing stages
+ */
+class ControllerRest : public Application, RestHandler {
+    Q_OBJECT
+    SIMPLE_APPLICATION(ControllerRest, "controller-rest")
+public:
+    void init(Loader* loader, const Config& config) override;
+
+    bool eventable() override { return false; }
+    AppType type() override { return AppType::None; }
+    json11::Json handleGET(std::vector<std::string> params, std::string body) override;
+
+private:
+    class Controller* ctrl;
+};
@@ -207,7 +207,7 @@ void FlowManager::init(Loader *loader, const Config &rootConfig)
 
     RestListener::get(loader)->registerRestHandler(this);
 
-    transaction = ctrl->registerStaticTransaction(this);
+    transaction = ctrl->registerTransaction(this);
     connect(transaction, &OFTransaction::response, this, &FlowManager::onResponse);
 
     acceptPath(Method::GET, "[0-9]+");
@@ -0,0 +1,445 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FlowReconciler.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/endian/conversion.hpp>
+
+#include "openflow/openflow-1.3.5.h"
+#include "OFEncoder.hh"
+
+namespace runos {
+
+namespace {
+
+constexpr size_t HEADER_LEN = 8;
+constexpr size_t MULTIPART_LEN = 16;    // header, type, flags and padding
+constexpr size_t MATCH_OFFSET = 48;     // in both flow-mod and flow-stats
+
+template<class T>
+T get(const uint8_t* p)
+{
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return boost::endian::big_to_native(v);
+}
+
+struct RawFlow {
+    const uint8_t* match;   // OXM TLVs
+    size_t match_len;
+    const uint8_t* instructions;
+    size_t instructions_len;
+};
+
+// Match and instructions of a flow-mod or a flow-stats entry
+bool parse_flow(const uint8_t* p, size_t len, RawFlow& ret)
+{
+    if (len < MATCH_OFFSET + 4)
+        return false;
+    size_t match_len = get<uint16_t>(p + MATCH_OFFSET + 2);
+    size_t padded = (match_len + 7) / 8 * 8;
+    if (match_len < 4 || MATCH_OFFSET + padded > len)
+        return false;
+    ret.match = p + MATCH_OFFSET + 4;
+    ret.match_len = match_len - 4;
+    ret.instructions = p + MATCH_OFFSET + padded;
+    ret.instructions_len = len - MATCH_OFFSET - padded;
+    return true;
+}
+
+// Splits OXM TLVs or instructions and sorts them,
+// so switches may report them in any order.
+std::string normalize(const uint8_t* p, size_t len, bool oxm)
+{
+    std::vector<std::string> items;
+    while (len >= 4) {
+        size_t n = oxm ? 4 + p[3] : get<uint16_t>(p + 2);
+        if (n < 4 || n > len)
+            break;
+        items.emplace_back(reinterpret_cast<const char*>(p), n);
+        p += n;
+        len -= n;
+    }
+    if (oxm) {
+        std::sort(items.begin(), items.end());
+    } else {
+        // Instruction types are unique, sorting by type is enough
+        std::stable_sort(items.begin(), items.end(),
+            [](const std::string& lhs, const std::string& rhs) {
+                return lhs.compare(0, 2, rhs, 0, 2) < 0;
+            });
+    }
+    std::string ret;
+    for (auto& item : items)
+        ret += item;
+    return ret;
+}
+
+std::string make_key(uint8_t table, uint16_t priority, const RawFlow& flow)
+{
+    std::string ret;
+    ret += char(table);
+    ret += char(priority >> 8);
+    ret += char(priority & 0xff);
+    ret += normalize(flow.match, flow.match_len, true);
+    return ret;
+}
+
+bool cookie_matches(uint64_t cookie, uint64_t value, uint64_t mask)
+{
+    return (cookie & mask) == (value & mask);
+}
+
+} // namespace
+
+FlowReconciler::Stats& FlowReconciler::Stats::operator+=(const Stats& other)
+{
+    runs += other.runs;
+    aborted += other.aborted;
+    dumped += other.dumped;
+    kept += other.kept;
+    added += other.added;
+    removed += other.removed;
+    elapsed += other.elapsed;
+    last_elapsed = other.last_elapsed;
+    return *this;
+}
+
+FlowReconciler::FlowReconciler(clock::time_point start)
+    : m_start(start)
+{ }
+
+void FlowReconciler::filter(const uint8_t* data, size_t len,
+                            std::vector<uint8_t>& out)
+{
+    switch (m_state) {
+    case State::Dumping:
+        m_held.insert(m_held.end(), data, data + len);
+        return;
+    case State::Done:
+        out.insert(out.end(), data, data + len);
+        return;
+    case State::Claiming:
+        break;
+    }
+
+    while (len >= HEADER_LEN) {
+        size_t n = get<uint16_t>(data + 2);
+        if (n < HEADER_LEN || n > len)
+            break;
+        message(data, n, out);
+        data += n;
+        len -= n;
+    }
+    out.insert(out.end(), data, data + len);
+}
+
+void FlowReconciler::message(const uint8_t* msg, size_t len,
+                             std::vector<uint8_t>& out)
+{
+    switch (msg[1]) {
+    case OFPT_FLOW_MOD:
+        flow_mod(msg, len, out);
+        return;
+    case OFPT_BARRIER_REQUEST:
+        // Deletions must be done by the time the barrier is replied
+        flush_deletes(out);
+        break;
+    }
+    out.insert(out.end(), msg, msg + len);
+}
+
+void FlowReconciler::flow_mod(const uint8_t* msg, size_t len,
+                              std::vector<uint8_t>& out)
+{
+    RawFlow flow;
+    if (not parse_flow(msg, len, flow)) {
+        out.insert(out.end(), msg, msg + len);
+        return;
+    }
+
+    uint64_t cookie = get<uint64_t>(msg + 8);
+    uint64_t cookie_mask = get<uint64_t>(msg + 16);
+    uint8_t table = msg[24];
+    uint8_t command = msg[25];
+    uint16_t priority = get<uint16_t>(msg + 30);
+    uint32_t buffer_id = get<uint32_t>(msg + 32);
+    uint32_t out_port = get<uint32_t>(msg + 36);
+    uint32_t out_group = get<uint32_t>(msg + 40);
+    uint16_t flags = get<uint16_t>(msg + 44);
+
+    switch (command) {
+    case OFPFC_ADD: {
+        Entry e;
+        e.table = table;
+        e.priority = priority;
+        e.cookie = cookie;
+        e.idle_timeout = get<uint16_t>(msg + 26);
+        e.hard_timeout = get<uint16_t>(msg + 28);
+        e.send_flow_rem = flags & OFPFF_SEND_FLOW_REM;
+        e.instructions = normalize(flow.instructions, flow.instructions_len, false);
+        e.claimed = true;
+
+        auto key = make_key(table, priority, flow);
+        auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            Entry& old = it->second;
+            if (old.cookie == e.cookie &&
+                old.idle_timeout == e.idle_timeout &&
+                old.hard_timeout == e.hard_timeout &&
+                old.send_flow_rem == e.send_flow_rem &&
+                old.instructions == e.instructions)
+            {
+                if (old.deleted) {
+                    old.deleted = false;
+                    --m_pending_deletes;
+                }
+                old.claimed = true;
+                // The add also releases a packet buffered on the switch
+                if (buffer_id != OFP_NO_BUFFER) {
+                    out.insert(out.end(), msg, msg + len);
+                } else {
+                    ++m_stats.kept;
+                }
+                return;
+            }
+            // Changed. Don't rely on the add replacing it,
+            // overlap checking would refuse it.
+            if (old.deleted)
+                --m_pending_deletes;
+            delete_strict(old, out);
+            m_entries.erase(it);
+        }
+
+        // New state may overlap with what is being deleted
+        flush_deletes(out);
+        e.match.assign(reinterpret_cast<const char*>(flow.match), flow.match_len);
+        m_entries.emplace(std::move(key), std::move(e));
+        ++m_stats.added;
+        out.insert(out.end(), msg, msg + len);
+        return;
+    }
+
+    case OFPFC_DELETE:
+    case OFPFC_DELETE_STRICT: {
+        bool strict = command == OFPFC_DELETE_STRICT;
+        if (out_port != OFPP_ANY || out_group != OFPG_ANY ||
+            (strict && table == OFPTT_ALL) ||
+            (not strict && flow.match_len != 0))
+        {
+            // Can't tell which entries it hits
+            forget(table, cookie, cookie_mask);
+            break;
+        }
+
+        if (strict) {
+            auto it = m_entries.find(make_key(table, priority, flow));
+            if (it != m_entries.end() &&
+                cookie_matches(it->second.cookie, cookie, cookie_mask))
+            {
+                defer_delete(it->second);
+            }
+        } else {
+            for (auto& kv : m_entries) {
+                Entry& e = kv.second;
+                if ((table == OFPTT_ALL || e.table == table) &&
+                    cookie_matches(e.cookie, cookie, cookie_mask))
+                {
+                    defer_delete(e);
+                }
+            }
+        }
+        return;
+    }
+
+    default:
+        forget(table, cookie, cookie_mask);
+        break;
+    }
+
+    out.insert(out.end(), msg, msg + len);
+}
+
+void FlowReconciler::defer_delete(Entry& e)
+{
+    if (not e.deleted) {
+        e.deleted = true;
+        ++m_pending_deletes;
+    }
+}
+
+void FlowReconciler::flush_deletes(std::vector<uint8_t>& out)
+{
+    if (m_pending_deletes == 0)
+        return;
+
+    for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+        if (it->second.deleted) {
+            delete_strict(it->second, out);
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_pending_deletes = 0;
+}
+
+void FlowReconciler::delete_strict(const Entry& e, std::vector<uint8_t>& out)
+{
+    OFEncoder::FlowModParams fm;
+    fm.command = OFPFC_DELETE_STRICT;
+    fm.table_id = e.table;
+    fm.priority = e.priority;
+    fm.cookie = e.cookie;
+    fm.cookie_mask = uint64_t(-1);
+
+    size_t at = out.size();
+    size_t capacity = MATCH_OFFSET + 4 + e.match.size() + 8;
+    out.resize(at + capacity);
+    OFEncoder enc(out.data() + at, capacity);
+    enc.begin_flow_mod(fm, reinterpret_cast<const uint8_t*>(e.match.data()),
+                       e.match.size());
+    enc.end_message();
+    out.resize(at + enc.size());
+
+    ++m_stats.removed;
+}
+
+void FlowReconciler::forget(uint8_t table, uint64_t cookie, uint64_t mask)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+        const Entry& e = it->second;
+        if ((table == OFPTT_ALL || e.table == table) &&
+            cookie_matches(e.cookie, cookie, mask))
+        {
+            if (e.deleted)
+                --m_pending_deletes;
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FlowReconciler::dump(const uint8_t* msg, size_t len)
+{
+    if (len < MULTIPART_LEN || get<uint16_t>(msg + 8) != OFPMP_FLOW)
+        return;
+
+    const uint8_t* p = msg + MULTIPART_LEN;
+    len -= MULTIPART_LEN;
+    while (len >= MATCH_OFFSET) {
+        size_t n = get<uint16_t>(p);
+        if (n < MATCH_OFFSET || n > len)
+            break;
+
+        RawFlow flow;
+        if (parse_flow(p, n, flow)) {
+            Entry e;
+            e.table = p[2];
+            e.priority = get<uint16_t>(p + 12);
+            e.idle_timeout = get<uint16_t>(p + 14);
+            e.hard_timeout = get<uint16_t>(p + 16);
+            e.send_flow_rem = get<uint16_t>(p + 18) & OFPFF_SEND_FLOW_REM;
+            e.cookie = get<uint64_t>(p + 24);
+            e.match.assign(reinterpret_cast<const char*>(flow.match), flow.match_len);
+            e.instructions = normalize(flow.instructions, flow.instructions_len, false);
+            if (m_entries.emplace(make_key(e.table, e.priority, flow),
+                                  std::move(e)).second)
+            {
+                ++m_stats.dumped;
+            }
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+void FlowReconciler::dumped(std::vector<uint8_t>& out)
+{
+    if (m_state != State::Dumping)
+        return;
+    m_state = State::Claiming;
+    std::vector<uint8_t> held;
+    held.swap(m_held);
+    filter(held.data(), held.size(), out);
+}
+
+FlowReconciler::Stats FlowReconciler::abort(std::vector<uint8_t>& out,
+                                            clock::time_point now)
+{
+    uint8_t buf[128];
+    OFEncoder enc(buf, sizeof(buf));
+    OFEncoder::FlowModParams fm;
+    fm.command = OFPFC_DELETE;
+    fm.table_id = OFPTT_ALL;
+    enc.begin_flow_mod(fm, oxm::field_set{});
+    enc.end_message();
+    enc.barrier_request();
+    out.insert(out.end(), enc.data(), enc.data() + enc.size());
+
+    out.insert(out.end(), m_held.begin(), m_held.end());
+    m_held.clear();
+    m_entries.clear();
+    m_pending_deletes = 0;
+
+    m_stats.aborted = 1;
+    return done(now);
+}
+
+std::vector<FlowReconciler::Unclaimed> FlowReconciler::unclaimed() const
+{
+    std::vector<Unclaimed> ret;
+    for (auto& kv : m_entries) {
+        const Entry& e = kv.second;
+        if (not e.claimed && not e.deleted)
+            ret.push_back(Unclaimed{e.table, e.cookie});
+    }
+    return ret;
+}
+
+FlowReconciler::Stats FlowReconciler::finish(
+        const std::function<bool(const Unclaimed&)>& keep,
+        std::vector<uint8_t>& out,
+        clock::time_point now)
+{
+    flush_deletes(out);
+    for (auto& kv : m_entries) {
+        const Entry& e = kv.second;
+        if (e.claimed || keep(Unclaimed{e.table, e.cookie}))
+            continue;
+        delete_strict(e, out);
+    }
+    m_entries.clear();
+    return done(now);
+}
+
+FlowReconciler::Stats FlowReconciler::done(clock::time_point now)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+
+    m_state = State::Done;
+    m_stats.runs = 1;
+    m_stats.last_elapsed = duration_cast<milliseconds>(now - m_start);
+    m_stats.elapsed = m_stats.last_elapsed;
+    return m_stats;
+}
+
+} // namespace runos
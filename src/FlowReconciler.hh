@@ -0,0 +1,125 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace runos {
+
+/**
+ * Brings the flow tables of a reconnected switch to the state the
+ * applications want without wiping them.
+ *
+ * Outgoing messages are held until the switch's flow-stats dump is
+ * complete, then compared against it: adds of entries which are
+ * already there are not sent, deletions are deferred until an add
+ * which doesn't resurrect them or a barrier, everything else passes
+ * through. When the applications have had time to re-send their
+ * state, entries nobody claimed are deleted.
+ *
+ * Works on serialized OpenFlow 1.3 messages and isn't thread-safe.
+ */
+class FlowReconciler {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Stats {
+        uint64_t runs = 0;
+        uint64_t aborted = 0;  ///< fell back to wiping the tables
+        uint64_t dumped = 0;   ///< entries found on the switch
+        uint64_t kept = 0;     ///< flow-mods not sent, entry was there
+        uint64_t added = 0;    ///< missing or changed entries sent
+        uint64_t removed = 0;  ///< stale entries deleted
+        std::chrono::milliseconds elapsed {0}; ///< time to consistent
+        std::chrono::milliseconds last_elapsed {0};
+
+        Stats& operator+=(const Stats& other);
+    };
+
+    /** Entry nobody re-sent during the reconciliation window */
+    struct Unclaimed {
+        uint8_t table;
+        uint64_t cookie;
+    };
+
+    explicit FlowReconciler(clock::time_point start = clock::now());
+
+    bool dumping() const { return m_state == State::Dumping; }
+
+    /** Passes outgoing messages, appending what is to be sent to `out` */
+    void filter(const uint8_t* data, size_t len, std::vector<uint8_t>& out);
+
+    /** Adds entries of a flow-stats multipart reply */
+    void dump(const uint8_t* msg, size_t len);
+
+    /** The dump is complete: replays held messages against it */
+    void dumped(std::vector<uint8_t>& out);
+
+    /** The dump failed: wipes the tables and sends held messages */
+    Stats abort(std::vector<uint8_t>& out, clock::time_point now = clock::now());
+
+    std::vector<Unclaimed> unclaimed() const;
+
+    /**
+     * Deletes entries nobody claimed, except those `keep` wants.
+     * Must not be called while dumping.
+     */
+    Stats finish(const std::function<bool(const Unclaimed&)>& keep,
+                 std::vector<uint8_t>& out,
+                 clock::time_point now = clock::now());
+
+private:
+    enum class State { Dumping, Claiming, Done };
+
+    struct Entry {
+        uint8_t table;
+        uint16_t priority;
+        uint64_t cookie;
+        uint16_t idle_timeout;
+        uint16_t hard_timeout;
+        bool send_flow_rem;
+        std::string match;        // OXM TLVs as sent by the switch
+        std::string instructions; // normalized
+        bool claimed {false};
+        bool deleted {false};     // deletion deferred
+    };
+
+    State m_state {State::Dumping};
+    clock::time_point m_start;
+    std::vector<uint8_t> m_held;
+    // key: table, priority and normalized match
+    std::unordered_map<std::string, Entry> m_entries;
+    size_t m_pending_deletes {0};
+    Stats m_stats;
+
+    void message(const uint8_t* msg, size_t len, std::vector<uint8_t>& out);
+    void flow_mod(const uint8_t* msg, size_t len, std::vector<uint8_t>& out);
+    void defer_delete(Entry& e);
+    void flush_deletes(std::vector<uint8_t>& out);
+    void delete_strict(const Entry& e, std::vector<uint8_t>& out);
+    void forget(uint8_t table, uint64_t cookie, uint64_t mask);
+    Stats done(clock::time_point now);
+};
+
+} // namespace runos
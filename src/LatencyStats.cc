@@ -0,0 +1,178 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "LatencyStats.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace runos {
+
+void LatencyHistogram::record(uint64_t ns, uint64_t count)
+{
+    m_counts[bucket(ns)] += count;
+    m_count += count;
+    m_sum += ns * count;
+    m_min = std::min(m_min, ns);
+    m_max = std::max(m_max, ns);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < nbuckets; ++i)
+        m_counts[i] += other.m_counts[i];
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (m_count == 0)
+        return 0;
+    uint64_t rank = std::max<uint64_t>(1, std::ceil(m_count * p / 100.0));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < nbuckets; ++i) {
+        seen += m_counts[i];
+        if (seen >= rank)
+            return std::min(upper(i), m_max);
+    }
+    return m_max;
+}
+
+// Histograms of one thread. It is the only writer, so counters are
+// updated with plain loads and stores; atomics keep readers defined.
+struct LatencyStats::Shard {
+    struct Histogram {
+        std::array<std::atomic<uint64_t>, LatencyHistogram::nbuckets> counts {};
+        std::atomic<uint64_t> count {0};
+        std::atomic<uint64_t> sum {0};
+        std::atomic<uint64_t> min {UINT64_MAX};
+        std::atomic<uint64_t> max {0};
+    };
+
+    // allocated on first record of the stage
+    std::array<std::atomic<Histogram*>, max_stages> stages {};
+
+    ~Shard()
+    {
+        for (auto& stage : stages)
+            delete stage.load();
+    }
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value,
+                      std::memory_order_relaxed);
+    }
+
+    void record(Stage stage, uint64_t ns)
+    {
+        Histogram* h = stages[stage].load(std::memory_order_relaxed);
+        if (not h) {
+            h = new Histogram;
+            stages[stage].store(h, std::memory_order_release);
+        }
+        add(h->counts[LatencyHistogram::bucket(ns)], 1);
+        add(h->count, 1);
+        add(h->sum, ns);
+        if (ns < h->min.load(std::memory_order_relaxed))
+            h->min.store(ns, std::memory_order_relaxed);
+        if (ns > h->max.load(std::memory_order_relaxed))
+            h->max.store(ns, std::memory_order_relaxed);
+    }
+};
+
+struct LatencyStats::Registry {
+    std::mutex mutex;
+    std::vector<std::string> names;
+    // shards of exited threads are kept for their records
+    std::vector<std::shared_ptr<Shard>> shards;
+};
+
+// Leaked, so threads exiting after main() may still record
+LatencyStats::Registry& LatencyStats::registry()
+{
+    static Registry* ret = new Registry;
+    return *ret;
+}
+
+LatencyStats::Shard& LatencyStats::shard()
+{
+    thread_local std::shared_ptr<Shard> ret = [] {
+        auto shard = std::make_shared<Shard>();
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.shards.push_back(shard);
+        return shard;
+    }();
+    return *ret;
+}
+
+LatencyStats::Stage LatencyStats::stage(const std::string& name)
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    auto it = std::find(r.names.begin(), r.names.end(), name);
+    if (it != r.names.end())
+        return it - r.names.begin();
+    if (r.names.size() == max_stages - 1)
+        r.names.push_back("other");
+    if (r.names.size() == max_stages)
+        return max_stages - 1;
+    r.names.push_back(name);
+    return r.names.size() - 1;
+}
+
+void LatencyStats::record(Stage stage, uint64_t ns)
+{
+    shard().record(stage, ns);
+}
+
+void LatencyStats::merge(const Shard& shard, Stage stage, LatencyHistogram& to)
+{
+    const Shard::Histogram* h = shard.stages[stage].load(std::memory_order_acquire);
+    if (not h)
+        return;
+    for (size_t i = 0; i < LatencyHistogram::nbuckets; ++i)
+        to.m_counts[i] += h->counts[i].load(std::memory_order_relaxed);
+    to.m_count += h->count.load(std::memory_order_relaxed);
+    to.m_sum += h->sum.load(std::memory_order_relaxed);
+    to.m_min = std::min(to.m_min, h->min.load(std::memory_order_relaxed));
+    to.m_max = std::max(to.m_max, h->max.load(std::memory_order_relaxed));
+}
+
+std::map<std::string, LatencyHistogram> LatencyStats::get()
+{
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    std::map<std::string, LatencyHistogram> ret;
+    for (Stage stage = 0; stage < r.names.size(); ++stage) {
+        LatencyHistogram hist;
+        for (auto& shard : r.shards)
+            merge(*shard, stage, hist);
+        if (hist.count() != 0)
+            ret.emplace(r.names[stage], hist);
+    }
+    return ret;
+}
+
+} // namespace runos
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace runos {
+
+/**
+ * Log-linear histogram of durations in nanoseconds, as HDR histograms
+ * do it: every power of two is split into 16 buckets, so a value is
+ * known to about 6%. Values below 16 ns are exact.
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned sub_bits = 4;
+    static constexpr size_t sub_buckets = size_t(1) << sub_bits;
+    static constexpr size_t nbuckets = (64 - sub_bits + 1) * sub_buckets;
+
+    static size_t bucket(uint64_t ns)
+    {
+        if (ns < sub_buckets)
+            return ns;
+        unsigned exp = 63 - __builtin_clzll(ns);
+        unsigned shift = exp - sub_bits;
+        return (shift + 1) * sub_buckets + ((ns >> shift) & (sub_buckets - 1));
+    }
+
+    /** Smallest value of the bucket */
+    static uint64_t lower(size_t bucket)
+    {
+        if (bucket < sub_buckets)
+            return bucket;
+        unsigned shift = bucket / sub_buckets - 1;
+        return (sub_buckets + bucket % sub_buckets) << shift;
+    }
+
+    /** Largest value of the bucket */
+    static uint64_t upper(size_t bucket)
+    {
+        if (bucket < sub_buckets)
+            return bucket;
+        unsigned shift = bucket / sub_buckets - 1;
+        return lower(bucket) + ((uint64_t(1) << shift) - 1);
+    }
+
+    void record(uint64_t ns, uint64_t count = 1);
+    void merge(const LatencyHistogram& other);
+
+    uint64_t count() const { return m_count; }
+    uint64_t min() const { return m_count ? m_min : 0; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_count ? double(m_sum) / m_count : 0.0; }
+
+    /** Value not exceeded by `p` percent of records, to bucket precision */
+    uint64_t percentile(double p) const;
+
+    uint64_t at(size_t bucket) const { return m_counts[bucket]; }
+
+private:
+    friend class LatencyStats;
+
+    std::array<uint64_t, nbuckets> m_counts {};
+    uint64_t m_count {0};
+    uint64_t m_sum {0};
+    uint64_t m_min {UINT64_MAX};
+    uint64_t m_max {0};
+};
+
+/**
+ * Latency histograms of named stages.
+ *
+ * Every thread records into histograms of its own without locks or
+ * atomic read-modify-writes; get() merges them. Histograms of exited
+ * threads are kept.
+ */
+class LatencyStats {
+public:
+    using Stage = uint32_t;
+
+    static constexpr Stage max_stages = 128;
+
+    /**
+     * Index of the stage with this name, registered on first use.
+     * Takes a lock, so look stages up before hot paths. Names beyond
+     * max_stages all get the last stage, "other".
+     */
+    static Stage stage(const std::string& name);
+
+    static void record(Stage stage, uint64_t ns);
+
+    /** Histograms of stages which have records, merged over threads */
+    static std::map<std::string, LatencyHistogram> get();
+
+private:
+    struct Shard;
+    struct Registry;
+
+    static Registry& registry();
+    static Shard& shard();
+    static void merge(const Shard& shard, Stage stage, LatencyHistogram& to);
+};
+
+#ifndef RUNOS_NO_LATENCY_STATS
+
+/** Records time from construction to destruction or stop() */
+class LatencyScope {
+    using clock = std::chrono::steady_clock;
+
+    LatencyStats::Stage m_stage;
+    clock::time_point m_start;
+
+public:
+    explicit LatencyScope(LatencyStats::Stage stage)
+        : m_stage(stage), m_start(clock::now())
+    { }
+
+    LatencyScope(const LatencyScope&) = delete;
+
+    /** Records now instead of on destruction */
+    void stop()
+    {
+        if (m_stage == stopped)
+            return;
+        auto elapsed = clock::now() - m_start;
+        LatencyStats::record(m_stage,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        m_stage = stopped;
+    }
+
+    ~LatencyScope()
+    {
+        stop();
+    }
+
+private:
+    static constexpr LatencyStats::Stage stopped = LatencyStats::Stage(-1);
+};
+
+#else
+
+// Built without latency stats: nothing is measured
+class LatencyScope {
+public:
+    explicit LatencyScope(LatencyStats::Stage)
+    { }
+
+    LatencyScope(const LatencyScope&) = delete;
+
+    void stop()
+    { }
+};
+
+#endif
+
+} // namespace runos
@@ -20,6 +20,7 @@
 #include "LinkDiscovery.hh"
 
 #include <cstdint>
+#include <stdexcept>
 #include <boost/endian/arithmetic.hpp>
 #include <boost/endian/conversion.hpp>
 
@@ -188,8 +189,25 @@ runos::retic::policy LinkDiscovery::getPolicy() {
         });
 }
 
-void LinkDiscovery::startUp(Loader *)
+void LinkDiscovery::startUp(Loader *loader)
 {
+    // Maple is optional, routes may come from retic only
+    try {
+        m_maple = Maple::get(loader);
+    } catch (const std::out_of_range&) { }
+
+    // Forget decisions made on the endpoints of broken links
+    if (m_maple) {
+        QObject::connect(this, &LinkDiscovery::linkBroken,
+             [this](switch_and_port from, switch_and_port to) {
+                 for (uint64_t dpid : {from.dpid, to.dpid}) {
+                     auto evicted = m_maple->invalidate(oxm::switch_id() == dpid);
+                     VLOG(5) << "Evicted " << evicted.paths << " paths and "
+                             << evicted.flows << " flows on switch " << dpid;
+                 }
+             });
+    }
+
     // Start LLDP polling
     startTimer(c_poll_interval * 1000);
 }
@@ -306,7 +324,6 @@ void LinkDiscovery::clearLinkAt(const switch_and_port &source)
         emit linkBroken(source, target);
     else
         emit linkBroken(target, source);
-    //ctrl->invalidateTraceTree(); // TODO : smart invalidation
 }
 
 void LinkDiscovery::timerEvent(QTimerEvent*)
@@ -26,6 +26,7 @@
 #include "Loader.hh"
 #include "ILinkDiscovery.hh"
 #include "Controller.hh"
+#include "Maple.hh"
 
 #include "retic/policies.hh"
 
@@ -69,6 +70,7 @@ protected:
 private:
     unsigned c_poll_interval;
     SwitchManager* m_switch_manager;
+    Maple* m_maple {nullptr}; // if loaded
 
     std::set<DiscoveredLink> m_links;
     std::unordered_map<switch_and_port, std::set<DiscoveredLink>::iterator >
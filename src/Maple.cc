@@ -17,12 +17,15 @@
 #include "Maple.hh"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <unordered_map>
 #include <vector>
 #include <mutex>
 #include <thread>
 #include <sstream>
 #include <memory>
+#include <optional>
 #include <functional>
 #include <iterator>
 
@@ -32,6 +35,8 @@
 #include <boost/variant/get.hpp>
 
 #include "maple/Runtime.hh"
+#include "maple/Epoch.hh"
+#include "maple/TablePipeline.hh"
 #include "oxm/field_set.hh"
 #include "oxm/openflow_basic.hh" //switch_id
 #include "types/exception.hh"
@@ -42,7 +47,8 @@
 #include "SwitchConnection.hh"
 #include "Flow.hh"
 #include "PacketParser.hh"
-#include "FluidOXMAdapter.hh"
+#include "OFEncoder.hh"
+#include "LatencyStats.hh"
 
 //hash for pairs
 namespace std{
@@ -68,6 +74,80 @@ using namespace std::placeholders;
 
 typedef std::vector< std::pair<std::string, PacketMissHandler> >
     PacketMissPipeline;
+
+namespace {
+
+// Stages of packet-in processing, nested ones are included in outer:
+// packet-in > write-lock, parse, lookup, augment > handler.<name>,
+// activate > send. The lookup takes no lock; write-lock is the wait
+// for the lock by packets the lookup didn't handle.
+struct Stages {
+    LatencyStats::Stage packet_in = LatencyStats::stage("maple.packet-in");
+    LatencyStats::Stage parse = LatencyStats::stage("maple.parse");
+    LatencyStats::Stage lookup = LatencyStats::stage("maple.lookup");
+    LatencyStats::Stage write_lock = LatencyStats::stage("maple.write-lock");
+    LatencyStats::Stage augment = LatencyStats::stage("maple.augment");
+    LatencyStats::Stage activate = LatencyStats::stage("maple.activate");
+    LatencyStats::Stage send = LatencyStats::stage("maple.send");
+};
+
+const Stages stages;
+
+// Fields the multi-table backend classifies by
+oxm::type pipeline_stage(const std::string& name)
+{
+    static const std::unordered_map<std::string, oxm::type> known {
+        { "in_port", oxm::in_port() },
+        { "eth_src", oxm::eth_src() },
+        { "eth_dst", oxm::eth_dst() },
+        { "eth_type", oxm::eth_type() },
+        { "vlan_vid", oxm::vlan_vid() },
+        { "ip_proto", oxm::ip_proto() },
+        { "ipv4_src", oxm::ipv4_src() },
+        { "ipv4_dst", oxm::ipv4_dst() },
+        { "tcp_src", oxm::tcp_src() },
+        { "tcp_dst", oxm::tcp_dst() },
+        { "udp_src", oxm::udp_src() },
+        { "udp_dst", oxm::udp_dst() }
+    };
+    auto it = known.find(name);
+    if (it == known.end()) {
+        RUNOS_THROW(invalid_argument() <<
+                    errinfo_str("Unknown Maple stage field " + name));
+    }
+    return it->second;
+}
+
+// Program of a multi-table rule, which equal rules share: flow-mod
+// fields taken from the flow, followed by encoded instructions
+struct Program {
+    uint16_t idle_timeout;
+    uint16_t hard_timeout;
+    uint16_t flags;
+
+    static std::string pack(const OFEncoder::FlowModParams& fm,
+                            const uint8_t* instructions, size_t len)
+    {
+        Program head {fm.idle_timeout, fm.hard_timeout, fm.flags};
+        std::string ret(reinterpret_cast<const char*>(&head), sizeof(head));
+        ret.append(reinterpret_cast<const char*>(instructions), len);
+        return ret;
+    }
+
+    // Fills fields of `fm`, returns the instructions
+    static std::pair<const char*, size_t>
+    unpack(const std::string& program, OFEncoder::FlowModParams& fm)
+    {
+        Program head;
+        std::memcpy(&head, program.data(), sizeof(head));
+        fm.idle_timeout = head.idle_timeout;
+        fm.hard_timeout = head.hard_timeout;
+        fm.flags = head.flags;
+        return { program.data() + sizeof(head), program.size() - sizeof(head) };
+    }
+};
+
+}
 typedef std::vector< std::pair<std::string, PacketMissHandlerFactory> >
     PacketMissPipelineFactory;
 
@@ -143,15 +223,38 @@ class FlowImpl final : public Flow
     maple::Installer m_installer; // Installer of flow through maple trace tree
     //underlying installed by install method
 
+    // Inspect handler read by packet-ins without the lock, null unless
+    // the flow is inspected and not expired. Copies of a flow start
+    // empty, the owner republishes them.
+    class PublishedHandler {
+        using Handler = Decision::Inspect::Handler;
+        std::atomic<Handler*> m_ptr {nullptr}; // retired through Epoch
+    public:
+        PublishedHandler() = default;
+        PublishedHandler(const PublishedHandler&) { }
+        PublishedHandler& operator=(const PublishedHandler&) { return *this; }
+        ~PublishedHandler() { delete m_ptr.load(); }
+
+        void set(Handler* handler)
+        {
+            if (Handler* old = m_ptr.exchange(handler))
+                maple::Epoch::retire(old);
+        }
+
+        const Handler* get() const { return m_ptr.load(); }
+    } m_inspect;
+
     bool installTrigger{false}; // true if flow is installing now
+    // when the flow left the switches, while it's idle or evicted
+    std::chrono::steady_clock::time_point m_since;
     friend class MapleBackend; // need diactivate this trigger, on miss flow
 
     class DecisionCompiler : public boost::static_visitor<void> {
-        ActionList& ret;
+        OFEncoder& enc;
         uint64_t dpid;
     public:
-        explicit DecisionCompiler(ActionList& ret, uint64_t dpid)
-            : ret(ret), dpid(dpid)
+        explicit DecisionCompiler(OFEncoder& enc, uint64_t dpid)
+            : enc(enc), dpid(dpid)
         { }
 
         void operator()(const Decision::Undefined&) const
@@ -164,44 +267,43 @@ class FlowImpl final : public Flow
 
         void operator()(const Decision::Unicast& u) const
         {
-            ret.add_action(new of13::OutputAction(u.port, 0));
+            enc.output(u.port);
         }
 
         void operator()(const Decision::Multicast& m) const
         {
             for (uint32_t port : m.ports) {
-                ret.add_action(new of13::OutputAction(port, 0));
+                enc.output(port);
             }
         }
 
         void operator()(const Decision::Broadcast& b) const
         {
-            ret.add_action(new of13::OutputAction(of13::OFPP_FLOOD, 0));
+            enc.output(of13::OFPP_FLOOD);
         }
 
         void operator()(const Decision::Inspect& i) const
         {
             DVLOG(30) << "Added rule inpecting. Len : " << int(i.send_bytes_len);
-            ret.add_action(new of13::OutputAction(of13::OFPP_CONTROLLER,
-                                                  i.send_bytes_len));
+            enc.output(of13::OFPP_CONTROLLER, i.send_bytes_len);
         }
 
         void operator()(const Decision::Custom& c) const
         {
+            // Custom decisions are expressed in libfluid actions
+            ActionList ret;
             c.body->apply(ret, dpid);
+            ret.pack(enc.reserve(ret.length()));
         }
    };
 
-    ActionList actions(uint64_t dpid) const
+    void actions(OFEncoder& enc, uint64_t dpid) const
     {
-        ActionList ret;
-
         for (const oxm::field<>& f : m_mods) {
-            ret.add_action(new of13::SetFieldAction(new FluidOXMAdapter(f)));
+            enc.set_field(f);
         }
 
-        boost::apply_visitor(DecisionCompiler(ret, dpid), m_decision.data());
-        return ret;
+        boost::apply_visitor(DecisionCompiler(enc, dpid), m_decision.data());
     }
 
     void packet_out(uint16_t priority,
@@ -210,41 +312,28 @@ class FlowImpl final : public Flow
     {
         auto &scope = m_switches.at(dpid);
         if (scope.packet_in){
-            of13::PacketOut po;
-            po.xid(scope.xid);
-            po.buffer_id(scope.buffer_id);
-            po.actions(actions(dpid));
-            po.in_port(scope.in_port);
+            auto enc = OFEncoder::scratch();
+            enc.begin_packet_out(scope.xid, scope.buffer_id, scope.in_port);
+            actions(enc, dpid);
 
             if (scope.buffer_id == OFP_NO_BUFFER && scope.packet_data != nullptr) {
-                po.data(scope.packet_data, scope.data_len);
+                enc.packet_data(scope.packet_data, scope.data_len);
             }
+            enc.end_message();
 
-            scope.conn->send(po);
+            LatencyScope sending {stages.send};
+            scope.conn->send(enc.data(), enc.size());
+            sending.stop();
 
             scope.packet_data = nullptr;
             scope.data_len = 0;
             }
     }
 
-    void flow_mod(uint16_t priority,
-                  const oxm::field_set& match,
-                  uint64_t dpid)
+    void timeouts(OFEncoder::FlowModParams& fm) const
     {
         using std::chrono::duration_cast;
         using std::chrono::seconds;
-        auto &scope = m_switches.at(dpid);
-        of13::FlowMod fm;
-
-        fm.command(of13::OFPFC_ADD);
-        fm.xid(scope.xid);
-
-        fm.buffer_id(scope.buffer_id);
-
-        fm.table_id(m_table);
-        fm.priority(priority);
-        fm.cookie(cookie());
-        fm.match(make_of_match(match));
 
         auto ito = m_decision.idle_timeout();
         auto hto = m_decision.hard_timeout();
@@ -252,40 +341,135 @@ class FlowImpl final : public Flow
         long long hto_seconds = duration_cast<seconds>(hto).count();
 
         if (ito == Decision::duration::max())
-            fm.idle_timeout(0);
+            fm.idle_timeout = 0;
         else
-            fm.idle_timeout(std::min(ito_seconds, 65535LL));
+            fm.idle_timeout = std::min(ito_seconds, 65535LL);
 
         if (hto == Decision::duration::max())
-            fm.hard_timeout(0);
+            fm.hard_timeout = 0;
         else
-            fm.hard_timeout(std::min(hto_seconds, 65535LL));
+            fm.hard_timeout = std::min(hto_seconds, 65535LL);
 
-        fm.flags( of13::OFPFF_CHECK_OVERLAP |
-                  of13::OFPFF_SEND_FLOW_REM );
+        fm.flags = of13::OFPFF_CHECK_OVERLAP |
+                   of13::OFPFF_SEND_FLOW_REM;
+    }
 
-        of13::ApplyActions applyActions;
-        applyActions.actions(actions(dpid));
-        fm.add_instruction(applyActions);
+    void instructions(OFEncoder& enc, uint64_t dpid) const
+    {
+        auto &scope = m_switches.at(dpid);
+        if (boost::get<Decision::Inspect>(&m_decision.data())) {
+            // Shape packet-ins in the datapath
+            if (uint32_t meter = scope.conn->packet_in_meter())
+                enc.meter(meter);
+        }
+        enc.begin_apply_actions();
+        actions(enc, dpid);
+    }
 
-        scope.conn->send(fm);
+    // Sends the rule unless `shadow` holds the same one, then keeps
+    // the sent rule there
+    bool flow_mod(uint16_t priority,
+                  const oxm::field_set& match,
+                  uint64_t dpid,
+                  std::string& shadow)
+    {
+        auto &scope = m_switches.at(dpid);
+        OFEncoder::FlowModParams fm;
+
+        fm.command = of13::OFPFC_ADD;
+        fm.xid = scope.xid;
+
+        fm.buffer_id = scope.buffer_id;
+
+        fm.table_id = m_table;
+        fm.priority = priority;
+        fm.cookie = cookie();
+        timeouts(fm);
+
+        auto enc = OFEncoder::scratch();
+        enc.begin_flow_mod(fm, match);
+        instructions(enc, dpid);
+        enc.end_message();
+
+        // Compared without xid and buffer_id, they are per packet
+        std::string image(reinterpret_cast<const char*>(enc.data()), enc.size());
+        std::fill_n(image.begin() + 4, 4, '\0');
+        std::fill_n(image.begin() + 32, 4, '\xff');
+        if (image == shadow)
+            return false;
+
+        LatencyScope sending {stages.send};
+        scope.conn->send(enc.data(), enc.size());
+        sending.stop();
+        shadow = std::move(image);
+        return true;
     }
 
+    static void served(SwitchInfo& scope)
+    {
+        scope.packet_in = false;
+        scope.xid = 0;
+        scope.buffer_id = OFP_NO_BUFFER;
+        scope.in_port = of13::OFPP_CONTROLLER;
+    }
+
+    class DecisionPrinter : public boost::static_visitor<void> {
+        std::ostream& out;
+    public:
+        explicit DecisionPrinter(std::ostream& out)
+            : out(out)
+        { }
+
+        void operator()(const Decision::Undefined&) const
+        { out << "undefined"; }
+
+        void operator()(const Decision::Drop&) const
+        { out << "drop"; }
+
+        void operator()(const Decision::Unicast& u) const
+        { out << "output:" << u.port; }
+
+        void operator()(const Decision::Multicast& m) const
+        {
+            const char* sep = "";
+            for (uint32_t port : m.ports) {
+                out << sep << "output:" << port;
+                sep = ",";
+            }
+        }
+
+        void operator()(const Decision::Broadcast&) const
+        { out << "flood"; }
+
+        void operator()(const Decision::Inspect& i) const
+        { out << "controller:" << int(i.send_bytes_len); }
+
+        void operator()(const Decision::Custom&) const
+        { out << "custom"; }
+    };
+
 public:
-    void install(uint16_t priority,
+    enum class Sent {
+        Nothing,   ///< no rule for this flow, at most a packet-out
+        Unchanged, ///< the switch already has the same rule
+        Rule       ///< flow-mod sent
+    };
+
+    // Installs the rule on `dpid` unless `shadow`, the rule the switch
+    // has at this priority and match, is the same
+    Sent install(uint16_t priority,
                  const oxm::field_set& match,
-                 uint64_t dpid)
+                 uint64_t dpid,
+                 std::string& shadow)
     {
         BOOST_ASSERT(installTrigger);
 
-        using std::chrono::duration_cast;
-        using std::chrono::seconds;
-
         auto& scope = m_switches.at(dpid);
 
         if (state() == State::Evicted && not scope.packet_in)
-            return;
+            return Sent::Nothing;
 
+        Sent ret = Sent::Nothing;
         if (m_decision.idle_timeout() <= Decision::duration::zero()) {
             packet_out(priority, match, dpid);
         } else {
@@ -293,21 +477,95 @@ public:
                 // Send packet if buffer is not supported
                 packet_out(priority, match, dpid);
             }
-            flow_mod(priority, match, dpid);
+            if (flow_mod(priority, match, dpid, shadow)) {
+                ret = Sent::Rule;
+            } else {
+                // Buffered packet is released by the flow-mod otherwise
+                if (scope.packet_in && scope.buffer_id != OFP_NO_BUFFER)
+                    packet_out(priority, match, dpid);
+                ret = Sent::Unchanged;
+            }
         }
 
-        scope.packet_in = false;
-        scope.xid = 0;
-        scope.buffer_id = OFP_NO_BUFFER;
-        scope.in_port = of13::OFPP_CONTROLLER;
+        served(scope);
+        return ret;
     }
 
-    void install(uint16_t priority,
+    Sent install(uint16_t priority,
                  const oxm::field_set& match,
-                 SwitchConnectionPtr conn)
+                 SwitchConnectionPtr conn,
+                 std::string& shadow)
     {
         m_switches.emplace(conn->dpid(), conn);
-        install(priority, match, conn->dpid());
+        return install(priority, match, conn->dpid(), shadow);
+    }
+
+    // Adds the rule to the pipeline of the switch, which sends
+    // entries on commit
+    Sent install(uint16_t priority,
+                 const oxm::field_set& match,
+                 SwitchConnectionPtr conn,
+                 maple::TablePipeline& pipeline)
+    {
+        BOOST_ASSERT(installTrigger);
+
+        uint64_t dpid = conn->dpid();
+        auto& scope = m_switches.emplace(dpid, conn).first->second;
+
+        if (state() == State::Evicted && not scope.packet_in)
+            return Sent::Nothing;
+
+        // Entries don't take buffered packets
+        packet_out(priority, match, dpid);
+        Sent ret = Sent::Nothing;
+        if (not disposable()) {
+            ret = pipeline.add(priority, match, cookie(), program(dpid))
+                ? Sent::Rule : Sent::Unchanged;
+        }
+
+        served(scope);
+        return ret;
+    }
+
+    // Timeouts, flags and instructions of the rules, the same for
+    // flows doing the same
+    std::string program(uint64_t dpid) const
+    {
+        OFEncoder::FlowModParams fm;
+        timeouts(fm);
+
+        auto enc = OFEncoder::scratch();
+        enc.begin_flow_mod(fm, oxm::field_set{});
+        size_t begin = enc.size();
+        instructions(enc, dpid);
+        enc.end_message();
+        return Program::pack(fm, enc.data() + begin, enc.size() - begin);
+    }
+
+    // Actions of the rules, e.g. "set eth_dst=... output:2"
+    std::string describe() const
+    {
+        std::ostringstream ret;
+        for (const oxm::field<>& f : m_mods) {
+            ret << "set " << f << " ";
+        }
+        boost::apply_visitor(DecisionPrinter(ret), m_decision.data());
+        return ret.str();
+    }
+
+    // Sends a packet held while rules of the flow were on their way
+    void release(SwitchConnectionPtr conn, uint32_t buffer_id,
+                 uint32_t in_port, const std::string& data)
+    {
+        auto enc = OFEncoder::scratch();
+        enc.begin_packet_out(0, buffer_id, in_port);
+        actions(enc, conn->dpid());
+        if (buffer_id == OFP_NO_BUFFER)
+            enc.packet_data(data.data(), data.size());
+        enc.end_message();
+
+        LatencyScope sending {stages.send};
+        conn->send(enc.data(), enc.size());
     }
 
     void installer(maple::Installer installer)
@@ -323,6 +581,7 @@ public:
             m_state = State::Active;
         } else {
             m_state = State::Evicted;
+            m_since = std::chrono::steady_clock::now();
         }
         installTrigger = false;
     }
@@ -341,12 +600,23 @@ public:
     {
         //BOOST_ASSERT(state() != State::Active);
         m_decision = std::move(d);
+        publish();
     }
 
     maple::Flow& operator=(const maple::Flow& other_) override
     {
         const FlowImpl& other = dynamic_cast<const FlowImpl&>(other_);
-        return *this = other;
+        *this = other;
+        publish();
+        return *this;
+    }
+
+    // After the decision changed or the flow expired
+    void publish()
+    {
+        auto i = boost::get<Decision::Inspect>(&m_decision.data());
+        m_inspect.set(i && state() != State::Expired ?
+                      new Decision::Inspect::Handler(i->handler) : nullptr);
     }
 
     // Transitions
@@ -373,6 +643,7 @@ public:
 
     void flow_removed(of13::FlowRemoved& fr)
     {
+        m_since = std::chrono::steady_clock::now();
         switch (fr.reason()) {
         case of13::OFPRR_DELETE:
         case of13::OFPRR_METER_DELETE:
@@ -386,14 +657,31 @@ public:
         case of13::OFPRR_HARD_TIMEOUT:
             kill();
             m_state = State::Expired;
+            publish();
             VLOG(30) << "Deleted flow by hard timeout";
             break;
         }
     }
 
+    // Not on any switch for `grace` at least
+    bool stale(std::chrono::steady_clock::time_point now,
+               std::chrono::steady_clock::duration grace) const
+    {
+        return (state() == State::Idle || state() == State::Evicted) &&
+               now - m_since >= grace;
+    }
+
     bool disposable(){
         return m_decision.idle_timeout() <= Decision::duration::zero();
     }
+    // preprocess() for packet-ins which don't hold the write lock
+    bool inspect(Packet& pkt, FlowPtr flow) const
+    {
+        maple::Epoch::Guard guard;
+        auto handler = m_inspect.get();
+        return handler && (*handler)(pkt, flow);
+    }
+
     bool preprocess(Packet& pkt, FlowPtr flow){
         auto data = m_decision.data();
         DVLOG(20) << "preprocessing packet";
@@ -448,14 +736,119 @@ class MapleBackend : public maple::Backend {
     uint8_t table{0};
     FlowImplPtr miss;
 
-    //set of miss rules by their identificator and hash
-    // hash by string : match={...}prio=...
-    // hash provide non collision for same rules, but differenet switches
-    mutable std::unordered_set<std::pair<uint64_t, size_t>> miss_rules;
-    std::unordered_map<uint64_t, SwitchConnectionPtr> conections;
+    // Rule of the Maple table on a switch
+    struct RuleKey {
+        uint16_t priority;
+        oxm::field_set match; // without switch_id
+
+        friend bool operator==(const RuleKey& lhs, const RuleKey& rhs)
+        { return lhs.priority == rhs.priority && lhs.match == rhs.match; }
+    };
+    struct RuleKeyHash {
+        size_t operator()(const RuleKey& key) const
+        { return hash_value(key.match) * 31 + key.priority; }
+    };
+    struct ShadowRule {
+        uint64_t cookie {0};
+        std::string image; // flow-mod as sent, without xid and buffer_id
+        FlowImplWeakPtr flow;
+    };
+    using RuleIndex = std::unordered_map<RuleKey, ShadowRule, RuleKeyHash>;
+
+    // Shadow copy of the Maple table of every switch: rules sent and
+    // not deleted since, so the same rule isn't sent again
+    std::unordered_map<uint64_t, RuleIndex> installed;
+    Maple::RuleStats stats;
 
     oxm::switch_id of_switch_id = oxm::switch_id();
 
+    // Priorities of flows moved by relabeling
+    std::unordered_map<uint64_t, uint16_t> moved;
+
+    // Rules sent to every switch since the last take_sent()
+    std::unordered_map<uint64_t, size_t> sent;
+
+    // Xids of barriers sent by barrier_request since take_barriers()
+    std::unordered_map<uint64_t, uint32_t> barriers;
+
+    // Sends entries of a switch's pipeline
+    struct EntrySender : maple::TablePipeline::Sink {
+        SwitchConnectionPtr conn;
+        Maple::RuleStats& stats;
+
+        EntrySender(SwitchConnectionPtr conn, Maple::RuleStats& stats)
+            : conn(std::move(conn)), stats(stats)
+        { }
+
+        void add(const maple::TablePipeline::Entry& e) override
+        {
+            OFEncoder::FlowModParams fm;
+            fm.command = of13::OFPFC_ADD;
+            fm.table_id = e.table;
+            fm.priority = e.priority;
+            fm.cookie = e.cookie;
+
+            auto enc = OFEncoder::scratch();
+            if (e.program.empty()) {
+                enc.begin_flow_mod(fm, e.match);
+                enc.write_metadata(e.metadata);
+                enc.goto_table(e.table + 1);
+            } else {
+                auto instructions = Program::unpack(e.program, fm);
+                enc.begin_flow_mod(fm, e.match);
+                std::memcpy(enc.reserve(instructions.second),
+                            instructions.first, instructions.second);
+            }
+            enc.end_message();
+
+            LatencyScope sending {stages.send};
+            conn->send(enc.data(), enc.size());
+            stats.rules_sent++;
+        }
+
+        void remove(const maple::TablePipeline::Entry& e) override
+        {
+            OFEncoder::FlowModParams fm;
+            fm.command = of13::OFPFC_DELETE_STRICT;
+            fm.table_id = e.table;
+            fm.priority = e.priority;
+
+            auto enc = OFEncoder::scratch();
+            enc.begin_flow_mod(fm, e.match);
+            enc.end_message();
+            conn->send(enc.data(), enc.size());
+        }
+    };
+
+    struct Pipeline {
+        EntrySender sender;
+        maple::TablePipeline tables;
+
+        Pipeline(SwitchConnectionPtr conn, Maple::RuleStats& stats,
+                 std::vector<oxm::type> stages, uint8_t table, uint64_t cookie)
+            : sender(std::move(conn), stats)
+            , tables(std::move(stages), table, cookie, sender)
+        { }
+    };
+
+    // Fields classified by tables before the rules, none for one table
+    std::vector<oxm::type> pipeline_stages;
+    std::unordered_map<uint64_t, std::unique_ptr<Pipeline>> pipelines;
+
+    maple::TablePipeline* pipeline(uint64_t dpid)
+    {
+        auto it = pipelines.find(dpid);
+        return it != pipelines.end() ? &it->second->tables : nullptr;
+    }
+
+    // Pipelines send what changed on barrier(), so rules and barrier
+    // rules added by one augment go out together
+    void commit()
+    {
+        for (auto& p : pipelines)
+            p.second->tables.commit();
+    }
+
     static FlowImplPtr flow_cast(maple::FlowPtr flow)
     {
         FlowImplPtr ret
@@ -505,6 +898,107 @@ class MapleBackend : public maple::Backend {
         return std::move(result);
     }
 
+    // Switches a match with optional switch_id applies to
+    std::vector<uint64_t> switches_of(oxm::field_set const& match) const
+    {
+        std::vector<uint64_t> ret;
+        auto dpid = match.load(oxm::mask<>(of_switch_id));
+        if (dpid.wildcard()){
+            for (auto& conn : connections)
+                ret.push_back(conn.first);
+        } else {
+            auto tmp = bits<64>(dpid.value_bits());
+            if (connections.count(tmp.to_ullong()))
+                ret.push_back(tmp.to_ullong());
+        }
+        return ret;
+    }
+
+    // Sends a rule of `flow` unless the switch already has it
+    FlowImpl::Sent send_rule(FlowImplPtr const& flow, uint64_t dpid,
+                             uint16_t priority, oxm::field_set const& match)
+    {
+        if (auto tables = pipeline(dpid)) {
+            auto ret = flow->install(priority, match, connections[dpid], *tables);
+            if (ret == FlowImpl::Sent::Rule)
+                sent[dpid]++;
+            else if (ret == FlowImpl::Sent::Unchanged)
+                stats.duplicates_avoided++;
+            return ret;
+        }
+
+        auto& rules = installed[dpid];
+        auto it = rules.emplace(RuleKey{priority, match}, ShadowRule{}).first;
+        auto& rule = it->second;
+
+        auto ret = flow->install(priority, match, connections[dpid], rule.image);
+        switch (ret) {
+        case FlowImpl::Sent::Rule:
+            rule.cookie = flow->cookie();
+            rule.flow = flow;
+            stats.rules_sent++;
+            sent[dpid]++;
+            break;
+        case FlowImpl::Sent::Unchanged:
+            stats.duplicates_avoided++;
+            break;
+        case FlowImpl::Sent::Nothing:
+            if (rule.image.empty())
+                rules.erase(it);
+            break;
+        }
+        return ret;
+    }
+
+    template<class Pred>
+    void forget_rules(uint64_t dpid, Pred pred)
+    {
+        auto& rules = installed[dpid];
+        for (auto it = rules.begin(); it != rules.end(); ) {
+            if (pred(it->first, it->second.cookie))
+                it = rules.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    void delete_strict(unsigned priority,
+                       oxm::field_set const& _match,
+                       uint64_t cookie, uint64_t cookie_mask)
+    {
+        auto match = _match;
+        match.erase(oxm::mask<>(of_switch_id));
+
+        OFEncoder::FlowModParams fm;
+        fm.command = of13::OFPFC_DELETE_STRICT;
+
+        fm.table_id = table;
+        fm.cookie = cookie;
+        fm.cookie_mask = cookie_mask;
+        fm.priority = priority;
+
+        auto enc = OFEncoder::scratch();
+        enc.begin_flow_mod(fm, match);
+        enc.end_message();
+
+        for (uint64_t dpid : switches_of(_match)) {
+            if (auto tables = pipeline(dpid)) {
+                tables->remove_if([&](uint16_t prio, const oxm::field_set& rule,
+                                      uint64_t rule_cookie) {
+                    return prio == priority && rule == match &&
+                           (rule_cookie & cookie_mask) == cookie;
+                });
+                continue;
+            }
+            connections[dpid]->send(enc.data(), enc.size());
+
+            auto& rules = installed[dpid];
+            auto it = rules.find(RuleKey{uint16_t(priority), match});
+            if (it != rules.end() && (it->second.cookie & cookie_mask) == cookie)
+                rules.erase(it);
+        }
+    }
+
 public:
     explicit MapleBackend(uint8_t table)
         : table(table), miss{new FlowImpl(table) }
@@ -513,13 +1007,58 @@ public:
                     [](Packet&, FlowPtr){return false;} )); // TODO: unhardcode
     }
 
+    // Rules go to a pipeline of tables classifying by `stages` first
+    void use_pipeline(std::vector<oxm::type> stages)
+    {
+        pipeline_stages = std::move(stages);
+    }
+
+    bool owns_table(uint8_t id) const
+    {
+        return id >= table && id <= table + pipeline_stages.size();
+    }
+
     void add_switch(SwitchConnectionPtr conn)
     {
         connections.emplace(conn->dpid(), conn);
+        // The table of a reconnected switch isn't known
+        installed.erase(conn->dpid());
+
+        if (pipeline_stages.empty())
+            return;
+        auto& p = pipelines[conn->dpid()];
+        if (not p) {
+            p.reset(new Pipeline(conn, stats, pipeline_stages, table,
+                                 miss->cookie()));
+        } else {
+            p->sender.conn = conn;
+            p->tables.reset();
+        }
+        p->tables.commit();
     }
 
     uint64_t miss_cookie() const { return miss->cookie(); }
 
+    // Sends a barrier request Maple waits on and returns its xid,
+    // plain barriers are sent if unset
+    std::function<uint32_t(SwitchConnectionPtr)> barrier_request;
+
+    // Xid of the last barrier sent to every switch since the last call
+    std::unordered_map<uint64_t, uint32_t> take_barriers()
+    {
+        std::unordered_map<uint64_t, uint32_t> ret;
+        std::swap(ret, barriers);
+        return ret;
+    }
+
+    // Count of rules sent to every switch since the last call
+    std::unordered_map<uint64_t, size_t> take_sent()
+    {
+        std::unordered_map<uint64_t, size_t> ret;
+        std::swap(ret, sent);
+        return ret;
+    }
+
     virtual void install(unsigned priority,
                          oxm::expirementer::full_field_set const& _matchs,
                          maple::FlowPtr flow_) override
@@ -537,13 +1076,13 @@ public:
                 DVLOG(20) << "Installing prio=" << priority
                          << ", match={" << match << "}"
                          << " => cookie = " << std::setbase(16) << flow->cookie() << " on switch " << dpid;
-                flow->install(priority, match, connections[dpid]);
+                send_rule(flow, dpid, priority, match);
             }
         }
     }
 
     virtual void barrier_rule(unsigned priority,
-                              oxm::expirementer::full_field_set const& match,
+                              oxm::expirementer::full_field_set const& _matchs,
                               oxm::field<> const& test,
                               uint64_t id)
     {
@@ -552,56 +1091,61 @@ public:
             test_type.id () == of_switch_id.id()){
             return;
         }
-        size_t hash;
-        std::stringstream tmp;
-        tmp << "match={" << match << "}"
-            << "prio="<<priority;
-        std::string tmp_str = tmp.str();
-        std::hash<std::string> tmp_hash;
-        hash = tmp_hash(tmp_str);
 
-        // id for same rule with different switches
-        std::pair<uint64_t, size_t> full_id = {id, hash};
-        auto it = miss_rules.find(full_id);
-        if (it == miss_rules.end()){
-            DVLOG(20) << "barrier rule install"
-                         << " match={" << match << "} "
-                         << "prio=" << priority;
-            miss_rules.insert(full_id);
-            miss->installTrigger = true;
-            install(priority, match, miss);
-            miss->installTrigger = false;
+        std::set<uint64_t> switches = compute_switches(_matchs, miss);
+        auto matchs = _matchs;
+        matchs.erase(oxm::mask<>(of_switch_id));
+
+        miss->installTrigger = true;
+        for (uint64_t dpid : switches){
+            for (auto& match : matchs.included().fields()){
+                DVLOG(20) << "barrier rule install"
+                          << " match={" << match << "} "
+                          << "prio=" << priority << " on switch " << dpid;
+                if (send_rule(miss, dpid, priority, match) == FlowImpl::Sent::Rule)
+                    stats.barrier_rules++;
+            }
         }
+        miss->installTrigger = false;
     }
 
     void remove(oxm::field_set const& _match) override
     {
         DVLOG(20) << "Removing flows matching {" << _match << "}" << " on switch ";
 
-        // clear cache of muss_rules
-        miss_rules.clear();
-
         auto match = _match;
         match.erase(oxm::mask<>(of_switch_id));
 
-        of13::FlowMod fm;
-        fm.command(of13::OFPFC_DELETE);
-
-        fm.table_id(table);
-        fm.cookie(Flow::cookie_space().first);
-        fm.cookie_mask(Flow::cookie_space().second);
-        fm.match(make_of_match(match));
-
-        fm.out_port(of13::OFPP_ANY);
-        fm.out_group(of13::OFPG_ANY);
-
-        auto dpid = _match.load(oxm::mask<>(of_switch_id));
-        if (dpid.wildcard()){
-            for (auto& conn : connections)
-                conn.second->send(fm);
-        } else {
-            auto tmp = bits<64>(dpid.value_bits());
-            connections[tmp.to_ullong()]->send(fm);
+        OFEncoder::FlowModParams fm;
+        fm.command = of13::OFPFC_DELETE;
+
+        fm.table_id = table;
+        fm.cookie = Flow::cookie_space().first;
+        fm.cookie_mask = Flow::cookie_space().second;
+
+        auto enc = OFEncoder::scratch();
+        enc.begin_flow_mod(fm, match);
+        enc.end_message();
+
+        // Non-strict delete takes rules at least as specific
+        auto covered = [&match](const oxm::field_set& rule) {
+            return std::all_of(match.begin(), match.end(),
+                [&rule](const oxm::field<>& f) {
+                    return rule.load(oxm::mask<>(f)) == f;
+                });
+        };
+
+        for (uint64_t dpid : switches_of(_match)) {
+            if (auto tables = pipeline(dpid)) {
+                tables->remove_if([&](uint16_t, const oxm::field_set& rule, uint64_t) {
+                    return covered(rule);
+                });
+                continue;
+            }
+            connections[dpid]->send(enc.data(), enc.size());
+            forget_rules(dpid, [&covered](const RuleKey& rule, uint64_t) {
+                return covered(rule.match);
+            });
         }
     }
 
@@ -611,32 +1155,45 @@ public:
         DVLOG(20) << "Removing flows matching prio=" << priority
                   << " with " << _match;
 
-        // clear cache of muss_rules
-        miss_rules.clear();
+        delete_strict(priority, _match,
+                      Flow::cookie_space().first, Flow::cookie_space().second);
+    }
 
-        auto match = _match;
-        match.erase(oxm::mask<>(of_switch_id));
+    // Adds the rule at the new priority, then deletes the old one
+    void move(unsigned from, unsigned to,
+              oxm::expirementer::full_field_set const& match,
+              maple::FlowPtr flow_) override
+    {
+        auto flow = flow_cast(flow_);
+        DVLOG(20) << "Moving flow with cookie=" << flow->cookie()
+                  << " from prio=" << from << " to prio=" << to;
 
-        of13::FlowMod fm;
-        fm.command(of13::OFPFC_DELETE_STRICT);
+        if (flow->state() == Flow::State::Active) {
+            flow->installTrigger = true;
+            install(to, match, flow);
+            flow->installTrigger = false;
+        }
+        moved[flow->cookie()] = to;
 
-        fm.table_id(table);
-        fm.cookie(Flow::cookie_space().first);
-        fm.cookie_mask(Flow::cookie_space().second);
-        fm.match(make_of_match(match));
-        fm.priority(priority);
+        for (auto& fields : match.included().fields())
+            delete_strict(from, fields, flow->cookie(), uint64_t(-1));
+    }
 
-        fm.out_port(of13::OFPP_ANY);
-        fm.out_group(of13::OFPG_ANY);
+    // Flow-removed is about a priority the flow moved from
+    bool moved_from(uint64_t cookie, uint16_t priority) const
+    {
+        auto it = moved.find(cookie);
+        return it != moved.end() && it->second != priority;
+    }
 
-        auto dpid = _match.load(oxm::mask<>(of_switch_id));
-        if (dpid.wildcard()){
-            for (auto& conn : connections)
-                conn.second->send(fm);
-        } else {
-            auto tmp = bits<64>(dpid.value_bits());
-            connections[tmp.to_ullong()]->send(fm);
-        }
+    void forget(uint64_t cookie)
+    {
+        moved.erase(cookie);
+    }
+
+    void forget()
+    {
+        moved.clear();
     }
 
     void remove(maple::FlowPtr flow_) override
@@ -644,29 +1201,123 @@ public:
         auto flow = flow_cast(flow_);
         DVLOG(20) << "Removing flow with cookie=" << flow->cookie();
 
-        //clear cache of miss rule
-        //TODO : maybe uneccessary
-        miss_rules.clear();
-
-        of13::FlowMod fm;
-        fm.command(of13::OFPFC_DELETE);
+        OFEncoder::FlowModParams fm;
+        fm.command = of13::OFPFC_DELETE;
 
-        fm.table_id(table);
-        fm.cookie(flow->cookie());
-        fm.cookie_mask(uint64_t(-1));
+        fm.table_id = table;
+        fm.cookie = flow->cookie();
+        fm.cookie_mask = uint64_t(-1);
 
-        fm.out_port(of13::OFPP_ANY);
-        fm.out_group(of13::OFPG_ANY);
+        auto enc = OFEncoder::scratch();
+        enc.begin_flow_mod(fm, oxm::field_set{});
+        enc.end_message();
 
         for (auto conn : connections){
-            conn.second->send(fm);
+            if (auto tables = pipeline(conn.first)) {
+                tables->remove_if([&flow](uint16_t, const oxm::field_set&,
+                                          uint64_t cookie) {
+                    return cookie == flow->cookie();
+                });
+                continue;
+            }
+            conn.second->send(enc.data(), enc.size());
+            forget_rules(conn.first, [&flow](const RuleKey&, uint64_t cookie) {
+                return cookie == flow->cookie();
+            });
         }
     }
 
+    // Switch deleted a rule on its own or reported a deletion
+    void flow_removed(uint64_t dpid, uint64_t cookie, uint16_t priority)
+    {
+        if (auto tables = pipeline(dpid))
+            tables->lost(cookie);
+        forget_rules(dpid, [=](const RuleKey& rule, uint64_t rule_cookie) {
+            return rule_cookie == cookie && rule.priority == priority;
+        });
+    }
+
+    // A packet missed rules of the flow on the switch, the shadow
+    // table is wrong about them
+    void lost(uint64_t dpid, uint64_t cookie)
+    {
+        if (auto tables = pipeline(dpid))
+            tables->lost(cookie);
+        forget_rules(dpid, [=](const RuleKey&, uint64_t rule_cookie) {
+            return rule_cookie == cookie;
+        });
+    }
+
+    // `describe` gives actions of a flow by cookie for pipeline entries
+    template<class Describe>
+    std::vector<Maple::ShadowRule> shadow_table(uint64_t dpid,
+                                                Describe describe) const
+    {
+        std::vector<Maple::ShadowRule> ret;
+        auto p = pipelines.find(dpid);
+        if (p != pipelines.end()) {
+            for (auto& e : p->second->tables.entries()) {
+                std::ostringstream match, actions;
+                match << "table=" << int(e.table);
+                if (not e.match.empty())
+                    match << " && " << e.match;
+                if (e.program.empty())
+                    actions << "metadata:" << e.metadata
+                            << " goto:" << int(e.table + 1);
+                else
+                    actions << describe(e.cookie);
+                ret.push_back(Maple::ShadowRule{
+                    e.priority, match.str(), e.cookie, actions.str()
+                });
+            }
+            return ret;
+        }
+
+        auto rules = installed.find(dpid);
+        if (rules == installed.end())
+            return ret;
+
+        for (auto& rule : rules->second) {
+            std::ostringstream match;
+            match << rule.first.match;
+            auto flow = rule.second.flow.lock();
+            ret.push_back(Maple::ShadowRule{
+                rule.first.priority,
+                match.str(),
+                rule.second.cookie,
+                flow ? flow->describe() : std::string()
+            });
+        }
+        std::sort(ret.begin(), ret.end(),
+            [](const Maple::ShadowRule& lhs, const Maple::ShadowRule& rhs) {
+                return lhs.priority > rhs.priority;
+            });
+        return ret;
+    }
+
+    Maple::RuleStats rule_stats() const
+    {
+        Maple::RuleStats ret = stats;
+        ret.installed = 0;
+        for (auto& rules : installed)
+            ret.installed += rules.second.size();
+        for (auto& p : pipelines)
+            ret.installed += p.second->tables.stats().entries;
+        return ret;
+    }
+
     void barrier() override
     {
+        commit();
+        if (barrier_request) {
+            for (auto& conn : connections)
+                barriers[conn.first] = barrier_request(conn.second);
+            return;
+        }
+        auto enc = OFEncoder::scratch();
+        enc.barrier_request();
         for (auto conn : connections){
-            conn.second->send(of13::BarrierRequest());
+            conn.second->send(enc.data(), enc.size());
         }
     }
 };
@@ -682,11 +1333,39 @@ struct runos::MapleImpl {
     MapleBackend backend;
     maple::Runtime<DecisionImpl, FlowImpl> runtime;
     PacketMissPipeline pipeline;
+    std::vector<LatencyStats::Stage> handler_stages; // of the pipeline
     std::unordered_map<uint64_t, FlowImplPtr> flows;
     uint8_t handler_table;
 
     std::unordered_map<std::string, PacketMissHandler> handlers;
 
+    std::chrono::seconds flow_grace {300};
+    Maple::GcStats gc_stats;
+
+    Controller* ctrl {nullptr};
+
+    // Packet-in held until rules of its flow are confirmed
+    struct Parked {
+        SwitchConnectionPtr conn;
+        uint32_t buffer_id;
+        uint32_t in_port;
+        std::string data; // if not buffered
+    };
+
+    // Flow whose rules were sent and not confirmed by a barrier yet
+    struct Pending {
+        FlowImplPtr flow;
+        std::unordered_map<uint64_t, size_t> switches; // rules sent to each
+        std::vector<Parked> parked;
+    };
+
+    static constexpr size_t max_parked = 256; // per flow
+    static constexpr std::chrono::milliseconds barrier_timeout {2000};
+
+    std::unordered_map<uint64_t, Pending> pending; // by cookie
+    std::unordered_map<uint32_t, uint64_t> awaited; // cookies by barrier xid
+    Maple::CoalescingStats coalescing;
+
     MapleImpl(Maple& maple,
               uint8_t handler_table=0)
         : app(maple)
@@ -697,6 +1376,7 @@ struct runos::MapleImpl {
 
     void createSwitchScope(SwitchConnectionPtr conn)
     {
+        auto lock = runtime.write_lock();
         backend.add_switch(conn);
     }
 
@@ -704,7 +1384,9 @@ struct runos::MapleImpl {
     DecisionImpl process(Packet& pkt, FlowImplPtr flow) const
     {
         DecisionImpl ret = DecisionImpl{};
-        for (auto& handler: pipeline) {
+        for (size_t i = 0; i < pipeline.size(); ++i) {
+            auto& handler = pipeline[i];
+            LatencyScope handling {handler_stages[i]};
             try {
                 ret = (DecisionImpl&&)(handler.second(pkt, flow, ret));
                 if (ret.base().return_)
@@ -717,6 +1399,13 @@ struct runos::MapleImpl {
         return ret;
     }
 
+    // Rules of live flows and barrier rules are not re-sent on reconnect
+    bool owns(uint64_t cookie) const
+    {
+        auto lock = runtime.read_lock();
+        return cookie == backend.miss_cookie() || flows.count(cookie) != 0;
+    }
+
     bool isTableMiss(of13::PacketIn& pi) const
     {
         if (pi.reason() == of13::OFPR_NO_MATCH)
@@ -728,27 +1417,77 @@ struct runos::MapleImpl {
     }
 
     void processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connection);
-    void processFlowRemoved(of13::FlowRemoved& fr);
+    void processMiss(of13::PacketIn& pi, SwitchConnectionPtr connection,
+                     PacketParser& pkt,
+                     std::shared_ptr<FlowImpl> flow,
+                     std::shared_ptr<FlowImpl> preprocessed);
+    void processFlowRemoved(of13::FlowRemoved& fr, uint64_t dpid);
+    void collectGarbage();
+
+    void activate(FlowImplPtr flow);
+    bool park(of13::PacketIn& pi, SwitchConnectionPtr connection, uint64_t cookie);
+    uint32_t barrier(SwitchConnectionPtr conn);
+    void confirmed(uint32_t xid, uint64_t dpid);
 };
 
+/*
+ * Packet-ins arrive on every controller worker thread.
+ * Parsing, trace tree lookup and inspect handlers run concurrently
+ * without locks, reading the trace tree and inspect handlers of flows
+ * published through Epoch; only packets which change flow state or
+ * the trace tree take the write lock.
+ */
 void MapleImpl::processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connection)
 {
     DVLOG(10) << "Packet-in on switch " << connection->dpid()
               << (isTableMiss(pi) ? " (miss)" : " (inspect)");
 
+    LatencyScope processing {stages.packet_in};
+
     // Serializes to/from raw buffer
+    LatencyScope parsing {stages.parse};
     PacketParser pkt { pi, connection->dpid() };
-    // Find flow in the trace tree
-    std::shared_ptr<FlowImpl> flow = runtime(pkt);
+    parsing.stop();
+
+    std::shared_ptr<FlowImpl> preprocessed;
+    std::optional<LatencyScope> waiting;
+    LatencyScope looking {stages.lookup};
+    runtime.dispatch(pkt, [&](std::shared_ptr<FlowImpl> flow) {
+        looking.stop();
+        if (flow != nullptr) {
+            if (flow->inspect(pkt, flow))
+                return true;
+            preprocessed = flow;
+        }
+        waiting.emplace(stages.write_lock);
+        return false;
+    }, [&](std::shared_ptr<FlowImpl> flow) {
+        waiting->stop();
+        processMiss(pi, connection, pkt, std::move(flow), preprocessed);
+    });
+}
 
-    DVLOG(30) << "flow cookie is : " << std::setbase(16)
-              << flow->cookie() << " packet cookie : " << pi.cookie();
+// The rest of a packet-in, with the write lock held. `flow` is found
+// in the trace tree under the lock, `preprocessed` was found before it.
+void MapleImpl::processMiss(of13::PacketIn& pi, SwitchConnectionPtr connection,
+                            PacketParser& pkt,
+                            std::shared_ptr<FlowImpl> flow,
+                            std::shared_ptr<FlowImpl> preprocessed)
+{
     // Delete flow if it doesn't found or expired
     if (flow == nullptr || flow->state() == Flow::State::Expired) {
         flow = std::make_shared<FlowImpl>(handler_table);
         flows[flow->cookie()] = flow;
     }
-    if (flow->preprocess(pkt, flow)){
+    DVLOG(30) << "flow cookie is : " << std::setbase(16)
+              << flow->cookie() << " packet cookie : " << pi.cookie();
+
+    if (flow != preprocessed && flow->preprocess(pkt, flow)){
+        return;
+    }
+    // Missed rules which are being installed
+    if (flow->state() == Flow::State::Active && isTableMiss(pi) &&
+        park(pi, connection, flow->cookie())) {
         return;
     }
     flow->packet_in(pi, connection);
@@ -762,6 +1501,8 @@ void MapleImpl::processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connecti
         {
             ModTrackingPacket mpkt {pkt};
             maple::Installer installer;
+            auto relabels = runtime.relabeling().runs;
+            LatencyScope augmenting {stages.augment};
             try{
                 std::tie(flow, installer) = runtime.augment(mpkt, flow);
             } catch (maple::priority_exceeded& e){
@@ -779,9 +1520,15 @@ void MapleImpl::processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connecti
                 }
                     LOG(INFO) << "Updating trace tree succesful";
             }
+            augmenting.stop();
+            auto relabeling = runtime.relabeling();
+            if (relabeling.runs != relabels) {
+                VLOG(10) << "Relabeled trace tree, "
+                         << relabeling.last_rules << " rules moved";
+            }
             flow->mods( std::move(mpkt.mods()) );
             flow->installer(installer);
-            flow->activate(); // this is needed way to install flow
+            activate(flow); // this is needed way to install flow
         }
         break;
 
@@ -799,7 +1546,8 @@ void MapleImpl::processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connecti
             if (not isTableMiss(pi)){
                 flow->decision(process(pkt, flow));
             } else {
-                flow->activate();
+                backend.lost(connection->dpid(), flow->cookie());
+                activate(flow);
             }
             // Maybe this packet arrived on switch when maple reload table, but may be from remowed flows
             // TODO: implement FSM of flow
@@ -809,25 +1557,199 @@ void MapleImpl::processPacketIn(of13::PacketIn& pi, SwitchConnectionPtr connecti
     }
 }
 
-void MapleImpl::processFlowRemoved(of13::FlowRemoved& fr)
+/*
+ * Until the switch has the rules of a new flow, its packets keep
+ * missing them. Such misses are parked instead of installing the flow
+ * again and sent out when a barrier confirms the rules.
+ */
+void MapleImpl::activate(FlowImplPtr flow)
+{
+    backend.take_sent();
+    backend.take_barriers();
+    {
+        LatencyScope activating {stages.activate};
+        flow->activate();
+    }
+
+    auto sent = backend.take_sent();
+    auto barriers = backend.take_barriers();
+    if (sent.empty() || not ctrl)
+        return;
+
+    uint64_t cookie = flow->cookie();
+    auto& p = pending[cookie];
+    p.flow = flow;
+    for (auto& sw : sent) {
+        // the installer's last barrier follows the rules
+        auto barrier = barriers.find(sw.first);
+        if (barrier == barriers.end())
+            continue;
+        p.switches[sw.first] += sw.second;
+        awaited[barrier->second] = cookie;
+    }
+    if (p.switches.empty())
+        pending.erase(cookie);
+}
+
+bool MapleImpl::park(of13::PacketIn& pi, SwitchConnectionPtr connection,
+                     uint64_t cookie)
+{
+    auto it = pending.find(cookie);
+    if (it == pending.end())
+        return false;
+    auto sw = it->second.switches.find(connection->dpid());
+    if (sw == it->second.switches.end())
+        return false;
+
+    auto& parked = it->second.parked;
+    if (parked.size() < max_parked) {
+        std::string data;
+        if (pi.buffer_id() == OFP_NO_BUFFER)
+            data.assign(static_cast<const char*>(pi.data()), pi.data_len());
+        parked.push_back(Parked{connection, pi.buffer_id(),
+                                pi.match().in_port()->value(),
+                                std::move(data)});
+        coalescing.parked++;
+    } else {
+        coalescing.dropped++;
+    }
+    coalescing.activations_avoided++;
+    coalescing.flow_mods_avoided += sw->second;
+    return true;
+}
+
+// Barriers of the backend, whose answers confirm rules sent before
+uint32_t MapleImpl::barrier(SwitchConnectionPtr conn)
+{
+    uint64_t dpid = conn->dpid();
+    OFSessionHandlers handlers;
+    handlers.response = [this, dpid](SwitchConnectionPtr,
+                                     std::shared_ptr<OFMsgUnion> reply) {
+        confirmed(reply->base()->xid(), dpid);
+    };
+    // Parked packets are sent out anyway
+    handlers.error = handlers.response;
+    handlers.timeout = [this, dpid](SwitchConnectionPtr, uint32_t xid) {
+        confirmed(xid, dpid);
+    };
+    of13::BarrierRequest br;
+    return ctrl->request(conn, br, std::move(handlers), barrier_timeout);
+}
+
+void MapleImpl::confirmed(uint32_t xid, uint64_t dpid)
+{
+    auto lock = runtime.write_lock();
+    auto waiting = awaited.find(xid);
+    if (waiting == awaited.end())
+        return;
+    uint64_t cookie = waiting->second;
+    awaited.erase(waiting);
+
+    auto it = pending.find(cookie);
+    if (it == pending.end())
+        return;
+    auto& p = it->second;
+    p.switches.erase(dpid);
+
+    auto released = std::stable_partition(p.parked.begin(), p.parked.end(),
+        [dpid](const Parked& packet) {
+            return packet.conn->dpid() != dpid;
+        });
+    for (auto packet = released; packet != p.parked.end(); ++packet) {
+        p.flow->release(packet->conn, packet->buffer_id,
+                        packet->in_port, packet->data);
+        coalescing.released++;
+    }
+    p.parked.erase(released, p.parked.end());
+
+    if (p.switches.empty())
+        pending.erase(it);
+}
+
+void MapleImpl::processFlowRemoved(of13::FlowRemoved& fr, uint64_t dpid)
 {
+    auto lock = runtime.write_lock();
+    backend.flow_removed(dpid, fr.cookie(), fr.priority());
+
     auto it = flows.find( fr.cookie() );
     if (it == flows.end())
         return;
     auto flow = it->second;
 
+    // The rule was deleted after its copy was added at another priority
+    if (fr.reason() == of13::OFPRR_DELETE &&
+        backend.moved_from(fr.cookie(), fr.priority()))
+        return;
+
     flow->flow_removed(fr);
-    if (flow->state() == Flow::State::Expired)
+    if (flow->state() == Flow::State::Expired) {
+        backend.forget(fr.cookie());
         flows.erase(it);
+    }
 }
 
+/*
+ * Flows idle or evicted for longer than the grace period are dropped,
+ * which leaves their trace tree paths dead; the tree is pruned right
+ * after. Packets of a dropped flow are handled as new ones.
+ */
+void MapleImpl::collectGarbage()
+{
+    auto lock = runtime.write_lock();
+    auto start = std::chrono::steady_clock::now();
+
+    size_t dropped = 0;
+    for (auto it = flows.begin(); it != flows.end(); ) {
+        if (it->second->stale(start, flow_grace)) {
+            backend.forget(it->first);
+            it = flows.erase(it);
+            ++dropped;
+        } else {
+            ++it;
+        }
+    }
+
+    auto collected = runtime.gc();
+    auto size = runtime.size();
+
+    auto& stats = gc_stats;
+    stats.runs++;
+    stats.flows += dropped;
+    stats.leaves += collected.leaves;
+    stats.tests += collected.tests;
+    stats.cases += collected.cases;
+    stats.bytes += collected.bytes;
+    stats.last_bytes = collected.bytes;
+    stats.nodes = size.nodes;
+    stats.tree_bytes = size.bytes;
+    stats.live_flows = flows.size();
+    stats.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    VLOG(10) << "Maple GC: " << dropped << " flows, "
+             << collected.leaves << " leaves, " << collected.tests << " tests, "
+             << collected.cases << " cases, " << collected.bytes << " bytes reclaimed; "
+             << size.nodes << " nodes, " << size.bytes << " bytes left";
+}
 
 void Maple::init(Loader* loader, const Config& root_config)
 {
     auto ctrl = Controller::get(loader);
-    uint8_t handler_table = ctrl->getTable("maple");
+    auto config = config_cd(root_config, "maple");
+    // The multi-table backend classifies packets by "stages" fields in
+    // tables after the Maple one, up to maple + stages, then applies rules
+    std::vector<oxm::type> stage_fields;
+    if (config_get(config, "backend", "single-table") == "multi-table") {
+        for (const auto& name : config["stages"].array_items())
+            stage_fields.push_back(pipeline_stage(name.string_value()));
+    }
+    uint8_t handler_table = ctrl->reserveTables("maple", stage_fields.size() + 1);
     impl.reset(new MapleImpl(*this, handler_table));
-    impl->config = config_cd(root_config, "maple");
+    impl->config = config;
+    impl->ctrl = ctrl;
+    impl->backend.barrier_request = std::bind(&MapleImpl::barrier, impl.get(), _1);
+    if (not stage_fields.empty())
+        impl->backend.use_pipeline(std::move(stage_fields));
     ctrl->registerHandler<of13::PacketIn>(
             [=](of13::PacketIn &pi, SwitchConnectionPtr conn){
                 //TODO : create a copy of packetIn
@@ -835,7 +1757,11 @@ void Maple::init(Loader* loader, const Config& root_config)
             });
     ctrl->registerHandler<of13::FlowRemoved>(
             [=](of13::FlowRemoved &fr, SwitchConnectionPtr conn){
-                impl->processFlowRemoved(fr);
+                impl->processFlowRemoved(fr, conn->dpid());
+            });
+    ctrl->registerFlowKeeper(
+            [=](uint64_t, uint8_t table, uint64_t cookie) {
+                return impl->backend.owns_table(table) && impl->owns(cookie);
             });
     QObject::connect(ctrl, &Controller::switchUp, this, &Maple::onSwitchUp);
 }
@@ -856,12 +1782,85 @@ void Maple::startUp(Loader*)
         // TODO: warn if doesn't exists
         auto name = name_token.string_value();
         impl->pipeline.emplace_back(name, impl->handlers.at(name));
+        impl->handler_stages.push_back(LatencyStats::stage("maple.handler." + name));
     }
     // TODO: print unused handlers
 
+    impl->flow_grace = std::chrono::seconds(config_get(config, "flow-grace", 300));
+    int gc_interval = config_get(config, "gc-interval", 60);
+    impl->gc_stats.interval = std::chrono::seconds(gc_interval);
+    if (gc_interval > 0)
+        startTimer(gc_interval * 1000);
+
     impl->started = true;
 }
 
+void Maple::timerEvent(QTimerEvent*)
+{
+    impl->collectGarbage();
+}
+
+Maple::GcStats Maple::gc()
+{
+    impl->collectGarbage();
+    return gcStats();
+}
+
+Maple::CoalescingStats Maple::coalescingStats() const
+{
+    auto lock = impl->runtime.read_lock();
+    auto ret = impl->coalescing;
+    ret.pending = impl->pending.size();
+    return ret;
+}
+
+Maple::GcStats Maple::gcStats() const
+{
+    auto lock = impl->runtime.read_lock();
+    return impl->gc_stats;
+}
+
+void Maple::invalidateTraceTree()
+{
+    auto lock = impl->runtime.write_lock();
+    impl->runtime.invalidate();
+    impl->backend.remove(oxm::field_set{});
+    impl->backend.barrier();
+    impl->backend.forget();
+    impl->flows.clear();
+}
+
+Maple::Eviction Maple::invalidate(oxm::field<> f)
+{
+    auto lock = impl->runtime.write_lock();
+    auto evicted = impl->runtime.invalidate(f);
+    for (auto& flow : evicted.flows) {
+        auto cookie = std::static_pointer_cast<FlowImpl>(flow)->cookie();
+        impl->backend.forget(cookie);
+        impl->flows.erase(cookie);
+    }
+
+    VLOG(10) << "Invalidated " << f << ": " << evicted.paths << " paths, "
+             << evicted.flows.size() << " flows";
+    return Eviction{evicted.paths, evicted.flows.size()};
+}
+
+Maple::RuleStats Maple::ruleStats() const
+{
+    auto lock = impl->runtime.read_lock();
+    return impl->backend.rule_stats();
+}
+
+std::vector<Maple::ShadowRule> Maple::shadowTable(uint64_t dpid) const
+{
+    auto lock = impl->runtime.read_lock();
+    return impl->backend.shadow_table(dpid, [this](uint64_t cookie) {
+        auto it = impl->flows.find(cookie);
+        return it != impl->flows.end() ? it->second->describe()
+                                       : std::string();
+    });
+}
+
 void Maple::onSwitchUp(SwitchConnectionPtr conn, of13::FeaturesReply fr)
 {
     impl->createSwitchScope(conn);
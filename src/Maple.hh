@@ -15,10 +15,15 @@
  */
 
 #pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+
 #include "Application.hh"
 #include "Loader.hh"
 #include "Controller.hh"
 #include "Common.hh"
+#include "oxm/field.hh"
 
 namespace runos {
 
@@ -30,6 +35,10 @@ public:
     /**
     * Registers new message handler for each worker thread.
     * Used for performance-critical message processing, such as packet-in's.
+    *
+    * Pipeline handlers are called one at a time while the trace tree is
+    * augmented. Inspect handlers of installed flows may be called
+    * concurrently from several worker threads.
     */
     void registerHandler(const char* name, PacketMissHandler factory);
 
@@ -43,10 +52,87 @@ public:
       */
     void invalidateTraceTree();
 
+    struct Eviction {
+        size_t paths; ///< trace tree paths dropped
+        size_t flows; ///< flows whose rules were removed from switches
+    };
+
+    /**
+     * Forgets decisions made for packets with a value of `f`
+     * (e.g. `oxm::switch_id() == dpid`), other flows stay installed.
+     */
+    Eviction invalidate(oxm::field<> f);
+
+    struct RuleStats {
+        uint64_t rules_sent = 0;         ///< flow-mods sent, barrier rules too
+        uint64_t barrier_rules = 0;      ///< barrier rules sent
+        uint64_t duplicates_avoided = 0; ///< not sent, already installed
+        size_t installed = 0;            ///< rules known on all switches
+    };
+
+    RuleStats ruleStats() const;
+
+    /**
+     * Rule of the Maple table as the controller believes it is installed.
+     * With the multi-table backend, entry of a table named in `match`.
+     */
+    struct ShadowRule {
+        uint16_t priority;
+        std::string match;
+        uint64_t cookie;
+        std::string actions; ///< empty if the flow is gone
+    };
+
+    /**
+     * Shadow copy of the Maple table of a switch, highest priority first.
+     * Rules are sent only when they differ from it.
+     */
+    std::vector<ShadowRule> shadowTable(uint64_t dpid) const;
+
+    struct GcStats {
+        uint64_t runs = 0;
+        uint64_t flows = 0;      ///< idle or evicted flows dropped
+        uint64_t leaves = 0;     ///< trace tree leaves of dropped flows
+        uint64_t tests = 0;      ///< test nodes left with nothing to test
+        uint64_t cases = 0;      ///< load cases left empty
+        uint64_t bytes = 0;      ///< reclaimed by all runs, approximate
+        uint64_t last_bytes = 0; ///< reclaimed by the last run
+        size_t nodes = 0;        ///< trace tree nodes after the last run
+        size_t tree_bytes = 0;   ///< trace tree size after the last run
+        size_t live_flows = 0;
+        std::chrono::seconds interval {0};      ///< between runs, 0 if off
+        std::chrono::microseconds elapsed {0};  ///< by the last run
+    };
+
+    /**
+     * Drops flows idle or evicted for longer than "flow-grace" seconds
+     * and prunes the trace tree. Done every "gc-interval" seconds.
+     */
+    GcStats gc();
+    GcStats gcStats() const;
+
+    /**
+     * Misses of a flow whose rules are sent but not confirmed by a
+     * barrier are held and sent out after it, instead of installing
+     * the flow again for each of them.
+     */
+    struct CoalescingStats {
+        uint64_t parked = 0;              ///< misses held
+        uint64_t released = 0;            ///< held packets sent out
+        uint64_t dropped = 0;             ///< misses over the per-flow limit
+        uint64_t activations_avoided = 0; ///< flow installs not repeated
+        uint64_t flow_mods_avoided = 0;   ///< rules not sent again
+        size_t pending = 0;               ///< flows awaiting barriers
+    };
+
+    CoalescingStats coalescingStats() const;
+
     ~Maple();
     void init(Loader *loader, const Config& config) override;
     void startUp(Loader *loader) override;
     void process(const of13::PacketIn &pi, SwitchConnectionPtr conn);
+protected:
+    void timerEvent(QTimerEvent*) override;
 public slots:
     void onSwitchUp(SwitchConnectionPtr conn, of13::FeaturesReply fr);
 private:
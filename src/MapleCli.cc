@@ -0,0 +1,65 @@
+#include "Maple.hh"
+
+#include "Common.hh"
+#include "CommandLine.hh"
+
+using namespace cli;
+using namespace runos;
+
+class MapleCli: public Application {
+SIMPLE_APPLICATION(MapleCli, "maple-cli")
+public:
+    void init(Loader* loader, const Config& config) override
+    {
+        auto app = Maple::get(loader);
+        auto cli = CommandLine::get(loader);
+        options::options_description desc;
+        desc.add_options()
+            ("dpid,d", options::value<uint64_t>(),
+             "Dpid of switch, its Maple table should be printed")
+            ("gc,g", "Collect garbage now");
+
+        auto cmd = [app](const options::variables_map& vm, Outside& out) {
+            auto stats = app->ruleStats();
+            out.print("Rules. Sent               : {}\n"
+                      "       Barrier rules      : {}\n"
+                      "       Duplicates avoided : {}\n"
+                      "       Installed          : {}\n",
+                      stats.rules_sent, stats.barrier_rules,
+                      stats.duplicates_avoided, stats.installed);
+
+            auto held = app->coalescingStats();
+            out.print("Misses. Parked              : {} ({} dropped)\n"
+                      "        Released            : {}\n"
+                      "        Activations avoided : {}\n"
+                      "        Flow-mods avoided   : {}\n"
+                      "        Pending flows       : {}\n",
+                      held.parked, held.dropped, held.released,
+                      held.activations_avoided, held.flow_mods_avoided,
+                      held.pending);
+
+            auto gc = vm["gc"].empty() ? app->gcStats() : app->gc();
+            out.print("GC.    Runs               : {}\n"
+                      "       Flows dropped      : {}\n"
+                      "       Nodes pruned       : {} leaves, {} tests, {} cases\n"
+                      "       Reclaimed          : {} bytes, {} by the last run\n"
+                      "       Trace tree         : {} nodes, {} bytes, {} flows\n",
+                      gc.runs, gc.flows, gc.leaves, gc.tests, gc.cases,
+                      gc.bytes, gc.last_bytes,
+                      gc.nodes, gc.tree_bytes, gc.live_flows);
+
+            auto dpid = vm["dpid"];
+            if (dpid.empty())
+                return;
+            for (auto& rule : app->shadowTable(dpid.as<uint64_t>())) {
+                out.print("prio={} cookie=0x{:x} match={{{}}} actions={}\n",
+                          rule.priority, rule.cookie, rule.match,
+                          rule.actions.empty() ? "?" : rule.actions);
+            }
+        };
+        cli->registerCommand("maple", std::move(desc), std::move(cmd),
+                             "Show Maple rules, as installed on a switch, and garbage collection");
+    }
+};
+
+REGISTER_APPLICATION(MapleCli, {"maple", "command-line-interface", ""})
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MapleRest.hh"
+
+#include <sstream>
+
+#include "RestListener.hh"
+
+REGISTER_APPLICATION(MapleRest, {"maple", "rest-listener", ""})
+
+using namespace runos;
+
+namespace {
+
+std::string hex(uint64_t value)
+{
+    std::ostringstream ret;
+    ret << "0x" << std::hex << value;
+    return ret.str();
+}
+
+json11::Json table_json(const std::vector<Maple::ShadowRule>& rules)
+{
+    json11::Json::array ret;
+    for (auto& rule : rules) {
+        ret.push_back(json11::Json::object {
+            {"priority", rule.priority},
+            {"match", rule.match},
+            {"cookie", hex(rule.cookie)},
+            {"actions", rule.actions}
+        });
+    }
+    return ret;
+}
+
+json11::Json rules_json(const Maple::RuleStats& stats)
+{
+    return json11::Json::object {
+        {"sent", json_counter(stats.rules_sent)},
+        {"barrier_rules", json_counter(stats.barrier_rules)},
+        {"duplicates_avoided", json_counter(stats.duplicates_avoided)},
+        {"installed", json_counter(stats.installed)}
+    };
+}
+
+json11::Json coalescing_json(const Maple::CoalescingStats& stats)
+{
+    return json11::Json::object {
+        {"parked", json_counter(stats.parked)},
+        {"released", json_counter(stats.released)},
+        {"dropped", json_counter(stats.dropped)},
+        {"activations_avoided", json_counter(stats.activations_avoided)},
+        {"flow_mods_avoided", json_counter(stats.flow_mods_avoided)},
+        {"pending", json_counter(stats.pending)}
+    };
+}
+
+json11::Json gc_json(const Maple::GcStats& stats)
+{
+    double interval = stats.interval.count();
+    return json11::Json::object {
+        {"runs", json_counter(stats.runs)},
+        {"flows", json_counter(stats.flows)},
+        {"leaves", json_counter(stats.leaves)},
+        {"tests", json_counter(stats.tests)},
+        {"cases", json_counter(stats.cases)},
+        {"reclaimed_bytes", json_counter(stats.bytes)},
+        {"last_reclaimed_bytes", json_counter(stats.last_bytes)},
+        {"reclaim_rate", interval > 0 ? stats.last_bytes / interval : 0.0},
+        {"nodes", json_counter(stats.nodes)},
+        {"tree_bytes", json_counter(stats.tree_bytes)},
+        {"live_flows", json_counter(stats.live_flows)},
+        {"interval_s", json_counter(stats.interval.count())},
+        {"elapsed_us", json_counter(stats.elapsed.count())}
+    };
+}
+
+}
+
+void MapleRest::init(Loader* loader, const Config&)
+{
+    maple = Maple::get(loader);
+
+    RestListener::get(loader)->registerRestHandler(this);
+    acceptPath(Method::GET, "table/[0-9]+");
+    acceptPath(Method::GET, "rules");
+    acceptPath(Method::GET, "gc");
+    acceptPath(Method::GET, "coalescing");
+}
+
+json11::Json MapleRest::handleGET(std::vector<std::string> params, std::string)
+{
+    if (params[0] == "table") {
+        return table_json(maple->shadowTable(std::stoull(params[1])));
+    }
+    if (params[0] == "rules") {
+        return rules_json(maple->ruleStats());
+    }
+    if (params[0] == "gc") {
+        return gc_json(maple->gcStats());
+    }
+    if (params[0] == "coalescing") {
+        return coalescing_json(maple->coalescingStats());
+    }
+    return json11::Json::object{
+        {"maple-rest", "incorrect request"}
+    };
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include "Common.hh"
+#include "Application.hh"
+#include "Loader.hh"
+#include "Maple.hh"
+#include "Rest.hh"
+#include "json11.hpp"
+
+/**
+ * REST access to Maple's view of the switches:
+ *  - GET table/<switch_id>: shadow copy of the Maple table of a switch,
+ *    compare it with GET /api/flow-manager/<switch_id>
+ *  - GET rules: counters of sent and avoided flow-mods
+ *  - GET gc: flows and trace tree nodes collected, reclaim rate in
+ *    bytes per second over the last interval
+ *  - GET coalescing: misses held until rules of their flows were confirmed
+ */
+class MapleRest : public Application, RestHandler {
+    Q_OBJECT
+    SIMPLE_APPLICATION(MapleRest, "maple-rest")
+public:
+    void init(Loader* loader, const Config& config) override;
+
+    bool eventable() override { return false; }
+    AppType type() override { return AppType::None; }
+    json11::Json handleGET(std::vector<std::string> params, std::string body) override;
+
+private:
+    runos::Maple* maple;
+};
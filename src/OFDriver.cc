@@ -6,6 +6,7 @@
 
 #include "Common.hh"
 #include "FluidOXMAdapter.hh"
+#include "OFEncoder.hh"
 
 
 namespace runos {
@@ -25,32 +26,16 @@ ActionSet convert_to_action_set(const Actions& acts) {
     return ret;
 }
 
-of13::ApplyActions convert_to_apply_action(const Actions& acts) {
-    of13::ApplyActions ret;
+void encode_actions(OFEncoder& enc, const Actions& acts) {
     for (const oxm::field<>& f : acts.set_fields) {
-        ret.add_action(new of13::SetFieldAction(new FluidOXMAdapter(f)));
+        enc.set_field(f);
     }
     if (acts.out_port != 0) {
-        ret.add_action(new of13::OutputAction(acts.out_port, 0)); //OFP_NO_BUFFER));
+        enc.output(acts.out_port, 0); //OFP_NO_BUFFER));
     }
     if (acts.group_id != 0) {
-        ret.add_action(new of13::GroupAction(acts.group_id));
+        enc.group(acts.group_id);
     }
-    return ret;
-}
-
-ActionList convert_to_action_list(const Actions& acts) {
-    ActionList ret;
-    for (const oxm::field<>& f : acts.set_fields) {
-        ret.add_action(new of13::SetFieldAction(new FluidOXMAdapter(f)));
-    }
-    if (acts.out_port != 0) {
-        ret.add_action(new of13::OutputAction(acts.out_port, 0)); //OFP_NO_BUFFER));
-    }
-    if (acts.group_id != 0) {
-        ret.add_action(new of13::GroupAction(acts.group_id));
-    }
-    return ret;
 }
 
 class Fluid13Rule: public Rule {
@@ -70,34 +55,43 @@ public:
       , m_cookie(cookie)
     {
         if (m_conn) {
-            of13::FlowMod fm;
-            fm.command(of13::OFPFC_ADD);
-            fm.buffer_id(OFP_NO_BUFFER);
-            fm.table_id(m_table);
-            fm.cookie(m_cookie);
-            fm.match(make_of_match(m_match));
-            fm.priority(prio);
-
-            fm.idle_timeout(m_acts.idle_timeout);
-            fm.hard_timeout(m_acts.hard_timeout);
-
-            fm.flags( of13::OFPFF_CHECK_OVERLAP |
-                      of13::OFPFF_SEND_FLOW_REM );
-            of13::ApplyActions apply_actions = convert_to_apply_action(m_acts);
-            fm.add_instruction(apply_actions);
-            m_conn->send(fm);
+            OFEncoder::FlowModParams fm;
+            fm.command = of13::OFPFC_ADD;
+            fm.buffer_id = OFP_NO_BUFFER;
+            fm.table_id = m_table;
+            fm.cookie = m_cookie;
+            fm.priority = prio;
+
+            fm.idle_timeout = m_acts.idle_timeout;
+            fm.hard_timeout = m_acts.hard_timeout;
+
+            fm.flags = of13::OFPFF_CHECK_OVERLAP |
+                       of13::OFPFF_SEND_FLOW_REM;
+
+            auto enc = OFEncoder::scratch();
+            enc.begin_flow_mod(fm, m_match);
+            if (m_acts.out_port == ports::to_controller) {
+                if (uint32_t meter = m_conn->packet_in_meter())
+                    enc.meter(meter);
+            }
+            enc.begin_apply_actions();
+            encode_actions(enc, m_acts);
+            enc.end_message();
+            m_conn->send(enc.data(), enc.size());
         }
     }
 
     ~Fluid13Rule() {
         if (m_conn) {
-            of13::FlowMod fm;
-            fm.command(of13::OFPFC_DELETE);
-            fm.cookie(m_cookie);
-            fm.cookie_mask(0xfffffffff);
-            fm.out_port(of13::OFPP_ANY);
-            fm.out_group(of13::OFPG_ANY);
-            m_conn->send(fm);
+            OFEncoder::FlowModParams fm;
+            fm.command = of13::OFPFC_DELETE;
+            fm.cookie = m_cookie;
+            fm.cookie_mask = 0xfffffffff;
+
+            auto enc = OFEncoder::scratch();
+            enc.begin_flow_mod(fm, oxm::field_set{});
+            enc.end_message();
+            m_conn->send(enc.data(), enc.size());
         }
         DVLOG(50) << "Remove flow 0x" << std::hex << m_cookie;
     }
@@ -199,12 +193,12 @@ public:
     }
 
     void packetOut(uint8_t* data, size_t data_len, Actions actions) override {
-        of13::PacketOut po;
-        po.xid(222);
-        po.buffer_id(OFP_NO_BUFFER);
-        po.actions(convert_to_action_list(actions));
-        po.data(data, data_len);
-        m_conn->send(po);
+        auto enc = OFEncoder::scratch();
+        enc.begin_packet_out(222, OFP_NO_BUFFER, of13::OFPP_CONTROLLER);
+        encode_actions(enc, actions);
+        enc.packet_data(data, data_len);
+        enc.end_message();
+        m_conn->send(enc.data(), enc.size());
     }
 private:
     SwitchConnectionPtr m_conn;
@@ -0,0 +1,353 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OFEncoder.hh"
+
+#include <array>
+#include <cstring>
+
+#include <boost/assert.hpp>
+#include <boost/endian/conversion.hpp>
+
+#include "openflow/common.hh"
+#include "openflow/openflow-1.3.5.h"
+#include "types/exception.hh"
+
+namespace runos {
+
+typedef boost::error_info< struct tag_oxm_ns, unsigned >
+    errinfo_oxm_ns;
+typedef boost::error_info< struct tag_oxm_field, unsigned >
+    errinfo_oxm_field;
+
+namespace {
+
+constexpr size_t FLOW_MOD_LEN = 48;         // without match
+constexpr size_t PACKET_OUT_LEN = 24;       // without actions
+constexpr size_t ACTION_SET_FIELD_LEN = 4;  // without oxm and padding
+constexpr size_t METER_BAND_DROP_LEN = 16;
+
+// Large enough to hold every OXM field at once
+constexpr size_t MAX_MATCH_FIELDS = 64;
+
+}
+
+OFEncoder OFEncoder::scratch()
+{
+    static thread_local std::array<uint8_t, max_message_len> buffer;
+    return OFEncoder(buffer.data(), buffer.size());
+}
+
+void OFEncoder::clear()
+{
+    m_pos = 0;
+    m_message = m_instruction = m_actions = npos;
+}
+
+uint8_t* OFEncoder::reserve(size_t len)
+{
+    if (len > m_capacity - m_pos) {
+        RUNOS_THROW(length_error() << errinfo_msg("OFEncoder buffer overflow"));
+    }
+    uint8_t* ret = m_buffer + m_pos;
+    m_pos += len;
+    return ret;
+}
+
+void OFEncoder::put8(uint8_t v)
+{
+    *reserve(1) = v;
+}
+
+void OFEncoder::put16(uint16_t v)
+{
+    v = boost::endian::native_to_big(v);
+    std::memcpy(reserve(sizeof(v)), &v, sizeof(v));
+}
+
+void OFEncoder::put32(uint32_t v)
+{
+    v = boost::endian::native_to_big(v);
+    std::memcpy(reserve(sizeof(v)), &v, sizeof(v));
+}
+
+void OFEncoder::put64(uint64_t v)
+{
+    v = boost::endian::native_to_big(v);
+    std::memcpy(reserve(sizeof(v)), &v, sizeof(v));
+}
+
+void OFEncoder::patch16(size_t at, uint16_t v)
+{
+    v = boost::endian::native_to_big(v);
+    std::memcpy(m_buffer + at, &v, sizeof(v));
+}
+
+void OFEncoder::zeros(size_t n)
+{
+    std::memset(reserve(n), 0, n);
+}
+
+void OFEncoder::pad8(size_t from)
+{
+    size_t len = m_pos - from;
+    zeros((len + 7) / 8 * 8 - len);
+}
+
+void OFEncoder::header(uint8_t type, uint32_t xid)
+{
+    BOOST_ASSERT(m_message == npos);
+    m_message = m_pos;
+    put8(OFP_VERSION);
+    put8(type);
+    put16(0); // patched by end_message()
+    put32(xid);
+}
+
+void OFEncoder::end_message()
+{
+    BOOST_ASSERT(m_message != npos);
+    if (m_instruction != npos)
+        end_apply_actions();
+    if (m_actions != npos)
+        close_packet_out_actions();
+
+    size_t len = m_pos - m_message;
+    if (len > max_message_len) {
+        RUNOS_THROW(length_error() << errinfo_msg("OpenFlow message too long"));
+    }
+    patch16(m_message + 2, len);
+    m_message = npos;
+}
+
+void OFEncoder::oxm(const oxm::field<>& field)
+{
+    auto type = field.type();
+    switch (type.ns()) {
+        case unsigned(of::oxm::ns::NXM_0): break;
+        case unsigned(of::oxm::ns::NXM_1): break;
+        case unsigned(of::oxm::ns::OPENFLOW_BASIC): break;
+        case unsigned(of::oxm::ns::EXPERIMENTER):
+            // oxm::type has no experimenter id to put after the header
+            RUNOS_THROW(
+                    invalid_argument() <<
+                    errinfo_msg("experimenter oxm fields aren't supported") <<
+                    errinfo_oxm_ns(type.ns()) <<
+                    errinfo_oxm_field(type.id()));
+        default :
+            RUNOS_THROW(
+                    invalid_argument() <<
+                    errinfo_msg("non openflow oxm field") <<
+                    errinfo_oxm_ns(type.ns()) <<
+                    errinfo_oxm_field(type.id()));
+    }
+
+    bool hasmask = not field.exact();
+    size_t nbytes = type.nbytes();
+
+    put16(type.ns());
+    put8((type.id() << 1) | (hasmask ? 1 : 0));
+    put8(hasmask ? 2 * nbytes : nbytes);
+    field.value_bits().to_buffer(reserve(nbytes));
+    if (hasmask) {
+        field.mask_bits().to_buffer(reserve(nbytes));
+    }
+}
+
+void OFEncoder::match(const oxm::field_set& match)
+{
+    // A field_set keeps fields sorted by (ns, id): the output is
+    // deterministic, and basic fields get their prerequisites
+    // (eth_type, ip_proto) in front of them.
+    size_t start = m_pos;
+    put16(OFPMT_OXM);
+    put16(0);
+    size_t n = 0;
+    for (const oxm::field<>& f : match) {
+        if (f.wildcard())
+            continue;
+        if (++n > MAX_MATCH_FIELDS) {
+            RUNOS_THROW(length_error() << errinfo_msg("Too many match fields"));
+        }
+        oxm(f);
+    }
+    patch16(start + 2, m_pos - start); // excludes padding
+    pad8(start);
+}
+
+void OFEncoder::begin_flow_mod(const FlowModParams& params,
+                               const oxm::field_set& match)
+{
+    flow_mod_header(params);
+    this->match(match);
+}
+
+void OFEncoder::begin_flow_mod(const FlowModParams& params,
+                               const uint8_t* oxm_fields, size_t oxm_len)
+{
+    flow_mod_header(params);
+    size_t start = m_pos;
+    put16(OFPMT_OXM);
+    put16(4 + oxm_len);
+    std::memcpy(reserve(oxm_len), oxm_fields, oxm_len);
+    pad8(start);
+}
+
+void OFEncoder::flow_mod_header(const FlowModParams& params)
+{
+    header(OFPT_FLOW_MOD, params.xid);
+    put64(params.cookie);
+    put64(params.cookie_mask);
+    put8(params.table_id);
+    put8(params.command);
+    put16(params.idle_timeout);
+    put16(params.hard_timeout);
+    put16(params.priority);
+    put32(params.buffer_id);
+    put32(params.out_port);
+    put32(params.out_group);
+    put16(params.flags);
+    zeros(2);
+    BOOST_ASSERT(m_pos - m_message == FLOW_MOD_LEN);
+}
+
+void OFEncoder::begin_packet_out(uint32_t xid, uint32_t buffer_id, uint32_t in_port)
+{
+    header(OFPT_PACKET_OUT, xid);
+    put32(buffer_id);
+    put32(in_port);
+    put16(0); // actions_len
+    zeros(6);
+    BOOST_ASSERT(m_pos - m_message == PACKET_OUT_LEN);
+    m_actions = m_pos;
+}
+
+void OFEncoder::close_packet_out_actions()
+{
+    patch16(m_message + 16, m_pos - m_actions);
+    m_actions = npos;
+}
+
+void OFEncoder::packet_data(const void* data, size_t len)
+{
+    if (m_actions != npos)
+        close_packet_out_actions();
+    std::memcpy(reserve(len), data, len);
+}
+
+void OFEncoder::barrier_request(uint32_t xid)
+{
+    header(OFPT_BARRIER_REQUEST, xid);
+    end_message();
+}
+
+void OFEncoder::meter_mod(uint32_t xid, uint16_t command, uint32_t meter_id,
+                          uint32_t rate, uint32_t burst)
+{
+    header(OFPT_METER_MOD, xid);
+    put16(command);
+    put16(OFPMF_PKTPS | (burst ? OFPMF_BURST : 0));
+    put32(meter_id);
+    if (command != OFPMC_DELETE) {
+        put16(OFPMBT_DROP);
+        put16(METER_BAND_DROP_LEN);
+        put32(rate);
+        put32(burst);
+        zeros(4);
+    }
+    end_message();
+}
+
+void OFEncoder::begin_apply_actions()
+{
+    BOOST_ASSERT(m_instruction == npos);
+    m_instruction = m_pos;
+    put16(OFPIT_APPLY_ACTIONS);
+    put16(0);
+    zeros(4);
+}
+
+void OFEncoder::end_apply_actions()
+{
+    BOOST_ASSERT(m_instruction != npos);
+    patch16(m_instruction + 2, m_pos - m_instruction);
+    m_instruction = npos;
+}
+
+void OFEncoder::goto_table(uint8_t table_id)
+{
+    put16(OFPIT_GOTO_TABLE);
+    put16(8);
+    put8(table_id);
+    zeros(3);
+}
+
+void OFEncoder::write_metadata(uint64_t metadata, uint64_t mask)
+{
+    BOOST_ASSERT(m_instruction == npos);
+    put16(OFPIT_WRITE_METADATA);
+    put16(24);
+    zeros(4);
+    put64(metadata);
+    put64(mask);
+}
+
+void OFEncoder::meter(uint32_t meter_id)
+{
+    BOOST_ASSERT(m_instruction == npos);
+    put16(OFPIT_METER);
+    put16(8);
+    put32(meter_id);
+}
+
+void OFEncoder::output(uint32_t port, uint16_t max_len)
+{
+    put16(OFPAT_OUTPUT);
+    put16(16);
+    put32(port);
+    put16(max_len);
+    zeros(6);
+}
+
+void OFEncoder::group(uint32_t group_id)
+{
+    put16(OFPAT_GROUP);
+    put16(8);
+    put32(group_id);
+}
+
+void OFEncoder::set_field(const oxm::field<>& field)
+{
+    size_t start = m_pos;
+    put16(OFPAT_SET_FIELD);
+    put16(0);
+    oxm(field);
+    pad8(start);
+    patch16(start + 2, m_pos - start);
+}
+
+uint8_t* OFEncoder::set_field(size_t oxm_len)
+{
+    size_t start = m_pos;
+    size_t len = (ACTION_SET_FIELD_LEN + oxm_len + 7) / 8 * 8;
+    uint8_t* action = reserve(len);
+    std::memset(action, 0, len);
+    patch16(start, OFPAT_SET_FIELD);
+    patch16(start + 2, len);
+    return action + ACTION_SET_FIELD_LEN;
+}
+
+} // namespace runos
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "oxm/field_set.hh"
+
+namespace runos {
+
+/**
+ * Serializes OpenFlow 1.3 messages straight into a caller-provided buffer.
+ *
+ * A message is built in place: begin it, append its parts in wire order
+ * and end it; lengths are patched when enclosing parts are closed.
+ * Several messages may be written back to back and sent at once with
+ * SwitchConnection::send(data(), size()).
+ *
+ * Nothing is allocated. Running out of buffer throws length_error.
+ */
+class OFEncoder {
+public:
+    /** Maximum length of a single OpenFlow message */
+    static constexpr size_t max_message_len = 65535;
+
+    struct FlowModParams {
+        uint32_t xid = 0;
+        uint64_t cookie = 0;
+        uint64_t cookie_mask = 0;
+        uint8_t  table_id = 0;
+        uint8_t  command = 0;               // OFPFC_ADD
+        uint16_t idle_timeout = 0;
+        uint16_t hard_timeout = 0;
+        uint16_t priority = 0;
+        uint32_t buffer_id = 0xffffffff;    // OFP_NO_BUFFER
+        uint32_t out_port = 0xffffffff;     // OFPP_ANY
+        uint32_t out_group = 0xffffffff;    // OFPG_ANY
+        uint16_t flags = 0;
+    };
+
+    OFEncoder(uint8_t* buffer, size_t capacity) noexcept
+        : m_buffer(buffer), m_capacity(capacity)
+    { }
+
+    /**
+     * Encoder over a per-thread buffer big enough for any message.
+     * Starts empty; don't keep it across calls which encode too.
+     */
+    static OFEncoder scratch();
+
+    const uint8_t* data() const { return m_buffer; }
+    size_t size() const { return m_pos; }
+    bool empty() const { return m_pos == 0; }
+    void clear();
+
+    // Messages
+
+    /** Flow-mod header and match, followed by instructions */
+    void begin_flow_mod(const FlowModParams& params,
+                        const oxm::field_set& match);
+
+    /** Same with a match of already serialized OXM TLVs */
+    void begin_flow_mod(const FlowModParams& params,
+                        const uint8_t* oxm_fields, size_t oxm_len);
+
+    /** Packet-out header, followed by actions and then packet_data() */
+    void begin_packet_out(uint32_t xid, uint32_t buffer_id, uint32_t in_port);
+    void packet_data(const void* data, size_t len);
+
+    void end_message();
+
+    void barrier_request(uint32_t xid = 0);
+
+    /**
+     * Meter-mod with a single drop band.
+     * Rate and burst are in packets; zero burst means the switch default.
+     */
+    void meter_mod(uint32_t xid, uint16_t command, uint32_t meter_id,
+                   uint32_t rate, uint32_t burst);
+
+    // Instructions
+
+    void begin_apply_actions();
+    void end_apply_actions();
+    void goto_table(uint8_t table_id);
+    void write_metadata(uint64_t metadata, uint64_t mask = uint64_t(-1));
+    /** Must precede apply-actions, which is closed by end_message() */
+    void meter(uint32_t meter_id);
+
+    // Actions
+
+    void output(uint32_t port, uint16_t max_len = 0);
+    void group(uint32_t group_id);
+    void set_field(const oxm::field<>& field);
+
+    /**
+     * Set-field action with an OXM TLV of oxm_len bytes serialized
+     * by the caller into the returned location.
+     */
+    uint8_t* set_field(size_t oxm_len);
+
+    /** Appends len uninitialized bytes for external serializers */
+    uint8_t* reserve(size_t len);
+
+private:
+    static constexpr size_t npos = size_t(-1);
+
+    uint8_t* m_buffer;
+    size_t m_capacity;
+    size_t m_pos {0};
+
+    size_t m_message {npos};
+    size_t m_instruction {npos};
+    size_t m_actions {npos};  // packet-out actions_len is patched from this
+
+    void put8(uint8_t v);
+    void put16(uint16_t v);
+    void put32(uint32_t v);
+    void put64(uint64_t v);
+    void patch16(size_t at, uint16_t v);
+    void zeros(size_t n);
+    void pad8(size_t from);
+
+    void header(uint8_t type, uint32_t xid);
+    void flow_mod_header(const FlowModParams& params);
+    void match(const oxm::field_set& match);
+    void oxm(const oxm::field<>& field);
+    void close_packet_out_actions();
+};
+
+} // namespace runos
@@ -16,6 +16,8 @@
 
 #include "OFMsgUnion.hh"
 
+#include "BlockPool.hh"
+
 OFMsgUnion::OFMsgUnion()
     : m_base(nullptr)
 {
@@ -73,7 +75,7 @@ void OFMsgUnion::reparseMultipartReply(void* data, size_t len)
     case of13::OFPMP_FLOW:
         m_base = new (&multipartReplyFlow) of13::MultipartReplyFlow; break;
     case of13::OFPMP_AGGREGATE:
-        m_base = new (&multipartReplyAggregate) of13::MultipartReplyAggregate;
+        m_base = new (&multipartReplyAggregate) of13::MultipartReplyAggregate; break;
     case of13::OFPMP_TABLE:
         m_base = new (&multipartReplyTable) of13::MultipartReplyTable; break;
     case of13::OFPMP_TABLE_FEATURES:
@@ -123,6 +125,12 @@ OFMsgUnion::~OFMsgUnion()
     if (m_base) m_base->~OFMsg();
 }
 
+std::shared_ptr<OFMsgUnion> OFMsgUnion::make_shared(uint8_t type, void* data, size_t len)
+{
+    return std::allocate_shared<OFMsgUnion>(runos::PoolAllocator<OFMsgUnion>(),
+                                            type, data, len);
+}
+
 static struct Init {
     Init() {
         qRegisterMetaType< std::shared_ptr<OFMsgUnion> >();
@@ -17,6 +17,8 @@
 #pragma once
 
 #include <exception>
+#include <memory>
+#include <boost/assert.hpp>
 #include "Common.hh"
 
 struct OFMsgParseError : std::exception { };
@@ -74,8 +76,22 @@ struct OFMsgUnion {
     //OFMsgUnion(OFMsgUnion&& other);
     ~OFMsgUnion();
 
+    /**
+     * Shared message decoded from data, allocated from a pool of
+     * recycled blocks together with its control block.
+     */
+    static std::shared_ptr<OFMsgUnion> make_shared(uint8_t type, void* data, size_t len);
+
     OFMsg* base() const { return m_base; }
 
+    /** Typed view of the decoded message, which must be a Message */
+    template<class Message>
+    Message& as() const
+    {
+        BOOST_ASSERT(dynamic_cast<Message*>(m_base) != nullptr);
+        return static_cast<Message&>(*m_base);
+    }
+
 private:
     OFMsg* m_base;
     void reparseMultipartReply(void* data, size_t len);
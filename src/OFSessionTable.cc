@@ -0,0 +1,165 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OFSessionTable.hh"
+
+#include <algorithm>
+
+namespace runos {
+
+OFSessionTable::OFSessionTable(uint32_t first_xid,
+                               std::chrono::milliseconds tick)
+    : m_first_xid(first_xid)
+    , m_tick(std::max(tick, std::chrono::milliseconds(1)))
+    , m_epoch(clock::now())
+    , m_next_xid(first_xid)
+{ }
+
+uint64_t OFSessionTable::ticks(clock::time_point t) const
+{
+    return (t - m_epoch) / m_tick;
+}
+
+uint32_t OFSessionTable::next_xid()
+{
+    uint32_t xid = m_next_xid++;
+    if (xid < m_first_xid) {
+        // wrapped around, skip static and libfluid xids
+        uint32_t expected = xid + 1;
+        m_next_xid.compare_exchange_strong(expected, m_first_xid + 1);
+        xid = m_first_xid;
+    }
+    return xid;
+}
+
+uint32_t OFSessionTable::insert(SwitchConnectionPtr conn,
+                                OFSessionHandlers handlers,
+                                std::chrono::milliseconds timeout)
+{
+    auto ptr = std::make_shared<const OFSessionHandlers>(std::move(handlers));
+    // round up, so an entry never expires before its timeout
+    uint64_t deadline = ticks(clock::now() + timeout) + 1;
+
+    uint32_t xid;
+    for (;;) {
+        xid = next_xid();
+        Shard& s = shard(xid);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        // a 2^32 wrap may still find a request which never completed
+        if (s.entries.emplace(xid, Entry{conn, ptr, deadline}).second)
+            break;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_wheel_mutex);
+        m_wheel[deadline % NSLOTS].emplace_back(xid, deadline);
+    }
+
+    ++m_in_flight;
+    ++m_issued;
+    return xid;
+}
+
+OFSessionTable::HandlersPtr OFSessionTable::erase(uint32_t xid)
+{
+    Shard& s = shard(xid);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto it = s.entries.find(xid);
+    if (it == s.entries.end())
+        return nullptr;
+    HandlersPtr ret = std::move(it->second.handlers);
+    s.entries.erase(it);
+    --m_in_flight;
+    return ret;
+}
+
+OFSessionTable::HandlersPtr OFSessionTable::take(uint32_t xid, bool more)
+{
+    if (more) {
+        Shard& s = shard(xid);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.entries.find(xid);
+        return it != s.entries.end() ? it->second.handlers : nullptr;
+    }
+
+    HandlersPtr ret = erase(xid);
+    if (ret)
+        ++m_completed;
+    return ret;
+}
+
+OFSessionTable::HandlersPtr OFSessionTable::take_error(uint32_t xid)
+{
+    HandlersPtr ret = erase(xid);
+    if (ret)
+        ++m_errors;
+    return ret;
+}
+
+void OFSessionTable::expire(clock::time_point now)
+{
+    std::vector<std::pair<uint32_t, uint64_t>> due;
+    std::vector<std::pair<uint32_t, Entry>> expired;
+
+    uint64_t current = ticks(now);
+    {
+        std::lock_guard<std::mutex> lock(m_wheel_mutex);
+        // No need to walk more than one turn of the wheel
+        uint64_t from = std::max(m_expired_tick + 1,
+                                 current >= NSLOTS ? current - NSLOTS + 1 : 0);
+        for (uint64_t t = from; t <= current; ++t) {
+            auto& slot = m_wheel[t % NSLOTS];
+            auto keep = std::partition(slot.begin(), slot.end(),
+                [current](const std::pair<uint32_t, uint64_t>& e) {
+                    return e.second > current;
+                });
+            due.insert(due.end(), keep, slot.end());
+            slot.erase(keep, slot.end());
+        }
+        m_expired_tick = std::max(m_expired_tick, current);
+    }
+
+    for (auto& e : due) {
+        Shard& s = shard(e.first);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.entries.find(e.first);
+        // Completed, or the xid was reused by a later request
+        if (it == s.entries.end() || it->second.deadline != e.second)
+            continue;
+        expired.emplace_back(e.first, std::move(it->second));
+        s.entries.erase(it);
+        --m_in_flight;
+        ++m_timeouts;
+    }
+
+    for (auto& e : expired) {
+        if (e.second.handlers->timeout)
+            e.second.handlers->timeout(e.second.conn, e.first);
+    }
+}
+
+OFSessionTable::Stats OFSessionTable::stats() const
+{
+    Stats ret;
+    ret.in_flight = m_in_flight;
+    ret.issued = m_issued;
+    ret.completed = m_completed;
+    ret.errors = m_errors;
+    ret.timeouts = m_timeouts;
+    return ret;
+}
+
+} // namespace runos
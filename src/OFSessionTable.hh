@@ -0,0 +1,133 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "SwitchConnectionFwd.hh"
+
+struct OFMsgUnion;
+
+namespace runos {
+
+/**
+ * Continuations of a request sent with a per-request xid.
+ * Exactly one of error or timeout ends the request,
+ * or response with the last part of the reply.
+ */
+struct OFSessionHandlers {
+    std::function<void(SwitchConnectionPtr, std::shared_ptr<OFMsgUnion>)> response;
+    std::function<void(SwitchConnectionPtr, std::shared_ptr<OFMsgUnion>)> error;
+    std::function<void(SwitchConnectionPtr, uint32_t xid)> timeout;
+};
+
+/**
+ * Concurrent xid -> continuation table.
+ *
+ * Entries live in hash shards, so insert and lookup are O(1) and
+ * requests on different switches rarely contend. Deadlines are kept
+ * in a hashed timer wheel which expire() advances.
+ */
+class OFSessionTable {
+public:
+    using clock = std::chrono::steady_clock;
+    using HandlersPtr = std::shared_ptr<const OFSessionHandlers>;
+
+    struct Stats {
+        uint64_t in_flight = 0;
+        uint64_t issued = 0;
+        uint64_t completed = 0;
+        uint64_t errors = 0;
+        uint64_t timeouts = 0;
+    };
+
+    /**
+     * @param first_xid Session xids are allocated from [first_xid, 2^32).
+     * @param tick Timer wheel resolution.
+     */
+    OFSessionTable(uint32_t first_xid, std::chrono::milliseconds tick);
+
+    /** Registers a request and returns the xid to send it with. */
+    uint32_t insert(SwitchConnectionPtr conn,
+                    OFSessionHandlers handlers,
+                    std::chrono::milliseconds timeout);
+
+    bool owns(uint32_t xid) const { return xid >= m_first_xid; }
+
+    /**
+     * Finds the continuation of a reply.
+     * The entry is kept while more parts of a multipart reply are expected.
+     */
+    HandlersPtr take(uint32_t xid, bool more);
+
+    /** Same as take() but counts the request as failed */
+    HandlersPtr take_error(uint32_t xid);
+
+    /** Calls timeout handlers of all requests due by now. */
+    void expire(clock::time_point now = clock::now());
+
+    Stats stats() const;
+
+private:
+    static constexpr size_t NSHARDS = 16;
+    static constexpr size_t NSLOTS = 1024;
+
+    struct Entry {
+        SwitchConnectionPtr conn;
+        HandlersPtr handlers;
+        uint64_t deadline; // in ticks
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<uint32_t, Entry> entries;
+    };
+
+    const uint32_t m_first_xid;
+    const clock::duration m_tick;
+    const clock::time_point m_epoch;
+
+    std::atomic<uint32_t> m_next_xid;
+    std::array<Shard, NSHARDS> m_shards;
+
+    std::mutex m_wheel_mutex;
+    std::array<std::vector<std::pair<uint32_t, uint64_t>>, NSLOTS> m_wheel;
+    uint64_t m_expired_tick {0};
+
+    std::atomic<uint64_t> m_in_flight {0};
+    std::atomic<uint64_t> m_issued {0};
+    std::atomic<uint64_t> m_completed {0};
+    std::atomic<uint64_t> m_errors {0};
+    std::atomic<uint64_t> m_timeouts {0};
+
+    Shard& shard(uint32_t xid) { return m_shards[xid % NSHARDS]; }
+    uint64_t ticks(clock::time_point t) const;
+    uint32_t next_xid();
+    HandlersPtr erase(uint32_t xid);
+};
+
+} // namespace runos
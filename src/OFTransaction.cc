@@ -16,14 +16,117 @@
 
 #include "OFTransaction.hh"
 
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "OFSessionTable.hh"
 #include "SwitchConnection.hh"
 
+// Continuations run on worker threads and may outlive the transaction.
+// Signals are emitted without the mutex held, so slots may use the
+// transaction; its destructor waits for emissions on other threads.
+struct OFTransaction::Guard {
+    std::mutex mutex;
+    std::condition_variable idle;
+    OFTransaction* self;
+    std::vector<std::thread::id> emitting;
+
+    explicit Guard(OFTransaction* self) : self(self) { }
+
+    template<class F>
+    void operator()(F&& f)
+    {
+        OFTransaction* target;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            target = self;
+            if (not target)
+                return;
+            emitting.push_back(std::this_thread::get_id());
+        }
+
+        struct Done {
+            Guard& guard;
+            ~Done() {
+                {
+                    std::lock_guard<std::mutex> lock(guard.mutex);
+                    auto it = std::find(guard.emitting.begin(),
+                                        guard.emitting.end(),
+                                        std::this_thread::get_id());
+                    guard.emitting.erase(it);
+                }
+                guard.idle.notify_all();
+            }
+        } done{*this};
+        f(target);
+    }
+
+    void release()
+    {
+        auto me = std::this_thread::get_id();
+        std::unique_lock<std::mutex> lock(mutex);
+        self = nullptr;
+        idle.wait(lock, [&] {
+            return std::all_of(emitting.begin(), emitting.end(),
+                               [me](std::thread::id id) { return id == me; });
+        });
+    }
+};
+
 OFTransaction::OFTransaction(uint32_t xid, QObject *parent)
     : QObject(parent), m_xid(xid)
 { }
 
-void OFTransaction::request(SwitchConnectionPtr conn, OFMsg& msg)
+OFTransaction::OFTransaction(OFSessionTable& sessions,
+                             std::chrono::milliseconds timeout,
+                             QObject *parent)
+    : QObject(parent)
+    , m_xid(0)
+    , m_sessions(&sessions)
+    , m_timeout(timeout)
+    , m_guard(std::make_shared<Guard>(this))
+{ }
+
+OFTransaction::~OFTransaction()
+{
+    if (m_guard) {
+        m_guard->release();
+    }
+}
+
+uint32_t OFTransaction::request(SwitchConnectionPtr conn, OFMsg& msg)
 {
-    msg.xid(m_xid);
+    if (not m_sessions) {
+        msg.xid(m_xid);
+        conn->send(msg);
+        return m_xid;
+    }
+
+    std::shared_ptr<Guard> guard = m_guard;
+    OFSessionHandlers handlers;
+    handlers.response = [guard](SwitchConnectionPtr conn,
+                                std::shared_ptr<OFMsgUnion> reply) {
+        (*guard)([&](OFTransaction* self) {
+            emit self->response(conn, reply);
+        });
+    };
+    handlers.error = [guard](SwitchConnectionPtr conn,
+                             std::shared_ptr<OFMsgUnion> error) {
+        (*guard)([&](OFTransaction* self) {
+            emit self->error(conn, error);
+        });
+    };
+    handlers.timeout = [guard](SwitchConnectionPtr conn, uint32_t xid) {
+        (*guard)([&](OFTransaction* self) {
+            emit self->timeout(conn, xid);
+        });
+    };
+
+    uint32_t xid = m_sessions->insert(conn, std::move(handlers), m_timeout);
+    msg.xid(xid);
     conn->send(msg);
+    return xid;
 }
@@ -16,11 +16,18 @@
 
 #pragma once
 
+#include <chrono>
+#include <memory>
+
 #include "Common.hh"
 #include "OFMsgUnion.hh"
 #include "SwitchConnectionFwd.hh"
 using namespace runos;
 
+namespace runos {
+class OFSessionTable;
+}
+
 
 
 /**
@@ -28,19 +35,29 @@ using namespace runos;
  *
  * That interface combines request and replay to a transaction. It allows your app to be called when a response with
  * the same xid (as in request) will be received on the controller.
+ *
+ * Static transactions share one xid for all requests. Session transactions
+ * (see Controller::registerTransaction) give every request its own xid, so
+ * any number of requests may be in flight at once; unanswered requests are
+ * reported with the timeout signal.
  * */
 
 class OFTransaction : public QObject {
     Q_OBJECT
 public:
     explicit OFTransaction(uint32_t xid, QObject *parent = 0);
+    OFTransaction(OFSessionTable& sessions,
+                  std::chrono::milliseconds timeout,
+                  QObject *parent = 0);
+    ~OFTransaction();
 
     /**
     * Sends an OpenFlow message.
     * @param ofconn Connection to use.
     * @param msg OpenFlow Message (xid will be overwritten).
+    * @return xid the message was sent with.
     */
-    void request(SwitchConnectionPtr conn, OFMsg& msg);
+    uint32_t request(SwitchConnectionPtr conn, OFMsg& msg);
 
 signals:
     /**
@@ -59,7 +76,20 @@ signals:
     */
     void error(SwitchConnectionPtr conn, std::shared_ptr<OFMsgUnion> error);
 
+    /**
+    * Switch didn't answer a request of a session transaction in time.
+    *
+    * @param ofconn     OpenFlow Connection.
+    * @param xid        Value returned by request().
+    */
+    void timeout(SwitchConnectionPtr conn, uint32_t xid);
+
 private:
+    struct Guard;
+
     uint32_t m_xid;
+    OFSessionTable* m_sessions {nullptr};
+    std::chrono::milliseconds m_timeout {0};
+    std::shared_ptr<Guard> m_guard;
 };
 
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PacketInAdmission.hh"
+
+#include <algorithm>
+
+#include <boost/exception/info.hpp>
+
+#include "types/exception.hh"
+
+namespace runos {
+
+namespace {
+
+constexpr size_t OFP_HEADER_LEN = 8;
+constexpr size_t PACKET_IN_MATCH_OFFSET = 24;
+constexpr uint8_t OFPR_NO_MATCH = 0;
+
+constexpr uint16_t ETH_TYPE_LLDP = 0x88cc;
+constexpr uint16_t ETH_TYPE_BDDP = 0x8942;
+constexpr uint16_t ETH_TYPE_VLAN = 0x8100;
+constexpr uint16_t ETH_TYPE_QINQ = 0x88a8;
+
+uint16_t get16(const uint8_t* p)
+{
+    return uint16_t(p[0] << 8 | p[1]);
+}
+
+}
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : m_rate(rate)
+    , m_burst(std::max(burst, 1.0))
+    , m_tokens(m_burst)
+    , m_last(clock::now())
+{ }
+
+bool TokenBucket::take(double reserve, clock::time_point now)
+{
+    if (m_rate <= 0)
+        return true;
+
+    if (now > m_last) {
+        std::chrono::duration<double> elapsed = now - m_last;
+        m_tokens = std::min(m_burst, m_tokens + elapsed.count() * m_rate);
+        m_last = now;
+    }
+
+    if (m_tokens - 1 < reserve)
+        return false;
+    m_tokens -= 1;
+    return true;
+}
+
+void TokenBucket::give_back()
+{
+    m_tokens = std::min(m_burst, m_tokens + 1);
+}
+
+PacketInAdmission::Switch::Switch(const Settings& settings)
+    : bucket(settings.switch_rate, settings.switch_burst)
+{ }
+
+PacketInAdmission::PacketInAdmission()
+    : PacketInAdmission(Settings())
+{ }
+
+PacketInAdmission::PacketInAdmission(Settings settings)
+    : m_settings(settings)
+    , m_global(settings.global_rate, settings.global_burst)
+{
+    if (m_settings.reserve < 0 || m_settings.reserve * (nclasses - 1) >= 1) {
+        RUNOS_THROW(invalid_argument() <<
+                    errinfo_msg("Admission reserve must be in [0, 1/2)"));
+    }
+    m_settings.sample_every = std::max(m_settings.sample_every, 1u);
+}
+
+PacketInAdmission::Class
+PacketInAdmission::classify(const uint8_t* msg, size_t len)
+{
+    if (len < PACKET_IN_MATCH_OFFSET + 4)
+        return Class::Inspect;
+
+    uint8_t reason = msg[OFP_HEADER_LEN + 6];
+    Class ret = reason == OFPR_NO_MATCH ? Class::TableMiss : Class::Inspect;
+
+    // Match is padded to 8 bytes and followed by 2 bytes of padding
+    size_t match_len = get16(msg + PACKET_IN_MATCH_OFFSET + 2);
+    size_t data = PACKET_IN_MATCH_OFFSET + (match_len + 7) / 8 * 8 + 2;
+    if (len < data + 14)
+        return ret;
+
+    size_t type_offset = data + 12;
+    uint16_t eth_type = get16(msg + type_offset);
+    while ((eth_type == ETH_TYPE_VLAN || eth_type == ETH_TYPE_QINQ) &&
+           len >= type_offset + 6) {
+        type_offset += 4;
+        eth_type = get16(msg + type_offset);
+    }
+
+    if (eth_type == ETH_TYPE_LLDP || eth_type == ETH_TYPE_BDDP)
+        return Class::Control;
+    return ret;
+}
+
+const char* PacketInAdmission::name(Class c)
+{
+    switch (c) {
+    case Class::Control: return "control";
+    case Class::TableMiss: return "table-miss";
+    case Class::Inspect: return "inspect";
+    }
+    return "unknown";
+}
+
+PacketInAdmission::Policy PacketInAdmission::parse_policy(const std::string& name)
+{
+    if (name == "drop")
+        return Policy::Drop;
+    if (name == "sample")
+        return Policy::Sample;
+    if (name == "buffer")
+        return Policy::Buffer;
+    RUNOS_THROW(invalid_argument() <<
+                errinfo_str("Unknown packet-in admission policy " + name));
+}
+
+double PacketInAdmission::reserve(const TokenBucket& bucket, Class c) const
+{
+    // A full bucket always has a token for any class
+    return (bucket.burst() - 1) * m_settings.reserve * static_cast<size_t>(c);
+}
+
+bool PacketInAdmission::take(Switch& sw, Class c, clock::time_point now)
+{
+    if (not sw.bucket.take(reserve(sw.bucket, c), now))
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_global_mutex);
+    if (not m_global.take(reserve(m_global, c), now)) {
+        sw.bucket.give_back();
+        return false;
+    }
+    return true;
+}
+
+PacketInAdmission::Verdict
+PacketInAdmission::admit(Switch& sw, Class c,
+                         const uint8_t* msg, size_t len,
+                         clock::time_point now)
+{
+    auto& stats = m_stats[static_cast<size_t>(c)];
+
+    // Don't overtake packets waiting in the buffer
+    if (sw.queue[static_cast<size_t>(c)].empty() && take(sw, c, now)) {
+        ++stats.admitted;
+        return Verdict::Admit;
+    }
+
+    switch (m_settings.policy) {
+    case Policy::Drop:
+        break;
+    case Policy::Sample:
+        if (++sw.over_limit % m_settings.sample_every == 0) {
+            ++stats.sampled;
+            return Verdict::Admit;
+        }
+        break;
+    case Policy::Buffer:
+        if (sw.buffered < m_settings.buffer_size) {
+            sw.queue[static_cast<size_t>(c)].emplace_back(msg, msg + len);
+            ++sw.buffered;
+            ++stats.buffered;
+            return Verdict::Buffered;
+        }
+        break;
+    }
+
+    ++stats.dropped;
+    return Verdict::Drop;
+}
+
+PacketInAdmission::Stats PacketInAdmission::stats() const
+{
+    Stats ret;
+    for (size_t c = 0; c < nclasses; ++c) {
+        ret[c].admitted = m_stats[c].admitted;
+        ret[c].dropped = m_stats[c].dropped;
+        ret[c].sampled = m_stats[c].sampled;
+        ret[c].buffered = m_stats[c].buffered;
+        ret[c].replayed = m_stats[c].replayed;
+    }
+    return ret;
+}
+
+} // namespace runos
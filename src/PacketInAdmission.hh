@@ -0,0 +1,182 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** @file */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace runos {
+
+/**
+ * Token bucket refilled continuously at `rate` tokens per second
+ * up to `burst` tokens. Zero rate means unlimited.
+ */
+class TokenBucket {
+public:
+    using clock = std::chrono::steady_clock;
+
+    TokenBucket(double rate = 0, double burst = 0);
+
+    /** Takes a token if more than `reserve` tokens would remain */
+    bool take(double reserve, clock::time_point now);
+
+    /** Returns a token taken in vain */
+    void give_back();
+
+    double rate() const { return m_rate; }
+    double burst() const { return m_burst; }
+
+private:
+    double m_rate;
+    double m_burst;
+    double m_tokens;
+    clock::time_point m_last;
+};
+
+/**
+ * Packet-in admission control in front of the packet-in handlers.
+ *
+ * Packet-ins are classified from raw bytes before decoding and must get
+ * a token both from their switch's bucket and the global one. Lower
+ * classes can't take the last tokens of a bucket, so under overload
+ * control traffic is served first, then table-misses, then inspected
+ * packets. What happens to packets over the limit depends on the policy.
+ */
+class PacketInAdmission {
+public:
+    using clock = TokenBucket::clock;
+
+    /** In order of priority */
+    enum class Class : uint8_t { Control, TableMiss, Inspect };
+    static constexpr size_t nclasses = 3;
+
+    enum class Policy : uint8_t {
+        Drop,   ///< drop packets over the limit
+        Sample, ///< let one of every `sample_every` packets over the limit in
+        Buffer  ///< keep packets over the limit until tokens are available
+    };
+
+    enum class Verdict : uint8_t { Admit, Drop, Buffered };
+
+    struct Settings {
+        bool enabled = false;
+        Policy policy = Policy::Drop;
+        double switch_rate = 0;
+        double switch_burst = 0;
+        double global_rate = 0;
+        double global_burst = 0;
+        // Share of a bucket each class leaves to higher classes
+        double reserve = 0.2;
+        unsigned sample_every = 100;
+        size_t buffer_size = 256; // per switch
+        // Buffered packets of quiet switches are drained this often, ms
+        unsigned drain_interval = 100;
+    };
+
+    struct ClassStats {
+        uint64_t admitted = 0;
+        uint64_t dropped = 0;
+        uint64_t sampled = 0;
+        uint64_t buffered = 0;
+        uint64_t replayed = 0;
+    };
+
+    using Stats = std::array<ClassStats, nclasses>;
+
+    /**
+     * Per-switch state. Used only by the worker thread of the
+     * switch connection.
+     */
+    class Switch {
+        friend class PacketInAdmission;
+        TokenBucket bucket;
+        std::array<std::deque<std::vector<uint8_t>>, nclasses> queue;
+        size_t buffered {0};
+        unsigned over_limit {0};
+    public:
+        explicit Switch(const Settings& settings);
+        bool has_buffered() const { return buffered != 0; }
+    };
+
+    PacketInAdmission();
+    explicit PacketInAdmission(Settings settings);
+
+    const Settings& settings() const { return m_settings; }
+    bool enabled() const { return m_settings.enabled; }
+
+    /** Classifies a raw OFPT_PACKET_IN message */
+    static Class classify(const uint8_t* msg, size_t len);
+
+    static const char* name(Class c);
+    static Policy parse_policy(const std::string& name);
+
+    /**
+     * Admits the packet-in, or applies the overload policy to it.
+     * Buffered verdict means the message was copied.
+     */
+    Verdict admit(Switch& sw, Class c,
+                  const uint8_t* msg, size_t len,
+                  clock::time_point now = clock::now());
+
+    /**
+     * Passes buffered packet-ins to `replay` in priority order
+     * while there are tokens for them.
+     */
+    template<class F>
+    void drain(Switch& sw, F&& replay, clock::time_point now = clock::now())
+    {
+        for (size_t c = 0; c < nclasses && sw.buffered != 0; ++c) {
+            auto& queue = sw.queue[c];
+            while (not queue.empty() && take(sw, Class(c), now)) {
+                std::vector<uint8_t> msg = std::move(queue.front());
+                queue.pop_front();
+                --sw.buffered;
+                ++m_stats[c].replayed;
+                replay(msg);
+            }
+        }
+    }
+
+    Stats stats() const;
+
+private:
+    struct AtomicStats {
+        std::atomic<uint64_t> admitted {0};
+        std::atomic<uint64_t> dropped {0};
+        std::atomic<uint64_t> sampled {0};
+        std::atomic<uint64_t> buffered {0};
+        std::atomic<uint64_t> replayed {0};
+    };
+
+    Settings m_settings;
+    std::mutex m_global_mutex;
+    TokenBucket m_global;
+    std::array<AtomicStats, nclasses> m_stats;
+
+    double reserve(const TokenBucket& bucket, Class c) const;
+    bool take(Switch& sw, Class c, clock::time_point now);
+};
+
+} // namespace runos
@@ -1,5 +1,6 @@
 #include "PacketParser.hh"
 
+#include <cstddef>
 #include <cstring>
 #include <algorithm>
 
@@ -25,124 +26,104 @@ using ofb = of::oxm::basic_match_fields;
 using non_of = of::oxm::non_openflow_fields;
 
 
-// TODO: make it more safe
-// add size-checking of passed oxm type against field size
-void PacketParser::bind(ofb_binding_list new_bindings)
-{
-    for (const auto& binding : new_bindings) {
-        auto id = static_cast<size_t>(binding.first);
-        if (ofb_bindings.at(id)) {
-            RUNOS_THROW(
-                    invalid_argument() <<
-                    errinfo_msg("Trying to bind already binded field") <<
-                    errinfo_oxm_ns(uint16_t(of::oxm::ns::OPENFLOW_BASIC)) <<
-                    errinfo_oxm_field(id));
-        }
-        ofb_bindings.at(id) = binding.second;
-    }
-}
+namespace {
 
-void PacketParser::rebind(ofb_binding_list new_bindings)
+// Layer which binds the field, NONE for fields the parser doesn't know
+constexpr uint8_t layer_of(size_t id)
 {
-    for (const auto& binding : new_bindings) {
-        auto id = static_cast<size_t>(binding.first);
-        if (!ofb_bindings.at(id)) {
-            RUNOS_THROW(
-                    invalid_argument() <<
-                    errinfo_msg("Trying to rebind unbinded field") <<
-                    errinfo_oxm_ns(uint16_t(of::oxm::ns::OPENFLOW_BASIC)) <<
-                    errinfo_oxm_field(id));
-        }
-        ofb_bindings.at(id) = binding.second;
+    switch (static_cast<ofb>(id)) {
+    case ofb::ETH_DST:
+    case ofb::ETH_SRC:
+    case ofb::ETH_TYPE:
+    case ofb::VLAN_VID:
+        return 0;
+    case ofb::IP_PROTO:
+    case ofb::IPV4_SRC:
+    case ofb::IPV4_DST:
+    case ofb::ARP_OP:
+    case ofb::ARP_SPA:
+    case ofb::ARP_TPA:
+    case ofb::ARP_SHA:
+    case ofb::ARP_THA:
+    case ofb::IPV6_SRC:
+    case ofb::IPV6_DST:
+        return 1;
+    case ofb::TCP_SRC:
+    case ofb::TCP_DST:
+    case ofb::UDP_SRC:
+    case ofb::UDP_DST:
+    case ofb::ICMPV4_TYPE:
+    case ofb::ICMPV4_CODE:
+        return 2;
+    default:
+        return 3;
     }
 }
 
-void PacketParser::bind(nonof_binding_list new_bindings)
-{
-    for (const auto& binding : new_bindings) {
-        auto id = static_cast<size_t>(binding.first);
-        if (nonof_bindings.at(id)) {
-            RUNOS_THROW(
-                    invalid_argument() <<
-                    errinfo_msg("Trying to bind already binded field") <<
-                    errinfo_oxm_ns(uint16_t(of::oxm::ns::NON_OPENFLOW)) <<
-                    errinfo_oxm_field(id));
-        }
-        nonof_bindings.at(id) = binding.second;
-    }
-}
+} // namespace
 
-void PacketParser::rebind(nonof_binding_list new_bindings)
+void PacketParser::bind(ofb_binding_list new_bindings) const
 {
-    for (const auto& binding : new_bindings) {
-        auto id = static_cast<size_t>(binding.first);
-        if (!nonof_bindings.at(id)) {
-            RUNOS_THROW(
-                    invalid_argument() <<
-                    errinfo_msg("Trying to rebind unbinded field") <<
-                    errinfo_oxm_ns(uint16_t(of::oxm::ns::NON_OPENFLOW)) <<
-                    errinfo_oxm_field(id));
-        }
-        nonof_bindings.at(id) = binding.second;
-    }
+    for (const auto& binding : new_bindings)
+        ofb_offsets[static_cast<size_t>(binding.first)] = binding.second + 1;
 }
 
-
-void PacketParser::parse_l2(uint8_t* data, size_t data_len)
+void PacketParser::parse_l2()
 {
-    uint16_t type = 0; // For adequate compile
-    size_t len = 0; // For adequate compile
-    if (sizeof(ethernet_hdr) <= data_len) {
-        eth = reinterpret_cast<ethernet_hdr*>(data);
-        if (eth->type == 0x8100){
-            if (sizeof(dot1q_hdr) <= data_len ){
-                dot1q = reinterpret_cast<dot1q_hdr*>(data);
-                bind({
-                    { ofb::ETH_TYPE, &dot1q->type },
-                    { ofb::ETH_SRC, &dot1q->src },
-                    { ofb::ETH_DST, &dot1q->dst },
-                    { ofb::VLAN_VID, &dot1q->tci } //fix this
-                });
-                type = dot1q->type;
-                len = dot1q->header_length();
-            }
-        } else {
-            bind({
-                { ofb::ETH_TYPE, &eth->type },
-                { ofb::ETH_SRC, &eth->src },
-                { ofb::ETH_DST, &eth->dst }
-            });
-            type = eth->type;
-            len = eth->header_length();
-        }
-    parse_l3(type,
-             static_cast<uint8_t*>(data) + len,
-             data_len - len);
+    if (sizeof(ethernet_hdr) > data_len)
+        return;
+
+    auto eth = reinterpret_cast<const ethernet_hdr*>(data);
+    if (eth->type == 0x8100) {
+        if (sizeof(dot1q_hdr) > data_len)
+            return;
+        bind({
+            { ofb::ETH_TYPE, offsetof(dot1q_hdr, type) },
+            { ofb::ETH_SRC, offsetof(dot1q_hdr, src) },
+            { ofb::ETH_DST, offsetof(dot1q_hdr, dst) },
+            { ofb::VLAN_VID, offsetof(dot1q_hdr, tci) } //fix this
+        });
+        auto dot1q = reinterpret_cast<const dot1q_hdr*>(data);
+        next_type = dot1q->type;
+        next_offset = dot1q->header_length();
+    } else {
+        bind({
+            { ofb::ETH_TYPE, offsetof(ethernet_hdr, type) },
+            { ofb::ETH_SRC, offsetof(ethernet_hdr, src) },
+            { ofb::ETH_DST, offsetof(ethernet_hdr, dst) }
+        });
+        next_type = eth->type;
+        next_offset = eth->header_length();
     }
 }
 
-void PacketParser::parse_l3(uint16_t eth_type, uint8_t* data, size_t data_len)
+void PacketParser::parse_l3() const
 {
+    size_t off = next_offset;
+    size_t len = data_len - off;
+    uint16_t eth_type = next_type;
+    parsed = L3;
+    next_type = 0;
+
     switch (eth_type) {
     case 0x0800: // ipv4
-        if (sizeof(ipv4_hdr) <= data_len) {
-            ipv4 = reinterpret_cast<ipv4_hdr*>(data);
+        if (sizeof(ipv4_hdr) <= len) {
+            auto ipv4 = reinterpret_cast<const ipv4_hdr*>(data + off);
             bind({
-                { ofb::IP_PROTO, &ipv4->protocol },
-                { ofb::IPV4_SRC, &ipv4->src },
-                { ofb::IPV4_DST, &ipv4->dst }
+                { ofb::IP_PROTO, off + offsetof(ipv4_hdr, protocol) },
+                { ofb::IPV4_SRC, off + offsetof(ipv4_hdr, src) },
+                { ofb::IPV4_DST, off + offsetof(ipv4_hdr, dst) }
             });
 
-            if (data_len > ipv4->header_length()) {
-                parse_l4(ipv4->protocol,
-                         data + ipv4->header_length(),
-                         data_len - ipv4->header_length());
+            if (len > ipv4->header_length()) {
+                next_type = ipv4->protocol;
+                next_offset = off + ipv4->header_length();
             }
         }
         break;
     case 0x0806: // arp
-        if (sizeof(arp_hdr) <= data_len) {
-            arp = reinterpret_cast<arp_hdr*>(data);
+        if (sizeof(arp_hdr) <= len) {
+            auto arp = reinterpret_cast<const arp_hdr*>(data + off);
             if (arp->htype != 1 ||
                 arp->ptype != 0x0800 ||
                 arp->hlen != 6 ||
@@ -150,59 +131,62 @@ void PacketParser::parse_l3(uint16_t eth_type, uint8_t* data, size_t data_len)
                 break;
 
             bind({
-                { ofb::ARP_OP, &arp->oper },
-                { ofb::ARP_SHA, &arp->sha },
-                { ofb::ARP_THA, &arp->tha },
-                { ofb::ARP_SPA, &arp->spa },
-                { ofb::ARP_TPA, &arp->tpa }
+                { ofb::ARP_OP, off + offsetof(arp_hdr, oper) },
+                { ofb::ARP_SHA, off + offsetof(arp_hdr, sha) },
+                { ofb::ARP_THA, off + offsetof(arp_hdr, tha) },
+                { ofb::ARP_SPA, off + offsetof(arp_hdr, spa) },
+                { ofb::ARP_TPA, off + offsetof(arp_hdr, tpa) }
             });
         }
         break;
     case 0x86dd: // ipv6
-        if (sizeof(ipv6_hdr) <= data_len){
-            ipv6 = reinterpret_cast<ipv6_hdr*>(data);
+        if (sizeof(ipv6_hdr) <= len) {
+            auto ipv6 = reinterpret_cast<const ipv6_hdr*>(data + off);
             bind({
-                { ofb::IPV6_SRC, &ipv6->src1 },
-                { ofb::IPV6_DST, &ipv6->dst1 },
-                { ofb::IP_PROTO, &ipv6->protocol }
+                { ofb::IPV6_SRC, off + offsetof(ipv6_hdr, src1) },
+                { ofb::IPV6_DST, off + offsetof(ipv6_hdr, dst1) },
+                { ofb::IP_PROTO, off + offsetof(ipv6_hdr, protocol) }
             });
-        }
-        if (data_len > ipv6->header_length()){
-            parse_l4(ipv6->protocol,
-                     data + ipv6->header_length(),
-                     data_len - ipv6->header_length());
+
+            if (len > ipv6->header_length()) {
+                next_type = ipv6->protocol;
+                next_offset = off + ipv6->header_length();
+            }
         }
         break;
     }
 }
 
-void PacketParser::parse_l4(uint8_t protocol, uint8_t* data, size_t data_len)
+void PacketParser::parse_l4() const
 {
+    size_t off = next_offset;
+    size_t len = data_len - off;
+    uint16_t protocol = next_type;
+    parsed = L4;
+    next_type = 0;
+
     switch (protocol) {
     case 0x06: // tcp
-        if (sizeof(tcp_hdr) <= data_len) {
-            tcp = reinterpret_cast<tcp_hdr*>(data);
+        if (sizeof(tcp_hdr) <= len) {
             bind({
-                { ofb::TCP_SRC, &tcp->src },
-                { ofb::TCP_DST, &tcp->dst }
+                { ofb::TCP_SRC, off + offsetof(tcp_hdr, src) },
+                { ofb::TCP_DST, off + offsetof(tcp_hdr, dst) }
             });
         }
         break;
     case 0x11: // udp
-        if (sizeof(udp_hdr) <= data_len) {
-            udp = reinterpret_cast<udp_hdr*>(data);
+        if (sizeof(udp_hdr) <= len) {
             bind({
-                { ofb::UDP_SRC, &udp->src },
-                { ofb::UDP_DST, &udp->dst }
+                { ofb::UDP_SRC, off + offsetof(udp_hdr, src) },
+                { ofb::UDP_DST, off + offsetof(udp_hdr, dst) }
             });
         }
         break;
     case 0x01: // icmp
-        if (sizeof(icmp_hdr) <= data_len) {
-            icmp = reinterpret_cast<icmp_hdr*>(data);
+        if (sizeof(icmp_hdr) <= len) {
             bind({
-                { ofb::ICMPV4_TYPE, &icmp->type },
-                { ofb::ICMPV4_CODE, &icmp->code }
+                { ofb::ICMPV4_TYPE, off + offsetof(icmp_hdr, type) },
+                { ofb::ICMPV4_CODE, off + offsetof(icmp_hdr, code) }
             });
         }
         break;
@@ -215,64 +199,55 @@ PacketParser::PacketParser(fluid_msg::of13::PacketIn& pi, uint64_t dpid, uint32_
     , in_port(pi.match().in_port()->value())
     , out_port(out)
     , switch_id(dpid)
+    , next_offset(0)
+    , next_type(0)
 {
-    ofb_bindings.fill(nullptr);
-    nonof_bindings.fill(nullptr);
-    bind({
-        { ofb::IN_PORT, &in_port }
-    });
-    bind({
-        { non_of::SWITCH_ID, &switch_id }
-    });
-    bind({
-        { non_of::OUT_PORT, &out_port }
-    });
-
+    ofb_offsets.fill(0);
+    parsed = L2;
     if (data) {
-        parse_l2(data, data_len);
+        parse_l2();
     }
 }
 
 uint8_t* PacketParser::access(oxm::type t) const
 {
-    uint8_t* ret(nullptr);
     switch (t.ns()){
         case unsigned(of::oxm::ns::OPENFLOW_BASIC) :
-            if (t.id() >= ofb_bindings.size() || !ofb_bindings[t.id()]) {
-                RUNOS_THROW(
-                        out_of_range() <<
-                        errinfo_msg("Unsupported oxm field") <<
-                        errinfo_oxm_ns(t.ns()) <<
-                        errinfo_oxm_field(t.id()));
+            if (t.id() == unsigned(ofb::IN_PORT))
+                return (uint8_t*) &in_port;
+            if (t.id() < ofb_offsets.size()) {
+                uint8_t layer = layer_of(t.id());
+                while (not ofb_offsets[t.id()] && layer != NONE &&
+                       parsed < layer) {
+                    if (parsed == L2)
+                        parse_l3();
+                    else
+                        parse_l4();
+                }
+                if (ofb_offsets[t.id()])
+                    return data + ofb_offsets[t.id()] - 1;
             }
-            ret =  (uint8_t*) ofb_bindings[t.id()];
-        break;
+            RUNOS_THROW(
+                    out_of_range() <<
+                    errinfo_msg("Unsupported oxm field") <<
+                    errinfo_oxm_ns(t.ns()) <<
+                    errinfo_oxm_field(t.id()));
         case unsigned(of::oxm::ns::NON_OPENFLOW) :
-             if (t.id() >= nonof_bindings.size() || !nonof_bindings[t.id()]) {
-                RUNOS_THROW(
-                        out_of_range() <<
-                        errinfo_msg("Unsupported oxm field") <<
-                        errinfo_oxm_ns(t.ns()) <<
-                        errinfo_oxm_field(t.id()));
-            }
-            ret =  (uint8_t*) nonof_bindings[t.id()];
-        break;
+            if (t.id() == unsigned(non_of::SWITCH_ID))
+                return (uint8_t*) &switch_id;
+            if (t.id() == unsigned(non_of::OUT_PORT))
+                return (uint8_t*) &out_port;
+            RUNOS_THROW(
+                    out_of_range() <<
+                    errinfo_msg("Unsupported oxm field") <<
+                    errinfo_oxm_ns(t.ns()) <<
+                    errinfo_oxm_field(t.id()));
         default:
             RUNOS_THROW(
                     out_of_range() <<
                     errinfo_msg("Unsupported oxm namespace") <<
                     errinfo_oxm_ns(t.ns()));
-        break;
-    }
-    if ( !ret ){
-        RUNOS_THROW(
-                out_of_range() <<
-                errinfo_msg("Couldn't find value") <<
-                errinfo_oxm_ns(t.ns()) <<
-                errinfo_oxm_field(t.id()));
     }
-    return ret;
-
 }
 
 oxm::field<> PacketParser::load(oxm::mask<> mask) const
@@ -288,6 +263,31 @@ void PacketParser::modify(oxm::field<> patch)
     updated.value_bits().to_buffer(access(patch.type()));
 }
 
+// Fields are bound in network byte order, like bits<>(nbits, buffer)
+bool PacketParser::load_word(oxm::type t, uint64_t& value) const
+{
+    if (t.nbits() > 64)
+        return false;
+    const uint8_t* field = access(t);
+    uint64_t ret = 0;
+    for (size_t i = 0; i < t.nbytes(); ++i)
+        ret = (ret << 8) | field[i];
+    value = ret & oxm::word_mask(t.nbits());
+    return true;
+}
+
+bool PacketParser::modify_word(oxm::type t, uint64_t value, uint64_t mask)
+{
+    uint64_t word;
+    if (not PacketParser::load_word(t, word))
+        return false;
+    word = (word & ~mask) | value;
+    uint8_t* field = access(t);
+    for (size_t i = t.nbytes(); i-- > 0; word >>= 8)
+        field[i] = uint8_t(word);
+    return true;
+}
+
 size_t PacketParser::serialize_to(size_t buffer_size, void* buffer) const
 {
     size_t copied = std::min(data_len, buffer_size);
@@ -9,7 +9,6 @@
 #include <boost/endian/arithmetic.hpp>
 
 #include "api/SerializablePacket.hh"
-#include "types/checked_ptr.hh"
 #include "openflow/common.hh"
 
 namespace fluid_msg {
@@ -28,42 +27,30 @@ class PacketParser final : public SerializablePacket {
     boost::endian::big_uint32_t out_port;
     boost::endian::big_uint64_t switch_id;
 
-    //ofb_bindings
-    typedef std::array<void*, 40> ofb_bindings_arr;
-    ofb_bindings_arr ofb_bindings;
-
-    //non openflow bindings
-    typedef std::array<void*, 20> nonof_bindings_arr;
-    nonof_bindings_arr nonof_bindings;
-
-    // replace with
-    checked_ptr<struct ethernet_hdr> eth;
-    checked_ptr<struct ipv4_hdr> ipv4;
-    checked_ptr<struct ipv6_hdr> ipv6;
-    checked_ptr<struct tcp_hdr> tcp;
-    checked_ptr<struct udp_hdr> udp;
-    checked_ptr<struct arp_hdr> arp;
-    checked_ptr<struct dot1q_hdr> dot1q;
-    checked_ptr<struct icmp_hdr> icmp;
-
-    void parse_l2(uint8_t* data, size_t data_len);
-    void parse_l3(uint16_t eth_type, uint8_t* data, size_t data_len);
-    void parse_l4(uint8_t protocol, uint8_t* data, size_t data_len);
+    // Only the ethernet header is parsed up front. Deeper layers are
+    // parsed on the first access to one of their fields, so loads
+    // change the parser, which isn't thread-safe.
+    enum layer : uint8_t { L2, L3, L4, NONE };
+    mutable layer parsed;
+    // the next layer to parse: where it starts and its ether type
+    // or ip protocol
+    mutable uint16_t next_offset;
+    mutable uint16_t next_type;
+
+    // Offsets of the openflow basic fields in data plus one, zero for
+    // fields the parsed layers don't have
+    typedef std::array<uint16_t, 40> ofb_offsets_arr;
+    mutable ofb_offsets_arr ofb_offsets;
+
+    void parse_l2();
+    void parse_l3() const;
+    void parse_l4() const;
 
     using ofb_binding_list =
-        std::initializer_list<std::pair<of::oxm::basic_match_fields, void*>>;
-
-    using nonof_binding_list =
-        std::initializer_list<std::pair<of::oxm::non_openflow_fields, void*>>;
+        std::initializer_list<std::pair<of::oxm::basic_match_fields, size_t>>;
 
-
-    // openflow basic bindings
-    void bind(ofb_binding_list ofb_bindings);
-    void rebind(ofb_binding_list ofb_bindings);
-
-    // non openflow bindings
-    void bind(nonof_binding_list nonof_bindings);
-    void rebind(nonof_binding_list nonof_bindings);
+    // binds fields to offsets in data
+    void bind(ofb_binding_list ofb_bindings) const;
 
     uint8_t* access(oxm::type t) const;
 
@@ -74,6 +61,9 @@ public:
     oxm::field<> load(oxm::mask<> mask) const override;
     void modify(oxm::field<> patch) override;
 
+    bool load_word(oxm::type t, uint64_t& value) const override;
+    bool modify_word(oxm::type t, uint64_t value, uint64_t mask) override;
+
     size_t total_bytes() const override;
     size_t serialize_to(size_t buffer_size, void* buffer) const override;
 
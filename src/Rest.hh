@@ -36,6 +36,12 @@ enum Method {
 
 typedef std::pair<Method, std::string> RestReq;
 
+/// Counter as a json number, json11 numbers are doubles
+inline json11::Json json_counter(uint64_t value)
+{
+    return static_cast<double>(value);
+}
+
 /**
  * RuNOS supports REST API, and you may write you own REST Application by using RestHandler
  */
@@ -19,6 +19,8 @@
 #include "RestListener.hh"
 #include "RestStringProcessing.hh"
 
+#include "types/exception.hh"
+#include <boost/exception/get_error_info.hpp>
 #include <boost/lexical_cast.hpp>
 #include <algorithm>
 
@@ -28,6 +30,17 @@
 
 REGISTER_APPLICATION(RestMultipart, {"controller", "switch-manager", "rest-listener", ""})
 
+namespace {
+
+std::string errorMessage(const runos::runtime_error &e)
+{
+    if (auto msg = boost::get_error_info<runos::errinfo_str>(e))
+        return *msg;
+    return "Some error on request handling";
+}
+
+}
+
 void RestMultipart::init(Loader *loader, const Config &rootConfig)
 {
     ctrl_ = Controller::get(loader);
@@ -45,8 +58,10 @@ void RestMultipart::init(Loader *loader, const Config &rootConfig)
     // TODO: test (mn does not support queues)
     acceptPath(Method::GET, "queue/" DPID_ "/" PORTNUMBER_ALL_ "/" QUEUEID_ALL_);
 
-    transaction_ = ctrl_->registerStaticTransaction(this);
+    transaction_ = ctrl_->registerTransaction(this);
     connect(transaction_, &OFTransaction::response, this, &RestMultipart::onResponse);
+    connect(transaction_, &OFTransaction::error, this, &RestMultipart::onFailure);
+    connect(transaction_, &OFTransaction::timeout, this, &RestMultipart::onTimeout);
 }
 
 json11::Json RestMultipart::handleGET(std::vector<std::string> params, std::string body)
@@ -56,14 +71,14 @@ json11::Json RestMultipart::handleGET(std::vector<std::string> params, std::stri
     try {
         if (params[0] == "flow") {
             sendGetRequest(of13::MultipartRequestFlow{}, boost::lexical_cast<uint64_t>(params[1]));
-            pause.exec();
+            wait(pause);
             return json11::Json::object{
                     {params[1], toJson(responseFlow_)}
             };
         }
         if (params[0] == "port") {
             sendGetRequest(of13::MultipartRequestPortStats{}, boost::lexical_cast<uint64_t>(params[1]), params[2]);
-            pause.exec();
+            wait(pause);
             return json11::Json::object{
                     {params[1], toJson(responsePort_)}
             };
@@ -77,28 +92,28 @@ json11::Json RestMultipart::handleGET(std::vector<std::string> params, std::stri
                 return arr;
             }
             sendGetRequest(of13::MultipartRequestDesc{}, boost::lexical_cast<uint64_t>(params[1]));
-            pause.exec();
+            wait(pause);
             return json11::Json::object{
                     {params[1], toJson(responseSwitchDesc_)}
             };
         }
         if (params[0] == "aggregate-flow") {
             sendGetRequest(of13::MultipartRequestAggregate{}, boost::lexical_cast<uint64_t>(params[1]));
-            pause.exec();
+            wait(pause);
             return json11::Json::object{
                     {params[1], toJson(responseAggregate_)}
             };
         }
         if (params[0] == "table") {
             sendGetRequest(of13::MultipartRequestTable{}, boost::lexical_cast<uint64_t>(params[1]));
-            pause.exec();
+            wait(pause);
             return json11::Json::object{
                     {params[1], toJson(responseTable_)}
             };
         }
         if (params[0] == "port-desc") {
             sendGetRequest(of13::MultipartRequestPortDescription{}, boost::lexical_cast<uint64_t>(params[1]));
-            pause.exec();
+            wait(pause);
             return json11::Json::object{
                     {params[1], toJson(responsePortDesc_)}
             };
@@ -106,11 +121,15 @@ json11::Json RestMultipart::handleGET(std::vector<std::string> params, std::stri
         if (params[0] == "queue") {
             sendGetRequest(of13::MultipartRequestQueue{}, boost::lexical_cast<uint64_t>(params[1]), params[2],
                            params[3]);
-            pause.exec();
+            wait(pause);
             return json11::Json::object{
                     {params[1], toJson(responseQueue_)}
             };
         }
+    } catch (const runos::runtime_error &e) {
+        return json11::Json::object{
+                {"RestMultipart", errorMessage(e)}
+        };
     } catch (...) {
         return json11::Json::object{
             {"RestMultipart", "incorrect request"}
@@ -133,7 +152,7 @@ json11::Json RestMultipart::handlePOST(std::vector<std::string> params, std::str
 
         if (params[0] == "flow") {
             sendPostRequest(of13::MultipartRequestFlow{}, boost::lexical_cast<uint64_t>(params[1]), req);
-            pause.exec();
+            wait(pause);
             return json11::Json::object{
                     {params[1], toJson(responseFlow_)}
             };
@@ -141,7 +160,7 @@ json11::Json RestMultipart::handlePOST(std::vector<std::string> params, std::str
         // todo: test. Does ovs support sending aggregate flows stats filtered by fields? Guess, no.
         if (params[0] == "aggregate-flow") {
             sendPostRequest(of13::MultipartRequestAggregate{}, boost::lexical_cast<uint64_t>(params[1]), req);
-            pause.exec();
+            wait(pause);
             return json11::Json::object{
                     {params[1], toJson(responseAggregate_)}
             };
@@ -150,6 +169,10 @@ json11::Json RestMultipart::handlePOST(std::vector<std::string> params, std::str
         return json11::Json::object{
                 {"RestMultipart", errMsg.c_str()}
         };
+    } catch (const runos::runtime_error &e) {
+        return json11::Json::object{
+                {"RestMultipart", errorMessage(e)}
+        };
     } catch (...) {
         return json11::Json::object{
                 {"RestMultipart", "Some error on request handling"}
@@ -173,7 +196,7 @@ void RestMultipart::sendGetRequest(of13::MultipartRequestFlow &&req, uint64_t dp
     req.cookie(0x0);  // match: cookie & mask == field.cookie & mask
     req.cookie_mask(0x0);
     req.flags(0);
-    transaction_->request(sw->connection(), req);
+    xid_ = transaction_->request(sw->connection(), req);
 }
 
 void RestMultipart::sendGetRequest(of13::MultipartRequestPortStats &&req,
@@ -191,7 +214,7 @@ void RestMultipart::sendGetRequest(of13::MultipartRequestPortStats &&req,
         req.port_no(of13::OFPP_ANY);
     }
     req.flags(0);
-    transaction_->request(sw->connection(), req);
+    xid_ = transaction_->request(sw->connection(), req);
 }
 
 void RestMultipart::sendGetRequest(of13::MultipartRequestDesc &&req, uint64_t dpid)
@@ -202,7 +225,7 @@ void RestMultipart::sendGetRequest(of13::MultipartRequestDesc &&req, uint64_t dp
     }
 
     req.flags(0);
-    transaction_->request(sw->connection(), req);
+    xid_ = transaction_->request(sw->connection(), req);
 }
 
 void RestMultipart::sendGetRequest(of13::MultipartRequestAggregate &&req, uint64_t dpid)
@@ -219,7 +242,7 @@ void RestMultipart::sendGetRequest(of13::MultipartRequestAggregate &&req, uint64
     req.cookie(0x0);
     req.cookie_mask(0x0);
     req.flags(0);
-    transaction_->request(sw->connection(), req);
+    xid_ = transaction_->request(sw->connection(), req);
 }
 
 void RestMultipart::sendGetRequest(of13::MultipartRequestTable &&req, uint64_t dpid)
@@ -230,7 +253,7 @@ void RestMultipart::sendGetRequest(of13::MultipartRequestTable &&req, uint64_t d
     }
 
     req.flags(0);
-    transaction_->request(sw->connection(), req);
+    xid_ = transaction_->request(sw->connection(), req);
 }
 
 void RestMultipart::sendGetRequest(of13::MultipartRequestPortDescription &&req, uint64_t dpid)
@@ -241,7 +264,7 @@ void RestMultipart::sendGetRequest(of13::MultipartRequestPortDescription &&req,
     }
 
     req.flags(0);
-    transaction_->request(sw->connection(), req);
+    xid_ = transaction_->request(sw->connection(), req);
 }
 
 void RestMultipart::sendGetRequest(of13::MultipartRequestQueue &&req,
@@ -266,7 +289,7 @@ void RestMultipart::sendGetRequest(of13::MultipartRequestQueue &&req,
         req.queue_id(0xFFFFFFFF);
     }
     req.flags(0);
-    transaction_->request(sw->connection(), req);
+    xid_ = transaction_->request(sw->connection(), req);
 }
 
 
@@ -294,7 +317,7 @@ void RestMultipart::sendPostRequest(of13::MultipartRequestFlow &&mpReq,
         const auto &matches = req.at("match").object_items();
         processMatches(mpReq, matches);
     }
-    transaction_->request(sw_m_->getSwitch(dpid)->connection(), mpReq);
+    xid_ = transaction_->request(sw->connection(), mpReq);
 }
 
 // note: same as for of13::MultipartRequestFlow
@@ -313,11 +336,45 @@ void RestMultipart::sendPostRequest(of13::MultipartRequestAggregate &&mpReq,
         const auto &matches = req.at("match").object_items();
         processMatches(mpReq, matches);
     }
-    transaction_->request(sw->connection(), mpReq);
+    xid_ = transaction_->request(sw->connection(), mpReq);
+}
+
+void RestMultipart::wait(QEventLoop &pause)
+{
+    failure_.clear();
+    pause.exec();
+    if (!failure_.empty()) {
+        RUNOS_THROW(runos::runtime_error() << runos::errinfo_str(failure_));
+    }
+}
+
+void RestMultipart::onFailure(SwitchConnectionPtr conn, std::shared_ptr<OFMsgUnion> error)
+{
+    if (error->base()->xid() != xid_) {
+        return;
+    }
+    of13::Error &e = error->error;
+    failure_ = "switch reports error: type " + std::to_string(e.type()) +
+               " code " + std::to_string(e.code());
+    emit ResponseHandlingFinished();
+}
+
+void RestMultipart::onTimeout(SwitchConnectionPtr conn, uint32_t xid)
+{
+    if (xid != xid_) {
+        return;
+    }
+    failure_ = "switch didn't respond in time";
+    emit ResponseHandlingFinished();
 }
 
 void RestMultipart::onResponse(SwitchConnectionPtr conn, std::shared_ptr<OFMsgUnion> reply)
 {
+    // a late reply to a request that already timed out
+    if (reply->base()->xid() != xid_) {
+        return;
+    }
+
     auto type = reply->base()->type();
     if (type != of13::OFPT_MULTIPART_REPLY) {
         LOG(ERROR) << "Unexpected response of type " << type  << " received, expected OFPT_MULTIPART_REPLY";
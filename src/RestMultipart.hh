@@ -44,6 +44,8 @@
  *           - handler (`onResponse`) updated variable that corresponds to the reply type(of13::MultipartReplyFlow replyFlow, for example)
  *           - handler wakes up `handleGET` method
  *       - responding to the user
+ *
+ * Every request has its own xid, so a late reply to a timed out request is ignored.
  */
 class RestMultipart : public Application, RestHandler {
 Q_OBJECT
@@ -59,6 +61,9 @@ public:
 protected slots:
     /// called on switch's response
     void onResponse(SwitchConnectionPtr conn, std::shared_ptr<OFMsgUnion> reply);
+    /// called when the switch reports an error or doesn't respond in time
+    void onFailure(SwitchConnectionPtr conn, std::shared_ptr<OFMsgUnion> error);
+    void onTimeout(SwitchConnectionPtr conn, uint32_t xid);
 signals:
     // emitted when response handling (in `onResponse`) is finished
     void ResponseHandlingFinished();
@@ -66,6 +71,11 @@ private:
     class Controller *ctrl_;
     class SwitchManager *sw_m_;
     OFTransaction *transaction_;
+    uint32_t xid_ {0};        // request being waited for
+    std::string failure_;
+
+    // runs event loop until the response is handled; throws failure description
+    void wait(QEventLoop &pause);
 
     // a set of sendRequest methods -- per one for each supported rest request
     void sendGetRequest(of13::MultipartRequestFlow &&req, uint64_t dpid);
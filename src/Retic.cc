@@ -30,19 +30,39 @@ void Retic::init(Loader* loader, const Config& root_config)
         DVLOG(10) << "PacketIn";
 
         PacketParser pp{pi, conn->dpid()};
-
-        retic::fdd::Traverser traverser(pp, m_backend.get());
-        auto& leaf = boost::apply_visitor(traverser, m_fdd);
-
-        std::vector<oxm::field_set> sets;
-        sets.reserve(sets.size());
-        for (auto& s: leaf.sets) {
-            if (s.body.has_value()) {
-                throw std::runtime_error("There must not be leaf with handler");
+        auto packetOuts = [&](const retic::fdd::leaf& leaf) {
+            std::vector<oxm::field_set> sets;
+            sets.reserve(leaf.sets.size());
+            for (auto& s: leaf.sets) {
+                if (s.body.has_value()) {
+                    throw std::runtime_error("There must not be leaf with handler");
+                }
+                sets.push_back(s.pred_actions);
+            }
+            m_backend->packetOuts(static_cast<uint8_t*>(pi.data()), pi.data_len(), sets, conn->dpid());
+        };
+
+        // Packets of known flows only read the diagram
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            if (not m_backend) {
+                return;
             }
-            sets.push_back(s.pred_actions);
+            retic::fdd::Lookup lookup(pp);
+            if (auto leaf = boost::apply_visitor(lookup, m_fdd)) {
+                packetOuts(*leaf);
+                return;
+            }
+        }
+
+        // Augmenting trace trees and installing rules changes
+        // the diagram and the backend, the packet is traversed again
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        if (not m_backend) {
+            return;
         }
-        m_backend->packetOuts(static_cast<uint8_t*>(pi.data()), pi.data_len(), sets, conn->dpid());
+        retic::fdd::Traverser traverser(pp, m_backend.get());
+        packetOuts(boost::apply_visitor(traverser, m_fdd));
     });
 
     m_table = ctrl->getTable("retic");
@@ -70,9 +90,14 @@ void Retic::registerPolicy(std::string name, retic::policy policy) {
 }
 
 void Retic::onSwitchUp(SwitchConnectionPtr conn, of13::FeaturesReply fr) {
-    m_backend = nullptr;
-    m_drivers[conn->dpid()] = makeDriver(conn);
-    this->reinstallRules();
+    auto driver = makeDriver(conn);
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    m_drivers[conn->dpid()] = driver;
+    if (m_backend) {
+        m_backend->addSwitch(conn->dpid(), driver, m_fdd);
+    } else {
+        this->reinstall();
+    }
 }
 
 std::vector<std::string> Retic::getPoliciesName() const {
@@ -85,20 +110,28 @@ std::vector<std::string> Retic::getPoliciesName() const {
 }
 
 void Retic::clearRules() {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
     m_backend = nullptr;
 }
 
 void Retic::reinstallRules() {
-    m_backend = std::make_unique<Of13Backend>(m_drivers, m_table);
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    this->reinstall();
+}
+
+void Retic::reinstall() {
+    // Old rules must go before the new ones with the same cookies come
+    m_backend = nullptr;
     m_fdd = retic::fdd::compile(m_policies.at(m_main_policy));
+    m_backend = std::make_unique<Of13Backend>(m_drivers, m_table);
     retic::fdd::Translator translator(*m_backend);
     boost::apply_visitor(translator, m_fdd);
 }
 
 void Retic::setMain(std::string new_main) {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
     m_main_policy = new_main;
-    m_fdd = retic::fdd::compile(m_policies[m_main_policy]);
-    this->reinstallRules();
+    this->reinstall();
 }
 
 namespace runos {
@@ -121,10 +154,14 @@ void Of13Backend::install(
         Packet& pkt_iface(match);
         uint64_t dpid = pkt_iface.load(ofb_switch_id);
         match.erase(oxm::mask<>(ofb_switch_id));
-        install_on(dpid, match, actions, prio, flow_settings);
+        if (targets(dpid)) {
+            install_on(dpid, match, actions, prio, flow_settings);
+        }
     } else {
         for (auto [dpid, driver]: m_drivers) {
-            install_on(dpid, match, actions, prio, flow_settings);
+            if (targets(dpid)) {
+                install_on(dpid, match, actions, prio, flow_settings);
+            }
         }
     }
 }
@@ -139,21 +176,49 @@ void Of13Backend::installBarrier(oxm::field_set match, uint16_t prio) {
         Packet& pkt_iface(match);
         uint64_t dpid = pkt_iface.load(ofb_switch_id);
         match.erase(oxm::mask<>(ofb_switch_id));
+        if (not targets(dpid)) {
+            return;
+        }
         auto driver_it = m_drivers.find(dpid);
         if (driver_it == m_drivers.end()) {
             LOG(WARNING) << "Needed to install rule. But there is no such switch";
             return;
         }
         auto flow = driver_it->second->installRule(match, prio, act, m_table);
-        m_storage.push_back(flow);
+        m_storage[dpid].push_back(flow);
     } else {
         for (auto [dpid, driver]: m_drivers) {
+            if (not targets(dpid)) {
+                continue;
+            }
             auto flow = driver->installRule(match, prio, act, m_table);
-            m_storage.push_back(flow);
+            m_storage[dpid].push_back(flow);
         }
     }
 }
 
+void Of13Backend::addSwitch(uint64_t dpid, OFDriverPtr driver, const retic::fdd::diagram& fdd) {
+    m_storage.erase(dpid);
+    m_drivers[dpid] = driver;
+    m_only = dpid;
+    try {
+        retic::fdd::Translator translator(*this);
+        boost::apply_visitor(translator, fdd);
+    } catch (...) {
+        m_only.reset();
+        throw;
+    }
+    m_only.reset();
+}
+
+size_t Of13Backend::objects() const {
+    size_t ret = 0;
+    for (auto& [dpid, storage]: m_storage) {
+        ret += storage.size();
+    }
+    return ret;
+}
+
 void Of13Backend::packetOuts(uint8_t* data, size_t data_len, std::vector<oxm::field_set> actions, uint64_t dpid) {
     static const auto ofb_out_port = oxm::out_port();
     auto driver = m_drivers.at(dpid);
@@ -218,19 +283,19 @@ void Of13Backend::install_on(
     if (buckets.empty()) {
         // install drop rule
         auto flow = driver->installRule(match, prio, {}, m_table);
-        m_storage.push_back(flow);
+        m_storage[dpid].push_back(flow);
     } else if(buckets.size() == 1) {
         // one actoinlist install directly into flow
         auto flow = driver->installRule(match, prio, buckets[0], m_table);
-        m_storage.push_back(flow);
+        m_storage[dpid].push_back(flow);
     } else {
         // many actionlists, create Group
 
         auto group = driver->installGroup(GroupType::All, buckets);
-        m_storage.push_back(group);
+        m_storage[dpid].push_back(group);
         Actions to_group = {.group_id = group->id()};
         auto flow = driver->installRule(match, prio, to_group, m_table);
-        m_storage.push_back(flow);
+        m_storage[dpid].push_back(flow);
     }
 }
 
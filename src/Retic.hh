@@ -2,6 +2,8 @@
 
 #include <unordered_map>
 #include <memory>
+#include <optional>
+#include <shared_mutex>
 #include <variant>
 #include <vector>
 
@@ -38,9 +40,19 @@ public:
     void setMain(std::string new_main);
 
 public slots:
+    /**
+     * Installs the compiled policy on the new switch only.
+     * Rules of other switches and the compiled diagram are left as is,
+     * so a reconnect storm costs linear time in the number of switches.
+     */
     void onSwitchUp(runos::SwitchConnectionPtr conn, fluid_msg::of13::FeaturesReply fr);
 
 private:
+    // Packet-in handlers on worker threads look packets up in the
+    // diagram under the shared lock; augmenting its trace trees and
+    // installing rules take the exclusive one
+    mutable std::shared_mutex m_mutex;
+
     std::unordered_map<std::string, runos::retic::policy> m_policies;
     runos::retic::fdd::diagram m_fdd;
     std::string m_main_policy;
@@ -48,6 +60,8 @@ private:
     std::unordered_map<uint64_t, runos::OFDriverPtr> m_drivers;
     std::unique_ptr<runos::Of13Backend> m_backend;
     uint8_t m_table;
+
+    void reinstall();
 };
 
 
@@ -68,6 +82,15 @@ public:
     void installBarrier(oxm::field_set match, uint16_t prio) override;
 
     void packetOuts (uint8_t* data, size_t data_len, std::vector<oxm::field_set> actions, uint64_t dpid) override;
+
+    /**
+     * Adds or replaces a switch and translates the diagram for it alone.
+     * Rules previously installed on that switch are released first.
+     * Traces the handlers already explored are installed as well.
+     */
+    void addSwitch(uint64_t dpid, OFDriverPtr driver, const retic::fdd::diagram& fdd);
+
+    size_t objects() const;
 private:
     void install_on(
         uint64_t dpid,
@@ -76,9 +99,12 @@ private:
         uint16_t prio,
         retic::FlowSettings flow_settings
     );
+    bool targets(uint64_t dpid) const { return !m_only || *m_only == dpid; }
+
     std::unordered_map<uint64_t, OFDriverPtr> m_drivers;
     using OfObject = std::variant<GroupPtr, RulePtr>;
-    std::vector<OfObject> m_storage;
+    std::unordered_map<uint64_t, std::vector<OfObject>> m_storage;
+    std::optional<uint64_t> m_only; // switch being added
     uint8_t m_table;
 };
 } // namespace runos
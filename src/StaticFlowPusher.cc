@@ -16,11 +16,16 @@
 
 #include "StaticFlowPusher.hh"
 
+#include <cstring>
+
 #include "Controller.hh"
 #include "FlowManager.hh"
+#include "OFEncoder.hh"
 #include "RestListener.hh"
 #include "SwitchConnection.hh"
 
+#include "oxm/openflow_basic.hh"
+
 REGISTER_APPLICATION(StaticFlowPusher, {"controller", "switch-manager", "rest-listener"/*, "flow-manager" */ /*TODO*/, ""})
 
 constexpr auto TO_CONTROLLER = "to-controller";
@@ -137,75 +142,77 @@ void StaticFlowPusher::init(Loader* loader, const Config& rootConfig)
     }
 }
 
-of13::FlowMod StaticFlowPusher::formFlowMod(FlowDesc* fd, Switch* sw)
+static ipv4addr to_ipv4addr(IPAddress ip)
 {
-    of13::FlowMod fm;
-    fm.command(of13::OFPFC_ADD);
-    fm.buffer_id(OFP_NO_BUFFER);
-    //fm.flags(of13::OFPFF_CHECK_OVERLAP);
+    uint32_t raw = ip.getIPv4(); // network byte order
+    ipv4addr::bytes_type octets;
+    std::memcpy(octets.data(), &raw, octets.size());
+    return ipv4addr(octets);
+}
 
+void StaticFlowPusher::encodeFlowMod(FlowDesc* fd, OFEncoder& enc)
+{
+    oxm::field_set match;
     if (fd->in_port() > 0) {
-        of13::InPort* oxm = new of13::InPort(fd->in_port());
-        fm.add_oxm_field(oxm);
+        match.modify(oxm::in_port() == fd->in_port());
     }
     if (fd->eth_src().to_string() != "00:00:00:00:00:00") {
-        of13::EthSrc* oxm = new of13::EthSrc(fd->eth_src());
-        fm.add_oxm_field(oxm);
+        match.modify(oxm::eth_src() == ethaddr(fd->eth_src().to_string()));
     }
     if (fd->eth_dst().to_string() != "00:00:00:00:00:00") {
-        of13::EthDst* oxm = new of13::EthDst(fd->eth_dst());
-        fm.add_oxm_field(oxm);
+        match.modify(oxm::eth_dst() == ethaddr(fd->eth_dst().to_string()));
     }
 
     if (fd->ip_src().getIPv4() != IPAddress::IPv4from_string("0.0.0.0")) {
-        of13::IPv4Src* oxm = new of13::IPv4Src(fd->ip_src());
-        fm.add_oxm_field(oxm);
+        match.modify(oxm::ipv4_src() == to_ipv4addr(fd->ip_src()));
         fd->eth_type(0x0800);
     }
     if (fd->ip_dst().getIPv4() != IPAddress::IPv4from_string("0.0.0.0")) {
-        of13::IPv4Dst* oxm = new of13::IPv4Dst(fd->ip_dst());
-        fm.add_oxm_field(oxm);
+        match.modify(oxm::ipv4_dst() == to_ipv4addr(fd->ip_dst()));
         fd->eth_type(0x0800);
     }
 
-    of13::ApplyActions act;
-    if (not fd->modify().empty()) {
-        for (auto it : fd->modify()) {
-            of13::SetFieldAction* set = new of13::SetFieldAction(it);
-            if (it->field() == of13::OFPXMT_OFB_IPV4_SRC || it->field() == of13::OFPXMT_OFB_IPV4_DST) {
-                    fd->eth_type(0x0800);
-            }
-            act.add_action(set);
+    ModifyList modify = fd->modify();
+    for (auto it : modify) {
+        if (it->field() == of13::OFPXMT_OFB_IPV4_SRC || it->field() == of13::OFPXMT_OFB_IPV4_DST) {
+                fd->eth_type(0x0800);
         }
     }
 
     if (fd->eth_type() > 0) {
-        of13::EthType* oxm = new of13::EthType(fd->eth_type());
-        fm.add_oxm_field(oxm);
+        match.modify(oxm::eth_type() == fd->eth_type());
     }
 
-    fm.idle_timeout(fd->idle());
-    fm.hard_timeout(fd->hard());
+    OFEncoder::FlowModParams fm;
+    fm.command = of13::OFPFC_ADD;
+    fm.buffer_id = OFP_NO_BUFFER;
+    //fm.flags = of13::OFPFF_CHECK_OVERLAP;
+
+    fm.idle_timeout = fd->idle();
+    fm.hard_timeout = fd->hard();
     if (fd->priority()) {
-        fm.priority(fd->priority());
+        fm.priority = fd->priority();
     }
     else {
-        fm.priority(start_prio++);
+        fm.priority = start_prio++;
     }
+    fm.table_id = table_no;
 
-    if (fd->out_port() > 0) {
-        of13::OutputAction* out = new of13::OutputAction(fd->out_port(), 128);
-        act.add_action(out);
+    enc.begin_flow_mod(fm, match);
+    enc.begin_apply_actions();
+    for (auto it : modify) {
+        it->pack(enc.set_field(of13::OFP_OXM_HEADER_LEN + it->length()));
+        delete it;
     }
-    fm.table_id(table_no);
 
-    fm.add_instruction(act);
+    if (fd->out_port() > 0) {
+        enc.output(fd->out_port(), 128);
+    }
+    enc.end_message();
 
 #if 0 // TODO
     flow_m->addToFlowManager(sf, sw->id());
 #endif
-
-    return fm;
 }
 
 FlowDesc StaticFlowPusher::readFlowFromConfig(Config config)
@@ -245,8 +252,9 @@ void StaticFlowPusher::cleanFlowTable(SwitchConnectionPtr conn)
 
 void StaticFlowPusher::sendToSwitch(Switch* dp, FlowDesc* fd)
 {
-    of13::FlowMod fm = formFlowMod(fd, dp);
-    dp->connection()->send(fm);
+    auto enc = OFEncoder::scratch();
+    encodeFlowMod(fd, enc);
+    dp->connection()->send(enc.data(), enc.size());
 }
 
 void StaticFlowPusher::onSwitchUp(Switch *dp)
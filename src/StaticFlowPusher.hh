@@ -35,6 +35,10 @@
 #include "Rest.hh"
 #include "json11.hpp"
 
+namespace runos {
+class OFEncoder;
+}
+
 typedef of13::OXMTLV* ModifyElem;
 typedef std::vector<ModifyElem> ModifyList;
 
@@ -110,7 +114,7 @@ private:
     uint32_t start_prio;
     uint8_t table_no;
 
-    of13::FlowMod formFlowMod(FlowDesc* fd, Switch *sw);
+    void encodeFlowMod(FlowDesc* fd, OFEncoder& enc);
     FlowDesc readFlowFromConfig(Config config);
 
     /**
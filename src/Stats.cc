@@ -84,7 +84,7 @@ void SwitchStats::init(Loader *loader, const Config& rootConfig)
     /* Get dependencies */
     m_switch_manager = SwitchManager::get(loader);
 
-    pdescr = Controller::get(loader)->registerStaticTransaction(this);
+    pdescr = Controller::get(loader)->registerTransaction(this);
     QObject::connect(pdescr, &OFTransaction::response,
                      this, &SwitchStats::portStatsArrived);
 
@@ -95,6 +95,12 @@ void SwitchStats::init(Loader *loader, const Config& rootConfig)
             << "type " << (int) error.type() << " code " << error.code();
     });
 
+    QObject::connect(pdescr, &OFTransaction::timeout,
+    [](SwitchConnectionPtr conn, uint32_t) {
+        LOG(WARNING) << "Switch " << conn->dpid()
+            << " didn't answer OFPT_MULTIPART_REQUEST in time";
+    });
+
     QObject::connect(m_switch_manager, &SwitchManager::switchDiscovered,
                      this, &SwitchStats::newSwitch);
 
@@ -2,6 +2,7 @@
 
 #include "Common.hh"
 #include "CommandLine.hh"
+#include "SwitchConnection.hh"
 
 #include <algorithm> // find
 
@@ -14,10 +15,11 @@ struct ShowSwitches {
     {
         auto dpid = vm["dpid"];
         bool is_ports_needed = not vm["ports"].empty();
+        bool is_writes_needed = not vm["writes"].empty();
 
         if (not dpid.empty()) {
             auto sw = app->getSwitch(dpid.as<uint64_t>());
-            print_switch_info(sw, out, is_ports_needed);
+            print_switch_info(sw, out, is_ports_needed, is_writes_needed);
         } else {
             auto switches = app->switches();
             auto name_var = vm["name"];
@@ -26,19 +28,20 @@ struct ShowSwitches {
                 auto it = std::find_if(switches.begin(), switches.end(),
                         [&name](auto elem) { return elem->dp_desc() == name; });
                 if (it != switches.end()) {
-                    print_switch_info(*it, out, is_ports_needed);
+                    print_switch_info(*it, out, is_ports_needed, is_writes_needed);
                 } else {
                     out.warning("Couldn't find switch with name {}", name);
                 }
             } else {
                 for (auto sw : switches) {
-                    print_switch_info(sw, out, is_ports_needed);
+                    print_switch_info(sw, out, is_ports_needed, is_writes_needed);
                 }
             }
         }
     }
 
-    void print_switch_info(const Switch* sw, Outside& out, bool is_ports_needed)
+    void print_switch_info(const Switch* sw, Outside& out,
+                           bool is_ports_needed, bool is_writes_needed)
     {
         if (sw == nullptr) {
             out.warning("Unreadable switch instances");
@@ -55,6 +58,26 @@ struct ShowSwitches {
         if (is_ports_needed) {
             print_ports_info(sw, out);
         }
+        if (is_writes_needed) {
+            print_writes_info(sw, out);
+        }
+    }
+
+    void print_writes_info(const Switch* sw, Outside& out)
+    {
+        auto conn = sw->connection();
+        if (not conn) {
+            out.warning("Switch 0x{:x} has no connection", sw->id());
+            return;
+        }
+        auto stats = conn->write_stats();
+        out.print("       Writes. Messages          : {:d}\n"
+                  "               Bytes             : {:d}\n"
+                  "               Flushes           : {:d}\n"
+                  "               Messages per flush: {:.2f}\n"
+                  "               Bytes per flush   : {:.2f}\n",
+                  stats.messages, stats.bytes, stats.flushes,
+                  stats.messages_per_flush(), stats.bytes_per_flush());
     }
 
     void print_ports_info(const Switch* sw, Outside& out){
@@ -77,7 +100,8 @@ struct ShowSwitches {
              "Dpid of switch, info about should be printed")
             ("name,n", options::value<std::string>()->default_value("all"),
              "Name of switch, info about should be printed")
-            ("ports,p", "Show ports of switch");
+            ("ports,p", "Show ports of switch")
+            ("writes,w", "Show write buffer counters of switch connection");
         return desc;
     }
 };
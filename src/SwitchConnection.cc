@@ -3,6 +3,8 @@
 #include <fluid/OFConnection.hh>
 #include <fluid/ofcommon/msg.hh>
 
+#include <algorithm>
+
 using fluid_base::OFConnection;
 
 namespace runos {
@@ -17,21 +19,210 @@ uint8_t SwitchConnection::version() const
     return m_ofconn ? m_ofconn->get_version() : 0;
 }
 
+namespace {
+
+// Connections with writes deferred by the current thread. They are
+// held weakly, so one closed during the batch is skipped, and keyed
+// by address to add each only once.
+thread_local unsigned batch_depth = 0;
+thread_local std::vector<
+    std::pair<const SwitchConnection*, std::weak_ptr<SwitchConnection>>
+> deferred;
+
+size_t count_messages(const uint8_t* data, size_t len)
+{
+    size_t n = 0;
+    while (len >= 4) {
+        size_t msg_len = (size_t(data[2]) << 8) | data[3];
+        if (msg_len < 4 || msg_len > len)
+            break;
+        data += msg_len;
+        len -= msg_len;
+        ++n;
+    }
+    return n;
+}
+
+} // namespace
+
+SwitchConnection::Batch::Batch()
+{
+    ++batch_depth;
+}
+
+SwitchConnection::Batch::~Batch()
+{
+    if (--batch_depth != 0)
+        return;
+
+    // flushes may send and defer more, so take the list first
+    auto conns = std::move(deferred);
+    deferred.clear();
+    for (auto& conn : conns) {
+        if (auto ptr = conn.second.lock())
+            ptr->flush();
+    }
+}
+
 void SwitchConnection::send(const fluid_msg::OFMsg& cmsg)
 {
     if (not m_ofconn || not m_ofconn->is_alive()) return;
 
     auto& msg = const_cast<fluid_msg::OFMsg&>(cmsg);
     auto buf = msg.pack();
-    m_ofconn->send(buf, msg.length());
+    enqueue(buf, msg.length());
     fluid_msg::OFMsg::free_buffer(buf);
 }
 
+void SwitchConnection::send(const void* data, size_t len)
+{
+    if (not m_ofconn || not m_ofconn->is_alive()) return;
+    enqueue(data, len);
+}
+
+void SwitchConnection::enqueue(const void* data, size_t len)
+{
+    auto bytes = static_cast<const uint8_t*>(data);
+
+    std::weak_ptr<SwitchConnection> self;
+    if (batch_depth != 0)
+        self = weak_from_this();
+
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    size_t at = m_wbuf.size();
+    if (m_reconciler) {
+        m_reconciler->filter(bytes, len, m_wbuf);
+    } else {
+        m_wbuf.insert(m_wbuf.end(), bytes, bytes + len);
+    }
+    m_wqueued += count_messages(m_wbuf.data() + at, m_wbuf.size() - at);
+
+    // connections not owned by a shared_ptr can't be deferred safely
+    if (batch_depth == 0 || self.expired() ||
+        m_wbuf.size() >= flush_threshold) {
+        flush_locked();
+        return;
+    }
+
+    auto it = std::find_if(deferred.begin(), deferred.end(),
+                           [this](const auto& conn) { return conn.first == this; });
+    if (it == deferred.end()) {
+        deferred.emplace_back(this, std::move(self));
+    } else if (it->second.expired()) {
+        // the address was reused by a new connection
+        it->second = std::move(self);
+    }
+}
+
+void SwitchConnection::flush()
+{
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    flush_locked();
+}
+
+void SwitchConnection::flush_locked()
+{
+    if (m_wbuf.empty())
+        return;
+
+    if (m_ofconn && m_ofconn->is_alive()) {
+        m_ofconn->send(m_wbuf.data(), m_wbuf.size());
+        m_wstats.messages += m_wqueued;
+        m_wstats.bytes += m_wbuf.size();
+        m_wstats.flushes++;
+    }
+
+    m_wbuf.clear();
+    m_wqueued = 0;
+}
+
+SwitchConnection::WriteStats SwitchConnection::write_stats() const
+{
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    return m_wstats;
+}
+
 void SwitchConnection::close()
 { 
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    flush_locked();
     if (m_ofconn) m_ofconn->close(), m_ofconn = nullptr;
 }
 
+void SwitchConnection::rebind(OFConnection* ofconn)
+{
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    m_wbuf.clear();
+    m_wqueued = 0;
+    m_ofconn = ofconn;
+    m_reconciler.reset();
+}
+
+void SwitchConnection::begin_reconcile()
+{
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    m_reconciler = std::make_shared<FlowReconciler>();
+}
+
+bool SwitchConnection::reconciling() const
+{
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    return m_reconciler != nullptr;
+}
+
+void SwitchConnection::reconcile_dump(const uint8_t* msg, size_t len, bool last)
+{
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    if (not m_reconciler || not m_reconciler->dumping())
+        return;
+    m_reconciler->dump(msg, len);
+    if (last) {
+        size_t at = m_wbuf.size();
+        m_reconciler->dumped(m_wbuf);
+        m_wqueued += count_messages(m_wbuf.data() + at, m_wbuf.size() - at);
+        flush_locked();
+    }
+}
+
+std::vector<FlowReconciler::Unclaimed> SwitchConnection::reconcile_unclaimed() const
+{
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    if (not m_reconciler || m_reconciler->dumping())
+        return {};
+    return m_reconciler->unclaimed();
+}
+
+FlowReconciler::Stats SwitchConnection::finish_reconcile(
+        const std::function<bool(const FlowReconciler::Unclaimed&)>& keep)
+{
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    if (not m_reconciler)
+        return FlowReconciler::Stats{};
+
+    size_t at = m_wbuf.size();
+    FlowReconciler::Stats ret = m_reconciler->dumping()
+        ? m_reconciler->abort(m_wbuf)
+        : m_reconciler->finish(keep, m_wbuf);
+    m_reconciler.reset();
+    m_wqueued += count_messages(m_wbuf.data() + at, m_wbuf.size() - at);
+    flush_locked();
+    return ret;
+}
+
+FlowReconciler::Stats SwitchConnection::abort_reconcile()
+{
+    std::lock_guard<std::mutex> lock(m_wmutex);
+    if (not m_reconciler)
+        return FlowReconciler::Stats{};
+
+    size_t at = m_wbuf.size();
+    FlowReconciler::Stats ret = m_reconciler->abort(m_wbuf);
+    m_reconciler.reset();
+    m_wqueued += count_messages(m_wbuf.data() + at, m_wbuf.size() - at);
+    flush_locked();
+    return ret;
+}
+
 SwitchConnection::SwitchConnection(OFConnection* ofconn, uint64_t dpid)
     : m_dpid(dpid), m_ofconn(ofconn)
 { }
@@ -2,11 +2,18 @@
 
 #include "SwitchConnectionFwd.hh"
 
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include <QMetaType>
 
+#include "FlowReconciler.hh"
+
 /** @file */
 
 namespace fluid_base {
@@ -20,12 +27,48 @@ class OFMsg;
 namespace runos {
 
 /**
- * Connection with physical switch for OpenFlow communication
+ * Connection with physical switch for OpenFlow communication.
+ *
+ * Outgoing messages are collected in a per-connection write buffer.
+ * Inside a SwitchConnection::Batch they are written out when the
+ * outermost batch on the thread ends or when the buffer grows over
+ * flush_threshold. The controller opens one batch per received
+ * message, so replies to each message take one write; messages read
+ * in the same pass of the event loop are still written separately.
+ * Outside of a batch every send is written immediately. Batches are
+ * per thread: a thread's batch never holds back writes of another one.
  */
-class SwitchConnection {
+class SwitchConnection
+    : public std::enable_shared_from_this<SwitchConnection> {
     const uint64_t m_dpid;
 
 public:
+    /** Buffered bytes which force a write even inside a batch */
+    static constexpr size_t flush_threshold = 64 * 1024;
+
+    struct WriteStats {
+        uint64_t messages = 0; ///< messages written to the socket
+        uint64_t bytes = 0;    ///< bytes written to the socket
+        uint64_t flushes = 0;  ///< writes issued to the socket
+
+        double messages_per_flush() const
+        { return flushes ? double(messages) / flushes : 0.0; }
+        double bytes_per_flush() const
+        { return flushes ? double(bytes) / flushes : 0.0; }
+    };
+
+    /**
+     * Defers writes of all connections on the current thread
+     * until the outermost batch is destroyed.
+     */
+    class Batch {
+    public:
+        Batch();
+        ~Batch();
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+    };
+
 	/** get dpid of switch, which connected */
     uint64_t dpid() const
     { return m_dpid; }
@@ -35,6 +78,13 @@ public:
 
     uint8_t version() const;
 
+    /**
+     * Meter to attach to rules which send packets to the controller,
+     * or zero if packet-ins are not rate limited on this switch.
+     */
+    uint32_t packet_in_meter() const
+    { return m_packet_in_meter; }
+
     /**
      * Send OpenFlow message to switch
      *
@@ -42,11 +92,57 @@ public:
      */
     void send(const fluid_msg::OFMsg& msg);
 
+    /**
+     * Send already serialized OpenFlow message(s) to switch
+     */
+    void send(const void* data, size_t len);
+
+    /** Write out buffered messages now */
+    void flush();
+
+    WriteStats write_stats() const;
+
     void close();
 
 protected:
     fluid_base::OFConnection* m_ofconn;
     SwitchConnection(fluid_base::OFConnection* ofconn, uint64_t dpid);
+
+    /** Points to a new connection, dropping anything queued for the old one */
+    void rebind(fluid_base::OFConnection* ofconn);
+
+    void packet_in_meter(uint32_t meter_id)
+    { m_packet_in_meter = meter_id; }
+
+    /**
+     * Holds outgoing messages until the flow table dump is complete,
+     * then sends only what the switch is missing. See FlowReconciler.
+     */
+    void begin_reconcile();
+    bool reconciling() const;
+
+    /** Adds a part of the dump, the last one releases held messages */
+    void reconcile_dump(const uint8_t* msg, size_t len, bool last);
+
+    std::vector<FlowReconciler::Unclaimed> reconcile_unclaimed() const;
+
+    /** Ends reconciliation, deleting stale entries `keep` doesn't want */
+    FlowReconciler::Stats finish_reconcile(
+            const std::function<bool(const FlowReconciler::Unclaimed&)>& keep);
+
+    /** Gives up on the dump and wipes the tables instead */
+    FlowReconciler::Stats abort_reconcile();
+
+private:
+    mutable std::mutex m_wmutex;
+    std::vector<uint8_t> m_wbuf;
+    size_t m_wqueued{0};
+    WriteStats m_wstats;
+    std::atomic<uint32_t> m_packet_in_meter{0};
+    std::shared_ptr<FlowReconciler> m_reconciler;
+
+    void enqueue(const void* data, size_t len);
+    void flush_locked();
 };
 
 } // namespace runos
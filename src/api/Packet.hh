@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <exception>
 #include <type_traits>
 #include <memory>
@@ -38,6 +39,26 @@ public:
 
     virtual void modify(oxm::field<> patch) = 0;
 
+    // Word-sized fast path of the typed helpers for fields of up to
+    // 64 bits (see oxm::native_type). Values are masked to the field.
+    // Return false to fall back to load(), test() and modify().
+    // Wrappers which override those should override these as well.
+    virtual bool load_word(oxm::type, uint64_t& /*value*/) const
+    { return false; }
+
+    virtual bool test_word(oxm::type t, uint64_t value, uint64_t mask,
+                           bool& ret) const
+    {
+        uint64_t read;
+        if (not load_word(t, read))
+            return false;
+        ret = (read & mask) == value;
+        return true;
+    }
+
+    virtual bool modify_word(oxm::type, uint64_t /*value*/, uint64_t /*mask*/)
+    { return false; }
+
     virtual ~Packet() noexcept = default;
 
     ////////////////////////
@@ -57,6 +78,11 @@ public:
     template<class Type>
     oxm::value<Type> load(Type type) const
     {
+        if constexpr (oxm::native_type<Type>::value) {
+            uint64_t word;
+            if (load_word(type, word))
+                return oxm::value<Type>(type, from_word<Type>(word));
+        }
         auto field = load(oxm::mask<Type>{type});
         BOOST_ASSERT(field.exact());
         return oxm::value<Type>(field);
@@ -65,6 +91,16 @@ public:
     template<class Type>
     oxm::field<Type> load(oxm::mask<Type> mask) const
     {
+        // load_word() reads the whole field, a partial mask goes the
+        // generic way so that only its bits are traced
+        if constexpr (oxm::native_type<Type>::value) {
+            uint64_t word;
+            if (mask.exact() && load_word(mask.type(), word)) {
+                using mask_type = typename Type::mask_type;
+                return oxm::field<Type>(from_word<Type>(word),
+                                        bit_cast<mask_type>(mask.mask_bits()));
+            }
+        }
         auto generic_mask = static_cast<oxm::mask<>>(mask);
         auto generic_ret = load(generic_mask);
         return static_cast<oxm::field<Type>>(generic_ret);
@@ -77,9 +113,22 @@ public:
     template<typename Type>
     bool test(oxm::field<Type> need) const
     {
+        if constexpr (oxm::native_type<Type>::value) {
+            bool ret;
+            uint64_t mask = need.exact() ? oxm::native_type<Type>::all
+                                         : need.mask_bits().to_ullong();
+            if (test_word(need.type(), need.value_bits().to_ullong(), mask, ret))
+                return ret;
+        }
         return test(oxm::field<>(need));
     }
 
+    template<typename Type>
+    bool test(oxm::value<Type> need) const
+    {
+        return test(oxm::field<Type>(need));
+    }
+
     // modify helpers
     // CONCEPT: pkt.modify(eth_src >> "aa:bb:cc:dd:ee:ff")
     //      eth_src_meta >> eth_src_meta::value_type -> oxm::value
@@ -89,9 +138,21 @@ public:
     template<typename Type>
     void modify(oxm::field<Type> patch)
     {
+        if constexpr (oxm::native_type<Type>::value) {
+            uint64_t mask = patch.exact() ? oxm::native_type<Type>::all
+                                          : patch.mask_bits().to_ullong();
+            if (modify_word(patch.type(), patch.value_bits().to_ullong(), mask))
+                return;
+        }
         modify(oxm::field<>(patch));
     }
 
+    template<typename Type>
+    void modify(oxm::value<Type> patch)
+    {
+        modify(oxm::field<Type>(patch));
+    }
+
     template<class T>
     friend typename std::enable_if<std::is_pointer<T>::value, T>::type
     packet_cast(Packet& pkt) noexcept;
@@ -103,6 +164,13 @@ public:
     virtual std::unique_ptr<Packet> clone() const = 0;
 
 protected:
+    template<class Type>
+    static typename Type::value_type from_word(uint64_t word)
+    {
+        using value_type = typename Type::value_type;
+        return bit_cast<value_type>(bits<Type().nbits()>(word));
+    }
+
     virtual Packet& next_wrapper() noexcept
     { return *this; }
 
@@ -170,6 +238,14 @@ public:
     void modify(oxm::field<> patch) override
     { pkt.modify(patch); }
 
+    // modify_word() isn't forwarded, proxies often track modify()
+    bool load_word(oxm::type t, uint64_t& value) const override
+    { return pkt.load_word(t, value); }
+
+    bool test_word(oxm::type t, uint64_t value, uint64_t mask,
+                   bool& ret) const override
+    { return pkt.test_word(t, value, mask, ret); }
+
     std::unique_ptr<Packet> clone() const override 
     { return pkt.clone(); }
 };
@@ -1,7 +1,7 @@
 #pragma once
 
 #include "Flow.hh"
-#include "oxm/field_set_fwd.hh"
+#include "oxm/field_set.hh"
 #include "oxm/field.hh"
 
 namespace runos {
@@ -23,6 +23,17 @@ struct Backend {
                             oxm::field<> const& test,
                             uint64_t id) = 0;
     virtual void barrier() { }
+
+    // Rule added by install() moves to another priority.
+    // The new one must be in place before the old one is gone.
+    virtual void move(unsigned from, unsigned to,
+                      oxm::expirementer::full_field_set const& match,
+                      FlowPtr flow)
+    {
+        install(to, match, flow);
+        for (auto& fields : match.included().fields())
+            remove(from, fields);
+    }
 };
 
 } // namespace maple
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Epoch.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace runos {
+namespace maple {
+
+namespace {
+
+// Thread's read-side state. Records are reused by later threads
+// and never freed, so the list can be walked without locks.
+struct Record {
+    std::atomic<uint64_t> epoch {0}; // 0 if not reading
+    std::atomic<bool> used {true};
+    unsigned depth {0};
+    Record* next {nullptr};
+};
+
+struct Retired {
+    void* ptr;
+    void (*deleter)(void*);
+    uint64_t epoch;
+};
+
+std::atomic<uint64_t> global_epoch {1};
+std::atomic<Record*> records {nullptr};
+
+std::mutex& retired_mutex()
+{
+    static std::mutex* ret = new std::mutex;
+    return *ret;
+}
+
+std::vector<Retired>& retired()
+{
+    static std::vector<Retired>* ret = new std::vector<Retired>;
+    return *ret;
+}
+
+Record* acquire_record()
+{
+    for (Record* r = records.load(); r; r = r->next) {
+        bool expected = false;
+        if (not r->used.load(std::memory_order_relaxed) &&
+                r->used.compare_exchange_strong(expected, true))
+            return r;
+    }
+
+    Record* r = new Record;
+    r->next = records.load();
+    while (not records.compare_exchange_weak(r->next, r)) { }
+    return r;
+}
+
+struct Handle {
+    Record* record = acquire_record();
+    ~Handle() { record->used.store(false, std::memory_order_release); }
+};
+
+Record& record()
+{
+    thread_local Handle handle;
+    return *handle.record;
+}
+
+// Oldest epoch a reader may still be in
+uint64_t oldest_reader()
+{
+    uint64_t ret = std::numeric_limits<uint64_t>::max();
+    for (Record* r = records.load(); r; r = r->next) {
+        uint64_t epoch = r->epoch.load();
+        if (epoch != 0 && epoch < ret)
+            ret = epoch;
+    }
+    return ret;
+}
+
+void reclaim_locked()
+{
+    auto& list = retired();
+    if (list.empty())
+        return;
+
+    uint64_t oldest = oldest_reader();
+    std::vector<Retired> free;
+    auto it = list.begin();
+    while (it != list.end()) {
+        if (it->epoch < oldest) {
+            free.push_back(*it);
+            it = list.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (auto& r : free)
+        r.deleter(r.ptr);
+}
+
+} // namespace
+
+Epoch::Guard::Guard()
+{
+    Record& r = record();
+    if (r.depth++ == 0)
+        r.epoch.store(global_epoch.load());
+}
+
+Epoch::Guard::~Guard()
+{
+    Record& r = record();
+    if (--r.depth == 0)
+        r.epoch.store(0, std::memory_order_release);
+}
+
+void Epoch::retire(void* ptr, void (*deleter)(void*))
+{
+    std::lock_guard<std::mutex> lock(retired_mutex());
+    // readers entering after the increment can't see the object
+    retired().push_back(Retired{ptr, deleter, global_epoch.fetch_add(1)});
+    reclaim_locked();
+}
+
+void Epoch::reclaim()
+{
+    std::lock_guard<std::mutex> lock(retired_mutex());
+    reclaim_locked();
+}
+
+} // namespace maple
+} // namespace runos
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+namespace runos {
+namespace maple {
+
+/**
+ * Epoch-based reclamation of objects read without locks.
+ *
+ * Readers hold a Guard while they use pointers loaded from shared
+ * atomics. A writer which unpublished an object retires it, and it is
+ * deleted once every guard that might have seen it is released.
+ */
+class Epoch {
+public:
+    /** Read-side critical section, may be nested */
+    class Guard {
+    public:
+        Guard();
+        ~Guard();
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    template<class T>
+    static void retire(T* ptr)
+    {
+        retire(ptr, [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    static void retire(void* ptr, void (*deleter)(void*));
+
+    /** Deletes retired objects no reader can see anymore */
+    static void reclaim();
+};
+
+} // namespace maple
+} // namespace runos
@@ -1,13 +1,17 @@
 #pragma once
 
 #include <sstream>
+#include <atomic>
 #include <functional>
+#include <mutex>
+#include <shared_mutex>
 #include <tuple>
 
 #include <boost/exception/exception.hpp>
 
 #include "TraceablePacketImpl.hh"
 #include "TraceTree.hh"
+#include "Epoch.hh"
 #include "Flow.hh"
 #include "LoggableTracer.hh"
 
@@ -19,25 +23,68 @@ typedef boost::error_info< struct tag_trace, std::string >
 
 typedef std::function<void()>  Installer;
 
+/**
+ * Trace tree with the policy it is built from.
+ *
+ * Lookups don't lock and may run on any thread at any time.
+ * Everything that modifies the tree (augment, update, commit,
+ * invalidate, gc) and installers it returns need write_lock(); read_lock()
+ * is left for callers which keep state of their flows next to the tree.
+ * Flows found by a lookup are read without either lock, so what
+ * packet-ins read of them must be published the way the tree is.
+ */
 template<class Decision, class Flow>
 class Runtime {
     using FlowPtr = std::shared_ptr<Flow>;
     using Policy = std::function<Decision(Packet& pkt, FlowPtr flow)>;
 
     Backend& backend;
-    std::unique_ptr<TraceTree> trace_tree;
+    std::atomic<TraceTree*> trace_tree; // retired through Epoch
     Policy policy;
+    mutable std::shared_mutex mutex;
 
 public:
+    using ReadLock = std::shared_lock<std::shared_mutex>;
+    using WriteLock = std::unique_lock<std::shared_mutex>;
+
     Runtime(Policy policy, Backend& backend)
         : backend(backend)
         , trace_tree{new TraceTree{backend}}
         , policy{policy}
     { }
 
+    ~Runtime()
+    {
+        delete trace_tree.load();
+    }
+
+    ReadLock read_lock() const
+    { return ReadLock(mutex); }
+
+    WriteLock write_lock()
+    { return WriteLock(mutex); }
+
+    /**
+     * Packet-in steps safe on any number of threads. The packet is
+     * looked up without a lock and `found` gets the flow, null if there
+     * is none; if it returns true the packet is handled. Else the packet
+     * is looked up again under the write lock, since the tree may have
+     * been augmented meanwhile, and `locked` gets that flow to augment
+     * the tree or change the flow.
+     */
+    template<class Found, class Locked>
+    void dispatch(Packet& pkt, Found&& found, Locked&& locked)
+    {
+        if (found((*this)(pkt)))
+            return;
+
+        auto lock = write_lock();
+        locked((*this)(pkt));
+    }
+
     std::pair<FlowPtr, Installer> augment(Packet& pkt, FlowPtr flow)
     {
-        auto tracer = trace_tree->augment();
+        auto tracer = trace_tree.load(std::memory_order_relaxed)->augment();
         LoggableTracer log_tracer {*tracer};
         TraceablePacketImpl tpkt{pkt, log_tracer};
         Installer installer;
@@ -57,23 +104,45 @@ public:
 
     FlowPtr operator()(Packet& pkt)
     {
-        auto flow = trace_tree->lookup(pkt);
-        return flow ? std::dynamic_pointer_cast<Flow>(flow) : nullptr;
+        Epoch::Guard guard;
+        // the tree holds only flows given to augment()
+        return std::static_pointer_cast<Flow>(trace_tree.load()->lookup(pkt));
     }
 
     void commit()
     {
-        trace_tree->commit();
+        trace_tree.load(std::memory_order_relaxed)->commit();
     }
 
     void update()
     {
-        trace_tree->update();
+        trace_tree.load(std::memory_order_relaxed)->update();
+    }
+
+    Relabeling relabeling() const
+    {
+        return trace_tree.load(std::memory_order_relaxed)->relabeling();
     }
 
     void invalidate()
     {
-        trace_tree.reset(new TraceTree{backend});
+        Epoch::retire(trace_tree.exchange(new TraceTree{backend}));
+    }
+
+    Collection gc()
+    {
+        return trace_tree.load(std::memory_order_relaxed)->gc();
+    }
+
+    TreeSize size() const
+    {
+        return trace_tree.load(std::memory_order_relaxed)->size();
+    }
+
+    /** Drops paths which saw a value of `f`, keeps the rest of the tree */
+    Eviction invalidate(oxm::field<> f)
+    {
+        return trace_tree.load(std::memory_order_relaxed)->invalidate(f);
     }
 };
 
@@ -0,0 +1,490 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TablePipeline.hh"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <utility>
+
+#include <boost/functional/hash.hpp>
+
+#include "oxm/openflow_basic.hh"
+
+namespace runos {
+namespace maple {
+
+namespace {
+
+// Gives equal keys one id while they are referenced.
+// Ids are not reused, so a freed id never means another key.
+template<class Key, class Hash = std::hash<Key>>
+class Interner {
+    struct Slot {
+        uint64_t id;
+        size_t refs;
+    };
+    std::unordered_map<Key, Slot, Hash> m_slots;
+    std::unordered_map<uint64_t, typename std::unordered_map<Key, Slot, Hash>::iterator> m_ids;
+    uint64_t m_next {1};
+
+public:
+    // Returns the id and whether the key is new
+    std::pair<uint64_t, bool> acquire(const Key& key)
+    {
+        auto res = m_slots.emplace(key, Slot{m_next, 0});
+        Slot& slot = res.first->second;
+        if (res.second)
+            m_ids.emplace(m_next++, res.first);
+        slot.refs++;
+        return {slot.id, res.second};
+    }
+
+    const Key& get(uint64_t id) const
+    { return m_ids.at(id)->first; }
+
+    bool has(uint64_t id) const
+    { return m_ids.count(id) != 0; }
+
+    // Returns true if it was the last reference
+    bool release(uint64_t id)
+    {
+        auto it = m_ids.at(id);
+        if (--it->second.refs)
+            return false;
+        m_slots.erase(it);
+        m_ids.erase(id);
+        return true;
+    }
+};
+
+struct ResidualKey {
+    uint16_t priority;
+    oxm::field_set match;
+    std::string program;
+
+    friend bool operator==(const ResidualKey& lhs, const ResidualKey& rhs)
+    {
+        return lhs.priority == rhs.priority && lhs.match == rhs.match &&
+               lhs.program == rhs.program;
+    }
+};
+
+struct ResidualKeyHash {
+    size_t operator()(const ResidualKey& key) const
+    {
+        size_t ret = hash_value(key.match) * 31 + key.priority;
+        boost::hash_combine(ret, key.program);
+        return ret;
+    }
+};
+
+// Rule from a stage on: the value it needs at the stage (0 for any)
+// and the item of the next stage, or the residual after the last one
+struct ItemKey {
+    size_t stage;
+    uint64_t value;
+    uint64_t next;
+
+    friend bool operator==(const ItemKey& lhs, const ItemKey& rhs)
+    {
+        return lhs.stage == rhs.stage && lhs.value == rhs.value &&
+               lhs.next == rhs.next;
+    }
+};
+
+struct ItemKeyHash {
+    size_t operator()(const ItemKey& key) const
+    {
+        size_t ret = key.stage;
+        boost::hash_combine(ret, key.value);
+        boost::hash_combine(ret, key.next);
+        return ret;
+    }
+};
+
+// Rules a class holds: items of its stage, residuals after the last one
+struct ClassKey {
+    size_t stage;
+    std::vector<uint64_t> nodes; // sorted
+
+    friend bool operator==(const ClassKey& lhs, const ClassKey& rhs)
+    { return lhs.stage == rhs.stage && lhs.nodes == rhs.nodes; }
+};
+
+struct ClassKeyHash {
+    size_t operator()(const ClassKey& key) const
+    {
+        size_t ret = key.stage;
+        boost::hash_range(ret, key.nodes.begin(), key.nodes.end());
+        return ret;
+    }
+};
+
+struct EntryKey {
+    uint8_t table;
+    uint16_t priority;
+    oxm::field_set match;
+
+    friend bool operator==(const EntryKey& lhs, const EntryKey& rhs)
+    {
+        return lhs.table == rhs.table && lhs.priority == rhs.priority &&
+               lhs.match == rhs.match;
+    }
+};
+
+struct EntryKeyHash {
+    size_t operator()(const EntryKey& key) const
+    { return (hash_value(key.match) * 31 + key.priority) * 31 + key.table; }
+};
+
+} // namespace
+
+struct TablePipeline::Impl {
+    // Entry of a class; the cookie of a rule entry is looked up when
+    // it is sent, its residual may have rules of several flows
+    struct Slot {
+        Entry entry;
+        uint64_t residual; // 0 for classifying entries
+    };
+
+    struct Class {
+        uint64_t id;
+        std::vector<Class*> children;
+        std::vector<Slot> entries;
+        uint64_t mark {0};
+    };
+
+    const std::vector<oxm::type>& stages;
+    uint8_t table;
+    uint64_t cookie;
+    Sink& sink;
+
+    Interner<oxm::field<>> values;
+    Interner<ResidualKey, ResidualKeyHash> residuals;
+    Interner<ItemKey, ItemKeyHash> items;
+    // cookies of the rules with a residual and their count
+    std::unordered_map<uint64_t, std::map<uint64_t, size_t>> cookies;
+
+    std::unordered_map<ClassKey, Class, ClassKeyHash> classes;
+    uint64_t next_class {1};
+    uint64_t epoch {0};
+
+    std::unordered_map<EntryKey, Slot, EntryKeyHash> installed;
+    bool dirty {false};
+    Stats stats;
+
+    Impl(const std::vector<oxm::type>& stages, uint8_t table,
+         uint64_t cookie, Sink& sink)
+        : stages(stages), table(table), cookie(cookie), sink(sink)
+    { }
+
+    size_t depth() const { return stages.size(); }
+
+    // Interns the rule, returns the item of its first stage
+    uint64_t acquire(uint16_t priority, oxm::field_set const& match,
+                     uint64_t rule_cookie, std::string program,
+                     uint64_t& residual)
+    {
+        std::vector<uint64_t> path(depth(), 0);
+        oxm::field_set rest;
+        for (const oxm::field<>& f : match) {
+            auto stage = std::find(stages.begin(), stages.end(), f.type());
+            if (stage != stages.end() && f.exact())
+                path[stage - stages.begin()] = values.acquire(f).first;
+            else
+                rest.modify(f);
+        }
+
+        residual = residuals.acquire(
+            ResidualKey{priority, std::move(rest), std::move(program)}).first;
+        cookies[residual][rule_cookie]++;
+
+        uint64_t next = residual;
+        for (size_t stage = depth(); stage-- > 0; ) {
+            auto res = items.acquire(ItemKey{stage, path[stage], next});
+            if (not res.second) {
+                // the item holds its own references
+                release(stage + 1, next);
+                if (path[stage])
+                    values.release(path[stage]);
+            }
+            next = res.first;
+        }
+        return next;
+    }
+
+    // Drops a reference to a node of the stage
+    void release(size_t stage, uint64_t node)
+    {
+        if (stage == depth()) {
+            if (residuals.release(node))
+                cookies.erase(node);
+            return;
+        }
+        ItemKey item = items.get(node);
+        if (not items.release(node))
+            return;
+        if (item.value)
+            values.release(item.value);
+        release(stage + 1, item.next);
+    }
+
+    void release(uint64_t head, uint64_t residual, uint64_t rule_cookie)
+    {
+        auto& counts = cookies.at(residual);
+        auto it = counts.find(rule_cookie);
+        if (--it->second == 0)
+            counts.erase(it);
+        release(0, head);
+    }
+
+    uint64_t cookie_of(uint64_t residual) const
+    {
+        auto it = cookies.find(residual);
+        return it == cookies.end() || it->second.empty()
+            ? cookie : it->second.begin()->first;
+    }
+
+    oxm::field_set with_metadata(oxm::field_set match, size_t stage, uint64_t id)
+    {
+        if (stage > 0)
+            match.modify(oxm::metadata() == id);
+        return match;
+    }
+
+    Class& compile(size_t stage, std::vector<uint64_t> nodes)
+    {
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+        auto res = classes.emplace(ClassKey{stage, std::move(nodes)}, Class{});
+        Class& ret = res.first->second;
+        if (not res.second)
+            return ret;
+        ret.id = next_class++;
+        const auto& content = res.first->first.nodes;
+        uint8_t at = table + stage;
+
+        if (stage == depth()) {
+            for (uint64_t id : content) {
+                const ResidualKey& rule = residuals.get(id);
+                ret.entries.push_back(Slot{Entry{
+                    at, rule.priority, with_metadata(rule.match, stage, ret.id),
+                    0, 0, rule.program
+                }, id});
+            }
+            return ret;
+        }
+
+        std::map<uint64_t, std::vector<uint64_t>> by_value;
+        std::vector<uint64_t> any;
+        for (uint64_t id : content) {
+            const ItemKey& item = items.get(id);
+            if (item.value)
+                by_value[item.value].push_back(item.next);
+            else
+                any.push_back(item.next);
+        }
+
+        // Exact values before the default, which takes the rest
+        for (auto& value : by_value) {
+            auto children = std::move(value.second);
+            children.insert(children.end(), any.begin(), any.end());
+            Class& child = compile(stage + 1, std::move(children));
+            ret.children.push_back(&child);
+            ret.entries.push_back(Slot{Entry{
+                at, 2,
+                with_metadata(oxm::field_set{values.get(value.first)}, stage, ret.id),
+                cookie, child.id, std::string()
+            }, 0});
+        }
+
+        Class& child = compile(stage + 1, std::move(any));
+        ret.children.push_back(&child);
+        ret.entries.push_back(Slot{Entry{
+            at, 1, with_metadata(oxm::field_set{}, stage, ret.id),
+            cookie, child.id, std::string()
+        }, 0});
+        return ret;
+    }
+
+    void collect(Class& c, std::unordered_map<EntryKey, Slot, EntryKeyHash>& desired)
+    {
+        if (c.mark == epoch)
+            return;
+        c.mark = epoch;
+        for (const Slot& slot : c.entries) {
+            Slot s = slot;
+            if (s.residual)
+                s.entry.cookie = cookie_of(s.residual);
+            EntryKey key{s.entry.table, s.entry.priority, s.entry.match};
+            desired.emplace(std::move(key), std::move(s));
+        }
+        for (Class* child : c.children)
+            collect(*child, desired);
+    }
+
+    static bool same(const Entry& lhs, const Entry& rhs)
+    {
+        return lhs.cookie == rhs.cookie && lhs.metadata == rhs.metadata &&
+               lhs.program == rhs.program;
+    }
+
+    void commit(std::vector<uint64_t> heads)
+    {
+        Class& root = compile(0, std::move(heads));
+
+        ++epoch;
+        std::unordered_map<EntryKey, Slot, EntryKeyHash> desired;
+        collect(root, desired);
+
+        std::vector<std::pair<const EntryKey*, const Slot*>> adds;
+        for (auto& d : desired) {
+            auto it = installed.find(d.first);
+            if (it == installed.end() || not same(it->second.entry, d.second.entry))
+                adds.emplace_back(&d.first, &d.second);
+        }
+        // Targets of goto-table are in place before entries going there
+        std::sort(adds.begin(), adds.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.second->entry.table > rhs.second->entry.table;
+        });
+        for (auto& add : adds) {
+            sink.add(add.second->entry);
+            installed[*add.first] = *add.second;
+            stats.added++;
+        }
+
+        for (auto it = installed.begin(); it != installed.end(); ) {
+            if (desired.count(it->first)) {
+                ++it;
+                continue;
+            }
+            sink.remove(it->second.entry);
+            stats.removed++;
+            it = installed.erase(it);
+        }
+
+        for (auto it = classes.begin(); it != classes.end(); ) {
+            if (it->second.mark != epoch)
+                it = classes.erase(it);
+            else
+                ++it;
+        }
+        dirty = false;
+    }
+};
+
+TablePipeline::TablePipeline(std::vector<oxm::type> stages, uint8_t table,
+                             uint64_t cookie, Sink& sink)
+    : m_stages(std::move(stages))
+    , m_impl(new Impl(m_stages, table, cookie, sink))
+{ }
+
+TablePipeline::~TablePipeline() = default;
+
+bool TablePipeline::add(uint16_t priority, oxm::field_set const& match,
+                        uint64_t cookie, std::string program)
+{
+    Rule rule;
+    rule.cookie = cookie;
+    rule.head = m_impl->acquire(priority, match, cookie, std::move(program),
+                                rule.residual);
+
+    auto res = m_rules.emplace(RuleKey{priority, match}, rule);
+    if (res.second) {
+        m_impl->dirty = true;
+        return true;
+    }
+
+    Rule old = res.first->second;
+    res.first->second = rule;
+    m_impl->release(old.head, old.residual, old.cookie);
+    if (old.residual == rule.residual && old.cookie == rule.cookie)
+        return false;
+    m_impl->dirty = true;
+    return true;
+}
+
+bool TablePipeline::remove(uint16_t priority, oxm::field_set const& match)
+{
+    auto it = m_rules.find(RuleKey{priority, match});
+    if (it == m_rules.end())
+        return false;
+    m_impl->release(it->second.head, it->second.residual, it->second.cookie);
+    m_rules.erase(it);
+    m_impl->dirty = true;
+    return true;
+}
+
+void TablePipeline::lost(uint64_t cookie)
+{
+    auto& installed = m_impl->installed;
+    for (auto it = installed.begin(); it != installed.end(); ) {
+        uint64_t residual = it->second.residual;
+        bool has = residual && m_impl->cookies.count(residual) &&
+                   m_impl->cookies.at(residual).count(cookie);
+        if (has || (residual && it->second.entry.cookie == cookie)) {
+            it = installed.erase(it);
+            m_impl->dirty = true;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void TablePipeline::reset()
+{
+    m_impl->installed.clear();
+    m_impl->dirty = true;
+}
+
+void TablePipeline::commit()
+{
+    if (not m_impl->dirty)
+        return;
+
+    std::vector<uint64_t> heads;
+    heads.reserve(m_rules.size());
+    for (auto& rule : m_rules)
+        heads.push_back(rule.second.head);
+    m_impl->commit(std::move(heads));
+}
+
+std::vector<TablePipeline::Entry> TablePipeline::entries() const
+{
+    std::vector<Entry> ret;
+    for (auto& e : m_impl->installed)
+        ret.push_back(e.second.entry);
+    std::sort(ret.begin(), ret.end(), [](const Entry& lhs, const Entry& rhs) {
+        return lhs.table != rhs.table ? lhs.table < rhs.table
+                                      : lhs.priority > rhs.priority;
+    });
+    return ret;
+}
+
+TablePipeline::Stats TablePipeline::stats() const
+{
+    Stats ret = m_impl->stats;
+    ret.rules = m_rules.size();
+    ret.entries = m_impl->installed.size();
+    ret.classes = m_impl->classes.size();
+    return ret;
+}
+
+} // namespace maple
+} // namespace runos
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "oxm/field.hh"
+#include "oxm/field_set.hh"
+
+namespace runos {
+namespace maple {
+
+/**
+ * Lays the rules of one priority-ordered table out into a pipeline
+ * of tables, so rules which load independent fields don't multiply.
+ *
+ * Every stage field has a table which classifies packets by the exact
+ * value of the field and passes the class on in metadata; the last
+ * table holds the rules without the stage fields they matched. A rule
+ * which doesn't match a stage field exactly belongs to every class of
+ * that stage. Classes holding the same rules are the same class, so
+ * entries of equal subtrees are shared.
+ *
+ * Changes are collected and sent by commit() as the difference from
+ * the entries sent before. Isn't thread-safe.
+ */
+class TablePipeline {
+public:
+    /** Entry of a pipeline table */
+    struct Entry {
+        uint8_t table;
+        uint16_t priority;
+        oxm::field_set match;  ///< with metadata beyond the first table
+        uint64_t cookie;
+        uint64_t metadata;     ///< written for the next table
+        std::string program;   ///< of the rule, empty for a goto-table
+    };
+
+    struct Sink {
+        /** Adds the entry, or replaces one with the same match */
+        virtual void add(const Entry& entry) = 0;
+        virtual void remove(const Entry& entry) = 0;
+        virtual ~Sink() = default;
+    };
+
+    struct Stats {
+        size_t rules = 0;
+        size_t entries = 0;   ///< on the switch
+        size_t classes = 0;
+        uint64_t added = 0;   ///< entries sent
+        uint64_t removed = 0; ///< entries deleted
+    };
+
+    /**
+     * Tables from `table` to `table + stages.size()` are used.
+     * Classifying entries are sent with `cookie`.
+     */
+    TablePipeline(std::vector<oxm::type> stages, uint8_t table,
+                  uint64_t cookie, Sink& sink);
+    ~TablePipeline();
+
+    /**
+     * Adds a rule, replacing one with the same priority and match.
+     * Rules with the same `program` do the same, whatever the cookie.
+     * Returns false if the same rule is there already.
+     */
+    bool add(uint16_t priority, oxm::field_set const& match,
+             uint64_t cookie, std::string program);
+
+    bool remove(uint16_t priority, oxm::field_set const& match);
+
+    /** Removes rules for which pred(priority, match, cookie) holds */
+    template<class Pred>
+    size_t remove_if(Pred pred)
+    {
+        std::vector<RuleKey> victims;
+        for (auto& rule : m_rules) {
+            if (pred(rule.first.priority, rule.first.match, rule.second.cookie))
+                victims.push_back(rule.first);
+        }
+        for (auto& key : victims)
+            remove(key.priority, key.match);
+        return victims.size();
+    }
+
+    /** Entries with rules of `cookie` are not on the switch anymore */
+    void lost(uint64_t cookie);
+
+    /** Nothing is on the switch, everything is sent on commit */
+    void reset();
+
+    /** Sends the difference, entries of later tables first */
+    void commit();
+
+    /** Entries on the switch, first table first */
+    std::vector<Entry> entries() const;
+
+    Stats stats() const;
+
+private:
+    struct RuleKey {
+        uint16_t priority;
+        oxm::field_set match;
+
+        friend bool operator==(const RuleKey& lhs, const RuleKey& rhs)
+        { return lhs.priority == rhs.priority && lhs.match == rhs.match; }
+    };
+    struct RuleKeyHash {
+        size_t operator()(const RuleKey& key) const
+        { return hash_value(key.match) * 31 + key.priority; }
+    };
+    struct Rule {
+        uint64_t cookie;
+        uint64_t residual; // the rule without stage fields
+        uint64_t head;     // its item of the first stage
+    };
+
+    // Interned parts of rules and classes compiled from them
+    struct Impl;
+
+    std::vector<oxm::type> m_stages;
+    std::unordered_map<RuleKey, Rule, RuleKeyHash> m_rules;
+    std::unique_ptr<Impl> m_impl;
+};
+
+} // namespace maple
+} // namespace runos
@@ -16,8 +16,12 @@
 
 #include "TraceTree.hh"
 
+#include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <cmath>
+#include <new>
+#include <stdexcept>
 
 #include <boost/variant/variant.hpp>
 #include <boost/variant/get.hpp>
@@ -28,6 +32,7 @@
 
 #include "api/Packet.hh"
 #include "TraceablePacketImpl.hh"
+#include "Epoch.hh"
 
 namespace runos {
 namespace maple {
@@ -72,8 +77,20 @@ struct TraceTree::load_node {
 struct TraceTree::Impl {
     class Lookup;
     class Compiler;
+    class Flattener;
+    class Invalidator;
+    class Collector;
+    class Sizer;
     class TracerImpl;
     class PriorityUpdater;
+
+    // Step from a node on a traced path to the next one
+    struct Edge {
+        bool positive;
+        boost::optional<bits<>> key;
+    };
+
+    static void rebuild(TraceTree& tree);
 };
 
 class TraceTree::Impl::Compiler : public boost::static_visitor<>
@@ -186,8 +203,756 @@ public:
     }
 };
 
+/*
+ * Read-only copy of the tree for lookups: nodes are kept in one array
+ * and refer to each other by index, load cases are open addressing
+ * tables of packed values in another one. Walking it costs no
+ * variant dispatch and no hashing of bits<>.
+ *
+ * Lookups run without locks while a writer patches the copy. Arrays
+ * grow by chunks which never move, entries are filled before an index
+ * to them is published by an atomic store, published entries are
+ * never changed but for links: branches of tests, tables of loads and
+ * children in slots, each a single atomic word.
+ */
+struct TraceTree::Flat {
+    enum Kind : uint8_t { Miss, Leaf, Test, Load, Wide };
+
+    // Chunk c holds first_size << c entries and is allocated when the
+    // array grows into it, so small trees stay small and the directory
+    // itself never moves.
+    template<class T>
+    class Array {
+        static constexpr size_t first_bits = 4;
+        static constexpr size_t first_size = size_t(1) << first_bits;
+        static constexpr size_t max_chunks = 24;
+
+        std::atomic<T*> chunks[max_chunks] {};
+        size_t m_size {0}; // written by the writer only
+
+        static size_t chunk_of(size_t i)
+        { return 63 - __builtin_clzll((i >> first_bits) + 1); }
+
+        static size_t chunk_begin(size_t c)
+        { return (first_size << c) - first_size; }
+
+    public:
+        Array() = default;
+        Array(const Array&) = delete;
+
+        ~Array()
+        {
+            for (size_t i = 0; i < m_size; ++i)
+                (*this)[i].~T();
+            for (size_t c = 0; c < max_chunks && chunks[c]; ++c)
+                ::operator delete(chunks[c].load());
+        }
+
+        size_t size() const { return m_size; }
+
+        // Entries allocated, used or not
+        size_t capacity() const
+        { return m_size ? chunk_begin(chunk_of(m_size - 1) + 1) : 0; }
+
+        T& operator[](size_t i) const
+        {
+            size_t c = chunk_of(i);
+            return chunks[c].load(std::memory_order_acquire)[i - chunk_begin(c)];
+        }
+
+        template<class... Args>
+        uint32_t emplace_back(Args&&... args)
+        {
+            size_t c = chunk_of(m_size);
+            if (c >= max_chunks)
+                throw std::length_error("trace tree is too large");
+            if (m_size == chunk_begin(c)) {
+                void* raw = ::operator new((first_size << c) * sizeof(T));
+                chunks[c].store(static_cast<T*>(raw), std::memory_order_release);
+            }
+            new (&(*this)[m_size]) T(std::forward<Args>(args)...);
+            return m_size++;
+        }
+    };
+
+    struct Node {
+        Kind kind;
+        uint32_t arg;   // index of the flow, field or mask
+        uint32_t size;  // number of cases, seen by the writer only
+        // positive and negative branches, or the first slot and the
+        // number of slots of cases
+        std::atomic<uint64_t> link;
+
+        Node(Kind kind, uint32_t arg)
+            : kind(kind), arg(arg), size(0), link(0)
+        { }
+
+        static uint64_t pack(uint32_t first, uint32_t second)
+        { return uint64_t(first) << 32 | second; }
+
+        uint32_t first() const
+        { return link.load(std::memory_order_acquire) >> 32; }
+        uint32_t second() const
+        { return uint32_t(link.load(std::memory_order_acquire)); }
+    };
+
+    // Value of a field up to 128 bits wide. Values of wider fields are
+    // kept aside, the key holds their hash and index.
+    struct Key {
+        uint64_t lo, hi;
+
+        bool operator==(const Key& other) const
+        { return lo == other.lo && hi == other.hi; }
+    };
+
+    struct Slot {
+        Key key;
+        std::atomic<uint32_t> child; // miss for a free slot
+
+        Slot() : key{0, 0}, child(0) { }
+    };
+
+    static constexpr uint32_t miss = 0;
+    // Miss which occupies a slot, keeps probe sequences unbroken
+    static constexpr uint32_t gone = 1;
+    static constexpr uint32_t none = uint32_t(-1);
+
+    Array<Node> nodes;
+    Array<Slot> slots;
+    Array<oxm::field<>> fields;
+    Array<oxm::mask<>> masks;
+    Array<std::weak_ptr<Flow>> flows;
+    Array<bits<>> wide;
+    std::unordered_map<bits<>, uint32_t> interned; // values in `wide`
+    std::atomic<uint32_t> root {miss};
+    size_t garbage {0}; // nodes and slots replaced by patches
+
+    size_t bytes() const
+    {
+        size_t ret = sizeof(Flat)
+                   + nodes.capacity() * sizeof(Node)
+                   + slots.capacity() * sizeof(Slot)
+                   + fields.capacity() * sizeof(oxm::field<>)
+                   + masks.capacity() * sizeof(oxm::mask<>)
+                   + flows.capacity() * sizeof(std::weak_ptr<Flow>)
+                   + wide.capacity() * sizeof(bits<>);
+        for (size_t i = 0; i < wide.size(); ++i)
+            ret += wide[i].num_blocks();
+        return ret + interned.size() * (sizeof(bits<>) + sizeof(void*) * 3);
+    }
+
+    Flat()
+    {
+        nodes.emplace_back(Miss, 0);
+        nodes.emplace_back(Miss, 0);
+    }
+
+    static bool packable(const oxm::mask<>& mask)
+    { return mask.type().nbits() <= 128; }
+
+    static Key pack(const bits<>& value)
+    {
+        return Key{value.word(0), value.word(1)};
+    }
+
+    Key key(const Node& load, const bits<>& value)
+    {
+        if (load.kind == Load)
+            return pack(value);
+        auto it = interned.find(value);
+        if (it == interned.end())
+            it = interned.emplace(value, wide.emplace_back(value)).first;
+        return Key{std::hash<bits<>>()(value), it->second};
+    }
+
+    static size_t hash(const Key& key)
+    {
+        uint64_t h = (key.lo ^ (key.hi * 0x9e3779b97f4a7c15ull))
+                   * 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 29);
+    }
+
+    uint32_t add(Kind kind, uint32_t arg)
+    {
+        return nodes.emplace_back(kind, arg);
+    }
+
+    uint32_t find(const Node& load, const Key& key) const
+    {
+        uint64_t link = load.link.load(std::memory_order_acquire);
+        uint32_t first = link >> 32;
+        size_t mask = uint32_t(link) - 1;
+        for (size_t i = hash(key) & mask; ; i = (i + 1) & mask) {
+            const Slot& slot = slots[first + i];
+            uint32_t child = slot.child.load(std::memory_order_acquire);
+            if (child == miss || slot.key == key)
+                return child;
+        }
+    }
+
+    uint32_t find_wide(const Node& load, const bits<>& value) const
+    {
+        uint64_t link = load.link.load(std::memory_order_acquire);
+        uint32_t first = link >> 32;
+        size_t mask = uint32_t(link) - 1;
+        uint64_t h = std::hash<bits<>>()(value);
+        for (size_t i = hash(Key{h, 0}) & mask; ; i = (i + 1) & mask) {
+            const Slot& slot = slots[first + i];
+            uint32_t child = slot.child.load(std::memory_order_acquire);
+            if (child == miss)
+                return miss;
+            if (slot.key.lo == h && wide[slot.key.hi] == value)
+                return child;
+        }
+    }
+
+    // Returns true if the key is new
+    bool place(uint32_t first, uint32_t count, const Key& key, uint32_t child,
+               bool wide)
+    {
+        size_t mask = count - 1;
+        // wide keys are probed by their hash only
+        size_t start = wide ? hash(Key{key.lo, 0}) : hash(key);
+        for (size_t i = start & mask; ; i = (i + 1) & mask) {
+            Slot& slot = slots[first + i];
+            if (slot.child.load(std::memory_order_relaxed) == miss) {
+                slot.key = key;
+                slot.child.store(child, std::memory_order_release);
+                return true;
+            }
+            if (slot.key == key) {
+                slot.child.store(child, std::memory_order_release);
+                return false;
+            }
+        }
+    }
+
+    // Allocates a table for at least `cases` cases
+    uint64_t table(size_t cases)
+    {
+        size_t count = 2;
+        while (count < 2 * cases)
+            count *= 2;
+        uint32_t first = slots.size();
+        for (size_t i = 0; i < count; ++i)
+            slots.emplace_back();
+        return Node::pack(first, count);
+    }
+
+    void insert(uint32_t load, const Key& key, uint32_t child)
+    {
+        if (child == miss)
+            child = gone;
+
+        Node& n = nodes[load];
+        bool is_wide = n.kind == Wide;
+        uint64_t link = n.link.load(std::memory_order_relaxed);
+
+        if ((n.size + 1) * 2 > uint32_t(link)) {
+            // readers keep walking the old table until the new one
+            // is complete
+            uint64_t grown = table(n.size + 1);
+            for (uint32_t i = 0; i < uint32_t(link); ++i) {
+                const Slot& slot = slots[(link >> 32) + i];
+                uint32_t c = slot.child.load(std::memory_order_relaxed);
+                if (c != miss)
+                    place(grown >> 32, uint32_t(grown), slot.key, c, is_wide);
+            }
+            garbage += uint32_t(link);
+            n.link.store(grown, std::memory_order_release);
+            link = grown;
+        }
+
+        if (place(link >> 32, uint32_t(link), key, child, is_wide))
+            ++n.size;
+    }
+
+    // Nodes and slots of a subtree, shared ones are counted every time
+    size_t reachable(uint32_t from) const
+    {
+        size_t ret = 0;
+        std::vector<uint32_t> stack {from};
+        while (not stack.empty()) {
+            const Node& n = nodes[stack.back()];
+            stack.pop_back();
+            switch (n.kind) {
+            case Miss:
+                continue;
+            case Test:
+                stack.push_back(n.first());
+                stack.push_back(n.second());
+                break;
+            case Load:
+            case Wide:
+                for (uint32_t i = 0; i < n.second(); ++i)
+                    stack.push_back(slots[n.first() + i].child.load());
+                ret += n.second();
+                break;
+            case Leaf:
+                break;
+            }
+            ++ret;
+        }
+        return ret;
+    }
+
+    FlowPtr lookup(const Packet& pkt) const
+    {
+        uint32_t at = root.load(std::memory_order_acquire);
+        for (;;) {
+            const Node& n = nodes[at];
+            switch (n.kind) {
+            case Miss:
+                return nullptr;
+            case Leaf:
+                return flows[n.arg].lock();
+            case Test:
+                at = pkt.test(fields[n.arg]) ? n.first() : n.second();
+                break;
+            case Load:
+                at = find(n, pack(pkt.load(masks[n.arg]).value_bits()));
+                break;
+            case Wide:
+                at = find_wide(n, pkt.load(masks[n.arg]).value_bits());
+                break;
+            }
+        }
+    }
+};
+
+/*
+ * Writes subtrees of the tree into the copy. Nodes are linked into
+ * the published part of the copy only when they are complete.
+ */
+class TraceTree::Impl::Flattener : public boost::static_visitor<uint32_t>
+{
+    Flat& flat;
+    // vload cases share nodes, they are flattened once
+    std::unordered_map<const node*, uint32_t> shared;
+
+    template<class LoadNode, class Child>
+    uint32_t cases(const LoadNode& load, Child child_of)
+    {
+        std::vector<std::pair<const bits<>*, uint32_t>> children;
+        for (auto& record : load.cases) {
+            uint32_t child = child_of(record.second);
+            if (child != Flat::miss)
+                children.emplace_back(&record.first, child);
+        }
+        if (children.empty())
+            return Flat::miss;
+
+        uint32_t mask = flat.masks.emplace_back(load.mask);
+        uint32_t ret = flat.add(Flat::packable(load.mask) ? Flat::Load
+                                                          : Flat::Wide, mask);
+        Flat::Node& n = flat.nodes[ret];
+        n.link.store(flat.table(children.size()), std::memory_order_relaxed);
+        for (auto& child : children)
+            flat.insert(ret, flat.key(n, *child.first), child.second);
+        return ret;
+    }
+
+    void link(uint32_t parent, const Edge* edge, uint32_t child)
+    {
+        if (parent == Flat::none) {
+            flat.root.store(child, std::memory_order_release);
+            return;
+        }
+        Flat::Node& n = flat.nodes[parent];
+        if (n.kind == Flat::Test) {
+            uint32_t positive = edge->positive ? child : n.first();
+            uint32_t negative = edge->positive ? n.second() : child;
+            n.link.store(Flat::Node::pack(positive, negative),
+                         std::memory_order_release);
+        } else {
+            flat.insert(parent, flat.key(n, *edge->key), child);
+        }
+    }
+
+public:
+    explicit Flattener(Flat& flat)
+        : flat(flat)
+    { }
+
+    uint32_t operator()(const unexplored&)
+    {
+        return Flat::miss;
+    }
+
+    uint32_t operator()(const flow_node& leaf)
+    {
+        return flat.add(Flat::Leaf, flat.flows.emplace_back(leaf.flow));
+    }
+
+    uint32_t operator()(const test_node& test)
+    {
+        uint32_t ret = flat.add(Flat::Test, flat.fields.emplace_back(test.need));
+        uint32_t positive = boost::apply_visitor(*this, test.positive);
+        uint32_t negative = boost::apply_visitor(*this, test.negative);
+        flat.nodes[ret].link.store(Flat::Node::pack(positive, negative),
+                                   std::memory_order_relaxed);
+        return ret;
+    }
+
+    uint32_t operator()(const load_node& load)
+    {
+        return cases(load, [this](const node& child) {
+            return boost::apply_visitor(*this, child);
+        });
+    }
+
+    uint32_t operator()(const vload_node& vload)
+    {
+        return cases(vload, [this](const std::shared_ptr<node>& child) {
+            auto it = shared.find(child.get());
+            if (it != shared.end())
+                return it->second;
+            uint32_t ret = boost::apply_visitor(*this, *child);
+            shared.emplace(child.get(), ret);
+            return ret;
+        });
+    }
+
+    // Brings the copy up to date after the tree was augmented along
+    // the path: flattens the first subtree it doesn't have yet
+    void patch(const std::vector<node*>& path, const std::vector<Edge>& edges)
+    {
+        uint32_t parent = Flat::none;
+        uint32_t at = flat.root.load(std::memory_order_relaxed);
+
+        for (size_t i = 0; i < path.size() && path[i]; ++i) {
+            node& n = *path[i];
+            bool last = i + 1 == path.size() || not path[i + 1];
+            // cases of vloads are connected to each other by finish()
+            bool vload_below = not last && boost::get<vload_node>(path[i + 1]);
+            const Flat::Node& copy = flat.nodes[at];
+
+            // leaves are replaced too, readers may be copying the flow
+            if ((copy.kind == Flat::Miss && not boost::get<unexplored>(&n))
+                    || copy.kind == Flat::Leaf || vload_below) {
+                flat.garbage += flat.reachable(at);
+                link(parent, i ? &edges[i - 1] : nullptr,
+                     boost::apply_visitor(*this, n));
+                return;
+            }
+
+            switch (copy.kind) {
+            case Flat::Miss:
+            case Flat::Leaf:
+                return;
+            case Flat::Test:
+                if (last) return;
+                parent = at;
+                at = edges[i].positive ? copy.first() : copy.second();
+                break;
+            case Flat::Load:
+                if (last) return;
+                parent = at;
+                at = flat.find(copy, Flat::pack(*edges[i].key));
+                break;
+            case Flat::Wide:
+                if (last) return;
+                parent = at;
+                at = flat.find_wide(copy, *edges[i].key);
+                break;
+            }
+        }
+    }
+};
+
+void TraceTree::Impl::rebuild(TraceTree& tree)
+{
+    std::unique_ptr<Flat> flat {new Flat};
+    Flattener flattener {*flat};
+    flat->root = boost::apply_visitor(flattener, *tree.m_root);
+    Epoch::retire(tree.m_flat.exchange(flat.release()));
+}
+
+class TraceTree::Impl::Invalidator
+{
+    const oxm::field<>& f;
+    Eviction& evicted;
+    Backend& backend;
+    // Match of the path, as the tracer saw it: it stops growing at
+    // the first vload
+    oxm::expirementer::full_field_set match;
+    unsigned vloads {0}; // on the path
+    std::unordered_set<const node*> visited; // vload cases are shared
+    std::unordered_set<const Flow*> flows;
+
+    // Some packet matches both
+    bool overlaps(const bits<>& value, const bits<>& mask) const
+    {
+        return ((value ^ f.value_bits()) & mask & f.mask_bits()).none();
+    }
+
+    template<class Visit>
+    void with(const oxm::field<>& field, Visit visit)
+    {
+        if (vloads) return visit();
+        match.add(field);
+        visit();
+        match.erase(oxm::mask<>(field));
+    }
+
+    template<class Visit>
+    void without(const oxm::field<>& field, Visit visit)
+    {
+        if (vloads) return visit();
+        match.exclude(field);
+        visit();
+        match.include(oxm::mask<>(field));
+    }
+
+    // Drops barrier rules of tests below, by the match they were
+    // installed with
+    void collect(const node& n)
+    {
+        if (const flow_node* leaf = boost::get<flow_node>(&n)) {
+            ++evicted.paths;
+            auto flow = leaf->flow.lock();
+            if (flow && flows.insert(flow.get()).second)
+                evicted.flows.push_back(flow);
+        } else if (const test_node* test = boost::get<test_node>(&n)) {
+            auto barrier = match;
+            barrier.add(test->need);
+            for (auto& fields : barrier.included().fields())
+                backend.remove(test->prio, fields);
+            ++evicted.barriers;
+
+            with(test->need, [&] { collect(test->positive); });
+            without(test->need, [&] { collect(test->negative); });
+        } else if (const load_node* load = boost::get<load_node>(&n)) {
+            auto type = load->mask.type();
+            for (auto& record : load->cases) {
+                with((type == record.first) & load->mask,
+                     [&] { collect(record.second); });
+            }
+        } else if (const vload_node* vload = boost::get<vload_node>(&n)) {
+            ++vloads;
+            for (auto& record : vload->cases) {
+                if (visited.insert(record.second.get()).second)
+                    collect(*record.second);
+            }
+            --vloads;
+        }
+    }
+
+    // `get` gives the case's node or nullptr if it was seen already
+    template<class Cases, class Get>
+    void cases(const oxm::mask<>& mask, Cases& cases, Get get)
+    {
+        auto type = mask.type();
+        bool same = type == f.type();
+        for (auto it = cases.begin(); it != cases.end(); ) {
+            if (same && not overlaps(it->first, mask.mask_bits())) {
+                // packets of this case don't have the value
+                ++it;
+                continue;
+            }
+            node* child = get(it->second);
+            if (not same) {
+                if (child)
+                    with((type == it->first) & mask, [&] { (*this)(*child); });
+                ++it;
+            } else {
+                if (child)
+                    with((type == it->first) & mask, [&] { collect(*child); });
+                it = cases.erase(it);
+            }
+        }
+    }
+
+public:
+    Invalidator(const oxm::field<>& f, Eviction& evicted, Backend& backend)
+        : f(f), evicted(evicted), backend(backend)
+    { }
+
+    void operator()(node& n)
+    {
+        if (test_node* test = boost::get<test_node>(&n)) {
+            if (test->need.type() != f.type()) {
+                with(test->need, [&] { (*this)(test->positive); });
+            } else if (overlaps(test->need.value_bits(), test->need.mask_bits())) {
+                with(test->need, [&] { collect(test->positive); });
+                test->positive = unexplored();
+            }
+            without(test->need, [&] { (*this)(test->negative); });
+        } else if (load_node* load = boost::get<load_node>(&n)) {
+            cases(load->mask, load->cases, [](node& child) {
+                return &child;
+            });
+        } else if (vload_node* vload = boost::get<vload_node>(&n)) {
+            ++vloads;
+            cases(vload->mask, vload->cases, [this](std::shared_ptr<node>& child) {
+                return visited.insert(child.get()).second ? child.get() : nullptr;
+            });
+            --vloads;
+        }
+    }
+};
+
+class TraceTree::Impl::Collector
+{
+    Backend& backend;
+    Collection& collected;
+    oxm::expirementer::full_field_set match;
+    std::unordered_set<const node*> visited; // vload cases are shared
+    unsigned shared {0}; // vloads on the path
+
+    static bool empty(const node& n)
+    {
+        return boost::get<unexplored>(&n) != nullptr;
+    }
+
+    // Drops cases left unexplored, `get` gives the case's node
+    template<class Cases, class Get>
+    void cases(const oxm::mask<>& mask, Cases& cases, Get get)
+    {
+        auto type = mask.type();
+        for (auto it = cases.begin(); it != cases.end(); ) {
+            match.add((type == it->first) & mask);
+            (*this)(get(it->second));
+            match.erase(mask);
+
+            if (empty(get(it->second))) {
+                ++collected.cases;
+                it = cases.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+public:
+    bool barriers_removed {false};
+
+    Collector(Backend& backend, Collection& collected)
+        : backend(backend), collected(collected)
+    { }
+
+    void operator()(node& n)
+    {
+        if (flow_node* leaf = boost::get<flow_node>(&n)) {
+            if (leaf->flow.expired()) {
+                ++collected.leaves;
+                n = unexplored();
+            }
+        } else if (test_node* test = boost::get<test_node>(&n)) {
+            match.exclude(test->need);
+            (*this)(test->negative);
+            match.include(oxm::mask<>(test->need));
+
+            match.add(test->need);
+            (*this)(test->positive);
+            // Barrier rules of a shared test were installed for every
+            // path to it, it's kept rather than tracking them all
+            bool collapse = shared == 0 &&
+                            empty(test->positive) && empty(test->negative);
+            if (collapse) {
+                for (auto& fields : match.included().fields())
+                    backend.remove(test->prio, fields);
+                barriers_removed = true;
+            }
+            match.erase(oxm::mask<>(test->need));
+
+            if (collapse) {
+                ++collected.tests;
+                n = unexplored();
+            }
+        } else if (load_node* load = boost::get<load_node>(&n)) {
+            cases(load->mask, load->cases, [](node& child) -> node& {
+                return child;
+            });
+            if (load->cases.empty())
+                n = unexplored();
+        } else if (vload_node* vload = boost::get<vload_node>(&n)) {
+            ++shared;
+            auto type = vload->mask.type();
+            for (auto it = vload->cases.begin(); it != vload->cases.end(); ) {
+                node& child = *it->second;
+                if (visited.insert(&child).second) {
+                    match.add((type == it->first) & vload->mask);
+                    (*this)(child);
+                    match.erase(vload->mask);
+                }
+                if (empty(child)) {
+                    ++collected.cases;
+                    it = vload->cases.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            --shared;
+            if (vload->cases.empty())
+                n = unexplored();
+        }
+    }
+};
+
+class TraceTree::Impl::Sizer : public boost::static_visitor<>
+{
+    TreeSize& size;
+    std::unordered_set<const node*> visited; // vload cases are shared
+
+    // Entry of an unordered_map of cases, without its node
+    static size_t case_bytes(const bits<>& key)
+    {
+        return sizeof(bits<>) + key.num_blocks() + sizeof(void*) * 2;
+    }
+
+public:
+    explicit Sizer(TreeSize& size)
+        : size(size)
+    { }
+
+    void visit(const node& n)
+    {
+        ++size.nodes;
+        size.bytes += sizeof(node);
+        boost::apply_visitor(*this, n);
+    }
+
+    void operator()(const unexplored&)
+    { }
+
+    void operator()(const flow_node& leaf)
+    {
+        ++size.leaves;
+        if (leaf.flow.expired())
+            ++size.dead;
+    }
+
+    void operator()(const test_node& test)
+    {
+        size.bytes += sizeof(test_node);
+        visit(test.positive);
+        visit(test.negative);
+    }
+
+    void operator()(const load_node& load)
+    {
+        size.bytes += sizeof(load_node);
+        for (auto& record : load.cases) {
+            size.bytes += case_bytes(record.first);
+            visit(record.second);
+        }
+    }
+
+    void operator()(const vload_node& vload)
+    {
+        for (auto& record : vload.cases) {
+            size.bytes += case_bytes(record.first) + sizeof(std::shared_ptr<node>);
+            if (visited.insert(record.second.get()).second)
+                visit(*record.second);
+        }
+    }
+};
+
 class TraceTree::Impl::TracerImpl : public Tracer {
     std::vector<node*> path;
+    std::vector<Edge> edges; // edges[i] leads from path[i] to path[i + 1]
+    TraceTree& tree;
     Backend& backend;
     uint16_t left_prio, right_prio;
 
@@ -202,16 +967,73 @@ class TraceTree::Impl::TracerImpl : public Tracer {
 
 
     node* node_ptr() { return path.back(); }
-    void node_push(node* n) { path.push_back(n); }
+    void node_push(node* n, Edge e)
+    {
+        path.push_back(n);
+        edges.push_back(std::move(e));
+    }
+
+    // Priority range of path[i] for every i
+    std::vector<std::pair<uint16_t, uint16_t>> ranges() const
+    {
+        std::vector<std::pair<uint16_t, uint16_t>> ret;
+        ret.emplace_back(tree.left_prio, tree.right_prio);
+        for (size_t i = 0; i + 1 < path.size(); i++) {
+            auto range = ret.back();
+            if (const test_node* test = boost::get<test_node>(path[i])) {
+                if (edges[i].positive)
+                    range.first = test->prio;
+                else
+                    range.second = test->prio;
+            }
+            ret.push_back(range);
+        }
+        return ret;
+    }
+
+    // Match of path[i], as the compiler sees it
+    oxm::expirementer::full_field_set match_at(size_t i) const
+    {
+        oxm::expirementer::full_field_set ret;
+        for (size_t k = 0; k < i; k++) {
+            if (const test_node* test = boost::get<test_node>(path[k])) {
+                if (edges[k].positive)
+                    ret.add(test->need);
+                else
+                    ret.exclude(test->need);
+            } else if (const load_node* load = boost::get<load_node>(path[k])) {
+                ret.add((load->mask.type() == *edges[k].key) & load->mask);
+            } else if (const vload_node* vload = boost::get<vload_node>(path[k])) {
+                ret.add((vload->mask.type() == *edges[k].key) & vload->mask);
+            }
+        }
+        return ret;
+    }
+
+    // Relabels the smallest subtree around the current node with
+    // enough room for it, leaving slack for the following augments
+    bool make_room();
+
+    uint16_t next_prio()
+    {
+        uint16_t prio = (left_prio + right_prio) / 2;
+        if (prio <= left_prio or prio >= right_prio) {
+            if (make_room())
+                prio = (left_prio + right_prio) / 2;
+            if (prio <= left_prio or prio >= right_prio)
+                RUNOS_THROW(priority_exceeded());
+        }
+        return prio;
+    }
 
 public:
-    explicit TracerImpl(node& root,
-                        Backend& backend,
+    explicit TracerImpl(TraceTree& tree,
                         uint16_t left_prio,
                         uint16_t right_prio)
-        : backend(backend), left_prio(left_prio), right_prio(right_prio)
+        : tree(tree), backend(tree.m_backend)
+        , left_prio(left_prio), right_prio(right_prio)
     {
-        path.push_back(&root);
+        path.push_back(tree.m_root.get());
     }
 
     void load(oxm::field<> data) override
@@ -221,11 +1043,13 @@ public:
             node_push( &boost::get<load_node>(*node_ptr())
                        .cases
                        .emplace(data.value_bits(), unexplored())
-                       .first->second ); // inserted value
+                       .first->second, // inserted value
+                       Edge{false, data.value_bits()} );
         } else if (load_node* load = boost::get<load_node>(node_ptr())) {
             if (load->mask != oxm::mask<>(data))
                 RUNOS_THROW(inconsistent_trace());
-            path.push_back(&load->cases[ data.value_bits() ]);
+            node_push(&load->cases[ data.value_bits() ],
+                      Edge{false, data.value_bits()});
         } else {
             RUNOS_THROW(inconsistent_trace());
         }
@@ -249,11 +1073,13 @@ public:
             node_push( &boost::get<load_node>(*node_ptr())
                         .cases
                         .emplace(by.value_bits(), unexplored())
-                        .first->second ); // inserted value
+                        .first->second, // inserted value
+                        Edge{false, by.value_bits()} );
         } else if (load_node* load = boost::get<load_node>(node_ptr())) {
             if (load->mask != oxm::mask<>(by))
                 RUNOS_THROW(inconsistent_trace());
-            path.push_back(&load->cases[ by.value_bits() ]);
+            node_push(&load->cases[ by.value_bits() ],
+                      Edge{false, by.value_bits()});
         } else {
             RUNOS_THROW(inconsistent_trace());
         }
@@ -264,7 +1090,7 @@ public:
                         .cases
                         .emplace(what.value_bits(), std::make_shared<node>())
                         .first->second; //inserted value
-            node_push(vload_ends.second.get());
+            node_push(vload_ends.second.get(), Edge{false, what.value_bits()});
         } else if (vload_node* vload = boost::get<vload_node>(node_ptr())) {
             if (vload->mask != oxm::mask<>(what))
                 RUNOS_THROW(inconsistent_trace());
@@ -282,7 +1108,7 @@ public:
 
             vload_ends.second = next_node;
 
-            path.push_back(next_node.get());
+            node_push(next_node.get(), Edge{false, what.value_bits()});
         } else {
             RUNOS_THROW(inconsistent_trace());
         }
@@ -293,9 +1119,7 @@ public:
     {
         uint16_t test_prio;
         if (boost::get<unexplored>(node_ptr())) {
-            test_prio = (left_prio + right_prio) / 2;
-            if (test_prio <= left_prio or test_prio >= right_prio)
-                RUNOS_THROW(priority_exceeded());
+            test_prio = next_prio();
             uint64_t id = id_generator();
             *node_ptr() = test_node{
                 pred, unexplored(), unexplored{}, id, test_prio
@@ -303,7 +1127,8 @@ public:
 
             node_push( ret ?
                 &boost::get<test_node>(node_ptr())->positive :
-                &boost::get<test_node>(node_ptr())->negative );
+                &boost::get<test_node>(node_ptr())->negative,
+                Edge{ret, boost::none} );
             auto tmp_match = match;
             tmp_match.add(pred);
             backend.barrier_rule(test_prio, tmp_match, pred, id);
@@ -312,7 +1137,8 @@ public:
             if (test->need != pred)
                 RUNOS_THROW(inconsistent_trace());
             test_prio = test->prio;
-            node_push( ret ? &test->positive : &test->negative );
+            node_push( ret ? &test->positive : &test->negative,
+                       Edge{ret, boost::none} );
         } else {
             RUNOS_THROW(inconsistent_trace());
         }
@@ -330,10 +1156,7 @@ public:
     Installer finish(FlowPtr new_flow) override
     {
         if (boost::get<unexplored>(node_ptr())) {
-            uint16_t prio = (left_prio + right_prio) / 2;
-            if (prio <= left_prio or prio >= right_prio)
-                RUNOS_THROW(priority_exceeded());
-            *node_ptr() = flow_node{ new_flow, prio };
+            *node_ptr() = flow_node{ new_flow, next_prio() };
         } else if (flow_node* leaf = boost::get<flow_node>(node_ptr())) {
             leaf->flow = new_flow;
         } else {
@@ -343,7 +1166,7 @@ public:
         //auto node = path[0];//node_ptr();
         auto node = isVloadOccured ? vload_ends.first : node_ptr();
 
-        node_push(nullptr);
+        path.push_back(nullptr);
 
         if (ovload_masks){
             auto vload_masks = *ovload_masks;
@@ -356,6 +1179,12 @@ public:
             }
         }
 
+        Flat& flat = *tree.m_flat.load(std::memory_order_relaxed);
+        Impl::Flattener(flat).patch(path, edges);
+        if (flat.garbage > (flat.nodes.size() + flat.slots.size()) / 2)
+            Impl::rebuild(tree);
+        Epoch::reclaim();
+
         return [node=node, match=match, &backend=backend](){
             backend.barrier();
             Impl::Compiler compiler(backend, match);
@@ -447,17 +1276,37 @@ class TraceTree::Impl::PriorityUpdater {
         }
     };
 
+    // Rule which got another priority
+    struct Move {
+        uint16_t from, to;
+        oxm::expirementer::full_field_set match;
+        const test_node* barrier; // barrier rule of the test, or
+        std::weak_ptr<Flow> flow; // rule of the flow
+    };
+    std::vector<Move> moves;
+
+    // Priorities are written after the walk, so nodes shared by
+    // vloads are seen with their old ones from every path
+    std::vector<std::pair<uint16_t*, uint16_t>> labels;
+
     class PriorityAssigner : public boost::static_visitor<>
     {
         const Depth& depth;
         double from, to;
+        oxm::expirementer::full_field_set match;
+        std::vector<Move>& moves;
+        std::vector<std::pair<uint16_t*, uint16_t>>& labels;
 
         double average(double from, double to, unsigned k, unsigned m)
         { return (from * m + to * k) / (m + k); }
 
     public:
-        PriorityAssigner(const Depth& depth, uint16_t from, uint16_t to)
-            : depth(depth), from(from), to(to)
+        PriorityAssigner(const Depth& depth, uint16_t from, uint16_t to,
+                         const oxm::expirementer::full_field_set& match,
+                         std::vector<Move>& moves,
+                         std::vector<std::pair<uint16_t*, uint16_t>>& labels)
+            : depth(depth), from(from), to(to), match(match)
+            , moves(moves), labels(labels)
         { }
 
         void operator() (unexplored&)
@@ -467,15 +1316,21 @@ class TraceTree::Impl::PriorityUpdater {
 
         void operator() (load_node& load)
         {
+            auto type = load.mask.type();
             for (auto& record : load.cases) {
+                match.add((type == record.first) & load.mask);
                 boost::apply_visitor(*this, record.second);
+                match.erase(load.mask);
             }
         }
 
         void operator() (vload_node& vload)
         {
+            auto type = vload.mask.type();
             for (auto& record : vload.cases) {
+                match.add((type == record.first) & vload.mask);
                 boost::apply_visitor(*this, *record.second);
+                match.erase(vload.mask);
             }
         }
 
@@ -485,23 +1340,33 @@ class TraceTree::Impl::PriorityUpdater {
             double old_from = from, old_to = to;
             auto d = depth.at(test.id);
             double this_prio = average(from, to, d.negative, d.positive);
+            uint16_t prio = std::round(this_prio);
 
             // handle negative branch
             to = this_prio;
+            match.exclude(test.need);
             boost::apply_visitor(*this, test.negative);
+            match.include(oxm::mask<>(test.need));
             to = old_to;
 
             // handle positive branch
             from = this_prio;
+            match.add(test.need);
+            if (prio != test.prio)
+                moves.push_back(Move{test.prio, prio, match, &test, {}});
             boost::apply_visitor(*this, test.positive);
+            match.erase(oxm::mask<>(test.need));
             from = old_from;
 
-            test.prio = std::round(this_prio);
+            labels.emplace_back(&test.prio, prio);
         }
 
         void operator() (flow_node& node)
         {
-            node.prio = std::round(average(from, to, 1, 1));
+            uint16_t prio = std::round(average(from, to, 1, 1));
+            if (prio != node.prio)
+                moves.push_back(Move{node.prio, prio, match, nullptr, node.flow});
+            labels.emplace_back(&node.prio, prio);
         }
     };
 
@@ -511,26 +1376,98 @@ public:
         : from(from), to(to)
     { }
 
-    void operator() (node& node)
+    // Count of priorities needed by the longest chain of the subtree
+    static unsigned size(const node& node)
+    {
+        Depth depth;
+        DepthCounter dc{depth};
+        return boost::apply_visitor(dc, node);
+    }
+
+    // `match` is the one of the node, as the compiler sees it
+    void operator() (node& node,
+                     const oxm::expirementer::full_field_set& match
+                         = oxm::expirementer::full_field_set())
     {
         DepthCounter dc{depth};
         boost::apply_visitor(dc, node);
 
-        PriorityAssigner pa{depth, from, to};
+        PriorityAssigner pa{depth, from, to, match, moves, labels};
         boost::apply_visitor(pa, node);
+
+        for (auto& label : labels)
+            *label.first = label.second;
     }
 
+    // Sends moved rules, returns their count
+    size_t emit(Backend& backend)
+    {
+        // Relabeling keeps the order of rules, so a rule doesn't land
+        // on the priority of an overlapping one which hasn't moved yet
+        // if rules going down move lowest first and going up highest first.
+        std::stable_sort(moves.begin(), moves.end(),
+            [](const Move& a, const Move& b) {
+                bool a_down = a.to < a.from, b_down = b.to < b.from;
+                if (a_down != b_down)
+                    return a_down;
+                return a_down ? a.from < b.from : a.from > b.from;
+            });
+
+        for (auto& move : moves) {
+            if (move.barrier) {
+                backend.barrier_rule(move.to, move.match,
+                                     move.barrier->need, move.barrier->id);
+                for (auto& fields : move.match.included().fields())
+                    backend.remove(move.from, fields);
+            } else if (auto flow = move.flow.lock()) {
+                backend.move(move.from, move.to, move.match, flow);
+            }
+        }
+        if (not moves.empty())
+            backend.barrier();
+        return moves.size();
+    }
 };
 
+bool TraceTree::Impl::TracerImpl::make_room()
+{
+    // Shared nodes below vloads are reached through other paths too
+    size_t end = path.size();
+    for (size_t i = 0; i < path.size(); i++) {
+        if (boost::get<vload_node>(path[i])) {
+            end = i;
+            break;
+        }
+    }
+
+    auto bounds = ranges();
+    for (size_t i = end; i-- > 0; ) {
+        unsigned room = bounds[i].second - bounds[i].first;
+        unsigned needed = PriorityUpdater::size(*path[i]) + 2;
+        if (room < needed * (i == 0 ? 2 : 4))
+            continue;
+
+        PriorityUpdater pu(bounds[i].first, bounds[i].second);
+        pu(*path[i], match_at(i));
+        tree.relabeled(pu.emit(backend));
+
+        std::tie(left_prio, right_prio) = ranges().back();
+        return true;
+    }
+    return false;
+}
+
+
 FlowPtr TraceTree::lookup(const Packet& pkt) const
 {
-    return boost::apply_visitor(Impl::Lookup(pkt), *m_root);
+    Epoch::Guard guard;
+    return m_flat.load()->lookup(pkt);
 }
 
 std::unique_ptr<Tracer> TraceTree::augment()
 {
     return std::unique_ptr<Tracer>(
-            new Impl::TracerImpl(*m_root, m_backend, left_prio, right_prio)
+            new Impl::TracerImpl(*this, left_prio, right_prio)
         );
 }
 
@@ -538,6 +1475,14 @@ void TraceTree::update()
 {
     Impl::PriorityUpdater pu(left_prio, right_prio);
     pu(*m_root);
+    relabeled(pu.emit(m_backend));
+}
+
+void TraceTree::relabeled(size_t rules)
+{
+    m_relabeling.runs++;
+    m_relabeling.rules += rules;
+    m_relabeling.last_rules = rules;
 }
 
 void TraceTree::commit()
@@ -549,11 +1494,54 @@ void TraceTree::commit()
     m_backend.barrier();
 }
 
+Eviction TraceTree::invalidate(oxm::field<> f)
+{
+    Eviction ret;
+    Impl::Invalidator invalidator {f, ret, m_backend};
+    invalidator(*m_root);
+
+    for (auto& flow : ret.flows)
+        m_backend.remove(flow);
+    if (not ret.flows.empty() || ret.barriers)
+        m_backend.barrier();
+
+    Impl::rebuild(*this);
+    return ret;
+}
+
+Collection TraceTree::gc()
+{
+    auto before = size();
+    Collection ret;
+    Impl::Collector collector {m_backend, ret};
+    collector(*m_root);
+
+    if (collector.barriers_removed)
+        m_backend.barrier();
+
+    // Also drops what patches of the lookup copy left behind
+    Impl::rebuild(*this);
+    auto after = size();
+    if (before.bytes > after.bytes)
+        ret.bytes = before.bytes - after.bytes;
+    return ret;
+}
+
+TreeSize TraceTree::size() const
+{
+    TreeSize ret;
+    Impl::Sizer sizer {ret};
+    sizer.visit(*m_root);
+    ret.bytes += m_flat.load(std::memory_order_relaxed)->bytes();
+    return ret;
+}
+
 TraceTree::TraceTree(Backend &backend,
                      uint16_t left_prio,
                      uint16_t right_prio)
     : m_backend(backend)
     , m_root(new node)
+    , m_flat(new Flat)
     , left_prio(left_prio)
     , right_prio(right_prio)
 { }
@@ -563,7 +1551,10 @@ TraceTree::TraceTree(Backend &backend,
     : TraceTree(backend, prio_space.first, prio_space.second)
 { }
 
-TraceTree::~TraceTree() = default;
+TraceTree::~TraceTree()
+{
+    delete m_flat.load();
+}
 
 } // namespace maple
 } // namespace runos
@@ -16,7 +16,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <vector>
 #include <boost/variant/variant_fwd.hpp>
 #include <boost/variant/recursive_wrapper_fwd.hpp>
 
@@ -30,6 +32,36 @@ class Packet;
 
 namespace maple {
 
+/** Paths dropped from a trace tree and flows they led to */
+struct Eviction {
+    size_t paths = 0;
+    std::vector<FlowPtr> flows;
+    size_t barriers = 0; ///< barrier rules of dropped tests
+};
+
+/** Rules moved to other priorities to make room for new ones */
+struct Relabeling {
+    uint64_t runs = 0;     ///< subtrees relabeled
+    uint64_t rules = 0;    ///< rules moved by all runs
+    size_t last_rules = 0; ///< rules moved by the last run
+};
+
+/** Size of a trace tree */
+struct TreeSize {
+    size_t nodes = 0;  ///< nodes shared by vloads counted once
+    size_t leaves = 0; ///< flow nodes
+    size_t dead = 0;   ///< flow nodes whose flows are gone
+    size_t bytes = 0;  ///< approximate, with the lookup copy
+};
+
+/** Nodes pruned by a garbage collection */
+struct Collection {
+    size_t leaves = 0; ///< flow nodes whose flows are gone
+    size_t tests = 0;  ///< test nodes with both branches unexplored
+    size_t cases = 0;  ///< load cases left unexplored
+    size_t bytes = 0;  ///< approximate
+};
+
 class TraceTree {
 public:
 
@@ -41,12 +73,39 @@ public:
               std::pair<uint16_t, uint16_t> priority_space);
     ~TraceTree();
 
+    /**
+     * Looks the packet up in a flattened copy of the tree, which is
+     * patched by every augment. Doesn't lock and may run concurrently
+     * with one thread modifying the tree.
+     */
     FlowPtr lookup(const Packet& pkt) const;
     std::unique_ptr<Tracer> augment();
 
     void commit();
+
+    /**
+     * Spreads priorities of the whole tree over its range and moves
+     * rules whose priority changed. Augments do it on their own for
+     * the smallest subtree with enough room when they run out of
+     * priorities, so this is only needed when the whole range is.
+     */
     void update();
-    void gc();
+
+    /**
+     * Prunes leaves of gone flows, then test nodes and load cases left
+     * with nothing under them, and removes barrier rules of the tests.
+     */
+    Collection gc();
+
+    TreeSize size() const;
+
+    const Relabeling& relabeling() const { return m_relabeling; }
+
+    /**
+     * Drops every path which loaded or tested a value of `f`, and
+     * removes rules of flows it led to from the switches.
+     */
+    Eviction invalidate(oxm::field<> f);
 
 protected:
     struct unexplored;
@@ -64,10 +123,15 @@ protected:
                       >;
 
     struct Impl;
+    struct Flat;
 
     Backend& m_backend;
     std::unique_ptr<node> m_root;
+    std::atomic<Flat*> m_flat; // retired through Epoch when rebuilt
     uint16_t left_prio, right_prio;
+    Relabeling m_relabeling;
+
+    void relabeled(size_t rules);
 };
 
 } // namespace maple
@@ -24,6 +24,37 @@ oxm::field<> TraceablePacketImpl::load(oxm::mask<> mask) const
     return read;
 }
 
+// Same as load() of the whole field when its bits were
+// explored all or none
+bool TraceablePacketImpl::load_word(oxm::type t, uint64_t& value) const
+{
+    if (not pkt.load_word(t, value))
+        return false;
+
+    uint64_t explored;
+    if (cache.load_word(t, explored))
+        return true;
+    if (cache.find(t) != cache.end())
+        return false;
+
+    oxm::field<> read {t, bits<>(t.nbits(), value)};
+    tracer.load(read);
+    cache.modify(read);
+    return true;
+}
+
+// Answers only tests determined by the previous calls, others
+// need test() to augment the trace
+bool TraceablePacketImpl::test_word(oxm::type t, uint64_t value, uint64_t mask,
+                                    bool& ret) const
+{
+    uint64_t explored;
+    if (not cache.load_word(t, explored))
+        return false;
+    ret = (explored & mask) == value;
+    return true;
+}
+
 bool TraceablePacketImpl::test(oxm::field<> need) const
 {
     // read requested bits from packet
@@ -28,6 +28,10 @@ public:
     bool test(oxm::field<> need) const override;
     void modify(oxm::field<> patch) override;
 
+    bool load_word(oxm::type t, uint64_t& value) const override;
+    bool test_word(oxm::type t, uint64_t value, uint64_t mask,
+                   bool& ret) const override;
+
     oxm::field<> watch(oxm::mask<> mask) const override
     { return pkt.load(mask); }
 
@@ -73,7 +73,7 @@ namespace detail {
             }
         }
 
-        constexpr bits_type<T> value_bits() const
+        constexpr const bits_type<T>& value_bits() const
         { return m_value; }
     };
 
@@ -104,7 +104,7 @@ namespace detail {
             }
         }
 
-        constexpr bits_type<T> mask_bits() const
+        constexpr const bits_type<T>& mask_bits() const
         { return m_mask; }
 
         constexpr bool exact() const noexcept
@@ -638,3 +638,16 @@ field<T> operator<< (const oxm::mask<T> m, const typename T::value_type val)
 
 } // namespace oxm
 } // namespace runos
+
+namespace std {
+    template<>
+    struct hash<runos::oxm::field<>> {
+        size_t operator() (const runos::oxm::field<>& f) const
+        {
+            size_t ret = std::hash<runos::oxm::type>()(f.type());
+            ret = ret * 31 + std::hash<runos::bits<>>()(f.value_bits());
+            ret = ret * 31 + std::hash<runos::bits<>>()(f.mask_bits());
+            return ret;
+        }
+    };
+}
@@ -1,11 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <initializer_list>
 #include <unordered_set>
 #include <unordered_map>
 #include <utility>
 #include <ostream>
 
+#include <boost/container/small_vector.hpp>
+
 #include "field_set_fwd.hh"
 #include "field.hh"
 #include "api/Packet.hh"
@@ -16,62 +19,84 @@ namespace oxm {
 class field_set : public Packet {
     // stores only non-wildcarded fields
     // all other fields implies to wildcard
-    struct HashByType {
-        size_t operator()(const field<> f) const {
-            return std::hash<type>()(f.type());
-        }
-    };
+    //
+    // Fields are kept sorted by type in a vector which doesn't
+    // allocate up to `inline_fields` fields, as matches usually have
+    // a few of them.
+    static constexpr size_t inline_fields = 8;
+    using Container = boost::container::small_vector< field<>, inline_fields >;
+    Container entries;
 
-    struct EqualByType {
-        bool operator()(const field<>& lhs, const field<>& rhs) const
-        { return lhs.type() == rhs.type(); }
+    static uint32_t key(const type t) noexcept
+    { return uint32_t(t.ns()) << 8 | t.id(); }
+
+    struct ByType {
+        bool operator()(const field<>& lhs, uint32_t rhs) const noexcept
+        { return key(lhs.type()) < rhs; }
     };
 
-    using Container = std::unordered_set< field<>, HashByType, EqualByType >;
-    Container entries;
+    Container::const_iterator lower_bound(const type t) const
+    { return std::lower_bound(entries.begin(), entries.end(), key(t), ByType()); }
+
+    Container::iterator lower_bound(const type t)
+    { return std::lower_bound(entries.begin(), entries.end(), key(t), ByType()); }
 
 public:
-    typedef typename Container::iterator iterator;
+    // fields are immutable, so that the order stays
+    typedef typename Container::const_iterator iterator;
     typedef typename Container::const_iterator const_iterator;
 
     field_set() = default;
 
     // types of all fields should be different.
-    // otherwise behaviour is undefined.
+    // otherwise all but the first field of a type are ignored.
     field_set(std::initializer_list<field<>> content)
-        : entries(content)
-    { }
+    {
+        for (const field<>& f : content) {
+            auto it = lower_bound(f.type());
+            if (it == entries.end() || it->type() != f.type())
+                entries.insert(it, f);
+        }
+    }
 
     field<> load(mask<> mask) const override
     {
         auto t = mask.type();
-        auto it = entries.find(field<>{t});
-        if (it == entries.end())
+        auto it = find(t);
+        if (it == end())
             return field<>{t} & mask;
         return *it & mask;
     }
 
+    bool load_word(type t, uint64_t& value) const override
+    {
+        if (t.nbits() > 64)
+            return false;
+        auto it = find(t);
+        if (it == end() || not it->exact())
+            return false;
+        value = it->value_bits().word(0);
+        return true;
+    }
+
     // modifiers
     void modify(field<> patch) override
     {
         auto t = patch.type();
-        auto it = entries.find(field<>{t});
-        if (it == entries.end())
-            it = entries.emplace(patch).first;
-
-        // it's safe because it->type() stay unchanged
-        const_cast<field<>&>(*it) = *it >> patch;
+        auto it = lower_bound(t);
+        if (it == entries.end() || it->type() != t)
+            entries.insert(it, std::move(patch));
+        else
+            *it = *it >> patch;
     }
 
     void erase(mask<> mask)
     {
-        auto t = mask.type();
-        auto it = entries.find(field<>{t});
-        if (it == entries.end())
+        auto it = lower_bound(mask.type());
+        if (it == entries.end() || it->type() != mask.type())
             return;
 
-        // it's safe because it->type() stay unchanged
-        const_cast<field<>&>(*it) = *it & ~mask;
+        *it = *it & ~mask;
         if (it->wildcard())
             entries.erase(it);
     }
@@ -83,38 +108,35 @@ public:
 
     bool empty() const { return entries.empty(); }
 
-    // iterators
-    iterator begin()
-    { return entries.begin(); }
+    size_t size() const { return entries.size(); }
+
+    // iterators, in the order of types
     const_iterator begin() const
     { return entries.begin(); }
     const_iterator cbegin() const
     { return entries.cbegin(); }
 
-    iterator end()
-    { return entries.end(); }
     const_iterator end() const
     { return entries.end(); }
     const_iterator cend() const
     { return entries.cend(); }
 
-    iterator find(type t)
-    { return entries.find(field<>(t)); }
-
     const_iterator find(type t) const
-    { return entries.find(field<>(t)); }
+    {
+        auto it = lower_bound(t);
+        return it != entries.end() && it->type() == t ? it : entries.end();
+    }
 
     std::unique_ptr<Packet> clone() const override {
-        auto ret = std::make_unique<field_set>();
-        for (const auto& f : *this) {
-            ret->modify(f);
-        }
-        return ret;
+        return std::make_unique<field_set>(*this);
     }
 
     friend bool operator==(const field_set& lhs, const field_set& rhs)
     { return lhs.entries == rhs.entries; }
 
+    friend bool operator!=(const field_set& lhs, const field_set& rhs)
+    { return not (lhs == rhs); }
+
     friend bool operator&(const field_set& lhs, const Packet& pkt)
     {
         return std::all_of(lhs.begin(), lhs.end(), [&pkt](const field<>& f){
@@ -125,6 +147,18 @@ public:
     friend bool operator&(const Packet& pkt, const field_set& lhs)
     { return lhs & pkt; }
 
+    // Matches `lhs` against a packet given by fields, in one pass
+    friend bool operator&(const field_set& lhs, const field_set& pkt)
+    {
+        auto it = pkt.begin();
+        for (const field<>& f : lhs) {
+            it = std::lower_bound(it, pkt.end(), key(f.type()), ByType());
+            if (it != pkt.end() && it->type() == f.type() && not (*it & f))
+                return false;
+        }
+        return true;
+    }
+
     friend std::ostream& operator<<(std::ostream& out, const field_set& fs)
     {
         // use std::ostream_joiner when it will be available
@@ -138,6 +172,15 @@ public:
 };
 
 
+// Doesn't depend on the order of fields
+inline size_t hash_value(const field_set& fs)
+{
+    size_t ret = 0;
+    for (const field<>& f : fs)
+        ret += std::hash<field<>>()(f);
+    return ret;
+}
+
 namespace expirementer{
 // expirementer block
 // needed to proof correct and to cover unit tests
@@ -253,6 +296,35 @@ public:
     { return elements.end(); }
     const_iterator cend() const
     { return elements.cend(); }
+
+    size_t size() const
+    { return elements.size(); }
+
+    friend bool operator==(const multi_field_set& lhs,
+                           const multi_field_set& rhs)
+    {
+        // elements of one type don't cover each other, so no duplicates
+        if (lhs.size() != rhs.size())
+            return false;
+        return std::all_of(lhs.begin(), lhs.end(), [&rhs](const auto& e) {
+            auto its = rhs.equal_range(e.first);
+            return std::any_of(its.first, its.second, [&e](const auto& r) {
+                return r.second == e.second;
+            });
+        });
+    }
+
+    friend bool operator!=(const multi_field_set& lhs,
+                           const multi_field_set& rhs)
+    { return not (lhs == rhs); }
+
+    friend size_t hash_value(const multi_field_set& mfs)
+    {
+        size_t ret = 0;
+        for (const auto& e : mfs)
+            ret += std::hash<field<>>()(e.second);
+        return ret;
+    }
 };
 
 // contain included and excluded fields
@@ -279,6 +351,20 @@ public:
     void exclude(oxm::field<> f) {_excluded.add(f);}
     void include(oxm::mask<> m) {_excluded.erase(m);}
 
+    friend bool operator==(const full_field_set& lhs, const full_field_set& rhs)
+    {
+        return lhs._included == rhs._included
+            && lhs._excluded == rhs._excluded;
+    }
+
+    friend bool operator!=(const full_field_set& lhs, const full_field_set& rhs)
+    { return not (lhs == rhs); }
+
+    friend size_t hash_value(const full_field_set& ffs)
+    {
+        return hash_value(ffs._included) * 31 + hash_value(ffs._excluded);
+    }
+
     friend std::ostream& operator<<(std::ostream& o, const full_field_set& ffs)
     {
         o << "included : ";
@@ -298,3 +384,17 @@ public:
 
 } // namespace oxm
 } // namespace runos
+
+namespace std {
+    template<>
+    struct hash<runos::oxm::field_set> {
+        size_t operator() (const runos::oxm::field_set& fs) const
+        { return hash_value(fs); }
+    };
+
+    template<>
+    struct hash<runos::oxm::expirementer::full_field_set> {
+        size_t operator() (const runos::oxm::expirementer::full_field_set& ffs) const
+        { return hash_value(ffs); }
+    };
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <boost/container/small_vector.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "types/exception.hh"
+#include "api/Packet.hh"
+#include "field.hh"
+#include "field_set.hh"
+
+namespace runos {
+namespace oxm {
+
+/**
+ * Matches compiled into value and mask bytes to check one packet
+ * against many of them.
+ *
+ * Every field type used by the matches gets a fixed place in a row,
+ * in network byte order. A packet is flattened into a header vector
+ * of the same layout once, by a load per field, and then each match
+ * is a compare-under-mask of the two rows, 16 bytes at a time. The
+ * result is the same as of `match & pkt`, but for fields the packet
+ * can't load: a match on such a field doesn't match instead of
+ * throwing.
+ *
+ * Header vectors are valid until a match with a new field type is
+ * added. At most 64 field types are supported.
+ */
+class match_table {
+    static constexpr size_t max_types = 64;
+    static constexpr size_t chunk_words = 2; // 16 bytes
+
+    using Row = boost::container::small_vector<uint64_t, 8>;
+
+    std::vector<type> m_types;
+    std::vector<size_t> m_offsets; // in bytes
+    size_t m_width = 0;            // bytes used of a row
+    size_t m_words = 0;            // row stride
+
+    std::vector<uint64_t> m_values; // masked
+    std::vector<uint64_t> m_masks;
+    std::vector<uint64_t> m_uses;   // bit per type
+
+    static uint8_t* bytes(uint64_t* row)
+    { return reinterpret_cast<uint8_t*>(row); }
+
+    size_t place(const type t)
+    {
+        for (size_t i = 0; i < m_types.size(); ++i) {
+            if (m_types[i] == t)
+                return i;
+        }
+        if (m_types.size() == max_types) {
+            RUNOS_THROW(length_error() <<
+                        errinfo_msg("Too many field types in a match table"));
+        }
+
+        m_types.push_back(t);
+        m_offsets.push_back(m_width);
+        m_width += t.nbytes();
+
+        size_t words = (m_width + 15) / 16 * chunk_words;
+        if (words > m_words) {
+            // new places are zero, wildcards for old rows
+            restride(m_values, words);
+            restride(m_masks, words);
+            m_words = words;
+        }
+        return m_types.size() - 1;
+    }
+
+    void restride(std::vector<uint64_t>& rows, size_t words) const
+    {
+        std::vector<uint64_t> ret(size() * words);
+        for (size_t i = 0; i < size(); ++i) {
+            std::copy_n(rows.begin() + i * m_words, m_words,
+                        ret.begin() + i * words);
+        }
+        rows.swap(ret);
+    }
+
+public:
+    /** Packet flattened into the layout of a table */
+    class header_vector {
+        friend class match_table;
+        Row value;
+        Row mask;
+        uint64_t bound = 0; // bit per type
+    };
+
+    /** Adds a match, returns its index */
+    size_t add(const field_set& match)
+    {
+        uint64_t uses = 0;
+        for (const field<>& f : match)
+            uses |= uint64_t(1) << place(f.type());
+
+        size_t i = size();
+        m_values.resize(m_values.size() + m_words);
+        m_masks.resize(m_masks.size() + m_words);
+        m_uses.push_back(uses);
+
+        uint8_t* value = bytes(&m_values[i * m_words]);
+        uint8_t* mask = bytes(&m_masks[i * m_words]);
+        for (const field<>& f : match) {
+            size_t off = m_offsets[place(f.type())];
+            (f.value_bits() & f.mask_bits()).to_buffer(value + off);
+            f.mask_bits().to_buffer(mask + off);
+        }
+        return i;
+    }
+
+    size_t size() const { return m_uses.size(); }
+    bool empty() const { return m_uses.empty(); }
+
+    void clear()
+    {
+        m_types.clear();
+        m_offsets.clear();
+        m_width = m_words = 0;
+        m_values.clear();
+        m_masks.clear();
+        m_uses.clear();
+    }
+
+    header_vector flatten(const Packet& pkt) const
+    {
+        header_vector ret;
+        ret.value.resize(m_words);
+        ret.mask.resize(m_words);
+        uint8_t* value = bytes(ret.value.data());
+        uint8_t* mask = bytes(ret.mask.data());
+
+        for (size_t i = 0; i < m_types.size(); ++i) {
+            const type t = m_types[i];
+            uint8_t* v = value + m_offsets[i];
+            uint8_t* m = mask + m_offsets[i];
+            try {
+                uint64_t word;
+                if (pkt.load_word(t, word)) {
+                    uint64_t all = word_mask(t.nbits());
+                    for (size_t b = t.nbytes(); b-- > 0; word >>= 8, all >>= 8) {
+                        v[b] = uint8_t(word);
+                        m[b] = uint8_t(all);
+                    }
+                } else {
+                    field<> f = pkt.load(oxm::mask<>(t));
+                    f.value_bits().to_buffer(v);
+                    f.mask_bits().to_buffer(m);
+                }
+                ret.bound |= uint64_t(1) << i;
+            } catch (const out_of_range&) {
+                // the packet has no such header
+            }
+        }
+        return ret;
+    }
+
+    /** Whether the i-th match matches the flattened packet */
+    bool test(size_t i, const header_vector& pkt) const
+    {
+        if (m_uses[i] & ~pkt.bound)
+            return false;
+
+        const uint64_t* rv = &m_values[i * m_words];
+        const uint64_t* rm = &m_masks[i * m_words];
+        const uint64_t* pv = pkt.value.data();
+        const uint64_t* pm = pkt.mask.data();
+#ifdef __SSE2__
+        const __m128i zero = _mm_setzero_si128();
+        for (size_t w = 0; w < m_words; w += chunk_words) {
+            auto load = [w](const uint64_t* row) {
+                return _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + w));
+            };
+            __m128i diff = _mm_and_si128(_mm_xor_si128(load(pv), load(rv)),
+                                         _mm_and_si128(load(rm), load(pm)));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero)) != 0xffff)
+                return false;
+        }
+        return true;
+#else
+        uint64_t diff = 0;
+        for (size_t w = 0; w < m_words; ++w)
+            diff |= (pv[w] ^ rv[w]) & rm[w] & pm[w];
+        return diff == 0;
+#endif
+    }
+
+    /**
+     * Index of the first match from `from` on, in the order they were
+     * added, which matches the packet. size() if there is none.
+     */
+    size_t find(const header_vector& pkt, size_t from = 0) const
+    {
+        for (size_t i = from; i < size(); ++i) {
+            if (test(i, pkt))
+                return i;
+        }
+        return size();
+    }
+};
+
+} // namespace oxm
+} // namespace runos
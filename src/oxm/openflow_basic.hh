@@ -74,6 +74,11 @@ struct in_port : define_ofb_type
      < in_port, of::oxm::basic_match_fields::IN_PORT, 32, uint32_t >
 { };
 
+// Passed between tables, the controller matches it only in rules
+struct metadata : define_ofb_type
+     < metadata, of::oxm::basic_match_fields::METADATA, 64, uint64_t, uint64_t, true >
+{ };
+
 struct eth_type : define_printable_ofb_type
     < eth_type, of::oxm::basic_match_fields::ETH_TYPE, 16, &types::print_eth_type, uint16_t >
 { };
@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <functional> // hash
 #include <ostream>
+#include <type_traits> // integral_constant
 
 #include <typeinfo>
 #include <boost/core/demangle.hpp>
@@ -92,6 +93,22 @@ struct define_type : type {
     { }
 };
 
+// Mask of the low `nbits` bits of a machine word
+constexpr uint64_t word_mask(size_t nbits) noexcept
+{
+    return nbits >= 64 ? ~uint64_t(0) : (uint64_t(1) << nbits) - 1;
+}
+
+// Types of up to 64 bits, which packets may load, test and modify
+// as native integers (see Packet::load_word)
+template<class T>
+struct native_type : std::integral_constant<bool, (T().nbits() <= 64)> {
+    static constexpr uint64_t all = word_mask(T().nbits());
+};
+
+template<>
+struct native_type<type> : std::false_type { };
+
 } // namespace oxm
 } // namespace runos
 
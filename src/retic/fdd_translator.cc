@@ -1,5 +1,7 @@
 #include "fdd_translator.hh"
 
+#include "trace_tree_translator.hh"
+
 namespace runos {
 namespace retic {
 namespace fdd {
@@ -68,6 +70,12 @@ void Translator::operator()(const leaf& l) {
     for (auto& s: l.sets) {
         if (s.body.has_value()) {
             m_backend.installBarrier(match, prio);
+            // Replay rules of traces augmented before, so a switch
+            // added later gets them without new packet-ins
+            trace_tree::Translator translator{
+                m_backend, match, l.prio_up, l.prio_down
+            };
+            boost::apply_visitor(translator, l.maple_tree);
             return;
         }
         sets.push_back(s.pred_actions);
@@ -1,6 +1,7 @@
 #include "trace_tree_translator.hh"
 
-#include <exception>
+#include "fdd.hh"
+#include "fdd_translator.hh"
 
 namespace runos {
 namespace retic {
@@ -11,7 +12,10 @@ void Translator::operator()(const unexplored& u) {
 }
 
 void Translator::operator()(const leaf_node& ln) {
-    throw std::runtime_error("Translator::operator()(cnst leaf_node& ) not implemented yet");
+    if (ln.kat_diagram) {
+        fdd::Translator translator{m_backend, match, prio_down, prio_up};
+        boost::apply_visitor(translator, ln.kat_diagram->value);
+    }
 }
 
 void Translator::operator()(const test_node& tn) {
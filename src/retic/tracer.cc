@@ -45,8 +45,10 @@ Trace Tracer::trace(Packet& pkt) const {
     ModTrackingPacket mod_tracking(traceable_pkt);
     auto f = boost::get<PacketFunction>(m_policy);
     policy p = f.function(mod_tracking);
-    for (auto& mod: mod_tracking.mods()) {
-        p = modify(mod) >> p;
+    // prepended backwards, so that mods go in the order of fields
+    auto& mods = mod_tracking.mods();
+    for (auto it = mods.end(); it != mods.begin(); ) {
+        p = modify(*--it) >> p;
     }
     ret.setResult(p);
     return ret;
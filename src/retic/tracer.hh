@@ -61,7 +61,7 @@ private:
 
 class Tracer {
 public:
-    Tracer(policy p)
+    Tracer(const policy& p)
         : m_policy(p)
     { }
 
@@ -83,6 +83,27 @@ leaf& Traverser::operator()(node& n) {
     }
 }
 
+leaf* Lookup::operator()(leaf& l) {
+    if (std::none_of(
+            l.sets.begin(), l.sets.end(),
+            [](auto& x){ return x.body.has_value(); }
+    )) {
+        return &l;
+    }
+
+    trace_tree::Traverser traverser{m_pkt};
+    auto next_fdd = boost::apply_visitor(traverser, l.maple_tree).first;
+    if (next_fdd == nullptr or leaf_is_temporary(m_pkt, next_fdd->value)) {
+        return nullptr;
+    }
+    return boost::apply_visitor(*this, next_fdd->value);
+}
+
+leaf* Lookup::operator()(node& n) {
+    return m_pkt.test(n.field) ? boost::apply_visitor(*this, n.positive)
+                               : boost::apply_visitor(*this, n.negative);
+}
+
 } // fdd
 } // retic
 } // runos
@@ -28,6 +28,20 @@ private:
 
 };
 
+// Find the leaf of the packet without changing the diagram
+// Returns nullptr if a trace tree on the way has no value for the packet
+// Then Traverser must augment it, which needs exclusive access
+class Lookup: public boost::static_visitor<leaf*> {
+public:
+    Lookup(const Packet& pkt)
+        : m_pkt(pkt)
+    { }
+    leaf* operator()(leaf& l);
+    leaf* operator()(node& n);
+private:
+    const Packet& m_pkt;
+};
+
 } // fdd
 } // retic
 } // runos
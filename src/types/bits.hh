@@ -1,14 +1,16 @@
 #pragma once
 
-// FIXME: make efficient implementation using custom bitsets
-
 #include <cstddef>
+#include <cstdint>
 #include <type_traits> // enable_if
+#include <algorithm>
 #include <bitset>
+#include <new> // placement new
+#include <ostream>
+#include <string>
 #include <utility>
 #include <stdexcept>
-#include <iterator> // reverse iterator
-#include <boost/dynamic_bitset.hpp>
+#include <typeinfo> // bad_cast
 
 namespace runos {
     template<size_t N>
@@ -64,22 +66,38 @@ namespace runos {
     ////////////////////
     // Dynamic bitset //
     ////////////////////
-    
+
+    // Bits are kept in 64-bit words, least significant first, inline
+    // up to inline_bits and on the heap beyond. Bits past size() are
+    // always zero, inline words too, so comparison and hashing work on
+    // whole words.
     template<>
-    class bits<0> : public boost::dynamic_bitset<uint8_t> {
+    class bits<0> {
     public:
-        typedef boost::dynamic_bitset<uint8_t> super;
-
-        bits(const super other)
-            : super(std::move(other))
-        { }
+        typedef uint8_t block_type; // of serialized bits
+        typedef size_t size_type;
+        static constexpr size_t bits_per_block = 8;
+        static constexpr size_t bits_per_word = 64;
+        static constexpr size_t inline_bits = 128;
 
         explicit bits(size_t num_bits)
-            : super(num_bits)
-        { }
+            : m_size(num_bits)
+        {
+            allocate();
+            std::fill_n(words(), num_slots(), 0);
+        }
 
         explicit bits(size_t num_bits, unsigned long val)
-            : super(num_bits, val)
+            : bits(num_bits)
+        {
+            if (num_bits > 0) {
+                words()[0] = val;
+                trim();
+            }
+        }
+
+        explicit bits(size_t num_bits, unsigned long long val)
+            : bits(num_bits, static_cast<unsigned long>(val))
         { }
 
         template< class CharT, class Traits, class Alloc >
@@ -87,8 +105,12 @@ namespace runos {
                        typename std::basic_string<CharT,Traits,Alloc>::size_type pos = 0,
                        typename std::basic_string<CharT,Traits,Alloc>::size_type n =
                           std::basic_string<CharT,Traits,Alloc>::npos)
-            : super(str, pos, n)
-        { }
+            : bits(str.data() + std::min(pos, str.size()),
+                   std::min(n, str.size() - std::min(pos, str.size())))
+        {
+            if (pos > str.size())
+                throw std::out_of_range("runos::bits: pos out of range");
+        }
 
         template< class CharT >
         explicit bits( const CharT* str,
@@ -96,27 +118,86 @@ namespace runos {
                             std::basic_string<CharT>::npos,
                        CharT zero = CharT('0'),
                        CharT one = CharT('1'))
-            : super(str, n, zero, one)
-        { }
+            : bits(n == std::basic_string<CharT>::npos
+                       ? std::char_traits<CharT>::length(str) : n)
+        {
+            for (size_t i = 0; i < m_size; ++i) {
+                CharT c = str[m_size - 1 - i];
+                if (c == one)
+                    words()[i / bits_per_word] |= word_type(1) << (i % bits_per_word);
+                else if (c != zero)
+                    throw std::invalid_argument("runos::bits: bad character");
+            }
+        }
 
         // serialization (big-endian)
         bits(size_t num_bits, const block_type* buffer)
-            : super( std::reverse_iterator<const block_type*>(
-                        buffer + (num_bits / bits_per_block)
-                               + ((num_bits % bits_per_block) ? 1 : 0)
-                     )
-                   , std::reverse_iterator<const block_type*>(buffer-1) )
+            : bits(num_bits)
+        {
+            size_t nblocks = num_blocks();
+            word_type* w = words();
+            for (size_t i = 0; i < nblocks; ++i) {
+                word_type block = buffer[nblocks - 1 - i];
+                w[i / 8] |= block << (i % 8 * bits_per_block);
+            }
+            trim();
+        }
+
+        bits(const bits& other)
+            : m_size(other.m_size)
+        {
+            allocate();
+            std::copy_n(other.words(), num_slots(), words());
+        }
+
+        bits(bits&& other) noexcept
+            : m_size(other.m_size)
+        {
+            if (on_heap()) {
+                m_heap = other.m_heap;
+                other.m_size = 0;
+                other.m_inline[0] = other.m_inline[1] = 0;
+            } else {
+                m_inline[0] = other.m_inline[0];
+                m_inline[1] = other.m_inline[1];
+            }
+        }
+
+        bits& operator=(const bits& other)
         {
-            resize(num_bits);
+            if (this != &other) {
+                if (num_words() != other.num_words()) {
+                    release();
+                    m_size = other.m_size;
+                    allocate();
+                }
+                m_size = other.m_size;
+                std::copy_n(other.words(), num_slots(), words());
+            }
+            return *this;
         }
 
-        bits(size_t num_bits, unsigned long long val);
+        bits& operator=(bits&& other) noexcept
+        {
+            if (this != &other) {
+                release();
+                new (this) bits(std::move(other));
+            }
+            return *this;
+        }
+
+        ~bits()
+        { release(); }
 
         // big-endian
         void to_buffer(block_type* buffer) const
         {
-            to_block_range(*this, std::reverse_iterator<block_type*>(
-                        buffer + num_blocks()));
+            size_t nblocks = num_blocks();
+            const word_type* w = words();
+            for (size_t i = 0; i < nblocks; ++i) {
+                buffer[nblocks - 1 - i] =
+                    block_type(w[i / 8] >> (i % 8 * bits_per_block));
+            }
         }
 
         template<size_t N, typename = std::enable_if<(N > 0)> >
@@ -124,20 +205,244 @@ namespace runos {
         {
             if ( size() != N )
                 throw std::bad_cast();
-            std::string ret;
-            to_string(*this, ret);
+            std::bitset<N> ret;
+            for (size_t i = num_words(); i-- > 0; ) {
+                if (N > bits_per_word)
+                    ret <<= bits_per_word;
+                ret |= std::bitset<N>(words()[i]);
+            }
             return bits<N>(ret);
         }
+
+        size_t size() const noexcept
+        { return m_size; }
+
+        size_t num_blocks() const noexcept
+        { return (m_size + bits_per_block - 1) / bits_per_block; }
+
+        /** i-th 64-bit word, least significant first, zero past the end */
+        uint64_t word(size_t i) const noexcept
+        { return i < num_words() ? words()[i] : 0; }
+
+        bool test(size_t pos) const
+        {
+            if (pos >= m_size)
+                throw std::out_of_range("runos::bits::test");
+            return (*this)[pos];
+        }
+
+        bool operator[](size_t pos) const noexcept
+        { return (words()[pos / bits_per_word] >> (pos % bits_per_word)) & 1; }
+
+        bits& set() noexcept
+        {
+            std::fill_n(words(), num_words(), ~word_type(0));
+            trim();
+            return *this;
+        }
+
+        bits& set(size_t pos, bool val = true)
+        {
+            if (pos >= m_size)
+                throw std::out_of_range("runos::bits::set");
+            word_type bit = word_type(1) << (pos % bits_per_word);
+            word_type& w = words()[pos / bits_per_word];
+            w = val ? (w | bit) : (w & ~bit);
+            return *this;
+        }
+
+        bits& reset() noexcept
+        {
+            std::fill_n(words(), num_slots(), 0);
+            return *this;
+        }
+
+        bits& reset(size_t pos)
+        { return set(pos, false); }
+
+        bits& flip() noexcept
+        {
+            word_type* w = words();
+            for (size_t i = 0; i < num_words(); ++i)
+                w[i] = ~w[i];
+            trim();
+            return *this;
+        }
+
+        bool all() const noexcept
+        {
+            const word_type* w = words();
+            size_t full = m_size / bits_per_word;
+            for (size_t i = 0; i < full; ++i)
+                if (~w[i]) return false;
+            return full == num_words() || w[full] == last_word_mask();
+        }
+
+        bool any() const noexcept
+        { return not none(); }
+
+        bool none() const noexcept
+        {
+            const word_type* w = words();
+            for (size_t i = 0; i < num_slots(); ++i)
+                if (w[i]) return false;
+            return true;
+        }
+
+        size_t count() const noexcept
+        {
+            size_t ret = 0;
+            const word_type* w = words();
+            for (size_t i = 0; i < num_words(); ++i)
+                ret += __builtin_popcountll(w[i]);
+            return ret;
+        }
+
+        unsigned long to_ulong() const
+        {
+            const word_type* w = words();
+            for (size_t i = 1; i < num_words(); ++i)
+                if (w[i])
+                    throw std::overflow_error("runos::bits::to_ulong");
+            return num_words() ? w[0] : 0;
+        }
+
+        std::string to_string() const
+        {
+            std::string ret(m_size, '0');
+            for (size_t i = 0; i < m_size; ++i)
+                if ((*this)[i]) ret[m_size - 1 - i] = '1';
+            return ret;
+        }
+
+        bits operator~() const
+        { return bits(*this).flip(); }
+
+        bits& operator&=(const bits& other)
+        { return apply(other, [](word_type& a, word_type b) { a &= b; }); }
+
+        bits& operator|=(const bits& other)
+        { return apply(other, [](word_type& a, word_type b) { a |= b; }); }
+
+        bits& operator^=(const bits& other)
+        { return apply(other, [](word_type& a, word_type b) { a ^= b; }); }
+
+        friend bits operator&(bits lhs, const bits& rhs)
+        { return std::move(lhs &= rhs); }
+
+        friend bits operator|(bits lhs, const bits& rhs)
+        { return std::move(lhs |= rhs); }
+
+        friend bits operator^(bits lhs, const bits& rhs)
+        { return std::move(lhs ^= rhs); }
+
+        friend bool operator==(const bits& lhs, const bits& rhs) noexcept
+        {
+            return lhs.m_size == rhs.m_size &&
+                   std::equal(lhs.words(), lhs.words() + lhs.num_slots(),
+                              rhs.words());
+        }
+
+        friend bool operator!=(const bits& lhs, const bits& rhs) noexcept
+        { return not (lhs == rhs); }
+
+        // As unsigned numbers, shorter first on equal values
+        friend bool operator<(const bits& lhs, const bits& rhs) noexcept
+        {
+            for (size_t i = std::max(lhs.num_words(), rhs.num_words()); i-- > 0; ) {
+                if (lhs.word(i) != rhs.word(i))
+                    return lhs.word(i) < rhs.word(i);
+            }
+            return lhs.m_size < rhs.m_size;
+        }
+
+        friend bool operator>(const bits& lhs, const bits& rhs) noexcept
+        { return rhs < lhs; }
+        friend bool operator<=(const bits& lhs, const bits& rhs) noexcept
+        { return not (rhs < lhs); }
+        friend bool operator>=(const bits& lhs, const bits& rhs) noexcept
+        { return not (lhs < rhs); }
+
+        friend std::ostream& operator<<(std::ostream& out, const bits& b)
+        { return out << b.to_string(); }
+
+    private:
+        template<size_t N> friend class bits;
+        typedef uint64_t word_type;
+
+        size_t m_size;
+        union {
+            word_type m_inline[inline_bits / bits_per_word];
+            word_type* m_heap;
+        };
+
+        bool on_heap() const noexcept
+        { return m_size > inline_bits; }
+
+        size_t num_words() const noexcept
+        { return (m_size + bits_per_word - 1) / bits_per_word; }
+
+        // Words kept, whether used or not
+        size_t num_slots() const noexcept
+        { return on_heap() ? num_words() : inline_bits / bits_per_word; }
+
+        word_type last_word_mask() const noexcept
+        { return ~word_type(0) >> (bits_per_word - 1 - (m_size - 1) % bits_per_word); }
+
+        word_type* words() noexcept
+        { return on_heap() ? m_heap : m_inline; }
+
+        const word_type* words() const noexcept
+        { return on_heap() ? m_heap : m_inline; }
+
+        void allocate()
+        {
+            if (on_heap())
+                m_heap = new word_type[num_words()];
+        }
+
+        void release() noexcept
+        {
+            if (on_heap())
+                delete[] m_heap;
+            m_size = 0;
+        }
+
+        // Clears bits past the end
+        void trim() noexcept
+        {
+            if (m_size > 0)
+                words()[num_words() - 1] &= last_word_mask();
+        }
+
+        template<class Op>
+        bits& apply(const bits& other, Op op)
+        {
+            if (m_size != other.m_size)
+                throw std::invalid_argument("runos::bits: size mismatch");
+            word_type* w = words();
+            const word_type* o = other.words();
+            for (size_t i = 0; i < num_slots(); ++i)
+                op(w[i], o[i]);
+            return *this;
+        }
     };
 
     ////////////////////
     // Implementation //
     ////////////////////
-    
+
     template<size_t N>
     bits<N>::operator bits<>() const
     {
-        return bits<>(this->to_string());
+        bits<> ret(N);
+        for (size_t i = 0; i < ret.num_words(); ++i) {
+            std::bitset<N> w = *this >> (i * bits<>::bits_per_word);
+            if (N > bits<>::bits_per_word)
+                w &= std::bitset<N>(~0ULL);
+            ret.words()[i] = w.to_ullong();
+        }
+        return ret;
     }
 
     /////////////////////////
@@ -276,9 +581,13 @@ template<>
 struct hash<runos::bits<>> {
     size_t operator()(const runos::bits<>& self) const
     {
-        std::string ret;
-        boost::to_string(runos::bits<>::super(self), ret);
-        return hash<std::string>()(ret);
+        // FNV-1a over the words, folding high bits down after each
+        uint64_t ret = 14695981039346656037ULL ^ self.size();
+        for (size_t i = 0; i * self.bits_per_word < self.size(); ++i) {
+            ret = (ret ^ self.word(i)) * 1099511628211ULL;
+            ret ^= ret >> 32;
+        }
+        return ret;
     }
 };
 }
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Time and heap allocations of the work dominated by oxm::field_set:
+// compiling a static policy of `nrules` forwarding rules into an FDD,
+// and handling packet-ins of `nhosts` hosts by a policy whose handler
+// learns like LearningSwitch, as retic does on every packet-in.
+
+#include <chrono>
+#include <cstdlib>
+#include <iterator>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include "oxm/field_set.hh"
+#include "oxm/openflow_basic.hh"
+#include "retic/fdd_compiler.hh"
+#include "retic/policies.hh"
+#include "retic/traverse_fdd.hh"
+#include "types/ethaddr.hh"
+
+using namespace runos;
+using namespace retic;
+
+namespace {
+
+size_t allocations = 0;
+
+// Keeps results alive so loops aren't optimized out
+volatile size_t sink;
+
+template<class F>
+void report(const char* name, size_t n, F&& f)
+{
+    size_t acc = 0;
+    size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i)
+        acc += f(i);
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    sink = acc;
+    std::cout << name << ": " << elapsed.count() / n << " us/op, "
+              << double(allocations - before) / n << " allocations/op"
+              << std::endl;
+}
+
+policy static_policy(uint32_t nrules)
+{
+    policy ret = stop();
+    for (uint32_t i = 1; i <= nrules; ++i) {
+        ret = ret + (filter(oxm::in_port() == i % 8 + 1) >>
+                     filter(oxm::eth_type() == 0x0800) >>
+                     filter(oxm::eth_dst() == uint64_t(i)) >>
+                     modify(oxm::vlan_vid() == i % 16) >>
+                     fwd(i % 8 + 1));
+    }
+    return ret;
+}
+
+policy learning_policy()
+{
+    return filter(oxm::eth_type() == 0x0800) >> handler([](Packet& pkt) {
+        uint32_t in_port = pkt.load(oxm::in_port());
+        uint64_t dst = ethaddr(pkt.load(oxm::eth_dst())).to_number();
+        pkt.load(oxm::eth_src());
+        return fwd(dst % 2 ? in_port : in_port + 1);
+    });
+}
+
+oxm::field_set packet_in(uint64_t host)
+{
+    return oxm::field_set {
+        oxm::switch_id() == 1,
+        oxm::in_port() == uint32_t(host % 8 + 1),
+        oxm::eth_type() == 0x0800,
+        oxm::eth_src() == host + 1,
+        oxm::eth_dst() == host / 2 + 1,
+        oxm::ip_proto() == 6,
+        oxm::ipv4_src() == uint32_t(0x0a000000 + host)
+    };
+}
+
+} // namespace
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    if (void* ret = std::malloc(size ? size : 1))
+        return ret;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t nrules = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    size_t nhosts = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 256;
+    size_t n = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 100000;
+
+    const policy rules = static_policy(nrules);
+    report("fdd compilation", 10, [&](size_t) {
+        fdd::diagram d = fdd::compile(rules);
+        return d.which();
+    });
+
+    std::vector<oxm::field_set> packets;
+    for (size_t host = 0; host < nhosts; ++host)
+        packets.push_back(packet_in(host));
+
+    // the first packet of a host augments the trace tree
+    fdd::diagram learning = fdd::compile(learning_policy());
+    report("packet-in, new host", nhosts, [&](size_t i) {
+        fdd::Traverser traverser{packets[i]};
+        return boost::apply_visitor(traverser, learning).sets.size();
+    });
+
+    report("packet-in, known host", n, [&](size_t i) {
+        const oxm::field_set& pkt = packets[i % nhosts];
+        fdd::Traverser traverser{pkt};
+        fdd::leaf& l = boost::apply_visitor(traverser, learning);
+        size_t ret = 0;
+        for (auto& unit : l.sets) {
+            oxm::field_set out = pkt;
+            for (const oxm::field<>& f : unit.pred_actions)
+                out.modify(f);
+            ret += std::distance(out.begin(), out.end());
+        }
+        return ret;
+    });
+
+    const oxm::field_set match {
+        oxm::in_port() == 3,
+        oxm::eth_type() == 0x0800,
+        oxm::eth_dst() == 2
+    };
+    report("match against a packet", n, [&](size_t i) {
+        return match & packets[i % nhosts];
+    });
+    report("match against a packet view", n, [&](size_t i) {
+        return match & static_cast<const Packet&>(packets[i % nhosts]);
+    });
+}
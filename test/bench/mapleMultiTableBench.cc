@@ -0,0 +1,198 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Rules and install time of a policy loading independent fields:
+// in_port, eth_src and eth_dst with `nvalues` values each, forwarding
+// by eth_dst. "single-table" sends one flow-mod per flow, as the Maple
+// backend does; "multi-table" lays the same rules out into a table per
+// field, committing after every flow as Maple does on packet-ins, and
+// "multi-table batch" commits once, as after a reconnect. Flow-mods
+// are encoded but not sent.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "OFEncoder.hh"
+#include "maple/TablePipeline.hh"
+#include "oxm/field_set.hh"
+#include "oxm/openflow_basic.hh"
+
+using namespace runos;
+using namespace std::chrono;
+using maple::TablePipeline;
+
+namespace {
+
+struct Counter {
+    uint64_t flow_mods = 0;
+    uint64_t bytes = 0;
+
+    void sent(const OFEncoder& enc)
+    {
+        ++flow_mods;
+        bytes += enc.size();
+    }
+};
+
+struct Flow {
+    oxm::field_set match;
+    uint32_t port;
+};
+
+std::vector<Flow> make_flows(size_t nfields, uint32_t nvalues)
+{
+    std::vector<Flow> ret(1);
+    for (size_t field = 0; field < nfields; ++field) {
+        std::vector<Flow> next;
+        for (auto& flow : ret) {
+            for (uint32_t value = 1; value <= nvalues; ++value) {
+                Flow f = flow;
+                switch (field) {
+                case 0: f.match.modify(oxm::eth_dst() == uint64_t(value)); break;
+                case 1: f.match.modify(oxm::eth_src() == uint64_t(value)); break;
+                default: f.match.modify(oxm::in_port() == value); break;
+                }
+                if (field == 0)
+                    f.port = value % 8 + 1;
+                next.push_back(std::move(f));
+            }
+        }
+        ret = std::move(next);
+    }
+    return ret;
+}
+
+// Instructions of the rules, Maple also keeps their timeouts
+std::string program(uint32_t port)
+{
+    auto enc = OFEncoder::scratch();
+    enc.begin_flow_mod(OFEncoder::FlowModParams{}, oxm::field_set{});
+    size_t begin = enc.size();
+    enc.begin_apply_actions();
+    enc.output(port);
+    enc.end_message();
+    return std::string(reinterpret_cast<const char*>(enc.data()) + begin,
+                       enc.size() - begin);
+}
+
+// Encodes entries the way the Maple backend sends them
+struct EncodingSink : TablePipeline::Sink {
+    Counter& counter;
+    explicit EncodingSink(Counter& counter) : counter(counter) { }
+
+    void add(const TablePipeline::Entry& e) override
+    {
+        OFEncoder::FlowModParams fm;
+        fm.table_id = e.table;
+        fm.priority = e.priority;
+        fm.cookie = e.cookie;
+        auto enc = OFEncoder::scratch();
+        enc.begin_flow_mod(fm, e.match);
+        if (e.program.empty()) {
+            enc.write_metadata(e.metadata);
+            enc.goto_table(e.table + 1);
+        } else {
+            std::copy_n(e.program.data(), e.program.size(),
+                        enc.reserve(e.program.size()));
+        }
+        enc.end_message();
+        counter.sent(enc);
+    }
+
+    void remove(const TablePipeline::Entry& e) override
+    {
+        OFEncoder::FlowModParams fm;
+        fm.command = 3; // OFPFC_DELETE_STRICT
+        fm.table_id = e.table;
+        fm.priority = e.priority;
+        auto enc = OFEncoder::scratch();
+        enc.begin_flow_mod(fm, e.match);
+        enc.end_message();
+        counter.sent(enc);
+    }
+};
+
+template<class F>
+void report(const char* name, const Counter& counter, F&& f)
+{
+    auto start = steady_clock::now();
+    size_t rules = f();
+    duration<double, std::milli> elapsed = steady_clock::now() - start;
+    std::cout << name << ": " << rules << " rules on the switch, "
+              << counter.flow_mods << " flow-mods ("
+              << counter.bytes << " bytes) in "
+              << elapsed.count() << " ms" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t nfields = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 3;
+    uint32_t nvalues = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+    nfields = std::min<size_t>(std::max<size_t>(nfields, 1), 3);
+
+    auto flows = make_flows(nfields, nvalues);
+    std::vector<std::string> programs;
+    for (uint32_t port = 0; port <= 8; ++port)
+        programs.push_back(program(port));
+    std::cout << flows.size() << " flows" << std::endl;
+
+    Counter single;
+    report("single-table", single, [&] {
+        for (size_t i = 0; i < flows.size(); ++i) {
+            OFEncoder::FlowModParams fm;
+            fm.priority = 10;
+            fm.cookie = i;
+            fm.idle_timeout = 10;
+            auto enc = OFEncoder::scratch();
+            enc.begin_flow_mod(fm, flows[i].match);
+            enc.begin_apply_actions();
+            enc.output(flows[i].port);
+            enc.end_message();
+            single.sent(enc);
+        }
+        return flows.size();
+    });
+
+    // eth_dst goes last, the rules are what's left of it
+    std::vector<oxm::type> stages { oxm::in_port(), oxm::eth_src(), oxm::eth_dst() };
+    stages.erase(stages.begin(), stages.begin() + (3 - nfields));
+
+    Counter incremental;
+    report("multi-table", incremental, [&] {
+        EncodingSink sink(incremental);
+        TablePipeline pipeline(stages, 0, 0, sink);
+        for (size_t i = 0; i < flows.size(); ++i) {
+            pipeline.add(10, flows[i].match, i, programs[flows[i].port]);
+            pipeline.commit();
+        }
+        return pipeline.stats().entries;
+    });
+
+    Counter batch;
+    report("multi-table batch", batch, [&] {
+        EncodingSink sink(batch);
+        TablePipeline pipeline(stages, 0, 0, sink);
+        for (size_t i = 0; i < flows.size(); ++i)
+            pipeline.add(10, flows[i].match, i, programs[flows[i].port]);
+        pipeline.commit();
+        return pipeline.stats().entries;
+    });
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Packet-in throughput of the Maple runtime against the number of
+// worker threads: lookups share the read lock, one packet in
+// `miss_every` is a new flow augmenting the trace tree under the write
+// lock. "serialized" takes the write lock for every packet, as a single
+// worker thread effectively did.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "oxm/field_set.hh"
+#include "maple/Backend.hh"
+#include "maple/Runtime.hh"
+
+using namespace runos;
+using namespace std::chrono;
+
+namespace {
+
+template <size_t N>
+struct F : oxm::define_type< F<N>, 0, N, 32, uint32_t, uint32_t, true>
+{ };
+
+class ValueFlow final : public maple::Flow {
+public:
+    uint32_t value{0};
+    void decision(uint32_t d) { value = d; }
+
+    std::vector<std::pair<oxm::field<>, oxm::field<>>>
+    virtual_fields(oxm::mask<>, oxm::mask<>) const override
+    { return {}; }
+};
+
+struct NullBackend : maple::Backend {
+    void install(unsigned, oxm::expirementer::full_field_set const&,
+                 maple::FlowPtr) override { }
+    void remove(maple::FlowPtr) override { }
+    void remove(unsigned, oxm::field_set const&) override { }
+    void remove(oxm::field_set const&) override { }
+    void barrier_rule(unsigned, oxm::expirementer::full_field_set const&,
+                      oxm::field<> const&, uint64_t) override { }
+};
+
+using Runtime = maple::Runtime<uint32_t, ValueFlow>;
+using FlowPtr = std::shared_ptr<ValueFlow>;
+
+uint32_t l2_policy(Packet& pkt, FlowPtr)
+{
+    uint32_t dst = pkt.load(F<1>());
+    if (pkt.test(F<2>() == 0x0800))
+        return dst + 1;
+    return dst;
+}
+
+struct Bench {
+    NullBackend backend;
+    Runtime runtime{l2_policy, backend};
+    std::vector<FlowPtr> flows;
+    std::atomic<uint32_t> next_key;
+
+    explicit Bench(uint32_t warm)
+        : next_key(warm)
+    {
+        for (uint32_t key = 0; key < warm; ++key) {
+            oxm::field_set pkt{F<1>() == key, F<2>() == 0x0800};
+            auto lock = runtime.write_lock();
+            augment(pkt);
+        }
+    }
+
+    void augment(Packet& pkt)
+    {
+        FlowPtr flow;
+        maple::Installer installer;
+        std::tie(flow, installer) =
+            runtime.augment(pkt, std::make_shared<ValueFlow>());
+        installer();
+        flows.push_back(flow);
+    }
+
+    void packet_in(Packet& pkt, bool serialized)
+    {
+        if (not serialized) {
+            auto lock = runtime.read_lock();
+            if (runtime(pkt))
+                return;
+        }
+        auto lock = runtime.write_lock();
+        if (not runtime(pkt))
+            augment(pkt);
+    }
+};
+
+double run(unsigned nthreads, size_t per_thread, size_t miss_every,
+           uint32_t warm, bool serialized)
+{
+    Bench bench(warm);
+    std::vector<std::thread> threads;
+
+    auto start = steady_clock::now();
+    for (unsigned t = 0; t < nthreads; ++t) {
+        threads.emplace_back([&, t] {
+            uint32_t key = t * 7919;
+            for (size_t i = 0; i < per_thread; ++i) {
+                key = (key * 1103515245 + 12345) % warm;
+                uint32_t k = (i % miss_every == 0) ? bench.next_key++ : key;
+                // the packet is built here, as Maple parses it unlocked
+                oxm::field_set pkt{F<1>() == k, F<2>() == 0x0800};
+                bench.packet_in(pkt, serialized);
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    duration<double> elapsed = steady_clock::now() - start;
+
+    return nthreads * per_thread / elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t per_thread = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    unsigned max_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10)
+                                    : std::max(1u, std::thread::hardware_concurrency());
+    const size_t miss_every = 100;
+    const uint32_t warm = 10000;
+
+    std::cout << "threads  serialized(pkt/s)  shared-lookup(pkt/s)  speedup" << std::endl;
+    double base = 0;
+    for (unsigned n = 1; n <= max_threads; n *= 2) {
+        double ser = run(n, per_thread, miss_every, warm, true);
+        double shr = run(n, per_thread, miss_every, warm, false);
+        if (n == 1)
+            base = shr;
+        std::cout << n << "  "
+                  << static_cast<uint64_t>(ser) << "  "
+                  << static_cast<uint64_t>(shr) << "  "
+                  << shr / base << "x" << std::endl;
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Nanoseconds per packet to find the first of `nrules` ACL-like
+// matches a packet satisfies: through a virtual test per field of
+// every match, by merging field sets, and by flattening the packet
+// once and comparing it with an oxm::match_table under masks.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "oxm/field_set.hh"
+#include "oxm/match_table.hh"
+#include "oxm/openflow_basic.hh"
+
+using namespace runos;
+
+namespace {
+
+// Keeps results alive so loops aren't optimized out
+volatile size_t sink;
+
+template<class F>
+void report(const char* name, size_t n, F&& f)
+{
+    size_t acc = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i)
+        acc += f(i);
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    sink = acc;
+    std::cout << name << ": " << elapsed.count() / n << " ns/packet"
+              << std::endl;
+}
+
+// Rules of an ACL: hosts and subnets to ports, most specific first,
+// the last one takes everything
+std::vector<oxm::field_set> acl(size_t nrules, std::mt19937& rng)
+{
+    std::vector<oxm::field_set> ret;
+    for (size_t i = 0; i + 1 < nrules; ++i) {
+        oxm::field_set match {
+            oxm::eth_type() == 0x0800,
+            (oxm::ipv4_src() & uint32_t(0xffffff00)) == uint32_t(0x0a000000 + (rng() % 64 << 8)),
+            oxm::ipv4_dst() == uint32_t(0x0a010000 + rng() % 1024),
+            oxm::ip_proto() == 6,
+            oxm::tcp_dst() == uint16_t(rng() % 4 ? 80 : 443)
+        };
+        if (rng() % 2)
+            match.modify(oxm::in_port() == uint32_t(rng() % 48 + 1));
+        ret.push_back(std::move(match));
+    }
+    ret.push_back(oxm::field_set{});
+    return ret;
+}
+
+oxm::field_set packet(std::mt19937& rng)
+{
+    return oxm::field_set {
+        oxm::switch_id() == 1,
+        oxm::in_port() == uint32_t(rng() % 48 + 1),
+        oxm::eth_type() == 0x0800,
+        oxm::eth_src() == uint64_t(rng() % 256 + 1),
+        oxm::eth_dst() == uint64_t(rng() % 256 + 1),
+        oxm::ipv4_src() == uint32_t(0x0a000000 + rng() % (64 << 8)),
+        oxm::ipv4_dst() == uint32_t(0x0a010000 + rng() % 1024),
+        oxm::ip_proto() == 6,
+        oxm::tcp_src() == uint16_t(rng() % 65536),
+        oxm::tcp_dst() == uint16_t(rng() % 2 ? 80 : 443)
+    };
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t nrules = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    size_t n = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 10000;
+    nrules = std::max<size_t>(nrules, 1);
+
+    std::mt19937 rng(1);
+    auto rules = acl(nrules, rng);
+    std::vector<oxm::field_set> packets;
+    for (size_t i = 0; i < 1024; ++i)
+        packets.push_back(packet(rng));
+
+    oxm::match_table table;
+    for (auto& match : rules)
+        table.add(match);
+
+    size_t mismatches = 0;
+    for (auto& pkt : packets) {
+        size_t first = 0;
+        while (not (rules[first] & static_cast<const Packet&>(pkt)))
+            ++first;
+        mismatches += first != table.find(table.flatten(pkt));
+    }
+    std::cout << nrules << " rules, " << mismatches
+              << " packets classified differently" << std::endl;
+
+    report("virtual test per field", n, [&](size_t i) {
+        const Packet& pkt = packets[i % packets.size()];
+        size_t first = 0;
+        while (not (rules[first] & pkt))
+            ++first;
+        return first;
+    });
+    report("merge of field sets", n, [&](size_t i) {
+        const oxm::field_set& pkt = packets[i % packets.size()];
+        size_t first = 0;
+        while (not (rules[first] & pkt))
+            ++first;
+        return first;
+    });
+    report("flatten and test one", n, [&](size_t i) {
+        auto flat = table.flatten(packets[i % packets.size()]);
+        return size_t(table.test(0, flat));
+    });
+    report("match table", n, [&](size_t i) {
+        return table.find(table.flatten(packets[i % packets.size()]));
+    });
+}
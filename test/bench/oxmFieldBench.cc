@@ -0,0 +1,141 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Nanoseconds per load, test and modify of oxm fields on a packet
+// held in an oxm::field_set, as handlers do on every packet-in, and
+// per run of a LearningSwitch-style handler, also under Maple tracing.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "maple/TraceablePacketImpl.hh"
+#include "oxm/field_set.hh"
+#include "oxm/openflow_basic.hh"
+#include "types/ethaddr.hh"
+
+using namespace runos;
+using namespace std::chrono;
+
+namespace {
+
+// Keeps results alive so loops aren't optimized out
+volatile uint64_t sink;
+
+// Trace of a handler run, thrown away
+struct NullTracer : maple::Tracer {
+    size_t nodes = 0;
+    void load(oxm::field<>) override { ++nodes; }
+    void test(oxm::field<>, bool) override { ++nodes; }
+    void vload(oxm::field<>, oxm::field<>) override { ++nodes; }
+    maple::Installer finish(maple::FlowPtr) override { return {}; }
+};
+
+// Reads what LearningSwitch reads of a packet
+uint64_t learn(Packet& pkt)
+{
+    const oxm::switch_id switch_id;
+    const oxm::in_port in_port;
+    const oxm::eth_type eth_type;
+    const oxm::eth_src eth_src;
+    const oxm::eth_dst eth_dst;
+
+    uint64_t dpid = pkt.load(switch_id);
+    uint32_t port = pkt.load(in_port);
+    ethaddr src = pkt.load(eth_src);
+    ethaddr dst = pkt.load(eth_dst);
+    bool ip = pkt.test(eth_type == 0x0800);
+    return dpid + port + src.to_number() + dst.to_number() + ip;
+}
+
+template<class F>
+void report(const char* name, size_t n, F&& f)
+{
+    uint64_t acc = 0;
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < n; ++i)
+        acc += f(i);
+    duration<double, std::nano> elapsed = steady_clock::now() - start;
+    sink = acc;
+    std::cout << name << ": " << elapsed.count() / n << " ns/op" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    const oxm::in_port in_port;
+    const oxm::eth_type eth_type;
+    const oxm::eth_src eth_src;
+    const oxm::eth_dst eth_dst;
+    const oxm::ipv4_src ipv4_src;
+    const oxm::ipv6_src ipv6_src;
+
+    oxm::field_set pkt {
+        oxm::switch_id() == 1,
+        in_port == 1,
+        eth_type == 0x0800,
+        eth_src == "00:11:22:33:44:55",
+        eth_dst == "66:77:88:99:aa:bb",
+        ipv4_src == "10.0.0.1",
+        ipv6_src == "fe80::1"
+    };
+    const Packet& view = pkt;
+
+    report("load in_port", n, [&](size_t) {
+        return view.load(in_port);
+    });
+    report("load eth_dst", n, [&](size_t) {
+        return ethaddr(view.load(eth_dst)).to_number();
+    });
+    const oxm::mask<> subnet = ipv4_src & "255.255.0.0";
+    report("load masked ipv4_src", n, [&](size_t) {
+        return view.load(subnet).value_bits().none();
+    });
+    report("load ipv6_src", n, [&](size_t) {
+        return view.load(oxm::mask<>(ipv6_src)).value_bits().count();
+    });
+
+    const oxm::field<> is_ip = eth_type == 0x0800;
+    const oxm::field<> from = eth_src == "00:11:22:33:44:55";
+    report("test eth_type", n, [&](size_t) {
+        return view.test(is_ip);
+    });
+    report("test eth_src", n, [&](size_t) {
+        return view.test(from);
+    });
+
+    report("modify eth_src", n, [&](size_t i) {
+        pkt.modify(eth_src == ethaddr(uint64_t(i & 0xffff)));
+        return i;
+    });
+    const auto host = ipv4_src & "0.0.255.255";
+    report("modify masked ipv4_src", n, [&](size_t i) {
+        pkt.modify(host == uint32_t(i));
+        return i;
+    });
+
+    report("learning switch handler", n, [&](size_t) {
+        return learn(pkt);
+    });
+    report("learning switch handler, traced", n, [&](size_t) {
+        NullTracer tracer;
+        maple::TraceablePacketImpl tpkt {pkt, tracer};
+        return learn(tpkt) + tracer.nodes;
+    });
+}
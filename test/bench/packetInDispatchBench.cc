@@ -0,0 +1,91 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares packet-in dispatch with the message decoded once per handler
+// and once more for the controller itself against the single decode
+// shared by all consumers.
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <unordered_map>
+
+#include "OFMsgUnion.hh"
+
+using namespace std::chrono;
+
+namespace {
+
+struct Sink {
+    uint64_t bytes = 0;
+    void operator()(of13::PacketIn& pi) { bytes += pi.data_len(); }
+};
+
+template<class F>
+double rate(const char* name, size_t n, F&& f)
+{
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < n; ++i)
+        f();
+    duration<double> elapsed = steady_clock::now() - start;
+    double pps = n / elapsed.count();
+    std::cout << name << ": " << static_cast<uint64_t>(pps)
+              << " packet-ins/sec" << std::endl;
+    return pps;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    std::array<uint8_t, 128> frame{};
+    of13::PacketIn pi(0x42, OFP_NO_BUFFER, frame.size(), of13::OFPR_NO_MATCH, 0, 0);
+    of13::InPort in_port(1);
+    pi.add_oxm_field(in_port);
+    pi.data(frame.data(), frame.size());
+    uint8_t* buffer = pi.pack();
+    size_t len = pi.length();
+    uint8_t type = of13::OFPT_PACKET_IN;
+
+    Sink sink;
+    std::unordered_map<uint8_t, Sink*> by_map{{type, &sink}};
+    std::array<Sink*, 256> by_type{};
+    by_type[type] = &sink;
+
+    double before = rate("decode per consumer", n, [&] {
+        auto it = by_map.find(type);
+        if (it != by_map.end()) {
+            of13::PacketIn own;
+            own.unpack(buffer);
+            (*it->second)(own);
+        }
+        OFMsgUnion msg(type, buffer, len);
+    });
+
+    double after = rate("decode once", n, [&] {
+        OFMsgUnion msg(type, buffer, len);
+        if (Sink* s = by_type[type])
+            (*s)(msg.as<of13::PacketIn>());
+    });
+
+    std::cout << "speedup: " << after / before << "x" << std::endl;
+
+    OFMsg::free_buffer(buffer);
+    return sink.bytes == 0;
+}
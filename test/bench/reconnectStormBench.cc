@@ -0,0 +1,125 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Time until every switch of a reconnect storm is programmed with the
+// Retic policy. "full" recompiles the policy and reinstalls it on all
+// switches on every switch-up, as Retic used to; "per-switch" installs
+// the compiled diagram on the new switch only. Switches are emulated
+// by drivers which count rules instead of sending them.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+
+#include "oxm/openflow_basic.hh"
+#include "retic/fdd_compiler.hh"
+#include "retic/fdd_translator.hh"
+#include "retic/policies.hh"
+#include "Retic.hh"
+
+using namespace runos;
+using namespace std::chrono;
+
+namespace {
+
+struct Counter {
+    uint64_t rules = 0;
+    uint64_t groups = 0;
+};
+
+class EmulatedSwitch : public OFDriver {
+    Counter& m_counter;
+    uint32_t m_group_id = 1;
+public:
+    explicit EmulatedSwitch(Counter& counter)
+        : m_counter(counter)
+    { }
+
+    RulePtr installRule(oxm::field_set, uint16_t, Actions, uint8_t) override
+    {
+        ++m_counter.rules;
+        return std::make_shared<Rule>();
+    }
+
+    GroupPtr installGroup(GroupType, std::vector<Actions>) override
+    {
+        struct EmulatedGroup : Group {
+            uint32_t m_id;
+            explicit EmulatedGroup(uint32_t id) : m_id(id) { }
+            uint32_t id() const override { return m_id; }
+        };
+        ++m_counter.groups;
+        return std::make_shared<EmulatedGroup>(m_group_id++);
+    }
+
+    void packetOut(uint8_t*, size_t, Actions) override
+    { }
+};
+
+retic::policy make_policy(uint32_t nports)
+{
+    using namespace retic;
+    policy ret = stop();
+    for (uint32_t port = 1; port <= nports; ++port) {
+        ret = ret + (filter(oxm::in_port() == port) >> fwd(port % nports + 1));
+    }
+    return ret;
+}
+
+template<class F>
+void report(const char* name, size_t nswitches, const Counter& counter, F&& f)
+{
+    auto start = steady_clock::now();
+    f();
+    duration<double, std::milli> elapsed = steady_clock::now() - start;
+    std::cout << name << ": " << elapsed.count() << " ms to program "
+              << nswitches << " switches, "
+              << counter.rules << " rules sent" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t nswitches = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+    uint32_t nports = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 8;
+    retic::policy policy = make_policy(nports);
+
+    Counter full;
+    report("full", nswitches, full, [&] {
+        std::unordered_map<uint64_t, OFDriverPtr> drivers;
+        std::unique_ptr<Of13Backend> backend;
+        for (uint64_t dpid = 1; dpid <= nswitches; ++dpid) {
+            drivers[dpid] = std::make_shared<EmulatedSwitch>(full);
+            backend = nullptr;
+            auto fdd = retic::fdd::compile(policy);
+            backend = std::make_unique<Of13Backend>(drivers);
+            retic::fdd::Translator translator(*backend);
+            boost::apply_visitor(translator, fdd);
+        }
+    });
+
+    Counter incremental;
+    report("per-switch", nswitches, incremental, [&] {
+        auto fdd = retic::fdd::compile(policy);
+        Of13Backend backend({});
+        for (uint64_t dpid = 1; dpid <= nswitches; ++dpid) {
+            backend.addSwitch(dpid, std::make_shared<EmulatedSwitch>(incremental), fdd);
+        }
+    });
+}
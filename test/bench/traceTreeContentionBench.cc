@@ -0,0 +1,161 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Latency of trace tree lookups while one thread keeps augmenting the
+// tree under the write lock. "read-lock" takes the runtime's read lock
+// around every lookup, as packet-ins used to; "lock-free" looks up
+// without it. Percentiles are over all lookups of all reader threads.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "oxm/field_set.hh"
+#include "maple/Backend.hh"
+#include "maple/Runtime.hh"
+
+using namespace runos;
+using namespace std::chrono;
+
+namespace {
+
+template <size_t N>
+struct F : oxm::define_type< F<N>, 0, N, 32, uint32_t, uint32_t, true>
+{ };
+
+class ValueFlow final : public maple::Flow {
+public:
+    uint32_t value{0};
+    void decision(uint32_t d) { value = d; }
+
+    std::vector<std::pair<oxm::field<>, oxm::field<>>>
+    virtual_fields(oxm::mask<>, oxm::mask<>) const override
+    { return {}; }
+};
+
+struct NullBackend : maple::Backend {
+    void install(unsigned, oxm::expirementer::full_field_set const&,
+                 maple::FlowPtr) override { }
+    void remove(maple::FlowPtr) override { }
+    void remove(unsigned, oxm::field_set const&) override { }
+    void remove(oxm::field_set const&) override { }
+    void barrier_rule(unsigned, oxm::expirementer::full_field_set const&,
+                      oxm::field<> const&, uint64_t) override { }
+};
+
+using Runtime = maple::Runtime<uint32_t, ValueFlow>;
+using FlowPtr = std::shared_ptr<ValueFlow>;
+
+uint32_t policy(Packet& pkt, FlowPtr)
+{
+    uint32_t key = pkt.load(F<1>());
+    if (pkt.test(F<2>() == 0x0800))
+        return key + 1;
+    return key;
+}
+
+oxm::field_set packet(uint32_t key)
+{
+    return oxm::field_set{F<1>() == key, F<2>() == 0x0800};
+}
+
+void augment(Runtime& runtime, std::vector<FlowPtr>& flows, uint32_t key)
+{
+    auto pkt = packet(key);
+    auto lock = runtime.write_lock();
+    FlowPtr flow;
+    maple::Installer installer;
+    std::tie(flow, installer) =
+        runtime.augment(pkt, std::make_shared<ValueFlow>());
+    flows.push_back(flow);
+}
+
+void run(const char* name, bool lock, unsigned nreaders, size_t per_reader,
+         uint32_t warm)
+{
+    NullBackend backend;
+    Runtime runtime{policy, backend};
+    std::vector<FlowPtr> flows;
+    for (uint32_t key = 0; key < warm; ++key)
+        augment(runtime, flows, key);
+
+    std::atomic<unsigned> running{nreaders};
+    std::thread writer([&] {
+        uint32_t key = warm;
+        while (running)
+            augment(runtime, flows, key++);
+    });
+
+    std::vector<std::vector<uint32_t>> latencies(nreaders);
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < nreaders; ++t) {
+        readers.emplace_back([&, t] {
+            auto& out = latencies[t];
+            out.reserve(per_reader);
+            uint32_t key = t + 1;
+            std::vector<oxm::field_set> packets;
+            for (size_t i = 0; i < 1024; ++i) {
+                key = (key * 1103515245 + 12345) % warm;
+                packets.push_back(packet(key));
+            }
+            for (size_t i = 0; i < per_reader; ++i) {
+                auto& pkt = packets[i % packets.size()];
+                auto start = steady_clock::now();
+                if (lock) {
+                    auto guard = runtime.read_lock();
+                    runtime(pkt);
+                } else {
+                    runtime(pkt);
+                }
+                out.push_back(duration_cast<nanoseconds>(
+                                  steady_clock::now() - start).count());
+            }
+            --running;
+        });
+    }
+    for (auto& t : readers)
+        t.join();
+    writer.join();
+
+    std::vector<uint32_t> all;
+    for (auto& l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    auto at = [&](double p) { return all[size_t(p * (all.size() - 1))]; };
+
+    std::cout << name << "  " << at(0.5) << "  " << at(0.99) << "  "
+              << at(0.999) << "  " << all.back() << "  "
+              << flows.size() - warm << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t per_reader = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    unsigned nreaders = argc > 2 ? std::strtoul(argv[2], nullptr, 10)
+                                 : std::max(2u, std::thread::hardware_concurrency()) - 1;
+    const uint32_t warm = 10000;
+
+    std::cout << "mode  p50(ns)  p99(ns)  p99.9(ns)  max(ns)  augments" << std::endl;
+    run("read-lock", true, nreaders, per_reader, warm);
+    run("lock-free", false, nreaders, per_reader, warm);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2015 Applied Research Center for Computer Networks
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Trace tree lookups per second against the number of leaves. The
+// policy loads a field, tests another one and loads a third, so every
+// lookup goes through two loads and a test before reaching a leaf.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "oxm/field_set.hh"
+#include "maple/Backend.hh"
+#include "maple/Runtime.hh"
+
+using namespace runos;
+using namespace std::chrono;
+
+namespace {
+
+template <size_t N>
+struct F : oxm::define_type< F<N>, 0, N, 32, uint32_t, uint32_t, true>
+{ };
+
+class ValueFlow final : public maple::Flow {
+public:
+    uint32_t value{0};
+    void decision(uint32_t d) { value = d; }
+
+    std::vector<std::pair<oxm::field<>, oxm::field<>>>
+    virtual_fields(oxm::mask<>, oxm::mask<>) const override
+    { return {}; }
+};
+
+struct NullBackend : maple::Backend {
+    void install(unsigned, oxm::expirementer::full_field_set const&,
+                 maple::FlowPtr) override { }
+    void remove(maple::FlowPtr) override { }
+    void remove(unsigned, oxm::field_set const&) override { }
+    void remove(oxm::field_set const&) override { }
+    void barrier_rule(unsigned, oxm::expirementer::full_field_set const&,
+                      oxm::field<> const&, uint64_t) override { }
+};
+
+using Runtime = maple::Runtime<uint32_t, ValueFlow>;
+using FlowPtr = std::shared_ptr<ValueFlow>;
+
+const uint32_t fanout = 1024;
+
+uint32_t policy(Packet& pkt, FlowPtr)
+{
+    uint32_t hi = pkt.load(F<1>());
+    if (pkt.test(F<3>() == 0))
+        return hi * fanout + pkt.load(F<2>());
+    return 0;
+}
+
+oxm::field_set packet(uint32_t key)
+{
+    return oxm::field_set{F<1>() == key / fanout,
+                          F<2>() == key % fanout,
+                          F<3>() == 0};
+}
+
+void run(uint32_t leaves, size_t lookups)
+{
+    NullBackend backend;
+    Runtime runtime{policy, backend};
+    std::vector<FlowPtr> flows;
+    flows.reserve(leaves);
+
+    auto start = steady_clock::now();
+    for (uint32_t key = 0; key < leaves; ++key) {
+        auto pkt = packet(key);
+        FlowPtr flow;
+        maple::Installer installer;
+        std::tie(flow, installer) =
+            runtime.augment(pkt, std::make_shared<ValueFlow>());
+        flows.push_back(flow);
+    }
+    duration<double> built = steady_clock::now() - start;
+
+    std::vector<oxm::field_set> packets;
+    uint32_t key = 1;
+    for (size_t i = 0; i < 4096; ++i) {
+        key = (key * 1103515245 + 12345) % leaves;
+        packets.push_back(packet(key));
+    }
+
+    size_t hits = 0;
+    start = steady_clock::now();
+    for (size_t i = 0; i < lookups; ++i) {
+        if (runtime(packets[i % packets.size()]))
+            ++hits;
+    }
+    duration<double> elapsed = steady_clock::now() - start;
+
+    std::cout << leaves << "  "
+              << static_cast<uint64_t>(lookups / elapsed.count()) << "  "
+              << static_cast<uint64_t>(leaves / built.count()) << "  "
+              << (hits == lookups ? "ok" : "MISSED") << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    size_t lookups = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+
+    std::cout << "leaves  lookups/s  augments/s" << std::endl;
+    for (uint32_t leaves : {10000u, 100000u, 1000000u})
+        run(leaves, lookups);
+}
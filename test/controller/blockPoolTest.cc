@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include "BlockPool.hh"
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace runos;
+
+namespace {
+
+struct Message {
+    std::array<uint8_t, 200> payload;
+    explicit Message(uint8_t fill) { payload.fill(fill); }
+};
+
+// Messages handed from the decoding thread to the handling one
+struct Queue {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::shared_ptr<Message>> items;
+    bool closed = false;
+
+    void push(std::shared_ptr<Message> msg)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back(std::move(msg));
+        cv.notify_one();
+    }
+
+    std::shared_ptr<Message> pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return closed || not items.empty(); });
+        if (items.empty())
+            return nullptr;
+        auto ret = std::move(items.front());
+        items.pop_front();
+        return ret;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        cv.notify_one();
+    }
+};
+
+// Passes `count` messages between two threads, at most `window` in flight
+void exchange(size_t count, size_t window)
+{
+    Queue queue;
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t in_flight = 0;
+
+    std::thread consumer([&] {
+        while (auto msg = queue.pop()) {
+            msg.reset();
+            std::lock_guard<std::mutex> lock(mutex);
+            --in_flight;
+            cv.notify_one();
+        }
+    });
+
+    for (size_t i = 0; i < count; ++i) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&] { return in_flight < window; });
+            ++in_flight;
+        }
+        queue.push(std::allocate_shared<Message>(PoolAllocator<Message>(),
+                                                 uint8_t(i)));
+    }
+    queue.close();
+    consumer.join();
+}
+
+}
+
+TEST(BlockPoolTest, ReusesFreedBlocks)
+{
+    auto before = BlockPoolStats::get();
+    {
+        auto msg = std::allocate_shared<Message>(PoolAllocator<Message>(), 1);
+    }
+    auto msg = std::allocate_shared<Message>(PoolAllocator<Message>(), 2);
+    auto after = BlockPoolStats::get();
+
+    EXPECT_EQ(2u, msg->payload[0]);
+    EXPECT_LE(after.heap_allocations - before.heap_allocations, 1u);
+    EXPECT_GE(after.reused - before.reused, 1u);
+}
+
+TEST(BlockPoolTest, SteadyStateDoesNotAllocate)
+{
+    const size_t window = 256;
+    auto before = BlockPoolStats::get();
+    exchange(10000, window);
+    auto warm = BlockPoolStats::get();
+    exchange(100000, window);
+    auto steady = BlockPoolStats::get();
+
+    // The heap is only used when every block is in flight or cached
+    // by the freeing thread, which holds at most two batches
+    EXPECT_LE(steady.heap_allocations - before.heap_allocations, window + 2 * 64 + 2);
+    EXPECT_LT(steady.heap_allocations - warm.heap_allocations, 100000u / 100);
+    EXPECT_EQ(warm.in_use, steady.in_use);
+}
@@ -0,0 +1,206 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "FlowReconciler.hh"
+#include "OFEncoder.hh"
+#include "oxm/openflow_basic.hh"
+#include "oxm/field_set.hh"
+#include "openflow/openflow-1.3.5.h"
+
+#include <array>
+#include <vector>
+
+using namespace runos;
+using namespace ::testing;
+
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+
+Bytes flow_mod(uint8_t command, uint64_t cookie, uint32_t in_port, uint32_t out,
+               uint64_t cookie_mask = 0)
+{
+    std::array<uint8_t, 512> buf;
+    OFEncoder enc(buf.data(), buf.size());
+    OFEncoder::FlowModParams fm;
+    fm.command = command;
+    fm.cookie = cookie;
+    fm.cookie_mask = cookie_mask;
+    fm.table_id = 1;
+    fm.priority = 10;
+    fm.flags = OFPFF_SEND_FLOW_REM;
+    if (in_port) {
+        enc.begin_flow_mod(fm, oxm::field_set{
+            oxm::in_port() == in_port,
+            oxm::eth_type() == 0x0800
+        });
+    } else {
+        enc.begin_flow_mod(fm, oxm::field_set{});
+    }
+    if (out) {
+        enc.begin_apply_actions();
+        enc.output(out);
+    }
+    enc.end_message();
+    return Bytes(enc.data(), enc.data() + enc.size());
+}
+
+Bytes add(uint64_t cookie, uint32_t in_port, uint32_t out)
+{
+    return flow_mod(OFPFC_ADD, cookie, in_port, out);
+}
+
+// Flow-stats reply describing the given flow-mods as installed
+Bytes stats_reply(const std::vector<Bytes>& flows)
+{
+    Bytes ret(16, 0);
+    ret[0] = OFP_VERSION;
+    ret[1] = OFPT_MULTIPART_REPLY;
+    ret[9] = OFPMP_FLOW;
+    for (auto& fm : flows) {
+        Bytes entry(48, 0);
+        entry.insert(entry.end(), fm.begin() + 48, fm.end());
+        entry[0] = entry.size() >> 8;
+        entry[1] = entry.size() & 0xff;
+        entry[2] = fm[24];                                           // table
+        std::copy(fm.begin() + 30, fm.begin() + 32, entry.begin() + 12); // priority
+        std::copy(fm.begin() + 26, fm.begin() + 30, entry.begin() + 14); // timeouts
+        std::copy(fm.begin() + 44, fm.begin() + 46, entry.begin() + 18); // flags
+        std::copy(fm.begin() + 8, fm.begin() + 16, entry.begin() + 24);  // cookie
+        ret.insert(ret.end(), entry.begin(), entry.end());
+    }
+    ret[2] = ret.size() >> 8;
+    ret[3] = ret.size() & 0xff;
+    return ret;
+}
+
+// Types and commands of messages in a buffer
+std::vector<std::pair<int, int>> messages(const Bytes& buf)
+{
+    std::vector<std::pair<int, int>> ret;
+    size_t at = 0;
+    while (at + 8 <= buf.size()) {
+        size_t len = buf[at + 2] << 8 | buf[at + 3];
+        int command = buf[at + 1] == OFPT_FLOW_MOD ? buf[at + 25] : -1;
+        ret.emplace_back(buf[at + 1], command);
+        at += len;
+    }
+    return ret;
+}
+
+void send(FlowReconciler& r, const Bytes& msg, Bytes& out)
+{
+    r.filter(msg.data(), msg.size(), out);
+}
+
+auto keep_none = [](const FlowReconciler::Unclaimed&) { return false; };
+
+}
+
+TEST(FlowReconcilerTest, SendsOnlyWhatIsMissing)
+{
+    FlowReconciler r;
+    Bytes out;
+
+    send(r, add(1, 1, 2), out);
+    send(r, add(3, 3, 4), out);
+    EXPECT_TRUE(out.empty()); // held until the dump is complete
+
+    auto reply = stats_reply({add(1, 1, 2), add(2, 2, 3)});
+    r.dump(reply.data(), reply.size());
+    r.dumped(out);
+    EXPECT_THAT(messages(out), ElementsAre(Pair(OFPT_FLOW_MOD, OFPFC_ADD)));
+
+    out.clear();
+    auto stats = r.finish(keep_none, out);
+    // the entry nobody re-sent
+    EXPECT_THAT(messages(out), ElementsAre(Pair(OFPT_FLOW_MOD, OFPFC_DELETE_STRICT)));
+    EXPECT_EQ(2u, stats.dumped);
+    EXPECT_EQ(1u, stats.kept);
+    EXPECT_EQ(1u, stats.added);
+    EXPECT_EQ(1u, stats.removed);
+}
+
+TEST(FlowReconcilerTest, DeleteAndReAddIsNotSent)
+{
+    FlowReconciler r;
+    Bytes out;
+    auto reply = stats_reply({add(7, 1, 2)});
+    r.dump(reply.data(), reply.size());
+    r.dumped(out);
+
+    send(r, flow_mod(OFPFC_DELETE, 7, 0, 0, uint64_t(-1)), out);
+    send(r, add(7, 1, 2), out);
+    EXPECT_TRUE(out.empty());
+
+    auto stats = r.finish(keep_none, out);
+    EXPECT_TRUE(out.empty());
+    EXPECT_EQ(1u, stats.kept);
+    EXPECT_EQ(0u, stats.removed);
+}
+
+TEST(FlowReconcilerTest, DeletesAreDoneBeforeBarrier)
+{
+    FlowReconciler r;
+    Bytes out;
+    auto reply = stats_reply({add(7, 1, 2)});
+    r.dump(reply.data(), reply.size());
+    r.dumped(out);
+
+    std::array<uint8_t, 8> barrier;
+    OFEncoder enc(barrier.data(), barrier.size());
+    enc.barrier_request();
+
+    send(r, flow_mod(OFPFC_DELETE, 0, 0, 0), out);
+    r.filter(barrier.data(), barrier.size(), out);
+    EXPECT_THAT(messages(out), ElementsAre(
+                Pair(OFPT_FLOW_MOD, OFPFC_DELETE_STRICT),
+                Pair(OFPT_BARRIER_REQUEST, -1)));
+}
+
+TEST(FlowReconcilerTest, ChangedEntryIsReplaced)
+{
+    FlowReconciler r;
+    Bytes out;
+    auto reply = stats_reply({add(1, 1, 2)});
+    r.dump(reply.data(), reply.size());
+    r.dumped(out);
+
+    send(r, add(1, 1, 5), out);
+    EXPECT_THAT(messages(out), ElementsAre(
+                Pair(OFPT_FLOW_MOD, OFPFC_DELETE_STRICT),
+                Pair(OFPT_FLOW_MOD, OFPFC_ADD)));
+}
+
+TEST(FlowReconcilerTest, OwnersKeepUnclaimedEntries)
+{
+    FlowReconciler r;
+    Bytes out;
+    auto reply = stats_reply({add(1, 1, 2), add(2, 2, 3)});
+    r.dump(reply.data(), reply.size());
+    r.dumped(out);
+
+    EXPECT_EQ(2u, r.unclaimed().size());
+    auto stats = r.finish([](const FlowReconciler::Unclaimed& e) {
+        return e.cookie == 2;
+    }, out);
+    EXPECT_EQ(1u, stats.removed);
+}
+
+TEST(FlowReconcilerTest, AbortWipesAndSendsHeld)
+{
+    FlowReconciler r;
+    Bytes out;
+    send(r, add(1, 1, 2), out);
+
+    auto stats = r.abort(out);
+    EXPECT_THAT(messages(out), ElementsAre(
+                Pair(OFPT_FLOW_MOD, OFPFC_DELETE),
+                Pair(OFPT_BARRIER_REQUEST, -1),
+                Pair(OFPT_FLOW_MOD, OFPFC_ADD)));
+    EXPECT_EQ(1u, stats.aborted);
+
+    out.clear();
+    send(r, add(1, 1, 2), out);
+    EXPECT_FALSE(out.empty());
+}
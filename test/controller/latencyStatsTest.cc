@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include "LatencyStats.hh"
+
+#include <thread>
+#include <vector>
+
+using namespace runos;
+
+TEST(LatencyStatsTest, BucketsCoverValues)
+{
+    for (uint64_t ns : std::vector<uint64_t>{0, 1, 15, 16, 17, 1000, 123456789,
+                                             uint64_t(-1)}) {
+        size_t b = LatencyHistogram::bucket(ns);
+        ASSERT_LT(b, LatencyHistogram::nbuckets);
+        EXPECT_LE(LatencyHistogram::lower(b), ns);
+        EXPECT_GE(LatencyHistogram::upper(b), ns);
+        // relative error is bounded by the number of sub-buckets
+        EXPECT_LE(LatencyHistogram::upper(b) - LatencyHistogram::lower(b),
+                  ns / LatencyHistogram::sub_buckets);
+    }
+    EXPECT_EQ(LatencyHistogram::upper(LatencyHistogram::bucket(31)) + 1,
+              LatencyHistogram::lower(LatencyHistogram::bucket(32)));
+}
+
+TEST(LatencyStatsTest, Percentiles)
+{
+    LatencyHistogram hist;
+    for (uint64_t ns = 1; ns <= 1000; ++ns)
+        hist.record(ns * 1000);
+
+    EXPECT_EQ(1000u, hist.count());
+    EXPECT_EQ(1000u, hist.min());
+    EXPECT_EQ(1000000u, hist.max());
+    EXPECT_DOUBLE_EQ(500500.0, hist.mean());
+    EXPECT_NEAR(500000.0, hist.percentile(50), 500000.0 / 16);
+    EXPECT_NEAR(990000.0, hist.percentile(99), 990000.0 / 16);
+    EXPECT_EQ(1000000u, hist.percentile(100));
+}
+
+TEST(LatencyStatsTest, MergesThreads)
+{
+    auto stage = LatencyStats::stage("test.merge");
+    EXPECT_EQ(stage, LatencyStats::stage("test.merge"));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([stage, t] {
+            for (int i = 0; i < 1000; ++i)
+                LatencyStats::record(stage, 100 * (t + 1));
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    auto stats = LatencyStats::get();
+    ASSERT_EQ(1u, stats.count("test.merge"));
+    auto& hist = stats.at("test.merge");
+    EXPECT_EQ(4000u, hist.count());
+    EXPECT_EQ(100u, hist.min());
+    EXPECT_EQ(400u, hist.max());
+    EXPECT_DOUBLE_EQ(250.0, hist.mean());
+}
@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "OFEncoder.hh"
+#include "oxm/openflow_basic.hh"
+#include "oxm/field_set.hh"
+#include "types/exception.hh"
+#include "fluid/of13msg.hh"
+
+#include <array>
+#include <vector>
+
+using namespace runos;
+namespace of13 = fluid_msg::of13;
+
+namespace {
+
+std::vector<uint8_t> pack(fluid_msg::OFMsg& msg)
+{
+    uint8_t* buf = msg.pack();
+    std::vector<uint8_t> ret(buf, buf + msg.length());
+    fluid_msg::OFMsg::free_buffer(buf);
+    return ret;
+}
+
+std::vector<uint8_t> bytes(const OFEncoder& enc)
+{
+    return std::vector<uint8_t>(enc.data(), enc.data() + enc.size());
+}
+
+}
+
+TEST(OFEncoderTest, FlowModSameAsLibfluid)
+{
+    of13::FlowMod fm;
+    fm.xid(42);
+    fm.command(of13::OFPFC_ADD);
+    fm.cookie(0x8000000000000001);
+    fm.cookie_mask(0);
+    fm.table_id(3);
+    fm.idle_timeout(10);
+    fm.hard_timeout(20);
+    fm.priority(100);
+    fm.buffer_id(OFP_NO_BUFFER);
+    fm.out_port(of13::OFPP_ANY);
+    fm.out_group(of13::OFPG_ANY);
+    fm.flags(of13::OFPFF_CHECK_OVERLAP | of13::OFPFF_SEND_FLOW_REM);
+    fm.add_oxm_field(new of13::InPort(1));
+    fm.add_oxm_field(new of13::EthType(0x0800));
+    of13::ApplyActions apply;
+    apply.add_action(new of13::SetFieldAction(
+                new of13::EthDst(fluid_msg::EthAddress("aa:bb:cc:dd:ee:ff"))));
+    apply.add_action(new of13::OutputAction(2, 0));
+    fm.add_instruction(apply);
+
+    OFEncoder::FlowModParams params;
+    params.xid = 42;
+    params.cookie = 0x8000000000000001;
+    params.table_id = 3;
+    params.idle_timeout = 10;
+    params.hard_timeout = 20;
+    params.priority = 100;
+    params.flags = of13::OFPFF_CHECK_OVERLAP | of13::OFPFF_SEND_FLOW_REM;
+
+    std::array<uint8_t, 512> buf;
+    OFEncoder enc(buf.data(), buf.size());
+    enc.begin_flow_mod(params, oxm::field_set{
+        oxm::eth_type() == 0x0800,
+        oxm::in_port() == 1
+    });
+    enc.begin_apply_actions();
+    enc.set_field(oxm::eth_dst() == "aa:bb:cc:dd:ee:ff");
+    enc.output(2);
+    enc.end_message();
+
+    EXPECT_EQ(pack(fm), bytes(enc));
+}
+
+TEST(OFEncoderTest, PacketOutSameAsLibfluid)
+{
+    uint8_t data[] = {1, 2, 3, 4, 5};
+
+    of13::PacketOut po;
+    po.xid(7);
+    po.buffer_id(OFP_NO_BUFFER);
+    po.in_port(of13::OFPP_CONTROLLER);
+    po.add_action(new of13::OutputAction(of13::OFPP_FLOOD, 0));
+    po.data(data, sizeof(data));
+
+    std::array<uint8_t, 512> buf;
+    OFEncoder enc(buf.data(), buf.size());
+    enc.begin_packet_out(7, OFP_NO_BUFFER, of13::OFPP_CONTROLLER);
+    enc.output(of13::OFPP_FLOOD);
+    enc.packet_data(data, sizeof(data));
+    enc.end_message();
+
+    EXPECT_EQ(pack(po), bytes(enc));
+}
+
+TEST(OFEncoderTest, MessagesBackToBack)
+{
+    std::array<uint8_t, 64> buf;
+    OFEncoder enc(buf.data(), buf.size());
+    enc.barrier_request(1);
+    enc.barrier_request(2);
+
+    of13::BarrierRequest b1(1), b2(2);
+    auto expected = pack(b1);
+    auto second = pack(b2);
+    expected.insert(expected.end(), second.begin(), second.end());
+
+    EXPECT_EQ(expected, bytes(enc));
+}
+
+TEST(OFEncoderTest, OverflowThrows)
+{
+    std::array<uint8_t, 32> buf;
+    OFEncoder enc(buf.data(), buf.size());
+    EXPECT_THROW(enc.begin_flow_mod(OFEncoder::FlowModParams{},
+                                    oxm::field_set{}),
+                 runos::length_error);
+}
+
+namespace {
+
+struct experimenter_field : oxm::define_type<
+    experimenter_field, 0xFFFF, 1, 32, uint32_t, uint32_t, true>
+{ };
+
+}
+
+TEST(OFEncoderTest, ExperimenterFieldsThrow)
+{
+    std::array<uint8_t, 128> buf;
+    OFEncoder enc(buf.data(), buf.size());
+    EXPECT_THROW(enc.begin_flow_mod(OFEncoder::FlowModParams{},
+                                    oxm::field_set{ experimenter_field() == 1 }),
+                 runos::invalid_argument);
+}
+
+TEST(OFEncoderTest, MeterModAndMeterInstruction)
+{
+    std::array<uint8_t, 128> buf;
+    OFEncoder enc(buf.data(), buf.size());
+    enc.meter_mod(5, of13::OFPMC_ADD, 1, 1000, 100);
+
+    std::vector<uint8_t> expected {
+        0x04, 29, 0, 32,  0, 0, 0, 5,   // header
+        0, 0,  0, 0x06,   0, 0, 0, 1,   // ADD, PKTPS | BURST, meter 1
+        0, 1,  0, 16,     0, 0, 0x03, 0xe8,
+        0, 0, 0, 100,     0, 0, 0, 0    // drop band
+    };
+    EXPECT_EQ(expected, bytes(enc));
+
+    enc.clear();
+    OFEncoder::FlowModParams params;
+    enc.begin_flow_mod(params, oxm::field_set{});
+    enc.meter(1);
+    enc.begin_apply_actions();
+    enc.output(of13::OFPP_CONTROLLER, 128);
+    enc.end_message();
+
+    // empty match is 8 bytes, instructions follow
+    std::vector<uint8_t> instructions(enc.data() + 56, enc.data() + enc.size());
+    std::vector<uint8_t> expected_instructions {
+        0, 6, 0, 8,  0, 0, 0, 1,        // meter 1
+        0, 4, 0, 24, 0, 0, 0, 0,        // apply-actions
+        0, 0, 0, 16, 0xff, 0xff, 0xff, 0xfd,
+        0, 128, 0, 0, 0, 0, 0, 0
+    };
+    EXPECT_EQ(expected_instructions, instructions);
+}
+
+TEST(OFEncoderTest, MetadataMatchAndGotoTable)
+{
+    std::array<uint8_t, 128> buf;
+    OFEncoder enc(buf.data(), buf.size());
+    OFEncoder::FlowModParams params;
+    params.table_id = 1;
+    enc.begin_flow_mod(params, oxm::field_set{ oxm::metadata() == uint64_t(7) });
+    enc.write_metadata(9);
+    enc.goto_table(2);
+    enc.end_message();
+
+    std::vector<uint8_t> rest(enc.data() + 48, enc.data() + enc.size());
+    std::vector<uint8_t> expected {
+        0, 1, 0, 16,  0x80, 0, 4, 8,    // match, metadata
+        0, 0, 0, 0,   0, 0, 0, 7,
+        0, 2, 0, 24,  0, 0, 0, 0,       // write-metadata
+        0, 0, 0, 0,   0, 0, 0, 9,
+        0xff, 0xff, 0xff, 0xff,  0xff, 0xff, 0xff, 0xff,
+        0, 1, 0, 8,   2, 0, 0, 0        // goto-table 2
+    };
+    EXPECT_EQ(expected, rest);
+}
@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "OFSessionTable.hh"
+
+#include <set>
+
+using namespace runos;
+using namespace std::chrono_literals;
+
+namespace {
+
+const uint32_t first_xid = 0x10000;
+
+OFSessionHandlers counting(int& responses, int& errors, int& timeouts)
+{
+    OFSessionHandlers ret;
+    ret.response = [&responses](SwitchConnectionPtr, std::shared_ptr<OFMsgUnion>) {
+        ++responses;
+    };
+    ret.error = [&errors](SwitchConnectionPtr, std::shared_ptr<OFMsgUnion>) {
+        ++errors;
+    };
+    ret.timeout = [&timeouts](SwitchConnectionPtr, uint32_t) {
+        ++timeouts;
+    };
+    return ret;
+}
+
+}
+
+TEST(OFSessionTableTest, EveryRequestGetsOwnXid)
+{
+    OFSessionTable table{first_xid, 100ms};
+    std::set<uint32_t> xids;
+    for (int i = 0; i < 1000; i++) {
+        uint32_t xid = table.insert(nullptr, OFSessionHandlers{}, 5s);
+        EXPECT_TRUE(table.owns(xid));
+        xids.insert(xid);
+    }
+    EXPECT_EQ(1000u, xids.size());
+    EXPECT_EQ(1000u, table.stats().in_flight);
+}
+
+TEST(OFSessionTableTest, MultipartKeepsEntryUntilLastPart)
+{
+    OFSessionTable table{first_xid, 100ms};
+    uint32_t xid = table.insert(nullptr, OFSessionHandlers{}, 5s);
+
+    EXPECT_TRUE(table.take(xid, /* more = */ true));
+    EXPECT_TRUE(table.take(xid, true));
+    EXPECT_TRUE(table.take(xid, false));
+    EXPECT_FALSE(table.take(xid, false));
+
+    auto stats = table.stats();
+    EXPECT_EQ(0u, stats.in_flight);
+    EXPECT_EQ(1u, stats.completed);
+}
+
+TEST(OFSessionTableTest, ErrorEndsRequest)
+{
+    OFSessionTable table{first_xid, 100ms};
+    uint32_t xid = table.insert(nullptr, OFSessionHandlers{}, 5s);
+
+    EXPECT_TRUE(table.take_error(xid));
+    EXPECT_FALSE(table.take(xid, false));
+
+    auto stats = table.stats();
+    EXPECT_EQ(0u, stats.in_flight);
+    EXPECT_EQ(1u, stats.errors);
+    EXPECT_EQ(0u, stats.completed);
+}
+
+TEST(OFSessionTableTest, ExpiresAfterDeadline)
+{
+    OFSessionTable table{first_xid, 10ms};
+    int responses = 0, errors = 0, timeouts = 0;
+    auto now = OFSessionTable::clock::now();
+
+    uint32_t answered = table.insert(nullptr, counting(responses, errors, timeouts), 50ms);
+    uint32_t lost = table.insert(nullptr, counting(responses, errors, timeouts), 50ms);
+    table.insert(nullptr, counting(responses, errors, timeouts), 10s);
+    EXPECT_TRUE(table.take(answered, false));
+
+    table.expire(now + 20ms);
+    EXPECT_EQ(0, timeouts);
+
+    table.expire(now + 100ms);
+    EXPECT_EQ(1, timeouts);
+    EXPECT_FALSE(table.take(lost, false));
+
+    // Far beyond one turn of the wheel
+    table.expire(now + 60s);
+    EXPECT_EQ(2, timeouts);
+
+    auto stats = table.stats();
+    EXPECT_EQ(0u, stats.in_flight);
+    EXPECT_EQ(2u, stats.timeouts);
+    EXPECT_EQ(1u, stats.completed);
+}
@@ -0,0 +1,166 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "PacketInAdmission.hh"
+
+#include <vector>
+
+using namespace runos;
+using namespace std::chrono_literals;
+
+using Class = PacketInAdmission::Class;
+using Verdict = PacketInAdmission::Verdict;
+
+namespace {
+
+// OFPT_PACKET_IN with an empty match and an ethernet frame
+std::vector<uint8_t> packet_in(uint8_t reason, uint16_t eth_type, bool vlan = false)
+{
+    std::vector<uint8_t> msg(24, 0);
+    msg[0] = 4;   // version
+    msg[1] = 10;  // OFPT_PACKET_IN
+    msg[14] = reason;
+    // ofp_match: OFPMT_OXM, length 4, padding
+    uint8_t match[] = {0, 1, 0, 4, 0, 0, 0, 0};
+    msg.insert(msg.end(), match, match + sizeof(match));
+    msg.insert(msg.end(), 2, 0);
+
+    std::vector<uint8_t> frame(12, 0xaa); // addresses
+    if (vlan) {
+        uint8_t tag[] = {0x81, 0x00, 0x00, 0x0a};
+        frame.insert(frame.end(), tag, tag + sizeof(tag));
+    }
+    frame.push_back(eth_type >> 8);
+    frame.push_back(eth_type & 0xff);
+    frame.resize(frame.size() + 46);
+    msg.insert(msg.end(), frame.begin(), frame.end());
+
+    msg[2] = msg.size() >> 8;
+    msg[3] = msg.size() & 0xff;
+    return msg;
+}
+
+PacketInAdmission::Settings limited(PacketInAdmission::Policy policy)
+{
+    PacketInAdmission::Settings ret;
+    ret.enabled = true;
+    ret.policy = policy;
+    ret.switch_rate = 10;
+    ret.switch_burst = 11;
+    ret.reserve = 0.2;
+    ret.sample_every = 4;
+    ret.buffer_size = 3;
+    return ret;
+}
+
+}
+
+TEST(PacketInAdmissionTest, Classify)
+{
+    auto lldp = packet_in(1, 0x88cc);
+    auto tagged_lldp = packet_in(0, 0x88cc, true);
+    auto miss = packet_in(0, 0x0800);
+    auto inspect = packet_in(1, 0x0806);
+
+    EXPECT_EQ(Class::Control, PacketInAdmission::classify(lldp.data(), lldp.size()));
+    EXPECT_EQ(Class::Control, PacketInAdmission::classify(tagged_lldp.data(), tagged_lldp.size()));
+    EXPECT_EQ(Class::TableMiss, PacketInAdmission::classify(miss.data(), miss.size()));
+    EXPECT_EQ(Class::Inspect, PacketInAdmission::classify(inspect.data(), inspect.size()));
+    // Truncated messages never read past the end
+    EXPECT_EQ(Class::TableMiss, PacketInAdmission::classify(miss.data(), 40));
+}
+
+TEST(PacketInAdmissionTest, LowerClassesLeaveReserve)
+{
+    PacketInAdmission admission(limited(PacketInAdmission::Policy::Drop));
+    PacketInAdmission::Switch sw(admission.settings());
+    auto msg = packet_in(0, 0x0800);
+    auto now = PacketInAdmission::clock::now();
+
+    // Burst 11, reserve 2 tokens per class step
+    int inspect = 0;
+    while (admission.admit(sw, Class::Inspect, msg.data(), msg.size(), now) == Verdict::Admit)
+        ++inspect;
+    int miss = 0;
+    while (admission.admit(sw, Class::TableMiss, msg.data(), msg.size(), now) == Verdict::Admit)
+        ++miss;
+    int control = 0;
+    while (admission.admit(sw, Class::Control, msg.data(), msg.size(), now) == Verdict::Admit)
+        ++control;
+
+    EXPECT_EQ(7, inspect);
+    EXPECT_EQ(2, miss);
+    EXPECT_EQ(2, control);
+
+    // Refilled at 10 tokens/sec
+    EXPECT_EQ(Verdict::Admit,
+              admission.admit(sw, Class::Control, msg.data(), msg.size(), now + 100ms));
+
+    auto stats = admission.stats();
+    EXPECT_EQ(7u, stats[size_t(Class::Inspect)].admitted);
+    EXPECT_EQ(1u, stats[size_t(Class::Inspect)].dropped);
+    EXPECT_EQ(3u, stats[size_t(Class::Control)].admitted);
+}
+
+TEST(PacketInAdmissionTest, GlobalBucketIsShared)
+{
+    auto settings = limited(PacketInAdmission::Policy::Drop);
+    settings.switch_rate = 0;
+    settings.global_rate = 10;
+    settings.global_burst = 4;
+    PacketInAdmission admission(settings);
+    PacketInAdmission::Switch a(settings), b(settings);
+    auto msg = packet_in(1, 0x88cc);
+    auto now = PacketInAdmission::clock::now();
+
+    int admitted = 0;
+    for (int i = 0; i < 10; ++i) {
+        admitted += admission.admit(a, Class::Control, msg.data(), msg.size(), now) == Verdict::Admit;
+        admitted += admission.admit(b, Class::Control, msg.data(), msg.size(), now) == Verdict::Admit;
+    }
+    EXPECT_EQ(4, admitted);
+}
+
+TEST(PacketInAdmissionTest, SamplePolicy)
+{
+    PacketInAdmission admission(limited(PacketInAdmission::Policy::Sample));
+    PacketInAdmission::Switch sw(admission.settings());
+    auto msg = packet_in(1, 0x88cc);
+    auto now = PacketInAdmission::clock::now();
+
+    int admitted = 0;
+    for (int i = 0; i < 11 + 40; ++i)
+        admitted += admission.admit(sw, Class::Control, msg.data(), msg.size(), now) == Verdict::Admit;
+
+    EXPECT_EQ(11 + 10, admitted);
+    EXPECT_EQ(10u, admission.stats()[size_t(Class::Control)].sampled);
+}
+
+TEST(PacketInAdmissionTest, BufferPolicyReplaysInPriorityOrder)
+{
+    PacketInAdmission admission(limited(PacketInAdmission::Policy::Buffer));
+    PacketInAdmission::Switch sw(admission.settings());
+    auto miss = packet_in(0, 0x0800);
+    auto lldp = packet_in(1, 0x88cc);
+    auto now = PacketInAdmission::clock::now();
+
+    while (admission.admit(sw, Class::Control, lldp.data(), lldp.size(), now) == Verdict::Admit)
+        ;
+    // the last one was buffered
+    EXPECT_EQ(Verdict::Buffered,
+              admission.admit(sw, Class::TableMiss, miss.data(), miss.size(), now));
+    EXPECT_EQ(Verdict::Buffered,
+              admission.admit(sw, Class::Control, lldp.data(), lldp.size(), now));
+    EXPECT_EQ(Verdict::Drop,
+              admission.admit(sw, Class::Control, lldp.data(), lldp.size(), now));
+    EXPECT_TRUE(sw.has_buffered());
+
+    std::vector<Class> replayed;
+    admission.drain(sw, [&](std::vector<uint8_t>& msg) {
+        replayed.push_back(PacketInAdmission::classify(msg.data(), msg.size()));
+    }, now + 1s);
+
+    EXPECT_THAT(replayed, ::testing::ElementsAre(
+                Class::Control, Class::Control, Class::TableMiss));
+    EXPECT_FALSE(sw.has_buffered());
+}
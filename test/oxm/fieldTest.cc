@@ -4,8 +4,12 @@
 #include <boost/concept/assert.hpp>
 #include <boost/concept_check.hpp>
 
+#include <random>
+
 #include "types/bits.hh"
 #include "oxm/field.hh"
+#include "oxm/field_set.hh"
+#include "oxm/match_table.hh"
 #include "oxm/openflow_basic.hh"
 #include "oxm/errors.hh"
 
@@ -317,4 +321,148 @@ BOOST_AUTO_TEST_CASE( rewrite_field_field_test ) {
                                                 ethaddr("ff:ff:ff:ff:00:00")) );
 }
 
+BOOST_AUTO_TEST_CASE( hash_test ) {
+    std::hash<oxm::field<>> hash;
+    oxm::field<> f1 = oxm::field<>(eth_type == 0x0800);
+    oxm::field<> f2 = oxm::field<>(eth_type == 0x0800);
+    BOOST_CHECK_EQUAL( hash(f1), hash(f2) );
+    BOOST_CHECK_NE( hash(f1), hash(oxm::field<>(eth_type == 0x0806)) );
+    BOOST_CHECK_NE( hash(oxm::field<>(eth_src == ethaddr("aa:bb:00:00:00:00"))),
+                    hash(oxm::field<>(oxm::field<oxm::eth_src>(
+                            ethaddr("aa:bb:00:00:00:00"),
+                            ethaddr("ff:ff:00:00:00:00")))) );
+
+    // field sets don't depend on the order of fields
+    oxm::field_set s1 {in_port == 1, eth_type == 0x0800};
+    oxm::field_set s2 {eth_type == 0x0800, in_port == 1};
+    BOOST_CHECK( s1 == s2 );
+    BOOST_CHECK_EQUAL( std::hash<oxm::field_set>()(s1),
+                       std::hash<oxm::field_set>()(s2) );
+
+    using oxm::expirementer::full_field_set;
+    full_field_set m1, m2, m3;
+    m1.add(in_port == 1);
+    m1.exclude(eth_type == 0x0800);
+    m2.exclude(eth_type == 0x0800);
+    m2.add(in_port == 1);
+    m3.add(eth_type == 0x0800);
+    m3.exclude(in_port == 1);
+    BOOST_CHECK( m1 == m2 );
+    BOOST_CHECK( m1 != m3 );
+    BOOST_CHECK_EQUAL( std::hash<full_field_set>()(m1),
+                       std::hash<full_field_set>()(m2) );
+    BOOST_CHECK_NE( std::hash<full_field_set>()(m1),
+                    std::hash<full_field_set>()(m3) );
+}
+
+BOOST_AUTO_TEST_CASE( field_set_test ) {
+    oxm::field_set s {eth_type == 0x0800, in_port == 1, eth_src == 0x1, in_port == 2};
+    BOOST_CHECK_EQUAL( s.size(), 3u );
+    BOOST_CHECK_EQUAL( oxm::field<>(*s.find(in_port)), oxm::field<>(in_port == 1) );
+    BOOST_CHECK( std::is_sorted(s.begin(), s.end(),
+        [](const oxm::field<>& lhs, const oxm::field<>& rhs) {
+            return lhs.type().id() < rhs.type().id();
+        }) );
+
+    s.modify(eth_dst == 0x2);
+    s.modify(in_port == 3);
+    BOOST_CHECK_EQUAL( s.size(), 4u );
+    BOOST_CHECK( s.find(in_port)->value_bits() == oxm::value<>(in_port == 3).value_bits() );
+    s.erase(oxm::mask<>(eth_src));
+    BOOST_CHECK( s.find(eth_src) == s.end() );
+    BOOST_CHECK( (s == oxm::field_set{in_port == 3, eth_dst == 0x2, eth_type == 0x0800}) );
+
+    // matching against a field set and against its packet view agree
+    oxm::field_set pkt {in_port == 3, eth_type == 0x0800,
+                        eth_src == 0x1, eth_dst == 0x2};
+    const Packet& view = pkt;
+    for (const oxm::field_set& match : std::vector<oxm::field_set>{
+            oxm::field_set{},
+            oxm::field_set{eth_type == 0x0800},
+            oxm::field_set{eth_type == 0x0806, in_port == 3},
+            oxm::field_set{(eth_dst & 0xff) == 0x2, in_port == 3},
+            oxm::field_set{(eth_dst & 0xff) == 0x3},
+            oxm::field_set{oxm::ip_proto() == 6, in_port == 3} })
+    {
+        BOOST_CHECK_EQUAL( match & pkt, match & view );
+    }
+    BOOST_CHECK( (oxm::field_set{eth_type == 0x0800, in_port == 3} & pkt) );
+    BOOST_CHECK( not (oxm::field_set{eth_type == 0x0806, in_port == 3} & pkt) );
+}
+
+// Packet without an IP header
+struct NonIpPacket : oxm::field_set {
+    using oxm::field_set::field_set;
+
+    oxm::field<> load(oxm::mask<> mask) const override
+    {
+        if (mask.type() == oxm::ip_proto())
+            RUNOS_THROW(out_of_range());
+        return oxm::field_set::load(mask);
+    }
+
+    bool load_word(oxm::type t, uint64_t& value) const override
+    {
+        if (t == oxm::ip_proto())
+            RUNOS_THROW(out_of_range());
+        return oxm::field_set::load_word(t, value);
+    }
+};
+
+BOOST_AUTO_TEST_CASE( match_table_test ) {
+    std::mt19937 rng(11);
+    const oxm::ipv4_src ipv4_src;
+    const oxm::ip_proto ip_proto;
+
+    auto random_set = [&](bool masked) {
+        oxm::field_set ret;
+        if (rng() % 2)
+            ret.modify(in_port == uint32_t(rng() % 3));
+        if (rng() % 2)
+            ret.modify(eth_type == uint16_t(0x0800 + rng() % 2));
+        if (rng() % 2 && masked)
+            ret.modify((eth_dst & uint64_t(rng() % 4)) == uint64_t(rng() % 4));
+        else if (rng() % 2)
+            ret.modify(eth_dst == uint64_t(rng() % 4));
+        if (rng() % 2) {
+            uint32_t mask = masked ? uint32_t(-1) << (rng() % 3) : uint32_t(-1);
+            ret.modify((ipv4_src & mask) == uint32_t(rng() % 4));
+        }
+        if (rng() % 3 == 0)
+            ret.modify(ip_proto == uint8_t(6));
+        return ret;
+    };
+
+    std::vector<oxm::field_set> matches;
+    oxm::match_table table;
+    for (size_t i = 0; i < 200; ++i) {
+        matches.push_back(random_set(true));
+        BOOST_CHECK_EQUAL( table.add(matches.back()), i );
+    }
+
+    for (size_t n = 0; n < 200; ++n) {
+        oxm::field_set pkt = random_set(n % 2);
+        auto flat = table.flatten(pkt);
+        for (size_t i = 0; i < matches.size(); ++i) {
+            bool expected = matches[i] & static_cast<const Packet&>(pkt);
+            BOOST_CHECK_EQUAL( table.test(i, flat), expected );
+        }
+        size_t first = 0;
+        while (first < matches.size() && not (matches[first] & pkt))
+            ++first;
+        BOOST_CHECK_EQUAL( table.find(flat), first );
+    }
+
+    // fields the packet doesn't have don't match
+    NonIpPacket arp {eth_type == 0x0806, in_port == 1};
+    auto flat = table.flatten(arp);
+    for (size_t i = 0; i < matches.size(); ++i) {
+        bool on_ip = matches[i].find(ip_proto) != matches[i].end();
+        if (on_ip)
+            BOOST_CHECK( not table.test(i, flat) );
+        else
+            BOOST_CHECK_EQUAL( table.test(i, flat), matches[i] & arp );
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END( )
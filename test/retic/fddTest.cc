@@ -5,6 +5,7 @@
 
 #include "retic/fdd.hh"
 #include "retic/fdd_compiler.hh"
+#include "retic/fdd_translator.hh"
 #include "retic/policies.hh"
 #include "retic/traverse_fdd.hh"
 #include "oxm/openflow_basic.hh"
@@ -825,8 +826,76 @@ TEST(FddTraverseTest, FddTraverseWithMapleCallMeTwice) {
     EXPECT_EQ(call_count, 2);
 }
 
+TEST(FddTraverseTest, LookupNeedsAugmentedTraceTree) {
+    int call_count = 0;
+    policy p = handler([&call_count](Packet& pkt) {
+        call_count++;
+        pkt.test(F<3>() == 3);
+        return modify(F<2>() << 2);
+    });
+    fdd::diagram d = fdd::compile(filter(F<1>() == 1) >> p);
+
+    oxm::field_set fs{F<1>() == 1, F<3>() == 3};
+    fdd::Lookup lookup{fs};
+    EXPECT_EQ(nullptr, boost::apply_visitor(lookup, d));
+    EXPECT_EQ(0, call_count);
+
+    fdd::Traverser traverser{fs};
+    fdd::leaf& l = boost::apply_visitor(traverser, d);
+    EXPECT_EQ(1, call_count);
+    EXPECT_EQ(&l, boost::apply_visitor(lookup, d));
+    EXPECT_EQ(1, call_count);
+
+    // other outcomes of the handler's test are still unexplored
+    oxm::field_set other{F<1>() == 1, F<3>() == 4};
+    fdd::Lookup lookup_other{other};
+    EXPECT_EQ(nullptr, boost::apply_visitor(lookup_other, d));
+
+    // packets the filter drops don't reach the handler
+    oxm::field_set dropped{F<1>() == 2};
+    fdd::Lookup lookup_dropped{dropped};
+    fdd::leaf* empty = boost::apply_visitor(lookup_dropped, d);
+    ASSERT_NE(nullptr, empty);
+    EXPECT_TRUE(empty->sets.empty());
+}
+
 using match = std::vector<oxm::field_set>;
 
+TEST(FddTraverseTest, TranslateAfterAugmentation) {
+    // A switch joining after a packet-in must get the explored trace too
+    MockBackend backend;
+    policy p = handler([](Packet& pkt) {
+        pkt.test(F<3>() == 3);
+        return modify(F<2>() << 2);
+    });
+    fdd::diagram d = fdd::compile(filter(F<1>() == 1) >> p);
+    oxm::field_set explored{F<1>() == 1, F<3>() == 3};
+    uint16_t barrier_prio = 0, test_prio = 0, rule_prio = 0;
+
+    EXPECT_CALL(backend, install(oxm::field_set{}, _, _, _));
+    EXPECT_CALL(backend, installBarrier(oxm::field_set{F<1>() == 1}, _))
+        .WillOnce(SaveArg<1>(&barrier_prio));
+    fdd::Translator translator{backend};
+    boost::apply_visitor(translator, d);
+
+    EXPECT_CALL(backend, installBarrier(explored, _))
+        .WillOnce(SaveArg<1>(&test_prio));
+    EXPECT_CALL(backend, install(explored, match{oxm::field_set{F<2>() == 2}}, _, _))
+        .WillOnce(SaveArg<2>(&rule_prio));
+    fdd::Traverser traverser{explored, &backend};
+    boost::apply_visitor(traverser, d);
+    Mock::VerifyAndClearExpectations(&backend);
+
+    MockBackend joined;
+    EXPECT_CALL(joined, install(oxm::field_set{}, _, _, _));
+    EXPECT_CALL(joined, installBarrier(oxm::field_set{F<1>() == 1}, barrier_prio));
+    EXPECT_CALL(joined, installBarrier(explored, test_prio));
+    EXPECT_CALL(joined,
+        install(explored, match{oxm::field_set{F<2>() == 2}}, rule_prio, _));
+    fdd::Translator late{joined};
+    boost::apply_visitor(late, d);
+}
+
 TEST(FddTraverseTest, FddTraverseWithMapleWithBackend) {
     MockBackend backend;
 
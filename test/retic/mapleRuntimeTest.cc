@@ -0,0 +1,540 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+
+#include "common.hh"
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "maple/Backend.hh"
+#include "maple/Epoch.hh"
+#include "maple/Runtime.hh"
+
+using namespace runos;
+
+namespace {
+
+class ValueFlow final : public maple::Flow {
+public:
+    uint32_t value{0};
+
+    void decision(uint32_t d)
+    { value = d; }
+
+    std::vector<std::pair<oxm::field<>, oxm::field<>>>
+    virtual_fields(oxm::mask<>, oxm::mask<>) const override
+    { return {}; }
+};
+
+struct CountingBackend : maple::Backend {
+    // Only called with the write lock held, so no locking here
+    std::set<uint64_t> barriers;
+    // of barrier rules and of rules removed by priority and match
+    std::set<std::pair<unsigned, std::string>> barrier_rules;
+    std::set<std::pair<unsigned, std::string>> removed_rules;
+    int installs{0};
+    int removed{0};
+    int removed_strict{0};
+
+    static std::string str(const oxm::field_set& match)
+    {
+        std::ostringstream ss;
+        ss << match;
+        return ss.str();
+    }
+
+    void install(unsigned, oxm::expirementer::full_field_set const&,
+                 maple::FlowPtr) override
+    { ++installs; }
+
+    void remove(maple::FlowPtr) override { ++removed; }
+    void remove(unsigned priority, oxm::field_set const& match) override
+    {
+        ++removed_strict;
+        removed_rules.emplace(priority, str(match));
+    }
+    void remove(oxm::field_set const&) override { }
+
+    void barrier_rule(unsigned priority,
+                      oxm::expirementer::full_field_set const& match,
+                      oxm::field<> const&, uint64_t id) override
+    {
+        EXPECT_TRUE(barriers.insert(id).second);
+        auto copy = match;
+        for (auto& fields : copy.included().fields())
+            barrier_rules.emplace(priority, str(fields));
+    }
+};
+
+using Runtime = maple::Runtime<uint32_t, ValueFlow>;
+using FlowPtr = std::shared_ptr<ValueFlow>;
+
+uint32_t parity_policy(Packet& pkt, FlowPtr)
+{
+    uint32_t key = pkt.load(F<1>());
+    if (pkt.test(F<2>() == 1))
+        return key * 2 + 1;
+    return key * 2;
+}
+
+// Runs the packet-in steps Maple runs, through Runtime::dispatch.
+// The trace tree holds weak references, flows are owned by the caller.
+FlowPtr handle(Runtime& runtime, Packet& pkt, std::vector<FlowPtr>& flows)
+{
+    FlowPtr ret;
+    runtime.dispatch(pkt, [&](FlowPtr flow) {
+        ret = flow;
+        return flow != nullptr;
+    }, [&](FlowPtr flow) {
+        if (flow) {
+            ret = flow;
+            return;
+        }
+        maple::Installer installer;
+        std::tie(ret, installer) =
+            runtime.augment(pkt, std::make_shared<ValueFlow>());
+        installer();
+        flows.push_back(ret);
+    });
+    return ret;
+}
+
+}
+
+TEST(MapleRuntimeTest, ConcurrentPacketInsAugmentOncePerFlow)
+{
+    const unsigned nthreads = 8;
+    const uint32_t nkeys = 200;
+    const int rounds = 20;
+
+    CountingBackend backend;
+    Runtime runtime{parity_policy, backend};
+    std::vector<FlowPtr> flows;
+    std::atomic<int> wrong{0};
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nthreads; t++) {
+        threads.emplace_back([&, t] {
+            for (int r = 0; r < rounds; r++) {
+                for (uint32_t i = 0; i < nkeys; i++) {
+                    // threads walk the keys in different orders
+                    uint32_t key = (i * 7 + t * 31) % nkeys;
+                    uint32_t bit = (r + t) % 2;
+                    oxm::field_set pkt{F<1>() == key, F<2>() == bit};
+                    FlowPtr flow = handle(runtime, pkt, flows);
+                    if (flow->value != key * 2 + bit)
+                        ++wrong;
+                }
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    EXPECT_EQ(0, wrong);
+    EXPECT_EQ(2 * nkeys, flows.size());
+    EXPECT_EQ(int(2 * nkeys), backend.installs);
+    EXPECT_EQ(nkeys, backend.barriers.size());
+}
+
+namespace {
+
+// Every key has its own subtree, so the tree is patched in many places
+uint32_t nested_policy(Packet& pkt, FlowPtr)
+{
+    uint32_t key = pkt.load(F<1>());
+    if (key % 3 == 0)
+        return key;
+    if (pkt.test(F<2>() == key % 5)) {
+        uint32_t sub = pkt.load(F<3>());
+        return key * 100 + sub;
+    }
+    return key * 100 + 99;
+}
+
+uint32_t expected(uint32_t key, uint32_t bit, uint32_t sub)
+{
+    if (key % 3 == 0)
+        return key;
+    if (bit == key % 5)
+        return key * 100 + sub;
+    return key * 100 + 99;
+}
+
+}
+
+TEST(MapleRuntimeTest, LookupSeesEveryAugment)
+{
+    CountingBackend backend;
+    Runtime runtime{nested_policy, backend};
+    std::vector<FlowPtr> flows;
+    std::vector<std::array<uint32_t, 3>> seen;
+
+    uint32_t seed = 1;
+    for (int i = 0; i < 3000; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t key = (seed >> 8) % 500;
+        uint32_t bit = (seed >> 4) % 5;
+        uint32_t sub = (seed >> 16) % 7;
+        oxm::field_set pkt{F<1>() == key, F<2>() == bit, F<3>() == sub};
+        FlowPtr flow = handle(runtime, pkt, flows);
+        ASSERT_EQ(expected(key, bit, sub), flow->value);
+        seen.push_back({key, bit, sub});
+    }
+
+    size_t augmented = flows.size();
+    for (auto& s : seen) {
+        oxm::field_set pkt{F<1>() == s[0], F<2>() == s[1], F<3>() == s[2]};
+        FlowPtr flow = runtime(pkt);
+        ASSERT_TRUE(flow);
+        EXPECT_EQ(expected(s[0], s[1], s[2]), flow->value);
+    }
+    EXPECT_EQ(augmented, flows.size());
+
+    oxm::field_set unseen{F<1>() == 1000, F<2>() == 0, F<3>() == 0};
+    EXPECT_FALSE(runtime(unseen));
+}
+
+TEST(MapleRuntimeTest, ExpiredFlowIsMissed)
+{
+    CountingBackend backend;
+    Runtime runtime{parity_policy, backend};
+    std::vector<FlowPtr> flows;
+    oxm::field_set pkt{F<1>() == 7, F<2>() == 1};
+
+    handle(runtime, pkt, flows);
+    flows.clear();
+    EXPECT_FALSE(runtime(pkt));
+
+    // augmenting the same trace again replaces the flow of the leaf
+    FlowPtr flow = handle(runtime, pkt, flows);
+    EXPECT_EQ(flow, runtime(pkt));
+}
+
+TEST(MapleRuntimeTest, LookupsDontLockWhileTreeChanges)
+{
+    const uint32_t nkeys = 1000;
+    const unsigned nreaders = 4;
+
+    CountingBackend backend;
+    Runtime runtime{nested_policy, backend};
+    std::vector<FlowPtr> flows;
+    std::atomic<bool> done{false};
+    std::atomic<int> wrong{0};
+    std::atomic<uint64_t> hits{0};
+
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < nreaders; t++) {
+        readers.emplace_back([&, t] {
+            uint32_t seed = t + 1;
+            while (not done) {
+                seed = seed * 1103515245 + 12345;
+                uint32_t key = (seed >> 8) % nkeys;
+                uint32_t bit = key % 5;
+                uint32_t sub = (seed >> 4) % 7;
+                oxm::field_set pkt{F<1>() == key, F<2>() == bit, F<3>() == sub};
+                if (FlowPtr flow = runtime(pkt)) {
+                    ++hits;
+                    if (flow->value != expected(key, bit, sub))
+                        ++wrong;
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < 2; round++) {
+        for (uint32_t key = 0; key < nkeys; key++) {
+            for (uint32_t sub = 0; sub < 7; sub += 3) {
+                oxm::field_set pkt{F<1>() == key, F<2>() == key % 5, F<3>() == sub};
+                handle(runtime, pkt, flows);
+            }
+        }
+        auto lock = runtime.write_lock();
+        runtime.invalidate();
+    }
+    done = true;
+    for (auto& t : readers)
+        t.join();
+
+    EXPECT_EQ(0, wrong);
+    EXPECT_LT(0u, hits);
+}
+
+TEST(MapleRuntimeTest, EpochKeepsRetiredWhileRead)
+{
+    static std::atomic<int> alive{0};
+    struct Object {
+        Object() { ++alive; }
+        ~Object() { --alive; }
+    };
+
+    std::atomic<bool> entered{false}, leave{false};
+    std::thread reader([&] {
+        maple::Epoch::Guard guard;
+        entered = true;
+        while (not leave)
+            std::this_thread::yield();
+    });
+    while (not entered)
+        std::this_thread::yield();
+
+    maple::Epoch::retire(new Object);
+    maple::Epoch::reclaim();
+    EXPECT_EQ(1, alive);
+
+    leave = true;
+    reader.join();
+    maple::Epoch::reclaim();
+    EXPECT_EQ(0, alive);
+}
+
+namespace {
+
+void fill(Runtime& runtime, uint32_t nkeys, std::vector<FlowPtr>& flows)
+{
+    for (uint32_t key = 0; key < nkeys; key++) {
+        for (uint32_t bit = 0; bit < 2; bit++) {
+            oxm::field_set pkt{F<1>() == key, F<2>() == bit};
+            handle(runtime, pkt, flows);
+        }
+    }
+}
+
+bool found(Runtime& runtime, uint32_t key, uint32_t bit)
+{
+    oxm::field_set pkt{F<1>() == key, F<2>() == bit};
+    return runtime(pkt) != nullptr;
+}
+
+}
+
+TEST(MapleRuntimeTest, InvalidateDropsLoadedValueOnly)
+{
+    CountingBackend backend;
+    Runtime runtime{parity_policy, backend};
+    std::vector<FlowPtr> flows;
+    fill(runtime, 10, flows);
+
+    maple::Eviction evicted;
+    {
+        auto lock = runtime.write_lock();
+        evicted = runtime.invalidate(F<1>() == 3);
+    }
+    EXPECT_EQ(2u, evicted.paths);
+    EXPECT_EQ(2u, evicted.flows.size());
+    EXPECT_EQ(2, backend.removed);
+
+    // The barrier rule of the test on key 3 goes with it
+    EXPECT_EQ(1u, evicted.barriers);
+    ASSERT_EQ(1u, backend.removed_rules.size());
+    EXPECT_EQ(1u, backend.barrier_rules.count(*backend.removed_rules.begin()));
+
+    for (uint32_t key = 0; key < 10; key++) {
+        EXPECT_EQ(key != 3, found(runtime, key, 0)) << key;
+        EXPECT_EQ(key != 3, found(runtime, key, 1)) << key;
+    }
+
+    // The dropped subtree is explored again
+    oxm::field_set pkt{F<1>() == 3, F<2>() == 1};
+    EXPECT_EQ(7u, handle(runtime, pkt, flows)->value);
+    EXPECT_TRUE(found(runtime, 3, 1));
+}
+
+TEST(MapleRuntimeTest, InvalidateDropsPassedTestsOnly)
+{
+    CountingBackend backend;
+    Runtime runtime{parity_policy, backend};
+    std::vector<FlowPtr> flows;
+    fill(runtime, 10, flows);
+
+    maple::Eviction evicted;
+    {
+        auto lock = runtime.write_lock();
+        evicted = runtime.invalidate(F<2>() == 1);
+    }
+    EXPECT_EQ(10u, evicted.paths);
+    EXPECT_EQ(10, backend.removed);
+    // The tests stay, with their barrier rules
+    EXPECT_EQ(0u, evicted.barriers);
+    EXPECT_EQ(0, backend.removed_strict);
+
+    for (uint32_t key = 0; key < 10; key++) {
+        EXPECT_TRUE(found(runtime, key, 0)) << key;
+        EXPECT_FALSE(found(runtime, key, 1)) << key;
+    }
+
+    // Nothing saw this value
+    {
+        auto lock = runtime.write_lock();
+        evicted = runtime.invalidate(F<3>() == 1);
+    }
+    EXPECT_EQ(0u, evicted.paths);
+    EXPECT_EQ(10, backend.removed);
+}
+
+namespace {
+
+// Reads the high byte of the key only
+uint32_t masked_policy(Packet& pkt, FlowPtr)
+{
+    auto high = pkt.load(F<1>() & uint32_t(0xff00));
+    return uint32_t(high.value_bits().to_ullong());
+}
+
+}
+
+TEST(MapleRuntimeTest, MaskedLoadTracesMaskedBitsOnly)
+{
+    CountingBackend backend;
+    Runtime runtime{masked_policy, backend};
+    std::vector<FlowPtr> flows;
+
+    oxm::field_set pkt{F<1>() == 0x1234, F<2>() == 0};
+    EXPECT_EQ(0x1200u, handle(runtime, pkt, flows)->value);
+
+    // Other bits of the key don't matter
+    EXPECT_TRUE(found(runtime, 0x12ff, 0));
+    EXPECT_FALSE(found(runtime, 0x13ff, 0));
+    EXPECT_EQ(1u, flows.size());
+}
+
+TEST(MapleRuntimeTest, GcPrunesGoneFlows)
+{
+    CountingBackend backend;
+    Runtime runtime{parity_policy, backend};
+    std::vector<FlowPtr> flows;
+    fill(runtime, 10, flows);
+
+    auto size = runtime.size();
+    EXPECT_EQ(20u, size.leaves);
+    EXPECT_EQ(0u, size.dead);
+
+    // Flows are filled by key, then bit
+    flows[3 * 2] = flows[3 * 2 + 1] = nullptr;
+    flows[5 * 2 + 1] = nullptr;
+    EXPECT_EQ(3u, runtime.size().dead);
+
+    maple::Collection collected;
+    {
+        auto lock = runtime.write_lock();
+        collected = runtime.gc();
+    }
+    EXPECT_EQ(3u, collected.leaves);
+    EXPECT_EQ(1u, collected.tests); // of key 3, with nothing under it
+    EXPECT_EQ(1u, collected.cases);
+    EXPECT_EQ(1, backend.removed_strict);
+    EXPECT_GT(collected.bytes, 0u);
+
+    auto after = runtime.size();
+    EXPECT_EQ(17u, after.leaves);
+    EXPECT_EQ(0u, after.dead);
+    EXPECT_LT(after.nodes, size.nodes);
+
+    EXPECT_FALSE(found(runtime, 3, 0));
+    EXPECT_TRUE(found(runtime, 5, 0));
+    EXPECT_FALSE(found(runtime, 5, 1));
+    EXPECT_TRUE(found(runtime, 4, 1));
+
+    oxm::field_set pkt{F<1>() == 3, F<2>() == 1};
+    EXPECT_EQ(7u, handle(runtime, pkt, flows)->value);
+    EXPECT_TRUE(found(runtime, 3, 1));
+}
+
+namespace {
+
+// Flow table of one switch, by priority: rules of a chain of tests
+// all overlap, so no two may share one.
+struct TableBackend : maple::Backend {
+    std::map<unsigned, std::string> rules;
+    int touched{0};
+
+    void add(unsigned priority, std::string rule)
+    {
+        ++touched;
+        EXPECT_TRUE(rules.emplace(priority, rule).second)
+            << rule << " lands on " << rules[priority];
+    }
+
+    void install(unsigned priority, oxm::expirementer::full_field_set const&,
+                 maple::FlowPtr flow) override
+    {
+        auto value = std::static_pointer_cast<ValueFlow>(flow)->value;
+        add(priority, "flow " + std::to_string(value));
+    }
+
+    void barrier_rule(unsigned priority,
+                      oxm::expirementer::full_field_set const&,
+                      oxm::field<> const& test, uint64_t) override
+    {
+        std::ostringstream ss;
+        ss << "test " << test;
+        add(priority, ss.str());
+    }
+
+    void remove(unsigned priority, oxm::field_set const&) override
+    {
+        ++touched;
+        EXPECT_EQ(1u, rules.erase(priority));
+    }
+
+    void remove(maple::FlowPtr) override { }
+    void remove(oxm::field_set const&) override { }
+};
+
+const uint32_t chain_length = 60;
+
+uint32_t chain_policy(Packet& pkt, FlowPtr)
+{
+    for (uint32_t i = 0; i < chain_length; i++) {
+        if (pkt.test(F<1>() == i))
+            return i;
+    }
+    return chain_length;
+}
+
+}
+
+TEST(MapleRuntimeTest, RelabelsInsteadOfExceedingPriorities)
+{
+    TableBackend backend;
+    Runtime runtime{chain_policy, backend};
+    std::vector<FlowPtr> flows;
+
+    for (uint32_t key = 0; key <= chain_length; key++) {
+        oxm::field_set pkt{F<1>() == key};
+        EXPECT_EQ(key, handle(runtime, pkt, flows)->value);
+    }
+
+    auto relabeling = runtime.relabeling();
+    EXPECT_LT(0u, relabeling.runs);
+    // Relabeling is local, not every rule moves every time
+    EXPECT_LT(relabeling.rules, relabeling.runs * 2 * chain_length);
+
+    // The chain is ordered from the first test down
+    std::vector<std::string> expected;
+    for (uint32_t i = 0; i < chain_length; i++) {
+        std::ostringstream test;
+        test << "test " << oxm::field<>(F<1>() == i);
+        expected.push_back("flow " + std::to_string(i));
+        expected.push_back(test.str());
+    }
+    expected.push_back("flow " + std::to_string(chain_length));
+
+    std::vector<std::string> table;
+    for (auto it = backend.rules.rbegin(); it != backend.rules.rend(); ++it)
+        table.push_back(it->second);
+    EXPECT_EQ(expected, table);
+
+    for (uint32_t key = 0; key <= chain_length; key++) {
+        oxm::field_set pkt{F<1>() == key};
+        ASSERT_NE(nullptr, runtime(pkt));
+        EXPECT_EQ(key, runtime(pkt)->value);
+    }
+}
@@ -158,3 +158,35 @@ TEST(PacketParserTest, ReticModifyValue)
                     }, "11:22:33:44:55:66"))
         ));
 }
+
+TEST(PacketParserTest, TypedFieldsAgreeWithGeneric)
+{
+    ethernet_hdr eth;
+    eth.dst = 0x123;
+    eth.src = 0x321;
+    eth.type = 0x0800;
+    fluid_msg::of13::PacketIn pi(10, OFP_NO_BUFFER, 0, 0, 0, 0);
+    pi.add_oxm_field(new fluid_msg::of13::InPort(2));
+    pi.data(&eth, eth.header_length());
+
+    PacketParser pp(pi, 7);
+    Packet& pkt{pp};
+    auto generic = [&](oxm::type t) {
+        return pkt.load(oxm::mask<>(t)).value_bits().to_ulong();
+    };
+
+    EXPECT_EQ(2u, pkt.load(oxm::in_port()));
+    EXPECT_EQ(7u, pkt.load(oxm::switch_id()));
+    EXPECT_EQ(0x0800, pkt.load(oxm::eth_type()));
+    EXPECT_EQ(0x321u, ethaddr(pkt.load(oxm::eth_src())).to_number());
+    EXPECT_TRUE(pkt.test(oxm::eth_type() == 0x0800));
+    EXPECT_FALSE(pkt.test(oxm::eth_type() == 0x0806));
+    EXPECT_TRUE(pkt.test((oxm::eth_src() & "00:00:00:00:ff:00") ==
+                         "00:00:00:00:03:00"));
+
+    pkt.modify((oxm::eth_dst() & "00:00:00:00:ff:ff") == "aa:bb:cc:dd:ee:ff");
+    EXPECT_EQ(0xeeffu, generic(oxm::eth_dst()));
+    EXPECT_EQ(0xeeffu, ethaddr(pkt.load(oxm::eth_dst())).to_number());
+    EXPECT_TRUE(pkt.test(oxm::eth_dst() == "00:00:00:00:ee:ff"));
+    EXPECT_EQ(0x321u, generic(oxm::eth_src()));
+}
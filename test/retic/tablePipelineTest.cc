@@ -0,0 +1,199 @@
+#include <gtest/gtest.h>
+
+#include "maple/TablePipeline.hh"
+#include "oxm/openflow_basic.hh"
+#include "oxm/field_set.hh"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace runos;
+using maple::TablePipeline;
+
+namespace {
+
+bool matches(const oxm::field_set& match, const Packet& pkt)
+{
+    return match & pkt;
+}
+
+// Tables of a switch as the pipeline left them
+struct EmulatedSwitch : TablePipeline::Sink {
+    std::vector<TablePipeline::Entry> entries;
+    size_t adds = 0;
+
+    static bool same_key(const TablePipeline::Entry& lhs,
+                         const TablePipeline::Entry& rhs)
+    {
+        return lhs.table == rhs.table && lhs.priority == rhs.priority &&
+               lhs.match == rhs.match;
+    }
+
+    void add(const TablePipeline::Entry& entry) override
+    {
+        ++adds;
+        remove(entry);
+        entries.push_back(entry);
+    }
+
+    void remove(const TablePipeline::Entry& entry) override
+    {
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+            [&](const TablePipeline::Entry& e) { return same_key(e, entry); }),
+            entries.end());
+    }
+
+    // Program of the entry the packet ends at, empty on a miss
+    std::string lookup(uint8_t table, const oxm::field_set& pkt) const
+    {
+        uint64_t metadata = 0;
+        for (;;) {
+            oxm::field_set with_metadata = pkt;
+            with_metadata.modify(oxm::metadata() == metadata);
+
+            const TablePipeline::Entry* best = nullptr;
+            for (auto& e : entries) {
+                if (e.table != table || not matches(e.match, with_metadata))
+                    continue;
+                if (not best || e.priority > best->priority)
+                    best = &e;
+            }
+            if (not best)
+                return std::string();
+            if (not best->program.empty())
+                return best->program;
+            metadata = best->metadata;
+            ++table;
+        }
+    }
+};
+
+struct Rule {
+    uint16_t priority;
+    oxm::field_set match;
+    std::string program;
+};
+
+// Highest priority rule of one table
+std::string lookup(const std::vector<Rule>& rules, const oxm::field_set& pkt)
+{
+    const Rule* best = nullptr;
+    for (auto& r : rules) {
+        if (matches(r.match, pkt) && (not best || r.priority > best->priority))
+            best = &r;
+    }
+    return best ? best->program : std::string();
+}
+
+std::vector<oxm::type> stages()
+{
+    return { oxm::in_port(), oxm::eth_dst() };
+}
+
+}
+
+TEST(TablePipelineTest, IndependentFieldsAddUp)
+{
+    EmulatedSwitch sw;
+    TablePipeline pipeline(stages(), 1, 0, sw);
+    for (uint32_t port = 1; port <= 8; ++port) {
+        for (uint64_t mac = 1; mac <= 8; ++mac) {
+            pipeline.add(10, oxm::field_set{ oxm::in_port() == port,
+                                             oxm::eth_dst() == mac },
+                         port * 100 + mac, "output:" + std::to_string(mac));
+        }
+    }
+    pipeline.commit();
+
+    // 8 ports and a default, 8 addresses and a default in the class
+    // all ports share, a default for the rest, 8 rules
+    EXPECT_EQ(27u, pipeline.stats().entries);
+    EXPECT_EQ(27u, sw.entries.size());
+    EXPECT_EQ("output:3", sw.lookup(1, oxm::field_set{ oxm::in_port() == 5,
+                                                       oxm::eth_dst() == 3 }));
+    EXPECT_EQ("", sw.lookup(1, oxm::field_set{ oxm::in_port() == 9,
+                                               oxm::eth_dst() == 3 }));
+}
+
+TEST(TablePipelineTest, SameAsOneTable)
+{
+    std::mt19937 rng(7);
+    std::vector<Rule> rules;
+    EmulatedSwitch sw;
+    TablePipeline pipeline(stages(), 1, 0, sw);
+
+    auto random_rule = [&](uint16_t priority) {
+        Rule r{priority, {}, "output:" + std::to_string(rng() % 5)};
+        if (rng() % 3)
+            r.match.modify(oxm::in_port() == uint32_t(rng() % 4 + 1));
+        if (rng() % 3)
+            r.match.modify(oxm::eth_dst() == uint64_t(rng() % 4 + 1));
+        if (rng() % 4 == 0)
+            r.match.modify(oxm::eth_type() == uint16_t(0x0800 + rng() % 2));
+        return r;
+    };
+
+    auto check = [&] {
+        pipeline.commit();
+        for (uint32_t port = 1; port <= 5; ++port) {
+            for (uint64_t mac = 1; mac <= 5; ++mac) {
+                for (uint16_t type : {0x0800, 0x0801}) {
+                    oxm::field_set pkt{ oxm::in_port() == port,
+                                        oxm::eth_dst() == mac,
+                                        oxm::eth_type() == type };
+                    ASSERT_EQ(lookup(rules, pkt), sw.lookup(1, pkt))
+                        << "port " << port << " mac " << mac;
+                }
+            }
+        }
+        EXPECT_EQ(pipeline.stats().entries, sw.entries.size());
+    };
+
+    for (uint16_t priority = 1; priority <= 40; ++priority) {
+        rules.push_back(random_rule(priority));
+        pipeline.add(rules.back().priority, rules.back().match, priority,
+                     rules.back().program);
+        if (priority % 5 == 0)
+            check();
+    }
+    for (size_t i = 0; i < 20; ++i) {
+        size_t victim = rng() % rules.size();
+        EXPECT_TRUE(pipeline.remove(rules[victim].priority, rules[victim].match));
+        rules.erase(rules.begin() + victim);
+        if (i % 4 == 0)
+            check();
+    }
+    check();
+
+    pipeline.remove_if([](uint16_t, const oxm::field_set&, uint64_t) {
+        return true;
+    });
+    rules.clear();
+    check();
+}
+
+TEST(TablePipelineTest, SendsOnlyChanges)
+{
+    EmulatedSwitch sw;
+    TablePipeline pipeline(stages(), 0, 0, sw);
+    oxm::field_set match{ oxm::in_port() == 1, oxm::eth_dst() == 2 };
+
+    EXPECT_TRUE(pipeline.add(10, match, 7, "output:2"));
+    pipeline.commit();
+    size_t adds = sw.adds;
+    EXPECT_FALSE(pipeline.add(10, match, 7, "output:2"));
+    pipeline.commit();
+    EXPECT_EQ(adds, sw.adds);
+
+    // the same rule under another port shares entries but the port's
+    pipeline.add(10, oxm::field_set{ oxm::in_port() == 3, oxm::eth_dst() == 2 },
+                 8, "output:2");
+    pipeline.commit();
+    EXPECT_EQ(adds + 1, sw.adds);
+
+    // a rule expired on the switch is sent again
+    pipeline.lost(7);
+    pipeline.commit();
+    EXPECT_EQ(adds + 2, sw.adds);
+}